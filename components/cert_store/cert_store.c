@@ -0,0 +1,333 @@
+#include "sdkconfig.h"
+#if CONFIG_CERT_STORE_ENABLE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cert_store.h"
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_flash_encrypt.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/platform_util.h"
+#include "mbedtls/x509_crt.h"
+
+#define STORE_PARTITION_SUBTYPE 0x41
+#define STORE_MAGIC             0x53545243 /* "CRTS"*/
+#define STORE_VERSION           2 /* One CA and one client certificate*/
+#define STORE_KEY_DER_MAX       3072 /* RSA 4096 is about 2.4 KB*/
+#define STORE_ALIGN(x)          (((x) + 15) & ~15u) /* Encrypted writes are 16 byte blocks*/
+
+static const char *TAG = "cert_store";
+
+enum {
+    STORE_ENTRY_CA,
+    STORE_ENTRY_CHAIN,
+    STORE_ENTRY_KEY,
+    STORE_ENTRIES,
+};
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;   /* STORE_ENTRY_**/
+    uint8_t reserved;
+    uint16_t len;
+    uint32_t offset; /* From the start of the partition*/
+} store_entry_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t crc;        /* Of the rest of the header and the data*/
+    uint8_t version;
+    uint8_t count;       /* STORE_ENTRIES*/
+    uint16_t reserved;
+    uint32_t source_crc; /* Of the PEM the store was converted from*/
+    uint32_t len;        /* Header and data*/
+    store_entry_t entries[STORE_ENTRIES]; /* By STORE_ENTRY_**/
+} store_header_t;
+
+static const esp_partition_t *store_partition;
+static esp_partition_mmap_handle_t store_mmap_handle;
+static const uint8_t *store_map;
+static bool store_ready;
+
+static int store_rng(void *ctx, unsigned char *buf, size_t len)
+{
+    esp_fill_random(buf, len);
+    return 0;
+}
+
+uint32_t cert_store_source_crc(const char *ca_pem, const char *chain_pem, const char *key_pem)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)ca_pem, strlen(ca_pem) + 1);
+    crc = esp_rom_crc32_le(crc, (const uint8_t *)chain_pem, strlen(chain_pem) + 1);
+    return esp_rom_crc32_le(crc, (const uint8_t *)key_pem, strlen(key_pem) + 1);
+}
+
+static uint32_t store_crc(const uint8_t *image, uint32_t len)
+{
+    size_t skip = offsetof(store_header_t, version);
+    return esp_rom_crc32_le(0, image + skip, len - skip);
+}
+
+static void store_unmap(void)
+{
+    if (store_map != NULL)
+    {
+        esp_partition_munmap(store_mmap_handle);
+        store_map = NULL;
+    }
+}
+
+static esp_err_t store_map_partition(void)
+{
+    const void *ptr;
+    esp_err_t err = esp_partition_mmap(store_partition, 0, store_partition->size,
+                                       ESP_PARTITION_MMAP_DATA, &ptr, &store_mmap_handle);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    store_map = ptr;
+    return ESP_OK;
+}
+
+/* Whether the mapped partition holds the certificates of source_crc*/
+static bool store_check(uint32_t source_crc)
+{
+    const store_header_t *header = (const store_header_t *)store_map;
+    if (header->magic != STORE_MAGIC || header->version != STORE_VERSION
+        || header->len < sizeof(*header) || header->len > store_partition->size
+        || header->count != STORE_ENTRIES
+        || header->crc != store_crc(store_map, header->len))
+    {
+        ESP_LOGI(TAG, "The store is empty or damaged");
+        return false;
+    }
+    if (header->source_crc != source_crc)
+    {
+        ESP_LOGI(TAG, "The provisioned certificates changed");
+        return false;
+    }
+    for (int i = 0; i < header->count; i++)
+    {
+        const store_entry_t *entry = &header->entries[i];
+        if (entry->type != i || entry->len == 0
+            || entry->offset < sizeof(*header) || entry->offset + entry->len > header->len)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void store_add(store_header_t *header, uint8_t *image, uint32_t *len,
+                      uint8_t type, const uint8_t *der, size_t der_len)
+{
+    store_entry_t *entry = &header->entries[header->count++];
+    entry->type = type;
+    entry->len = der_len;
+    entry->offset = *len;
+    memcpy(image + *len, der, der_len);
+    *len = STORE_ALIGN(*len + der_len);
+}
+
+/* Converts the PEM to DER, checks it and writes it with the header last.
+ esp-tls reads a DER buffer as a single certificate, so a CA or a client
+ chain of more than one is left in PEM*/
+static esp_err_t store_write(const char *ca_pem, const char *chain_pem, const char *key_pem,
+                             uint32_t source_crc)
+{
+    esp_err_t err = ESP_ERR_INVALID_ARG;
+    mbedtls_x509_crt ca, chain;
+    mbedtls_pk_context pk;
+    uint8_t *key_der = NULL;
+    uint8_t *image = NULL;
+    store_header_t header = { 0 };
+    uint32_t len = STORE_ALIGN(sizeof(header));
+    int key_len;
+    int ret;
+
+    mbedtls_x509_crt_init(&ca);
+    mbedtls_x509_crt_init(&chain);
+    mbedtls_pk_init(&pk);
+    if ((ret = mbedtls_x509_crt_parse(&ca, (const uint8_t *)ca_pem, strlen(ca_pem) + 1)) != 0)
+    {
+        ESP_LOGE(TAG, "Could not parse the CA certificates: -0x%x", -ret);
+        goto exit;
+    }
+    if ((ret = mbedtls_x509_crt_parse(&chain, (const uint8_t *)chain_pem, strlen(chain_pem) + 1)) != 0)
+    {
+        ESP_LOGE(TAG, "Could not parse the client certificates: -0x%x", -ret);
+        goto exit;
+    }
+    if ((ret = mbedtls_pk_parse_key(&pk, (const uint8_t *)key_pem, strlen(key_pem) + 1,
+                                    NULL, 0, store_rng, NULL)) != 0)
+    {
+        ESP_LOGE(TAG, "Could not parse the key: -0x%x", -ret);
+        goto exit;
+    }
+    if ((ret = mbedtls_pk_check_pair(&chain.MBEDTLS_PRIVATE(pk), &pk, store_rng, NULL)) != 0)
+    {
+        ESP_LOGE(TAG, "The key does not belong to the client certificate: -0x%x", -ret);
+        goto exit;
+    }
+    if (ca.next != NULL || chain.next != NULL)
+    {
+        ESP_LOGW(TAG, "More than one CA or client certificate, they are kept in PEM");
+        err = ESP_ERR_NOT_SUPPORTED;
+        goto exit;
+    }
+
+    key_der = malloc(STORE_KEY_DER_MAX);
+    if (key_der == NULL)
+    {
+        err = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+    /* Written at the end of the buffer*/
+    key_len = mbedtls_pk_write_key_der(&pk, key_der, STORE_KEY_DER_MAX);
+    if (key_len <= 0)
+    {
+        ESP_LOGE(TAG, "Could not encode the key: -0x%x", -key_len);
+        goto exit;
+    }
+
+    len = STORE_ALIGN(len + ca.raw.len);
+    len = STORE_ALIGN(len + chain.raw.len);
+    len = STORE_ALIGN(len + key_len);
+    if (len > store_partition->size)
+    {
+        ESP_LOGE(TAG, "%lu bytes do not fit in the partition", (unsigned long)len);
+        err = ESP_ERR_INVALID_SIZE;
+        goto exit;
+    }
+    image = calloc(1, len);
+    if (image == NULL)
+    {
+        err = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+
+    len = STORE_ALIGN(sizeof(header));
+    store_add(&header, image, &len, STORE_ENTRY_CA, ca.raw.p, ca.raw.len);
+    store_add(&header, image, &len, STORE_ENTRY_CHAIN, chain.raw.p, chain.raw.len);
+    store_add(&header, image, &len, STORE_ENTRY_KEY, key_der + STORE_KEY_DER_MAX - key_len, key_len);
+
+    header.magic = STORE_MAGIC;
+    header.version = STORE_VERSION;
+    header.source_crc = source_crc;
+    header.len = len;
+    memcpy(image, &header, sizeof(header));
+    header.crc = store_crc(image, len);
+    memcpy(image, &header, sizeof(header));
+
+    size_t erase_len = (len + store_partition->erase_size - 1)
+        & ~(store_partition->erase_size - 1);
+    size_t data_offset = STORE_ALIGN(sizeof(header));
+    if ((err = esp_partition_erase_range(store_partition, 0, erase_len)) != ESP_OK
+        || (err = esp_partition_write(store_partition, data_offset,
+                                      image + data_offset, len - data_offset)) != ESP_OK
+        || (err = esp_partition_write(store_partition, 0, image, data_offset)) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Could not write the partition: %s", esp_err_to_name(err));
+        goto exit;
+    }
+    ESP_LOGI(TAG, "Stored the certificates and the key in %lu bytes", (unsigned long)len);
+    if (!esp_flash_encryption_enabled())
+    {
+        ESP_LOGW(TAG, "Flash encryption is disabled, the key is stored in clear");
+    }
+
+exit:
+    if (key_der != NULL)
+    {
+        mbedtls_platform_zeroize(key_der, STORE_KEY_DER_MAX);
+        free(key_der);
+    }
+    if (image != NULL)
+    {
+        mbedtls_platform_zeroize(image, len);
+        free(image);
+    }
+    mbedtls_pk_free(&pk);
+    mbedtls_x509_crt_free(&chain);
+    mbedtls_x509_crt_free(&ca);
+    return err;
+}
+
+static esp_err_t store_start(void)
+{
+    store_ready = false;
+    store_unmap();
+    store_partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA,
+        STORE_PARTITION_SUBTYPE,
+        CONFIG_CERT_STORE_PARTITION_LABEL
+    );
+    if (store_partition == NULL)
+    {
+        ESP_LOGE(TAG, "No %s partition", CONFIG_CERT_STORE_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    return store_map_partition();
+}
+
+esp_err_t cert_store_open(uint32_t source_crc)
+{
+    ESP_RETURN_ON_ERROR(store_start(), TAG, "Could not map the store");
+    if (!store_check(source_crc))
+    {
+        store_unmap();
+        return ESP_ERR_INVALID_STATE;
+    }
+    store_ready = true;
+    return ESP_OK;
+}
+
+esp_err_t cert_store_init(const char *ca_pem, const char *chain_pem, const char *key_pem)
+{
+    ESP_RETURN_ON_FALSE(ca_pem != NULL && chain_pem != NULL && key_pem != NULL,
+                        ESP_ERR_INVALID_ARG, TAG, "Missing certificates");
+    uint32_t source_crc = cert_store_source_crc(ca_pem, chain_pem, key_pem);
+    ESP_RETURN_ON_ERROR(store_start(), TAG, "Could not map the store");
+    if (!store_check(source_crc))
+    {
+        /* The writes go through the cache, map it again after them*/
+        store_unmap();
+        ESP_RETURN_ON_ERROR(store_write(ca_pem, chain_pem, key_pem, source_crc),
+                            TAG, "Could not convert the certificates");
+        ESP_RETURN_ON_ERROR(store_map_partition(), TAG, "Could not map the new store");
+        if (!store_check(source_crc))
+        {
+            store_unmap();
+            ESP_LOGE(TAG, "The written store does not read back");
+            return ESP_ERR_INVALID_CRC;
+        }
+    }
+
+    store_ready = true;
+    return ESP_OK;
+}
+
+bool cert_store_ready(void)
+{
+    return store_ready;
+}
+
+esp_err_t cert_store_get(cert_store_der_t *der)
+{
+    ESP_RETURN_ON_FALSE(store_ready, ESP_ERR_INVALID_STATE, TAG, "Store not ready");
+    const store_header_t *header = (const store_header_t *)store_map;
+    der->ca = store_map + header->entries[STORE_ENTRY_CA].offset;
+    der->ca_len = header->entries[STORE_ENTRY_CA].len;
+    der->chain = store_map + header->entries[STORE_ENTRY_CHAIN].offset;
+    der->chain_len = header->entries[STORE_ENTRY_CHAIN].len;
+    der->key = store_map + header->entries[STORE_ENTRY_KEY].offset;
+    der->key_len = header->entries[STORE_ENTRY_KEY].len;
+    return ESP_OK;
+}
+#endif
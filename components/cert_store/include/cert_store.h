@@ -0,0 +1,87 @@
+/**
+ * @file cert_store.h
+ * @brief Certificates in DER form on their own flash partition.
+ *
+ * The provisioned PEM certificates and key are converted to DER and
+ * validated once, then written to the partition with a CRC and the CRC of
+ * the PEM they came from. Every boot maps the partition and hands the DER
+ * to esp-tls, so the TLS connections do not decode PEM and the PEM can be
+ * dropped from RAM. esp-tls parses a DER buffer as one certificate, so only
+ * a single CA and client certificate are stored. With flash encryption the
+ * partition, flagged encrypted in partitions.csv, is encrypted with the key.
+ */
+#ifndef CERT_STORE_H
+#define CERT_STORE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief Stored certificates and key, DER in the mapped partition.
+ */
+typedef struct {
+    const uint8_t *ca;    /*!< CA certificate of the broker*/
+    size_t ca_len;        /*!< Length of ca*/
+    const uint8_t *chain; /*!< Client certificate*/
+    size_t chain_len;     /*!< Length of chain*/
+    const uint8_t *key;   /*!< Client private key*/
+    size_t key_len;       /*!< Length of key*/
+} cert_store_der_t;
+
+/**
+ * @brief Map the store, writing it first if it does not hold these certificates.
+ *
+ * @param ca_pem CA certificates of the broker, null terminated.
+ * @param chain_pem Client certificate followed by its chain, null terminated.
+ * @param key_pem Client private key, null terminated.
+ * @return
+ *   - ESP_OK: The certificates can be attached to a TLS configuration
+ *   - ESP_ERR_NOT_FOUND: There is no certificate partition
+ *   - ESP_ERR_INVALID_ARG: The certificates or the key could not be parsed,
+ *     or the key does not belong to the client certificate
+ *   - ESP_ERR_INVALID_SIZE: The certificates do not fit in the partition
+ *   - ESP_ERR_NOT_SUPPORTED: More than one CA or client certificate, to be
+ *     used in PEM
+ */
+esp_err_t cert_store_init(const char *ca_pem, const char *chain_pem, const char *key_pem);
+
+/**
+ * @brief Map the store without the PEM, when it holds the certificates of source_crc.
+ *
+ * @param source_crc CRC of the PEM, see cert_store_source_crc.
+ * @return
+ *   - ESP_OK: The certificates can be attached to a TLS configuration
+ *   - ESP_ERR_NOT_FOUND: There is no certificate partition
+ *   - ESP_ERR_INVALID_STATE: The store is empty, damaged or holds other certificates
+ */
+esp_err_t cert_store_open(uint32_t source_crc);
+
+/**
+ * @brief CRC of the PEM a store is converted from, which identifies it.
+ *
+ * @param ca_pem CA certificates of the broker, null terminated.
+ * @param chain_pem Client certificate followed by its chain, null terminated.
+ * @param key_pem Client private key, null terminated.
+ * @return The CRC32 of the three strings with their terminators.
+ */
+uint32_t cert_store_source_crc(const char *ca_pem, const char *chain_pem, const char *key_pem);
+
+/**
+ * @brief Whether cert_store_init or cert_store_open succeeded.
+ */
+bool cert_store_ready(void);
+
+/**
+ * @brief Get the stored certificates and key.
+ *
+ * Meant for cacert_buf, clientcert_buf and clientkey_buf of esp_tls_cfg_t.
+ * They stay mapped for the run.
+ *
+ * @param der Filled with the DER buffers and their lengths.
+ * @return
+ *   - ESP_OK: Success
+ *   - ESP_ERR_INVALID_STATE: The store is not ready
+ */
+esp_err_t cert_store_get(cert_store_der_t *der);
+#endif // !CERT_STORE_H
@@ -0,0 +1,407 @@
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "diagnostics.h"
+#include "link_manager.h"
+#include "mqtt_inbound.h"
+#include "mqtt_outbox.h"
+#include "mqtt_rpc.h"
+#include "nvs_structures.h"
+#include "sgp30.h"
+#include "telemetry_queue.h"
+#include "tls_session.h"
+#include "uplink.h"
+
+#define MAX_TAG_LEN 24
+
+static const char *TAG = "diagnostics";
+
+/* Components whose debug messages trace the telemetry path*/
+static const char *const traced_tags[] = {
+    "link_manager",
+    "mqtt_inbound",
+    "mqtt_outbox",
+    "mqtt_router",
+    "mqtt_rpc",
+    "telemetry_batch",
+    "telemetry_codec",
+    "telemetry_compress",
+    "telemetry_queue",
+    "tls_session",
+    "uplink_coap",
+};
+
+static const char *const log_level_names[] = {
+    [ESP_LOG_NONE] = "none",
+    [ESP_LOG_ERROR] = "error",
+    [ESP_LOG_WARN] = "warn",
+    [ESP_LOG_INFO] = "info",
+    [ESP_LOG_DEBUG] = "debug",
+    [ESP_LOG_VERBOSE] = "verbose",
+};
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+/* Filled by the MQTT task only, while answering getPerf*/
+static TaskStatus_t diagnostics_tasks[CONFIG_DIAGNOSTICS_MAX_TASKS];
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+/* Run time counters of the previous snapshot, by task number*/
+static UBaseType_t previous_task_numbers[CONFIG_DIAGNOSTICS_MAX_TASKS];
+static configRUN_TIME_COUNTER_TYPE previous_task_counters[CONFIG_DIAGNOSTICS_MAX_TASKS];
+static size_t previous_tasks_len;
+static configRUN_TIME_COUNTER_TYPE previous_total_run_time;
+#endif
+#endif
+
+/* Parameters of setTrace and setLogLevel*/
+typedef struct {
+    bool has_enabled;
+    bool enabled;
+    char tag[MAX_TAG_LEN + 1];
+    int level;
+} diagnostics_params_t;
+
+/* Appends to a reply, the length keeps growing past size on overflow so
+ the caller can detect it once at the end*/
+static void append(char *response, size_t size, size_t *len, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(
+        response + (*len < size ? *len : size),
+        *len < size ? size - *len : 0,
+        format,
+        args
+    );
+    va_end(args);
+    if (written > 0)
+    {
+        *len += written;
+    }
+}
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+static configRUN_TIME_COUNTER_TYPE previous_counter(UBaseType_t task_number)
+{
+    for (size_t i = 0; i < previous_tasks_len; i++)
+    {
+        if (previous_task_numbers[i] == task_number)
+        {
+            return previous_task_counters[i];
+        }
+    }
+    return 0;
+}
+#endif
+
+static void append_tasks(char *response, size_t size, size_t *len)
+{
+    configRUN_TIME_COUNTER_TYPE total_run_time = 0;
+    UBaseType_t tasks_len = uxTaskGetSystemState(diagnostics_tasks, CONFIG_DIAGNOSTICS_MAX_TASKS, &total_run_time);
+
+    if (tasks_len == 0)
+    {
+        append(response, size, len, ",\"tasks\":null");
+        return;
+    }
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    /* Share of the time of every core since the previous snapshot*/
+    configRUN_TIME_COUNTER_TYPE elapsed = (total_run_time - previous_total_run_time) * portNUM_PROCESSORS;
+#endif
+    append(response, size, len, ",\"tasks\":[");
+    for (UBaseType_t i = 0; i < tasks_len; i++)
+    {
+        const TaskStatus_t *task = &diagnostics_tasks[i];
+        append(
+            response,
+            size,
+            len,
+            "%s{\"n\":\"%s\",\"s\":%" PRIu32,
+            i == 0 ? "" : ",",
+            task->pcTaskName,
+            (uint32_t)task->usStackHighWaterMark
+        );
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        configRUN_TIME_COUNTER_TYPE used = task->ulRunTimeCounter - previous_counter(task->xTaskNumber);
+        append(response, size, len, ",\"c\":%" PRIu32, elapsed == 0 ? 0 : (uint32_t)((uint64_t)used * 100 / elapsed));
+#endif
+        append(response, size, len, "}");
+    }
+    append(response, size, len, "]");
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    for (UBaseType_t i = 0; i < tasks_len; i++)
+    {
+        previous_task_numbers[i] = diagnostics_tasks[i].xTaskNumber;
+        previous_task_counters[i] = diagnostics_tasks[i].ulRunTimeCounter;
+    }
+    previous_tasks_len = tasks_len;
+    previous_total_run_time = total_run_time;
+#endif
+}
+#endif
+
+/* Flash writes per namespace since power on, with the entries of the last
+ usage sample*/
+static void append_nvs(char *response, size_t size, size_t *len)
+{
+    storage_stats_t stats;
+
+    storage_get_stats(&stats);
+    append(
+        response,
+        size,
+        len,
+        ",\"nvs\":{\"used\":%" PRIu32 ",\"free\":%" PRIu32 ",\"opens\":%" PRIu32 ",\"ns\":[",
+        stats.used_entries,
+        stats.free_entries,
+        stats.opens
+    );
+    for (size_t i = 0; i < STORAGE_STATS_NAMESPACES; i++)
+    {
+        const storage_namespace_stats_t *ns = &stats.namespaces[i];
+        append(
+            response,
+            size,
+            len,
+            "%s{\"n\":\"%s\",\"r\":%" PRIu32 ",\"w\":%" PRIu32 ",\"skip\":%" PRIu32 ",\"c\":%" PRIu32
+            ",\"wb\":%" PRIu32 ",\"us\":%" PRIu32 ",\"max_us\":%" PRIu32 "}",
+            i == 0 ? "" : ",",
+            ns->name,
+            ns->reads,
+            ns->writes,
+            ns->skipped,
+            ns->commits,
+            ns->written_bytes,
+            ns->read_us + ns->write_us + ns->commit_us,
+            ns->max_us
+        );
+    }
+    append(response, size, len, "]}");
+}
+
+/* The outbox and TLS counters are updated by other tasks, a snapshot may
+ mix values of consecutive updates*/
+static esp_err_t get_perf(
+    const char *request,
+    size_t request_len,
+    char *response,
+    size_t response_size,
+    size_t *response_len
+)
+{
+    mqtt_outbox_stats_t outbox;
+    tls_session_stats_t tls;
+    sgp30_i2c_errors_t i2c;
+    link_manager_stats_t link;
+    uplink_stats_t uplink;
+    size_t len = 0;
+
+    mqtt_outbox_get_stats(&outbox);
+    tls_session_get_stats(&tls);
+    sgp30_get_i2c_errors(&i2c);
+    link_manager_get_stats(&link);
+    uplink_get_stats(&uplink);
+
+    append(
+        response,
+        response_size,
+        &len,
+        "{\"uptime\":%" PRIu32 ",\"heap\":%" PRIu32 ",\"heap_min\":%" PRIu32,
+        (uint32_t)(esp_timer_get_time() / 1000000),
+        esp_get_free_heap_size(),
+        esp_get_minimum_free_heap_size()
+    );
+    append(
+        response,
+        response_size,
+        &len,
+        ",\"outbox\":{\"used\":%u,\"peak\":%u,\"rejected\":%" PRIu32 ",\"dropped\":%" PRIu32 "},\"queue\":%u",
+        outbox.slots_used,
+        outbox.slots_peak,
+        outbox.rejected,
+        outbox.dropped,
+        (unsigned)telemetry_queue_pending()
+    );
+    append(
+        response,
+        response_size,
+        &len,
+        ",\"i2c\":{\"write\":%" PRIu32 ",\"read\":%" PRIu32 ",\"crc\":%" PRIu32 "}",
+        i2c.write,
+        i2c.read,
+        i2c.crc
+    );
+    append(
+        response,
+        response_size,
+        &len,
+        ",\"tls\":{\"full\":%" PRIu32 ",\"resumed\":%" PRIu32 ",\"last_ms\":%" PRIu32
+        ",\"heap_peak\":%" PRIu32 ",\"heap_held\":%" PRIu32 "}",
+        tls.full_handshakes,
+        tls.resumed_handshakes,
+        tls.last_us / 1000,
+        tls.last_heap_peak,
+        tls.last_heap_held
+    );
+    append(
+        response,
+        response_size,
+        &len,
+        ",\"link\":{\"up\":%s,\"connects\":%" PRIu32 ",\"radio_hour_s\":%" PRIu32 "}",
+        link.up ? "true" : "false",
+        link.connects,
+        link.last_hour_on_s
+    );
+    /* Averages per acknowledged upload, to compare the transports*/
+    append(
+        response,
+        response_size,
+        &len,
+        ",\"uplink\":{\"name\":\"%s\",\"uploads\":%" PRIu32 ",\"failures\":%" PRIu32 ",\"retx\":%" PRIu32
+        ",\"tx\":%" PRIu64 ",\"rx\":%" PRIu64 ",\"avg_ms\":%" PRIu32 ",\"max_ms\":%" PRIu32 ",\"radio_ms\":%" PRIu32 "}",
+        uplink.name,
+        uplink.uploads,
+        uplink.failures,
+        uplink.retransmits,
+        uplink.tx_bytes,
+        uplink.rx_bytes,
+        uplink.uploads > 0 ? (uint32_t)(uplink.latency_us / uplink.uploads / 1000) : 0,
+        (uint32_t)(uplink.max_latency_us / 1000),
+        uplink.uploads > 0 ? (uint32_t)(link.radio_on_us / uplink.uploads / 1000) : 0
+    );
+    append_nvs(response, response_size, &len);
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    append_tasks(response, response_size, &len);
+#endif
+    append(response, response_size, &len, "}");
+
+    *response_len = len;
+    return len < response_size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+static int find_log_level(const char *name, size_t name_len)
+{
+    for (int level = ESP_LOG_NONE; level <= ESP_LOG_VERBOSE; level++)
+    {
+        if (mqtt_json_equals(name, name_len, log_level_names[level]))
+        {
+            return level;
+        }
+    }
+    return -1;
+}
+
+static void read_params(const mqtt_json_member_t *member, void *ctx)
+{
+    diagnostics_params_t *params = ctx;
+
+    if (!mqtt_json_equals(member->parent, member->parent_len, "params"))
+    {
+        return;
+    }
+    if (mqtt_json_equals(member->key, member->key_len, "enabled")
+        && (member->type == MQTT_JSON_TRUE || member->type == MQTT_JSON_FALSE))
+    {
+        params->has_enabled = true;
+        params->enabled = member->type == MQTT_JSON_TRUE;
+    }
+    else if (mqtt_json_equals(member->key, member->key_len, "tag")
+             && member->type == MQTT_JSON_STRING && member->value_len <= MAX_TAG_LEN)
+    {
+        memcpy(params->tag, member->value, member->value_len);
+        params->tag[member->value_len] = '\0';
+    }
+    else if (mqtt_json_equals(member->key, member->key_len, "level") && member->type == MQTT_JSON_STRING)
+    {
+        params->level = find_log_level(member->value, member->value_len);
+    }
+}
+
+static esp_err_t scan_params(const char *request, size_t request_len, diagnostics_params_t *params)
+{
+    *params = (diagnostics_params_t) { .level = -1 };
+    return mqtt_json_scan(request, request_len, read_params, params);
+}
+
+static esp_err_t set_trace(
+    const char *request,
+    size_t request_len,
+    char *response,
+    size_t response_size,
+    size_t *response_len
+)
+{
+    diagnostics_params_t params;
+
+    ESP_RETURN_ON_ERROR(scan_params(request, request_len, &params), TAG, "malformed setTrace");
+    if (!params.has_enabled)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_log_level_t level = params.enabled ? CONFIG_DIAGNOSTICS_TRACE_LEVEL : CONFIG_LOG_DEFAULT_LEVEL;
+    for (size_t i = 0; i < sizeof(traced_tags) / sizeof(traced_tags[0]); i++)
+    {
+        esp_log_level_set(traced_tags[i], level);
+    }
+    ESP_LOGI(TAG, "Tracing %s", params.enabled ? "enabled" : "disabled");
+    *response_len = snprintf(response, response_size, "{\"trace\":%s}", params.enabled ? "true" : "false");
+    return ESP_OK;
+}
+
+static esp_err_t set_log_level(
+    const char *request,
+    size_t request_len,
+    char *response,
+    size_t response_size,
+    size_t *response_len
+)
+{
+    diagnostics_params_t params;
+
+    ESP_RETURN_ON_ERROR(scan_params(request, request_len, &params), TAG, "malformed setLogLevel");
+    if (params.tag[0] == '\0' || params.level < 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_log_level_set(params.tag, params.level);
+    ESP_LOGI(TAG, "Log level of %s set to %s", params.tag, log_level_names[params.level]);
+    *response_len = snprintf(
+        response,
+        response_size,
+        "{\"tag\":\"%s\",\"level\":\"%s\"}",
+        params.tag,
+        log_level_names[params.level]
+    );
+    return ESP_OK;
+}
+
+static const mqtt_rpc_method_t diagnostics_methods[] = {
+    { "getPerf", get_perf },
+    { "setTrace", set_trace },
+    { "setLogLevel", set_log_level },
+};
+
+static const size_t diagnostics_methods_len =
+    sizeof(diagnostics_methods) / sizeof(diagnostics_methods[0]);
+
+esp_err_t diagnostics_init(void)
+{
+    for (int i = 0; i < diagnostics_methods_len; i++)
+    {
+        ESP_RETURN_ON_ERROR(
+            mqtt_rpc_register(&diagnostics_methods[i]),
+            TAG,
+            "Could not register %s",
+            diagnostics_methods[i].method
+        );
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,30 @@
+/**
+ * @file diagnostics.h
+ * @brief RPC methods to profile a node remotely.
+ *
+ * - getPerf: compact performance snapshot, with heap, tasks, outbox, queue,
+ *   I2C, TLS and radio counters and uptime. CPU usage is measured since the
+ *   previous getPerf.
+ * - setTrace {"enabled": bool}: debug logging of the telemetry and MQTT
+ *   components.
+ * - setLogLevel {"tag": "...", "level": "none|error|warn|info|debug|verbose"}:
+ *   log level of a tag, "*" for every tag.
+ *
+ * The snapshot is written into the static RPC reply buffer, nothing is
+ * allocated while answering.
+ */
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+#include "esp_err.h"
+
+/**
+ * @brief Register the diagnostics RPC methods.
+ *
+ * It has to be called before mqtt_init.
+ *
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: Failure
+ */
+esp_err_t diagnostics_init(void);
+#endif // !DIAGNOSTICS_H
@@ -0,0 +1,43 @@
+#include <stdint.h>
+#include "esp_mac.h"
+#include "esp_random.h"
+#include "fleet.h"
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+uint32_t fleet_backoff_next(fleet_backoff_t *backoff)
+{
+    uint64_t high = (uint64_t)(backoff->last_ms == 0 ? CONFIG_FLEET_BACKOFF_BASE_MS : backoff->last_ms) * 3;
+
+    if (high > CONFIG_FLEET_BACKOFF_CAP_MS)
+    {
+        high = CONFIG_FLEET_BACKOFF_CAP_MS;
+    }
+    backoff->last_ms = CONFIG_FLEET_BACKOFF_BASE_MS + esp_random() % (uint32_t)(high - CONFIG_FLEET_BACKOFF_BASE_MS + 1);
+    return backoff->last_ms;
+}
+
+void fleet_backoff_reset(fleet_backoff_t *backoff)
+{
+    backoff->last_ms = 0;
+}
+
+uint32_t fleet_slot_offset(uint32_t period_ms)
+{
+    uint8_t mac[6] = { 0 };
+    uint32_t hash = FNV_OFFSET_BASIS;
+
+    if (period_ms == 0)
+    {
+        return 0;
+    }
+    /* Consecutive MACs of a batch of boards must not get close slots*/
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    for (int i = 0; i < sizeof(mac); i++)
+    {
+        hash ^= mac[i];
+        hash *= FNV_PRIME;
+    }
+    return hash % period_ms;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file fleet.h
+ * @brief Spreads the network load of many nodes sharing an access point and
+ * a broker.
+ *
+ * Reconnections wait with decorrelated jitter, each wait random between
+ * CONFIG_FLEET_BACKOFF_BASE_MS and three times the previous one, capped at
+ * CONFIG_FLEET_BACKOFF_CAP_MS. Uploads are given a slot derived from the
+ * station MAC, so devices restarted together still publish apart.
+ */
+#ifndef FLEET_H
+#define FLEET_H
+#include <stdint.h>
+
+/**
+ * @brief Reconnect backoff state.
+ */
+typedef struct {
+    uint32_t last_ms; /*!< Previous wait, 0 after a reset */
+} fleet_backoff_t;
+
+/**
+ * @brief Get the next reconnect wait.
+ *
+ * @param backoff Backoff state, zero initialized or reset.
+ * @return Wait in milliseconds.
+ */
+uint32_t fleet_backoff_next(fleet_backoff_t *backoff);
+
+/**
+ * @brief Start over after a successful connection.
+ *
+ * @param backoff Backoff state.
+ */
+void fleet_backoff_reset(fleet_backoff_t *backoff);
+
+/**
+ * @brief Get the upload slot of the device within a period.
+ *
+ * The same device always gets the same slot for a period, and the slots of
+ * a fleet are uniformly distributed over it.
+ *
+ * @param period_ms Period in milliseconds.
+ * @return Offset from the start of the period in milliseconds, 0 if
+ * period_ms is 0.
+ */
+uint32_t fleet_slot_offset(uint32_t period_ms);
+#endif // !FLEET_H
@@ -0,0 +1,269 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "gateway.h"
+#include "gateway_frame.h"
+#include "json_structures.h"
+#include "mqtt_controller.h"
+#if CONFIG_TELEMETRY_BATCH_STORE_AND_FORWARD
+#include "telemetry_queue.h"
+#endif
+
+/* "<prefix><12 hex digits>":[] plus the separator*/
+#define DEVICE_OVERHEAD (sizeof(CONFIG_GATEWAY_DEVICE_PREFIX) - 1 + 12 + 6)
+/* A record plus its separator*/
+#define RECORD_LEN (JSON_STRUCTURES_TIMED_MEASUREMENT_MAX_LEN + 1)
+/* {} around the devices*/
+#define PAYLOAD_OVERHEAD 2
+
+static const char *TAG = "gateway";
+
+ESP_EVENT_DEFINE_BASE(GATEWAY_EVENT);
+
+/* A window received from a leaf*/
+typedef struct {
+    uint8_t mac[6];
+    sgp30_timed_measurement_t m;
+} gateway_record_t;
+
+static esp_event_loop_handle_t gateway_event_loop;
+static gateway_record_t gateway_records[CONFIG_GATEWAY_CAPACITY];
+static size_t gateway_records_len;
+/* Upper bound of the payload of the held records*/
+static size_t gateway_records_bytes;
+static char gateway_payload[CONFIG_GATEWAY_MAX_BYTES];
+static gateway_stats_t gateway_stats;
+/* Only written by the link task*/
+static volatile uint32_t gateway_malformed;
+
+static void gateway_recv_callback(const uint8_t *data, size_t len)
+{
+    uint8_t mac[6];
+    size_t n;
+
+    /* Called from the link task. The event does not carry the length, so
+     only frames whose header matches it are posted. A frame that does not
+     fit in the loop is lost like one lost on air*/
+    if (gateway_frame_decode(data, len, mac, &n) != ESP_OK)
+    {
+        gateway_malformed++;
+        return;
+    }
+    esp_event_post_to(gateway_event_loop, GATEWAY_EVENT, GATEWAY_EVENT_FRAME, data, len, 0);
+}
+
+/* Whether a record before the given index comes from the same leaf*/
+static bool gateway_seen_before(const uint8_t mac[6], size_t before)
+{
+    for (size_t i = 0; i < before; i++)
+    {
+        if (memcmp(gateway_records[i].mac, mac, 6) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t gateway_bytes_with(const uint8_t mac[6])
+{
+    return gateway_records_bytes + RECORD_LEN
+           + (gateway_seen_before(mac, gateway_records_len) ? 0 : DEVICE_OVERHEAD);
+}
+
+static void gateway_drop_oldest(void)
+{
+    memmove(
+        &gateway_records[0],
+        &gateway_records[1],
+        (gateway_records_len - 1) * sizeof(gateway_record_t)
+    );
+    gateway_records_len--;
+    gateway_records_bytes = PAYLOAD_OVERHEAD;
+    for (size_t i = 0; i < gateway_records_len; i++)
+    {
+        gateway_records_bytes += RECORD_LEN + (gateway_seen_before(gateway_records[i].mac, i) ? 0 : DEVICE_OVERHEAD);
+    }
+    gateway_stats.dropped++;
+    ESP_LOGW(TAG, "Buffer full and unpublished, dropped oldest window");
+}
+
+/* Appends to the payload, the length keeps growing past its size on
+ overflow so it is checked once at the end*/
+static void append(size_t *len, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(
+        gateway_payload + (*len < sizeof(gateway_payload) ? *len : sizeof(gateway_payload)),
+        *len < sizeof(gateway_payload) ? sizeof(gateway_payload) - *len : 0,
+        format,
+        args
+    );
+    va_end(args);
+    if (written > 0)
+    {
+        *len += written;
+    }
+}
+
+/* {"<device>":[{"ts":...,"values":{...}},...],...}, the records of every
+ leaf grouped in order of arrival*/
+static esp_err_t gateway_encode(size_t *out_len)
+{
+    size_t len = 0;
+    bool first_device = true;
+
+    append(&len, "{");
+    for (size_t i = 0; i < gateway_records_len; i++)
+    {
+        const uint8_t *mac = gateway_records[i].mac;
+        if (gateway_seen_before(mac, i))
+        {
+            continue;
+        }
+        append(
+            &len,
+            "%s\"%s%02x%02x%02x%02x%02x%02x\":[",
+            first_device ? "" : ",",
+            CONFIG_GATEWAY_DEVICE_PREFIX,
+            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]
+        );
+        first_device = false;
+        bool first_record = true;
+        for (size_t j = i; j < gateway_records_len; j++)
+        {
+            if (memcmp(gateway_records[j].mac, mac, 6) != 0)
+            {
+                continue;
+            }
+            if (!first_record)
+            {
+                append(&len, ",");
+            }
+            first_record = false;
+            if (len < sizeof(gateway_payload))
+            {
+                len += json_structures_write_timed_measurement(
+                    gateway_payload + len,
+                    sizeof(gateway_payload) - len,
+                    &gateway_records[j].m
+                );
+            }
+        }
+        append(&len, "]");
+    }
+    append(&len, "}");
+
+    *out_len = len;
+    return len < sizeof(gateway_payload) ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+static esp_err_t gateway_add(const uint8_t mac[6], const sgp30_timed_measurement_t *m)
+{
+    esp_err_t err = ESP_OK;
+
+    if (gateway_records_len > 0
+        && (gateway_records_len == CONFIG_GATEWAY_CAPACITY
+            || gateway_bytes_with(mac) > sizeof(gateway_payload)))
+    {
+        err = gateway_flush();
+    }
+    /* If the broker could not take them make room for the newest window*/
+    while (gateway_records_len > 0
+           && (gateway_records_len == CONFIG_GATEWAY_CAPACITY
+               || gateway_bytes_with(mac) > sizeof(gateway_payload)))
+    {
+        gateway_drop_oldest();
+    }
+    gateway_records_bytes = gateway_bytes_with(mac);
+    memcpy(gateway_records[gateway_records_len].mac, mac, 6);
+    gateway_records[gateway_records_len].m = *m;
+    gateway_records_len++;
+    return err;
+}
+
+static void gateway_on_frame(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    const uint8_t *frame = event_data;
+    uint8_t mac[6];
+    size_t n;
+    sgp30_timed_measurement_t m;
+
+    /* Checked before posting, the header gives the length*/
+    gateway_frame_decode(frame, GATEWAY_FRAME_HEADER_LEN + frame[7] * GATEWAY_FRAME_RECORD_LEN, mac, &n);
+    ESP_LOGD(TAG, "%d windows from " MACSTR, (int)n, MAC2STR(mac));
+    time_t now = time(NULL);
+    for (size_t i = 0; i < n; i++)
+    {
+        gateway_frame_record(frame, i, now, &m);
+        gateway_add(mac, &m);
+    }
+    gateway_stats.frames++;
+    gateway_stats.windows += n;
+}
+
+esp_err_t gateway_init(esp_event_loop_handle_t loop, const gateway_link_t *link)
+{
+    gateway_event_loop = loop;
+    gateway_records_len = 0;
+    gateway_records_bytes = PAYLOAD_OVERHEAD;
+
+    ESP_RETURN_ON_ERROR(
+        esp_event_handler_register_with(gateway_event_loop, GATEWAY_EVENT, GATEWAY_EVENT_FRAME, gateway_on_frame, NULL),
+        TAG,
+        "Could not register frame handler"
+    );
+    ESP_RETURN_ON_ERROR(link->open(gateway_recv_callback, NULL), TAG, "Could not open %s", link->name);
+    ESP_LOGI(TAG, "Receiving windows over %s", link->name);
+    return ESP_OK;
+}
+
+esp_err_t gateway_flush(void)
+{
+    size_t payload_len;
+
+    if (gateway_records_len == 0)
+    {
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(gateway_encode(&payload_len), TAG, "Could not encode %d windows", (int)gateway_records_len);
+#if CONFIG_TELEMETRY_BATCH_STORE_AND_FORWARD
+    ESP_RETURN_ON_ERROR(
+        telemetry_queue_append(MQTT_GATEWAY_TELEMETRY_TOPIC, (const uint8_t *)gateway_payload, payload_len),
+        TAG,
+        "Could not publish %d windows",
+        (int)gateway_records_len
+    );
+#else
+    ESP_RETURN_ON_ERROR(
+        mqtt_publish_topic(MQTT_GATEWAY_TELEMETRY_TOPIC, gateway_payload, payload_len, NULL),
+        TAG,
+        "Could not publish %d windows",
+        (int)gateway_records_len
+    );
+#endif
+    ESP_LOGI(TAG, "Published %d leaf windows in %d bytes", (int)gateway_records_len, (int)payload_len);
+    gateway_stats.payloads++;
+    gateway_records_len = 0;
+    gateway_records_bytes = PAYLOAD_OVERHEAD;
+    return ESP_OK;
+}
+
+void gateway_get_stats(gateway_stats_t *stats)
+{
+    *stats = gateway_stats;
+    stats->rejected = gateway_malformed;
+}
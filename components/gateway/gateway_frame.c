@@ -0,0 +1,81 @@
+#include <string.h>
+#include "gateway_frame.h"
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(p, v & 0xFFFF);
+    put_u16(p + 2, v >> 16);
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+esp_err_t gateway_frame_encode(
+    const uint8_t mac[6],
+    const sgp30_timed_measurement_t *m,
+    size_t n,
+    time_t now,
+    uint8_t *buf,
+    size_t *out_len
+)
+{
+    if (n > GATEWAY_FRAME_MAX_RECORDS)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    buf[0] = GATEWAY_FRAME_VERSION;
+    memcpy(&buf[1], mac, 6);
+    buf[7] = n;
+    uint8_t *record = &buf[GATEWAY_FRAME_HEADER_LEN];
+    for (size_t i = 0; i < n; i++, record += GATEWAY_FRAME_RECORD_LEN)
+    {
+        /* A clock stepped back by SNTP must not give negative ages*/
+        put_u32(record, now > m[i].time ? (uint32_t)(now - m[i].time) : 0);
+        put_u16(record + 4, m[i].measurement.eCO2);
+        put_u16(record + 6, m[i].measurement.TVOC);
+    }
+    *out_len = GATEWAY_FRAME_HEADER_LEN + n * GATEWAY_FRAME_RECORD_LEN;
+    return ESP_OK;
+}
+
+esp_err_t gateway_frame_decode(const uint8_t *data, size_t len, uint8_t mac[6], size_t *n)
+{
+    if (len < GATEWAY_FRAME_HEADER_LEN)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (data[0] != GATEWAY_FRAME_VERSION)
+    {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (data[7] > GATEWAY_FRAME_MAX_RECORDS
+        || len != GATEWAY_FRAME_HEADER_LEN + data[7] * GATEWAY_FRAME_RECORD_LEN)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(mac, &data[1], 6);
+    *n = data[7];
+    return ESP_OK;
+}
+
+void gateway_frame_record(const uint8_t *data, size_t i, time_t now, sgp30_timed_measurement_t *m)
+{
+    const uint8_t *record = &data[GATEWAY_FRAME_HEADER_LEN + i * GATEWAY_FRAME_RECORD_LEN];
+
+    m->time = now - get_u32(record);
+    m->measurement.eCO2 = get_u16(record + 4);
+    m->measurement.TVOC = get_u16(record + 6);
+}
@@ -0,0 +1,147 @@
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "gateway.h"
+#include "gateway_frame.h"
+
+/* A sent callback not seen by then was lost, the frame is sent again*/
+#define LEAF_SENT_TIMEOUT_US 1000000
+
+static const char *TAG = "gateway_leaf";
+
+static esp_event_loop_handle_t leaf_event_loop;
+static const gateway_link_t *leaf_link;
+static uint8_t leaf_mac[6];
+static sgp30_timed_measurement_t leaf_records[GATEWAY_FRAME_MAX_RECORDS];
+static size_t leaf_records_len;
+/* The first leaf_sending records are in the frame in flight*/
+static size_t leaf_sending;
+static int64_t leaf_sent_at;
+static uint8_t leaf_frame[GATEWAY_LINK_MAX_FRAME_LEN];
+static gateway_stats_t leaf_stats;
+
+static void leaf_sent_callback(bool delivered)
+{
+    /* Called from the link task, a lost status times out*/
+    esp_event_post_to(leaf_event_loop, GATEWAY_EVENT, GATEWAY_EVENT_SENT, &delivered, sizeof(delivered), 0);
+}
+
+static esp_err_t leaf_send(void)
+{
+    size_t frame_len;
+
+    if (leaf_sending > 0 && esp_timer_get_time() - leaf_sent_at < LEAF_SENT_TIMEOUT_US)
+    {
+        return ESP_OK;
+    }
+    leaf_sending = leaf_records_len;
+    ESP_RETURN_ON_ERROR(
+        gateway_frame_encode(leaf_mac, leaf_records, leaf_sending, time(NULL), leaf_frame, &frame_len),
+        TAG,
+        "Could not encode %d windows",
+        (int)leaf_sending
+    );
+    leaf_sent_at = esp_timer_get_time();
+    esp_err_t err = leaf_link->send(leaf_frame, frame_len);
+    if (err != ESP_OK)
+    {
+        leaf_sending = 0;
+        leaf_stats.rejected++;
+        ESP_LOGW(TAG, "Could not send %d windows: %s", (int)leaf_records_len, esp_err_to_name(err));
+    }
+    return err;
+}
+
+static void leaf_on_sent(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    bool delivered = *(const bool *)event_data;
+
+    if (leaf_sending == 0)
+    {
+        return;
+    }
+    if (!delivered)
+    {
+        /* Kept for the next window, retrying now would only hit the same
+         busy channel*/
+        ESP_LOGW(TAG, "Gateway did not acknowledge %d windows", (int)leaf_sending);
+        leaf_stats.rejected++;
+        leaf_sending = 0;
+        return;
+    }
+    ESP_LOGD(TAG, "Delivered %d windows", (int)leaf_sending);
+    leaf_stats.frames++;
+    leaf_stats.windows += leaf_sending;
+    memmove(
+        &leaf_records[0],
+        &leaf_records[leaf_sending],
+        (leaf_records_len - leaf_sending) * sizeof(sgp30_timed_measurement_t)
+    );
+    leaf_records_len -= leaf_sending;
+    leaf_sending = 0;
+    if (leaf_records_len >= CONFIG_GATEWAY_LEAF_BATCH)
+    {
+        leaf_send();
+    }
+}
+
+esp_err_t gateway_leaf_init(esp_event_loop_handle_t loop, const gateway_link_t *link)
+{
+    leaf_event_loop = loop;
+    leaf_link = link;
+    leaf_records_len = 0;
+    leaf_sending = 0;
+
+    ESP_RETURN_ON_ERROR(esp_read_mac(leaf_mac, ESP_MAC_WIFI_STA), TAG, "Could not read the MAC");
+    ESP_RETURN_ON_ERROR(
+        esp_event_handler_register_with(leaf_event_loop, GATEWAY_EVENT, GATEWAY_EVENT_SENT, leaf_on_sent, NULL),
+        TAG,
+        "Could not register sent handler"
+    );
+    ESP_RETURN_ON_ERROR(link->open(NULL, leaf_sent_callback), TAG, "Could not open %s", link->name);
+    ESP_LOGI(TAG, "Sending windows over %s", link->name);
+    return ESP_OK;
+}
+
+esp_err_t gateway_leaf_add(const sgp30_timed_measurement_t *m)
+{
+    if (leaf_records_len == GATEWAY_FRAME_MAX_RECORDS)
+    {
+        leaf_stats.dropped++;
+        if (leaf_sending == GATEWAY_FRAME_MAX_RECORDS)
+        {
+            ESP_LOGW(TAG, "Buffer full and in flight, dropped newest window");
+            return leaf_send();
+        }
+        /* The oldest window not in flight makes room*/
+        memmove(
+            &leaf_records[leaf_sending],
+            &leaf_records[leaf_sending + 1],
+            (leaf_records_len - leaf_sending - 1) * sizeof(sgp30_timed_measurement_t)
+        );
+        leaf_records_len--;
+        ESP_LOGW(TAG, "Buffer full and undelivered, dropped oldest window");
+    }
+    leaf_records[leaf_records_len++] = *m;
+    if (leaf_records_len >= CONFIG_GATEWAY_LEAF_BATCH)
+    {
+        return leaf_send();
+    }
+    return ESP_OK;
+}
+
+void gateway_leaf_get_stats(gateway_stats_t *stats)
+{
+    *stats = leaf_stats;
+}
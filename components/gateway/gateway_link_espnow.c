@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_now.h"
+#include "esp_wifi.h"
+#include "gateway_link.h"
+#include "power_manager.h"
+
+static const char *TAG = "gateway_link_espnow";
+
+static uint8_t espnow_peer[ESP_NOW_ETH_ALEN];
+static gateway_link_recv_cb_t espnow_on_recv;
+static gateway_link_sent_cb_t espnow_on_sent;
+
+static void espnow_recv_callback(const esp_now_recv_info_t *info, const uint8_t *data, int len)
+{
+    if (espnow_on_recv != NULL && len > 0)
+    {
+        espnow_on_recv(data, len);
+    }
+}
+
+static void espnow_send_callback(const uint8_t *mac, esp_now_send_status_t status)
+{
+    /* Broadcast frames are never acknowledged, they always succeed*/
+    if (espnow_on_sent != NULL)
+    {
+        espnow_on_sent(status == ESP_NOW_SEND_SUCCESS);
+    }
+}
+
+static esp_err_t espnow_open(gateway_link_recv_cb_t on_recv, gateway_link_sent_cb_t on_sent)
+{
+    esp_now_peer_info_t peer = {
+        /* The current channel, set by the leaf and followed by the gateway*/
+        .channel = 0,
+        .ifidx = WIFI_IF_STA,
+        .encrypt = false,
+    };
+
+    if (sscanf(
+            CONFIG_GATEWAY_ESPNOW_PEER,
+            "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+            &espnow_peer[0], &espnow_peer[1], &espnow_peer[2],
+            &espnow_peer[3], &espnow_peer[4], &espnow_peer[5]
+        ) != ESP_NOW_ETH_ALEN)
+    {
+        ESP_LOGE(TAG, "Malformed peer %s", CONFIG_GATEWAY_ESPNOW_PEER);
+        return ESP_ERR_INVALID_ARG;
+    }
+    espnow_on_recv = on_recv;
+    espnow_on_sent = on_sent;
+    ESP_RETURN_ON_ERROR(esp_now_init(), TAG, "Could not initialize ESP-NOW");
+    ESP_RETURN_ON_ERROR(esp_now_register_recv_cb(espnow_recv_callback), TAG, "Could not register receive callback");
+    ESP_RETURN_ON_ERROR(esp_now_register_send_cb(espnow_send_callback), TAG, "Could not register send callback");
+    /* Only the leaves send, a gateway receives from any peer*/
+    if (on_sent != NULL)
+    {
+        memcpy(peer.peer_addr, espnow_peer, ESP_NOW_ETH_ALEN);
+        ESP_RETURN_ON_ERROR(esp_now_add_peer(&peer), TAG, "Could not add peer");
+        ESP_LOGI(TAG, "Sending to " MACSTR " on channel %d", MAC2STR(espnow_peer), CONFIG_GATEWAY_ESPNOW_CHANNEL);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t espnow_send(const uint8_t *data, size_t len)
+{
+    esp_err_t err = esp_now_send(espnow_peer, data, len);
+    if (err == ESP_OK)
+    {
+        power_manager_energy_count_tx(len);
+    }
+    return err;
+}
+
+const gateway_link_t gateway_link_espnow = {
+    .name = "ESP-NOW",
+    .open = espnow_open,
+    .send = espnow_send,
+};
@@ -0,0 +1,101 @@
+/**
+ * @file gateway.h
+ * @brief ThingsBoard gateway role, nodes of a room share one TLS session.
+ *
+ * Leaves send their windows over a local link and never connect to the
+ * broker. The gateway groups the windows it receives by leaf and publishes
+ * them through the ThingsBoard gateway API with its own connection, where
+ * every leaf appears as a device named CONFIG_GATEWAY_DEVICE_PREFIX plus its
+ * MAC. Every function has to be called from the event loop given to the
+ * init function of the role.
+ */
+#ifndef GATEWAY_H
+#define GATEWAY_H
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "gateway_link.h"
+#include "sgp30_types.h"
+
+ESP_EVENT_DECLARE_BASE(GATEWAY_EVENT);
+
+/**
+ * @brief Gateway event IDs.
+ */
+typedef enum {
+    GATEWAY_EVENT_FRAME, /*!< A frame was received, data is the frame */
+    GATEWAY_EVENT_SENT,  /*!< A frame was sent, data is the bool delivery status */
+} gateway_event_id_t;
+
+/**
+ * @brief Role metrics since boot.
+ */
+typedef struct {
+    uint32_t frames;    /*!< Frames delivered by the leaf or accepted by the gateway */
+    uint32_t rejected;  /*!< Frames not delivered by the leaf or malformed at the gateway */
+    uint32_t windows;   /*!< Windows delivered or accepted */
+    uint32_t dropped;   /*!< Windows dropped because the buffer was full */
+    uint32_t payloads;  /*!< Gateway payloads published, 0 at a leaf */
+} gateway_stats_t;
+
+/**
+ * @brief Start the leaf role.
+ *
+ * @param loop Event loop where the link events are posted.
+ * @param link Link to the gateway.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: Failure
+ */
+esp_err_t gateway_leaf_init(esp_event_loop_handle_t loop, const gateway_link_t *link);
+
+/**
+ * @brief Add a window, it is sent with the next CONFIG_GATEWAY_LEAF_BATCH - 1.
+ *
+ * Windows are kept until the gateway acknowledges their frame. When the
+ * buffer is full the oldest is dropped.
+ *
+ * @param m Timed measurement of the window.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: the frame could not be sent, it is retried with
+ *   the next window
+ */
+esp_err_t gateway_leaf_add(const sgp30_timed_measurement_t *m);
+
+/**
+ * @brief Get the metrics of the leaf role.
+ *
+ * @param stats Where the metrics will be copied.
+ */
+void gateway_leaf_get_stats(gateway_stats_t *stats);
+
+/**
+ * @brief Start the gateway role.
+ *
+ * @param loop Event loop where the link events are posted.
+ * @param link Link to the leaves.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: Failure
+ */
+esp_err_t gateway_init(esp_event_loop_handle_t loop, const gateway_link_t *link);
+
+/**
+ * @brief Publish the windows received from the leaves.
+ *
+ * It is also called when the buffer or the payload would overflow.
+ *
+ * @return
+ * - ESP_OK: Success or nothing received
+ * - some other error code: the windows are kept for the next flush
+ */
+esp_err_t gateway_flush(void);
+
+/**
+ * @brief Get the metrics of the gateway role.
+ *
+ * @param stats Where the metrics will be copied.
+ */
+void gateway_get_stats(gateway_stats_t *stats);
+#endif // !GATEWAY_H
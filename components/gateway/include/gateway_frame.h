@@ -0,0 +1,86 @@
+/**
+ * @file gateway_frame.h
+ * @brief Frames of windows sent by a leaf to its gateway.
+ *
+ * | version (1) | leaf MAC (6) | count (1) | count * record (8) |
+ *
+ * Every record is the age of the window in seconds followed by eCO2 and
+ * TVOC, little endian. Leaves may not have synchronized their clock, the
+ * gateway stamps the windows with its own time minus their age.
+ */
+#ifndef GATEWAY_FRAME_H
+#define GATEWAY_FRAME_H
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "esp_err.h"
+#include "gateway_link.h"
+#include "sgp30_types.h"
+
+/**
+ * @brief Version of the frame layout.
+ */
+#define GATEWAY_FRAME_VERSION 1
+
+/**
+ * @brief Bytes before the records.
+ */
+#define GATEWAY_FRAME_HEADER_LEN 8
+
+/**
+ * @brief Bytes of every record.
+ */
+#define GATEWAY_FRAME_RECORD_LEN 8
+
+/**
+ * @brief Most records in a frame.
+ */
+#define GATEWAY_FRAME_MAX_RECORDS \
+    ((GATEWAY_LINK_MAX_FRAME_LEN - GATEWAY_FRAME_HEADER_LEN) / GATEWAY_FRAME_RECORD_LEN)
+
+/**
+ * @brief Encode windows into a frame.
+ *
+ * @param mac Station MAC of the leaf.
+ * @param m Array of timed measurements.
+ * @param n Number of timed measurements, at most GATEWAY_FRAME_MAX_RECORDS.
+ * @param now Current time of the leaf.
+ * @param buf Buffer of at least GATEWAY_LINK_MAX_FRAME_LEN bytes.
+ * @param out_len Length of the frame.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_SIZE: too many windows
+ */
+esp_err_t gateway_frame_encode(
+    const uint8_t mac[6],
+    const sgp30_timed_measurement_t *m,
+    size_t n,
+    time_t now,
+    uint8_t *buf,
+    size_t *out_len
+);
+
+/**
+ * @brief Check a received frame and get its leaf and number of records.
+ *
+ * @param data Frame.
+ * @param len Length of the frame.
+ * @param mac Where the station MAC of the leaf will be copied.
+ * @param n Number of records.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_VERSION: unknown layout
+ * - ESP_ERR_INVALID_SIZE: the length does not match the records
+ */
+esp_err_t gateway_frame_decode(const uint8_t *data, size_t len, uint8_t mac[6], size_t *n);
+
+/**
+ * @brief Get a record of a frame checked with gateway_frame_decode.
+ *
+ * @param data Frame.
+ * @param i Index of the record.
+ * @param now Current time of the gateway.
+ * @param m Where the timed measurement will be written.
+ */
+void gateway_frame_record(const uint8_t *data, size_t i, time_t now, sgp30_timed_measurement_t *m);
+#endif // !GATEWAY_FRAME_H
@@ -0,0 +1,57 @@
+/**
+ * @file gateway_link.h
+ * @brief Local link between leaves and their gateway.
+ *
+ * A link carries frames of up to GATEWAY_LINK_MAX_FRAME_LEN bytes between
+ * the nodes of a room. The callbacks may be called from any task, usually
+ * the Wi-Fi task, so they must not block.
+ */
+#ifndef GATEWAY_LINK_H
+#define GATEWAY_LINK_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief Largest frame every link carries, the ESP-NOW payload limit.
+ */
+#define GATEWAY_LINK_MAX_FRAME_LEN 250
+
+/**
+ * @brief Called with every received frame.
+ */
+typedef void (*gateway_link_recv_cb_t)(const uint8_t *data, size_t len);
+
+/**
+ * @brief Called once per sent frame with its delivery status.
+ */
+typedef void (*gateway_link_sent_cb_t)(bool delivered);
+
+/**
+ * @brief Link operations.
+ */
+typedef struct {
+    const char *name; /*!< Name for the logs */
+    /**
+     * @brief Start the link, the radio has to be started already.
+     */
+    esp_err_t (*open)(gateway_link_recv_cb_t on_recv, gateway_link_sent_cb_t on_sent);
+    /**
+     * @brief Send a frame to the gateway, on_sent reports whether it arrived.
+     */
+    esp_err_t (*send)(const uint8_t *data, size_t len);
+} gateway_link_t;
+
+/**
+ * @brief ESP-NOW on channel CONFIG_GATEWAY_ESPNOW_CHANNEL, frames are sent
+ * to CONFIG_GATEWAY_ESPNOW_PEER.
+ */
+extern const gateway_link_t gateway_link_espnow;
+
+/**
+ * @brief Delivers every sent frame to the receive callback of the same
+ * node, to run a leaf and a gateway in one process on the host.
+ */
+extern const gateway_link_t gateway_link_loopback;
+#endif // !GATEWAY_LINK_H
@@ -0,0 +1,55 @@
+/**
+ * @file json_structures.h
+ * @brief ThingsBoard JSON representations of the sgp30 structures.
+ */
+#ifndef JSON_STRUCTURES_H
+#define JSON_STRUCTURES_H
+#include <stddef.h>
+#include "esp_err.h"
+#include "sgp30_types.h"
+
+/**
+ * @brief Upper bound of the JSON representation of one timed measurement.
+ *
+ * {"ts":<20 digits>,"values":{"eCO2":<5 digits>,"TVOC":<5 digits>}}
+ */
+#define JSON_STRUCTURES_TIMED_MEASUREMENT_MAX_LEN 72
+
+/**
+ * @brief Write a timed measurement as a ThingsBoard ts/values object.
+ *
+ * The timestamp is written in milliseconds as ThingsBoard expects.
+ *
+ * @param buf Buffer where the object will be written, may be NULL to only
+ * compute the length.
+ * @param buf_len Size of buf.
+ * @param m Timed measurement to write.
+ * @return Number of characters of the object, excluding the null byte.
+ */
+size_t json_structures_write_timed_measurement(
+    char *buf,
+    size_t buf_len,
+    const sgp30_timed_measurement_t *m
+);
+
+/**
+ * @brief Write an array of timed measurements as a ThingsBoard telemetry
+ * array payload: [{"ts":...,"values":{...}},...].
+ *
+ * @param m Array of timed measurements.
+ * @param n Number of timed measurements in m.
+ * @param buf Buffer where the payload will be written.
+ * @param buf_len Size of buf.
+ * @param out_len Length of the written payload, excluding the null byte.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_SIZE: buf is too small for the payload
+ */
+esp_err_t json_structures_write_timed_measurement_array(
+    const sgp30_timed_measurement_t *m,
+    size_t n,
+    char *buf,
+    size_t buf_len,
+    size_t *out_len
+);
+#endif // !JSON_STRUCTURES_H
@@ -0,0 +1,67 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include "esp_err.h"
+#include "json_structures.h"
+#include "sgp30_types.h"
+
+size_t json_structures_write_timed_measurement(
+    char *buf,
+    size_t buf_len,
+    const sgp30_timed_measurement_t *m
+)
+{
+    int written = snprintf(
+        buf,
+        buf_len,
+        "{\"ts\":%" PRId64 ",\"values\":{\"eCO2\":%" PRIu16 ",\"TVOC\":%" PRIu16 "}}",
+        (int64_t)m->time * 1000,
+        m->measurement.eCO2,
+        m->measurement.TVOC
+    );
+    return (written < 0) ? 0 : (size_t)written;
+}
+
+esp_err_t json_structures_write_timed_measurement_array(
+    const sgp30_timed_measurement_t *m,
+    size_t n,
+    char *buf,
+    size_t buf_len,
+    size_t *out_len
+)
+{
+    size_t len = 0;
+
+    /* Opening bracket, closing bracket and null byte are always needed*/
+    if (buf_len < 3)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    buf[len++] = '[';
+    for (size_t i = 0; i < n; i++)
+    {
+        if (i > 0)
+        {
+            if (len + 2 >= buf_len)
+            {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            buf[len++] = ',';
+        }
+        /* Keep room for the closing bracket*/
+        size_t room = buf_len - len - 1;
+        size_t written = json_structures_write_timed_measurement(
+            buf + len,
+            room,
+            &m[i]
+        );
+        if (written >= room)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        len += written;
+    }
+    buf[len++] = ']';
+    buf[len] = '\0';
+    *out_len = len;
+    return ESP_OK;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file link_manager.h
+ * @brief Decides when Wi-Fi and MQTT are up.
+ *
+ * With LINK_MANAGER_ALWAYS_ON the link stays up as before. With
+ * LINK_MANAGER_ON_DEMAND the radio is off between uploads: the link is
+ * brought up by link_manager_request, and torn down once the uplink
+ * transport and the pending payloads are acknowledged and
+ * CONFIG_LINK_MANAGER_LINGER_MS have passed. Every function has to be called from the event loop given to
+ * link_manager_init.
+ */
+#ifndef LINK_MANAGER_H
+#define LINK_MANAGER_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+ESP_EVENT_DECLARE_BASE(LINK_MANAGER_EVENT);
+
+/**
+ * @brief Link manager event IDs.
+ */
+typedef enum {
+    LINK_MANAGER_EVENT_GOT_IP,  /*!< The station got an address */
+    LINK_MANAGER_EVENT_LINGER,  /*!< Nothing was pending for CONFIG_LINK_MANAGER_LINGER_MS */
+    LINK_MANAGER_EVENT_TIMEOUT, /*!< The link was up for CONFIG_LINK_MANAGER_MAX_ON_S */
+    LINK_MANAGER_EVENT_HOUR,    /*!< Report of the radio time of the last hour */
+} link_manager_event_id_t;
+
+/**
+ * @brief Connection policy.
+ */
+typedef enum {
+    LINK_MANAGER_ALWAYS_ON, /*!< Wi-Fi and MQTT stay up */
+    LINK_MANAGER_ON_DEMAND, /*!< Wi-Fi and MQTT are up only to upload */
+} link_manager_policy_t;
+
+/**
+ * @brief Counts payloads not acknowledged yet outside the uplink transport.
+ */
+typedef size_t (*link_manager_pending_cb_t)(void);
+
+/**
+ * @brief Link metrics since boot.
+ */
+typedef struct {
+    link_manager_policy_t policy; /*!< Current policy */
+    bool up;                      /*!< Wi-Fi and MQTT are up or coming up */
+    uint32_t connects;            /*!< Times the link was brought up again */
+    uint32_t timeouts;            /*!< Uploads cut by CONFIG_LINK_MANAGER_MAX_ON_S */
+    uint64_t radio_on_us;         /*!< Time the radio was on */
+    uint32_t last_hour_on_s;      /*!< Radio time in the last complete hour */
+} link_manager_stats_t;
+
+/**
+ * @brief Initialize the link manager, the link is considered up.
+ *
+ * @param loop Event loop where the broker events are posted.
+ * @param pending Payloads still to be acknowledged besides the uplink
+ * transport, it can be NULL.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: Failure
+ */
+esp_err_t link_manager_init(esp_event_loop_handle_t loop, link_manager_pending_cb_t pending);
+
+/**
+ * @brief Bring the link up to upload, if it is down.
+ *
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: the radio could not be started
+ */
+esp_err_t link_manager_request(void);
+
+/**
+ * @brief Change the connection policy.
+ *
+ * Switching to LINK_MANAGER_ALWAYS_ON brings the link up.
+ *
+ * @param policy New policy.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: unknown policy
+ * - ESP_ERR_NOT_SUPPORTED: LINK_MANAGER_ON_DEMAND on a gateway
+ * - some other error code: the radio could not be started
+ */
+esp_err_t link_manager_set_policy(link_manager_policy_t policy);
+
+/**
+ * @brief Check if the link is wanted up, a lost Wi-Fi connection is only
+ * retried while it is. It can be called from any task.
+ */
+bool link_manager_is_up(void);
+
+/**
+ * @brief Get the link metrics.
+ *
+ * @param stats Where the metrics are copied.
+ */
+void link_manager_get_stats(link_manager_stats_t *stats);
+#endif // !LINK_MANAGER_H
@@ -0,0 +1,344 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "link_manager.h"
+#include "mqtt_controller.h"
+#include "uplink.h"
+
+#define HOUR_US (3600LL * 1000000)
+
+static const char *TAG = "link_manager";
+
+ESP_EVENT_DEFINE_BASE(LINK_MANAGER_EVENT);
+
+static esp_event_loop_handle_t link_event_loop;
+static link_manager_pending_cb_t link_pending;
+static esp_timer_handle_t link_linger_timer;
+static esp_timer_handle_t link_timeout_timer;
+static esp_timer_handle_t link_hour_timer;
+static link_manager_stats_t link_stats = {
+#if CONFIG_LINK_MANAGER_ON_DEMAND
+    .policy = LINK_MANAGER_ON_DEMAND,
+#else
+    .policy = LINK_MANAGER_ALWAYS_ON,
+#endif
+};
+static int64_t link_up_since;
+static uint64_t link_hour_mark_us;
+static bool link_connected;
+static bool link_mqtt_stopped;
+
+static void link_timer_callback(void *args)
+{
+    /* Posted with no wait, link_check_idle arms a dropped linger again*/
+    esp_event_post_to(link_event_loop, LINK_MANAGER_EVENT, (int32_t)(intptr_t)args, NULL, 0, 0);
+}
+
+static void link_on_got_ip_default_loop(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    esp_event_post_to(link_event_loop, LINK_MANAGER_EVENT, LINK_MANAGER_EVENT_GOT_IP, NULL, 0, 0);
+}
+
+static uint64_t link_radio_on_us(void)
+{
+    return link_stats.radio_on_us + (link_stats.up ? esp_timer_get_time() - link_up_since : 0);
+}
+
+static bool link_idle(void)
+{
+    return uplink_pending() == 0 && (link_pending == NULL || link_pending() == 0);
+}
+
+static esp_err_t link_up(void)
+{
+    ESP_RETURN_ON_ERROR(esp_wifi_start(), TAG, "Could not start Wi-Fi");
+    link_stats.up = true;
+    link_stats.connects++;
+    link_up_since = esp_timer_get_time();
+    if (link_stats.policy == LINK_MANAGER_ON_DEMAND)
+    {
+        esp_timer_start_once(link_timeout_timer, ((uint64_t)CONFIG_LINK_MANAGER_MAX_ON_S) * 1000000);
+    }
+    ESP_LOGI(TAG, "Link up");
+    /* MQTT is started once the station has an address*/
+    return ESP_OK;
+}
+
+static void link_down(void)
+{
+    int64_t up_us = esp_timer_get_time() - link_up_since;
+
+    if (esp_timer_is_active(link_linger_timer))
+    {
+        esp_timer_stop(link_linger_timer);
+    }
+    if (esp_timer_is_active(link_timeout_timer))
+    {
+        esp_timer_stop(link_timeout_timer);
+    }
+    /* Cleared first so the Wi-Fi disconnection is not retried*/
+    link_stats.up = false;
+    link_stats.radio_on_us += up_us;
+    if (!link_mqtt_stopped && mqtt_stop() == ESP_OK)
+    {
+        link_mqtt_stopped = true;
+    }
+    if (esp_wifi_stop() != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not stop Wi-Fi");
+    }
+    ESP_LOGI(TAG, "Link down after %d ms", (int)(up_us / 1000));
+}
+
+static void link_check_idle(void)
+{
+    if (link_stats.policy != LINK_MANAGER_ON_DEMAND || !link_stats.up || !link_connected
+        || esp_timer_is_active(link_linger_timer) || !link_idle())
+    {
+        return;
+    }
+    esp_timer_start_once(link_linger_timer, ((uint64_t)CONFIG_LINK_MANAGER_LINGER_MS) * 1000);
+}
+
+static void link_on_got_ip(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    if (link_stats.up && link_mqtt_stopped && mqtt_start() == ESP_OK)
+    {
+        link_mqtt_stopped = false;
+    }
+}
+
+static void link_on_linger(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    if (link_stats.policy == LINK_MANAGER_ON_DEMAND && link_stats.up && link_idle())
+    {
+        link_down();
+    }
+}
+
+static void link_on_timeout(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    if (link_stats.policy != LINK_MANAGER_ON_DEMAND || !link_stats.up)
+    {
+        return;
+    }
+    link_stats.timeouts++;
+    ESP_LOGW(TAG, "Upload not completed in %d s, retrying on the next one", CONFIG_LINK_MANAGER_MAX_ON_S);
+    link_down();
+}
+
+static void link_on_hour(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    uint64_t radio_on_us = link_radio_on_us();
+
+    link_stats.last_hour_on_s = (radio_on_us - link_hour_mark_us) / 1000000;
+    link_hour_mark_us = radio_on_us;
+    ESP_LOGI(TAG, "Radio on %" PRIu32 " s in the last hour", link_stats.last_hour_on_s);
+}
+
+static void link_on_connected(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    link_connected = true;
+    link_check_idle();
+}
+
+static void link_on_disconnected(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    link_connected = false;
+}
+
+static void link_on_delivered(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    link_check_idle();
+}
+
+static const mqtt_thingsboard_event_handler_register_t link_mqtt_events[] = {
+    { MQTT_BROKER_CONNECTED, link_on_connected },
+    { MQTT_BROKER_DISCONNECTED, link_on_disconnected },
+    { MQTT_OUTBOX_DELIVERED, link_on_delivered },
+};
+
+static const size_t link_mqtt_events_len =
+    sizeof(link_mqtt_events) / sizeof(link_mqtt_events[0]);
+
+static const struct {
+    link_manager_event_id_t event_id;
+    esp_event_handler_t event_handler;
+} link_events[] = {
+    { LINK_MANAGER_EVENT_GOT_IP, link_on_got_ip },
+    { LINK_MANAGER_EVENT_LINGER, link_on_linger },
+    { LINK_MANAGER_EVENT_TIMEOUT, link_on_timeout },
+    { LINK_MANAGER_EVENT_HOUR, link_on_hour },
+};
+
+static const size_t link_events_len = sizeof(link_events) / sizeof(link_events[0]);
+
+static esp_err_t link_create_timer(const char *name, link_manager_event_id_t event_id, esp_timer_handle_t *timer)
+{
+    esp_timer_create_args_t timer_args = {
+        .callback = link_timer_callback,
+        .arg = (void *)(intptr_t)event_id,
+        .name = name,
+    };
+    return esp_timer_create(&timer_args, timer);
+}
+
+esp_err_t link_manager_init(esp_event_loop_handle_t loop, link_manager_pending_cb_t pending)
+{
+    link_event_loop = loop;
+    link_pending = pending;
+    link_stats.up = true;
+    link_up_since = esp_timer_get_time();
+
+    ESP_RETURN_ON_ERROR(
+        link_create_timer("link_linger", LINK_MANAGER_EVENT_LINGER, &link_linger_timer),
+        TAG,
+        "Could not create linger timer"
+    );
+    ESP_RETURN_ON_ERROR(
+        link_create_timer("link_timeout", LINK_MANAGER_EVENT_TIMEOUT, &link_timeout_timer),
+        TAG,
+        "Could not create timeout timer"
+    );
+    ESP_RETURN_ON_ERROR(
+        link_create_timer("link_hour", LINK_MANAGER_EVENT_HOUR, &link_hour_timer),
+        TAG,
+        "Could not create hour timer"
+    );
+    ESP_RETURN_ON_ERROR(esp_timer_start_periodic(link_hour_timer, HOUR_US), TAG, "Could not start hour timer");
+
+    for (int i = 0; i < link_events_len; i++)
+    {
+        ESP_RETURN_ON_ERROR(
+            esp_event_handler_register_with(
+                link_event_loop,
+                LINK_MANAGER_EVENT,
+                link_events[i].event_id,
+                link_events[i].event_handler,
+                NULL
+            ),
+            TAG,
+            "Could not register handler %d",
+            link_events[i].event_id
+        );
+    }
+    for (int i = 0; i < link_mqtt_events_len; i++)
+    {
+        ESP_RETURN_ON_ERROR(
+            esp_event_handler_register_with(
+                link_event_loop,
+                MQTT_THINGSBOARD_EVENT,
+                link_mqtt_events[i].event_id,
+                link_mqtt_events[i].event_handler,
+                NULL
+            ),
+            TAG,
+            "Could not register handler %d",
+            link_mqtt_events[i].event_id
+        );
+    }
+    ESP_RETURN_ON_ERROR(
+        esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, link_on_got_ip_default_loop, NULL),
+        TAG,
+        "Could not register IP handler"
+    );
+    ESP_LOGI(TAG, "Connecting %s", link_stats.policy == LINK_MANAGER_ON_DEMAND ? "on demand" : "always");
+    return ESP_OK;
+}
+
+esp_err_t link_manager_request(void)
+{
+    if (link_stats.up)
+    {
+        return ESP_OK;
+    }
+    return link_up();
+}
+
+esp_err_t link_manager_set_policy(link_manager_policy_t policy)
+{
+    if (policy != LINK_MANAGER_ALWAYS_ON && policy != LINK_MANAGER_ON_DEMAND)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+#if CONFIG_GATEWAY_ROLE_GATEWAY
+    /* The gateway has to listen to its leaves all the time*/
+    if (policy == LINK_MANAGER_ON_DEMAND)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+    if (policy == link_stats.policy)
+    {
+        return ESP_OK;
+    }
+    link_stats.policy = policy;
+    ESP_LOGI(TAG, "Connecting %s", policy == LINK_MANAGER_ON_DEMAND ? "on demand" : "always");
+    if (policy == LINK_MANAGER_ALWAYS_ON)
+    {
+        if (esp_timer_is_active(link_timeout_timer))
+        {
+            esp_timer_stop(link_timeout_timer);
+        }
+        return link_manager_request();
+    }
+    link_check_idle();
+    return ESP_OK;
+}
+
+bool link_manager_is_up(void)
+{
+    return link_stats.up;
+}
+
+void link_manager_get_stats(link_manager_stats_t *stats)
+{
+    *stats = link_stats;
+    stats->radio_on_us = link_radio_on_us();
+}
@@ -0,0 +1,147 @@
+/**
+ * @file measurement_history.h
+ * @brief Time series of the measurements on a flash partition.
+ *
+ * Measurements are appended as fixed size records to a circular log, so
+ * every sector is erased once per turn of the partition. Every sector
+ * starts with a header holding the sequence number and time of its first
+ * record, which is the index kept in RAM: a time range is found from the
+ * index and only the sectors it covers are read. Acknowledged records are
+ * truncated, and the oldest ones are overwritten when the partition is
+ * full. A record torn by a reset fails its CRC and is skipped.
+ *
+ * It is not thread safe, every call has to come from the same task.
+ */
+#ifndef MEASUREMENT_HISTORY_H
+#define MEASUREMENT_HISTORY_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "esp_err.h"
+#include "sgp30_types.h"
+
+/**
+ * @brief Bytes of a record on flash.
+ */
+#define MEASUREMENT_HISTORY_RECORD_SIZE 12
+
+/**
+ * @brief Records an iterator reads from flash at a time.
+ */
+#define MEASUREMENT_HISTORY_READ_AHEAD 16
+
+/**
+ * @brief Stored measurement.
+ */
+typedef struct {
+    uint32_t seq;                          /*!< Sequence number */
+    sgp30_timed_measurement_t measurement; /*!< Measurement and time, in seconds */
+} measurement_history_record_t;
+
+/**
+ * @brief Iterator over a time range, see measurement_history_iter_init.
+ */
+typedef struct {
+    uint32_t seq;      /*!< Next record */
+    uint32_t end_seq;  /*!< First record not covered */
+    time_t from;       /*!< Start of the range, inclusive */
+    time_t to;         /*!< End of the range, exclusive */
+    size_t cached;     /*!< Records read ahead */
+    size_t next;       /*!< Next of them */
+    uint8_t cache[MEASUREMENT_HISTORY_READ_AHEAD * MEASUREMENT_HISTORY_RECORD_SIZE]; /*!< Read ahead records */
+} measurement_history_iter_t;
+
+/**
+ * @brief Metrics since boot.
+ */
+typedef struct {
+    uint32_t records;     /*!< Records not truncated */
+    uint32_t first_seq;   /*!< Oldest record not truncated */
+    uint32_t next_seq;    /*!< Sequence number of the next record */
+    uint32_t appends;     /*!< Records appended */
+    uint32_t dropped;     /*!< Unacknowledged records overwritten */
+    uint32_t corrupt;     /*!< Records skipped for a wrong CRC */
+    uint32_t erases;      /*!< Sectors erased */
+    uint32_t min_wear;    /*!< Fewest erases of a sector */
+    uint32_t max_wear;    /*!< Most erases of a sector */
+    uint64_t read_bytes;  /*!< Bytes read from flash */
+} measurement_history_stats_t;
+
+/**
+ * @brief Recover the log from the partition.
+ *
+ * @return
+ *   - ESP_OK: Success
+ *   - ESP_ERR_NOT_FOUND: There is no history partition
+ *   - ESP_ERR_INVALID_SIZE: The partition has less than two sectors
+ */
+esp_err_t measurement_history_init(void);
+
+/**
+ * @brief Append a measurement.
+ *
+ * Constant time, the sector after a full one is erased first, dropping the
+ * records it held.
+ *
+ * @param measurement Measurement and its time, from 1970 to 2106.
+ * @param seq Where the sequence number of the record is written, can be NULL.
+ * @return
+ *   - ESP_OK: Success
+ *   - ESP_ERR_INVALID_STATE: Not initialized
+ *   - Others: The flash could not be written
+ */
+esp_err_t measurement_history_append(const sgp30_timed_measurement_t *measurement, uint32_t *seq);
+
+/**
+ * @brief Start iterating over the records of a time range, oldest first.
+ *
+ * The range is found assuming the times do not go backwards, records out
+ * of order near its ends may be missed.
+ *
+ * @param iter Iterator to set up.
+ * @param from Start of the range, inclusive.
+ * @param to End of the range, exclusive.
+ * @return
+ *   - ESP_OK: Success
+ *   - ESP_ERR_INVALID_STATE: Not initialized
+ */
+esp_err_t measurement_history_iter_init(measurement_history_iter_t *iter, time_t from, time_t to);
+
+/**
+ * @brief Read the next record of the range.
+ *
+ * Appends do not invalidate the iterator, records overwritten meanwhile are
+ * skipped.
+ *
+ * @param iter Iterator.
+ * @param record Where the record is written.
+ * @return
+ *   - ESP_OK: Success
+ *   - ESP_ERR_NOT_FOUND: No more records in the range
+ *   - Others: The flash could not be read
+ */
+esp_err_t measurement_history_iter_next(measurement_history_iter_t *iter, measurement_history_record_t *record);
+
+/**
+ * @brief Drop the records up to an acknowledged one.
+ *
+ * The truncation is kept in the header of the sector of the record, up to
+ * a few times per sector. Past that it only holds until the next reset,
+ * after which the records are iterated again.
+ *
+ * @param acked_seq Sequence number of the last acknowledged record.
+ * @return
+ *   - ESP_OK: Success
+ *   - ESP_ERR_INVALID_STATE: Not initialized
+ *   - ESP_ERR_INVALID_ARG: acked_seq was not appended yet
+ */
+esp_err_t measurement_history_truncate(uint32_t acked_seq);
+
+/**
+ * @brief Get the metrics.
+ *
+ * @param stats Where the metrics are copied.
+ */
+void measurement_history_get_stats(measurement_history_stats_t *stats);
+#endif // !MEASUREMENT_HISTORY_H
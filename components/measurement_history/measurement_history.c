@@ -0,0 +1,482 @@
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "measurement_history.h"
+
+#define HISTORY_PARTITION_SUBTYPE 0x42
+#define HISTORY_SECTOR_MAGIC      0x54534948 /* "HIST"*/
+#define HISTORY_ACK_MARKS         7
+#define HISTORY_ERASED_WORD       0xFFFFFFFF
+
+static const char *TAG = "measurement_history";
+
+/* Written in one go when the sector is taken, but the truncation marks,
+ each written later over its erased word*/
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t erase_count;
+    uint32_t first_seq;
+    uint32_t first_time;
+    uint32_t crc; /* Of erase_count, first_seq and first_time*/
+    uint32_t acked[HISTORY_ACK_MARKS];
+} history_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t time;
+    uint16_t eCO2;
+    uint16_t TVOC;
+    uint32_t crc; /* Of the sequence number, time and values*/
+} history_record_t;
+
+_Static_assert(sizeof(history_record_t) == MEASUREMENT_HISTORY_RECORD_SIZE, "Record size");
+
+/* The index, one entry per sector*/
+typedef struct {
+    uint32_t first_seq;
+    uint32_t first_time;
+    uint32_t erase_count;
+    uint16_t count; /* Slots written, torn ones too*/
+    uint8_t marks;  /* Truncation marks written*/
+    bool used;      /* The header is valid*/
+} history_sector_t;
+
+static const esp_partition_t *history_partition;
+static history_sector_t *history_index;
+static uint32_t history_sectors;
+static uint32_t history_slots; /* Records per sector*/
+static uint32_t history_oldest; /* Sector of the oldest record*/
+static uint32_t history_head;   /* Sector written*/
+static uint32_t history_live;   /* Sectors from history_oldest to history_head, 0 if none*/
+static uint32_t history_first_seq; /* Oldest record not truncated*/
+static uint32_t history_next_seq;
+static measurement_history_stats_t history_stats;
+
+static uint32_t history_sector_offset(uint32_t sector)
+{
+    return sector * history_partition->erase_size;
+}
+
+static uint32_t history_slot_offset(uint32_t sector, uint32_t slot)
+{
+    return history_sector_offset(sector) + sizeof(history_header_t) + slot * sizeof(history_record_t);
+}
+
+static esp_err_t history_read(uint32_t offset, void *dst, size_t len)
+{
+    history_stats.read_bytes += len;
+    return esp_partition_read(history_partition, offset, dst, len);
+}
+
+static uint32_t history_header_crc(const history_header_t *header)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)&header->erase_count, 3 * sizeof(uint32_t));
+}
+
+static uint32_t history_record_crc(uint32_t seq, const history_record_t *record)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&seq, sizeof(seq));
+    return esp_rom_crc32_le(crc, (const uint8_t *)record, offsetof(history_record_t, crc));
+}
+
+static bool history_record_erased(const history_record_t *record)
+{
+    const uint8_t *bytes = (const uint8_t *)record;
+    for (size_t i = 0; i < sizeof(*record); i++)
+    {
+        if (bytes[i] != 0xFF)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Sector of the live position, 0 being the oldest*/
+static uint32_t history_position(uint32_t position)
+{
+    return (history_oldest + position) % history_sectors;
+}
+
+/* Slots are written in order, a torn one is not erased either, so the
+ first erased slot is found by bisection*/
+static uint16_t history_count_slots(uint32_t sector)
+{
+    history_record_t record;
+    uint32_t low = 0;
+    uint32_t high = history_slots;
+
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (history_read(history_slot_offset(sector, mid), &record, sizeof(record)) == ESP_OK
+            && history_record_erased(&record))
+        {
+            high = mid;
+        }
+        else
+        {
+            low = mid + 1;
+        }
+    }
+    return low;
+}
+
+/* Live position of the last sector whose first sequence number, or first
+ time, is not after value. 0 if there is none*/
+static uint32_t history_search(uint32_t value, bool by_time)
+{
+    uint32_t low = 0;
+    uint32_t high = history_live;
+
+    while (high - low > 1)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        const history_sector_t *entry = &history_index[history_position(mid)];
+        if ((by_time ? entry->first_time : entry->first_seq) <= value)
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static esp_err_t history_recover(void)
+{
+    history_header_t header;
+    bool found = false;
+    uint32_t acked_max = 0;
+
+    history_live = 0;
+    history_next_seq = 1;
+    for (uint32_t sector = 0; sector < history_sectors; sector++)
+    {
+        history_sector_t *entry = &history_index[sector];
+
+        memset(entry, 0, sizeof(*entry));
+        if (history_read(history_sector_offset(sector), &header, sizeof(header)) != ESP_OK
+            || header.magic != HISTORY_SECTOR_MAGIC)
+        {
+            continue;
+        }
+        /* A torn header still tells the wear*/
+        entry->erase_count = header.erase_count == HISTORY_ERASED_WORD ? 0 : header.erase_count;
+        if (header.crc != history_header_crc(&header))
+        {
+            continue;
+        }
+        entry->used = true;
+        entry->first_seq = header.first_seq;
+        entry->first_time = header.first_time;
+        entry->count = history_count_slots(sector);
+        while (entry->marks < HISTORY_ACK_MARKS && header.acked[entry->marks] != HISTORY_ERASED_WORD)
+        {
+            if (header.acked[entry->marks] > acked_max)
+            {
+                acked_max = header.acked[entry->marks];
+            }
+            entry->marks++;
+        }
+        if (!found || entry->first_seq > history_index[history_head].first_seq)
+        {
+            history_head = sector;
+        }
+        if (!found || entry->first_seq < history_index[history_oldest].first_seq)
+        {
+            history_oldest = sector;
+        }
+        found = true;
+    }
+
+    if (found)
+    {
+        const history_sector_t *head = &history_index[history_head];
+        history_live = (history_head + history_sectors - history_oldest) % history_sectors + 1;
+        history_next_seq = head->first_seq + head->count;
+        history_first_seq = history_index[history_oldest].first_seq;
+    }
+    else
+    {
+        history_first_seq = history_next_seq;
+    }
+    if (acked_max >= history_first_seq && acked_max < history_next_seq)
+    {
+        history_first_seq = acked_max + 1;
+    }
+    ESP_LOGI(
+        TAG,
+        "Recovered %" PRIu32 " records in %" PRIu32 " sectors, next sequence %" PRIu32,
+        history_next_seq - history_first_seq,
+        history_live,
+        history_next_seq
+    );
+    return ESP_OK;
+}
+
+/* Erase the sector after the head and start it with the next record,
+ dropping the oldest sector when it is the one taken*/
+static esp_err_t history_open_sector(uint32_t time)
+{
+    uint32_t sector = history_live == 0 ? 0 : (history_head + 1) % history_sectors;
+    history_sector_t *entry = &history_index[sector];
+
+    if (history_live > 0 && sector == history_oldest)
+    {
+        uint32_t end_seq = entry->first_seq + entry->count;
+        if (end_seq > history_first_seq)
+        {
+            uint32_t dropped = end_seq - history_first_seq;
+            history_stats.dropped += dropped;
+            ESP_LOGW(TAG, "History full, dropped %" PRIu32 " unacknowledged records", dropped);
+            history_first_seq = end_seq;
+        }
+        history_oldest = (history_oldest + 1) % history_sectors;
+        history_live--;
+    }
+
+    entry->used = false;
+    ESP_RETURN_ON_ERROR(
+        esp_partition_erase_range(history_partition, history_sector_offset(sector), history_partition->erase_size),
+        TAG,
+        "Could not erase sector %" PRIu32,
+        sector
+    );
+    history_stats.erases++;
+    entry->erase_count++;
+
+    history_header_t header;
+    memset(&header, 0xFF, sizeof(header));
+    header.magic = HISTORY_SECTOR_MAGIC;
+    header.erase_count = entry->erase_count;
+    header.first_seq = history_next_seq;
+    header.first_time = time;
+    header.crc = history_header_crc(&header);
+    ESP_RETURN_ON_ERROR(
+        esp_partition_write(history_partition, history_sector_offset(sector), &header, offsetof(history_header_t, acked)),
+        TAG,
+        "Could not write the header of sector %" PRIu32,
+        sector
+    );
+
+    entry->used = true;
+    entry->first_seq = history_next_seq;
+    entry->first_time = time;
+    entry->count = 0;
+    entry->marks = 0;
+    if (history_live == 0)
+    {
+        history_oldest = sector;
+        history_first_seq = history_next_seq;
+    }
+    history_head = sector;
+    history_live++;
+    return ESP_OK;
+}
+
+esp_err_t measurement_history_init(void)
+{
+    history_partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA,
+        HISTORY_PARTITION_SUBTYPE,
+        CONFIG_MEASUREMENT_HISTORY_PARTITION_LABEL
+    );
+    if (history_partition == NULL)
+    {
+        ESP_LOGE(TAG, "No %s partition", CONFIG_MEASUREMENT_HISTORY_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    history_sectors = history_partition->size / history_partition->erase_size;
+    if (history_sectors < 2)
+    {
+        ESP_LOGE(TAG, "The partition needs at least two sectors");
+        history_partition = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    history_slots = (history_partition->erase_size - sizeof(history_header_t)) / sizeof(history_record_t);
+
+    free(history_index);
+    history_index = calloc(history_sectors, sizeof(*history_index));
+    if (history_index == NULL)
+    {
+        history_partition = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    memset(&history_stats, 0, sizeof(history_stats));
+    return history_recover();
+}
+
+esp_err_t measurement_history_append(const sgp30_timed_measurement_t *measurement, uint32_t *seq)
+{
+    ESP_RETURN_ON_FALSE(history_partition != NULL, ESP_ERR_INVALID_STATE, TAG, "Not initialized");
+    uint32_t time = measurement->time < 0 ? 0 : (uint32_t)measurement->time;
+
+    if (history_live == 0 || history_index[history_head].count == history_slots)
+    {
+        ESP_RETURN_ON_ERROR(history_open_sector(time), TAG, "Could not take a sector");
+    }
+
+    history_sector_t *head = &history_index[history_head];
+    history_record_t record = {
+        .time = time,
+        .eCO2 = measurement->measurement.eCO2,
+        .TVOC = measurement->measurement.TVOC,
+    };
+    record.crc = history_record_crc(history_next_seq, &record);
+    esp_err_t err = esp_partition_write(
+        history_partition,
+        history_slot_offset(history_head, head->count),
+        &record,
+        sizeof(record)
+    );
+    /* The slot is taken even if the write failed, so the sequence
+     numbers still follow the slots*/
+    if (seq != NULL)
+    {
+        *seq = history_next_seq;
+    }
+    head->count++;
+    history_next_seq++;
+    history_stats.appends++;
+    return err;
+}
+
+esp_err_t measurement_history_iter_init(measurement_history_iter_t *iter, time_t from, time_t to)
+{
+    ESP_RETURN_ON_FALSE(history_partition != NULL, ESP_ERR_INVALID_STATE, TAG, "Not initialized");
+    memset(iter, 0, sizeof(*iter));
+    iter->from = from;
+    iter->to = to;
+    iter->end_seq = history_next_seq;
+    iter->seq = history_next_seq;
+    if (history_live > 0)
+    {
+        uint32_t start = from < 0 ? 0 : from > UINT32_MAX ? UINT32_MAX : (uint32_t)from;
+        iter->seq = history_index[history_position(history_search(start, true))].first_seq;
+    }
+    return ESP_OK;
+}
+
+esp_err_t measurement_history_iter_next(measurement_history_iter_t *iter, measurement_history_record_t *record)
+{
+    history_record_t *cache = (history_record_t *)iter->cache;
+
+    for (;;)
+    {
+        if (iter->seq < history_first_seq)
+        {
+            /* Truncated or overwritten since*/
+            iter->seq = history_first_seq;
+            iter->cached = 0;
+            iter->next = 0;
+        }
+        if (iter->seq >= iter->end_seq)
+        {
+            return ESP_ERR_NOT_FOUND;
+        }
+        if (iter->next == iter->cached)
+        {
+            uint32_t sector = history_position(history_search(iter->seq, false));
+            const history_sector_t *entry = &history_index[sector];
+            uint32_t slot = iter->seq - entry->first_seq;
+            uint32_t len = entry->count - slot;
+            if (len > MEASUREMENT_HISTORY_READ_AHEAD)
+            {
+                len = MEASUREMENT_HISTORY_READ_AHEAD;
+            }
+            if (len > iter->end_seq - iter->seq)
+            {
+                len = iter->end_seq - iter->seq;
+            }
+            ESP_RETURN_ON_ERROR(
+                history_read(history_slot_offset(sector, slot), cache, len * sizeof(history_record_t)),
+                TAG,
+                "Could not read record %" PRIu32,
+                iter->seq
+            );
+            iter->cached = len;
+            iter->next = 0;
+        }
+
+        const history_record_t *stored = &cache[iter->next++];
+        uint32_t seq = iter->seq++;
+        if (stored->crc != history_record_crc(seq, stored))
+        {
+            history_stats.corrupt++;
+            continue;
+        }
+        if ((time_t)stored->time < iter->from)
+        {
+            continue;
+        }
+        if ((time_t)stored->time >= iter->to)
+        {
+            iter->seq = iter->end_seq;
+            return ESP_ERR_NOT_FOUND;
+        }
+        record->seq = seq;
+        record->measurement.time = stored->time;
+        record->measurement.measurement.eCO2 = stored->eCO2;
+        record->measurement.measurement.TVOC = stored->TVOC;
+        return ESP_OK;
+    }
+}
+
+esp_err_t measurement_history_truncate(uint32_t acked_seq)
+{
+    ESP_RETURN_ON_FALSE(history_partition != NULL, ESP_ERR_INVALID_STATE, TAG, "Not initialized");
+    ESP_RETURN_ON_FALSE(acked_seq < history_next_seq, ESP_ERR_INVALID_ARG, TAG, "Record %" PRIu32 " not appended", acked_seq);
+    if (acked_seq < history_first_seq)
+    {
+        return ESP_OK;
+    }
+    history_first_seq = acked_seq + 1;
+
+    uint32_t sector = history_position(history_search(acked_seq, false));
+    history_sector_t *entry = &history_index[sector];
+    if (entry->marks == HISTORY_ACK_MARKS)
+    {
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(
+        esp_partition_write(
+            history_partition,
+            history_sector_offset(sector) + offsetof(history_header_t, acked) + entry->marks * sizeof(uint32_t),
+            &acked_seq,
+            sizeof(acked_seq)
+        ),
+        TAG,
+        "Could not mark the truncation"
+    );
+    entry->marks++;
+    return ESP_OK;
+}
+
+void measurement_history_get_stats(measurement_history_stats_t *stats)
+{
+    *stats = history_stats;
+    stats->records = history_next_seq - history_first_seq;
+    stats->first_seq = history_first_seq;
+    stats->next_seq = history_next_seq;
+    stats->min_wear = history_sectors > 0 ? UINT32_MAX : 0;
+    stats->max_wear = 0;
+    for (uint32_t sector = 0; sector < history_sectors; sector++)
+    {
+        if (history_index[sector].erase_count < stats->min_wear)
+        {
+            stats->min_wear = history_index[sector].erase_count;
+        }
+        if (history_index[sector].erase_count > stats->max_wear)
+        {
+            stats->max_wear = history_index[sector].erase_count;
+        }
+    }
+}
@@ -0,0 +1,204 @@
+#include <string.h>
+#include "coap_message.h"
+
+#define COAP_VERSION 1
+#define COAP_HEADER_LEN 4
+#define COAP_PAYLOAD_MARKER 0xFF
+/* Option deltas and lengths from 13 and 269 take one and two more bytes*/
+#define COAP_EXTENDED_8 13
+#define COAP_EXTENDED_16 14
+#define COAP_EXTENDED_8_BASE 13
+#define COAP_EXTENDED_16_BASE 269
+
+static void put(coap_writer_t *w, uint8_t byte)
+{
+    if (w->len < w->size)
+    {
+        w->buf[w->len] = byte;
+    }
+    w->len++;
+}
+
+static void put_bytes(coap_writer_t *w, const void *data, size_t len)
+{
+    if (len > 0 && w->len + len <= w->size)
+    {
+        memcpy(&w->buf[w->len], data, len);
+    }
+    w->len += len;
+}
+
+/* Nibble of a delta or length, the extended bytes follow the option header*/
+static uint8_t option_nibble(uint32_t value)
+{
+    if (value < COAP_EXTENDED_8_BASE)
+    {
+        return value;
+    }
+    return value < COAP_EXTENDED_16_BASE ? COAP_EXTENDED_8 : COAP_EXTENDED_16;
+}
+
+static void put_extended(coap_writer_t *w, uint32_t value)
+{
+    if (value >= COAP_EXTENDED_16_BASE)
+    {
+        value -= COAP_EXTENDED_16_BASE;
+        put(w, value >> 8);
+        put(w, value & 0xFF);
+    }
+    else if (value >= COAP_EXTENDED_8_BASE)
+    {
+        put(w, value - COAP_EXTENDED_8_BASE);
+    }
+}
+
+void coap_message_start(
+    coap_writer_t *w,
+    uint8_t *buf,
+    size_t size,
+    coap_type_t type,
+    uint8_t code,
+    uint16_t message_id,
+    const uint8_t *token,
+    size_t token_len
+)
+{
+    *w = (coap_writer_t) {
+        .buf = buf,
+        .size = size,
+    };
+    put(w, (COAP_VERSION << 6) | (type << 4) | token_len);
+    put(w, code);
+    put(w, message_id >> 8);
+    put(w, message_id & 0xFF);
+    put_bytes(w, token, token_len);
+}
+
+void coap_message_add_option(coap_writer_t *w, uint16_t number, const void *value, size_t len)
+{
+    uint32_t delta = number - w->last_option;
+
+    put(w, (option_nibble(delta) << 4) | option_nibble(len));
+    put_extended(w, delta);
+    put_extended(w, len);
+    put_bytes(w, value, len);
+    w->last_option = number;
+}
+
+void coap_message_add_uint_option(coap_writer_t *w, uint16_t number, uint32_t value)
+{
+    uint8_t bytes[4];
+    size_t len = 0;
+
+    /* Big endian without leading zeros, 0 is the empty value*/
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+        if (len > 0 || (value >> shift) & 0xFF)
+        {
+            bytes[len++] = (value >> shift) & 0xFF;
+        }
+    }
+    coap_message_add_option(w, number, bytes, len);
+}
+
+void coap_message_add_path(coap_writer_t *w, const char *path)
+{
+    while (*path != '\0')
+    {
+        const char *end = strchr(path, '/');
+        size_t len = end == NULL ? strlen(path) : (size_t)(end - path);
+        coap_message_add_option(w, COAP_OPTION_URI_PATH, path, len);
+        path += len;
+        if (*path == '/')
+        {
+            path++;
+        }
+    }
+}
+
+esp_err_t coap_message_finish(coap_writer_t *w, const void *payload, size_t payload_len, size_t *out_len)
+{
+    if (payload_len > 0)
+    {
+        put(w, COAP_PAYLOAD_MARKER);
+        put_bytes(w, payload, payload_len);
+    }
+    *out_len = w->len;
+    return w->len <= w->size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+/* Reads the extended delta or length of a nibble, false if truncated or
+ reserved*/
+static bool read_extended(const uint8_t **p, const uint8_t *end, uint8_t nibble, uint32_t *value)
+{
+    if (nibble < COAP_EXTENDED_8)
+    {
+        *value = nibble;
+        return true;
+    }
+    if (nibble == COAP_EXTENDED_8 && end - *p >= 1)
+    {
+        *value = COAP_EXTENDED_8_BASE + (*p)[0];
+        *p += 1;
+        return true;
+    }
+    if (nibble == COAP_EXTENDED_16 && end - *p >= 2)
+    {
+        *value = COAP_EXTENDED_16_BASE + (((*p)[0] << 8) | (*p)[1]);
+        *p += 2;
+        return true;
+    }
+    return false;
+}
+
+esp_err_t coap_message_parse(const uint8_t *data, size_t len, coap_message_t *m)
+{
+    const uint8_t *end = data + len;
+
+    if (len < COAP_HEADER_LEN)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (data[0] >> 6 != COAP_VERSION)
+    {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    *m = (coap_message_t) {
+        .type = (data[0] >> 4) & 0x03,
+        .token_len = data[0] & 0x0F,
+        .code = data[1],
+        .message_id = (data[2] << 8) | data[3],
+    };
+    if (m->token_len > COAP_MAX_TOKEN_LEN || len < COAP_HEADER_LEN + m->token_len)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(m->token, &data[COAP_HEADER_LEN], m->token_len);
+
+    /* Options are skipped, only the payload is used*/
+    const uint8_t *p = &data[COAP_HEADER_LEN + m->token_len];
+    while (p < end && *p != COAP_PAYLOAD_MARKER)
+    {
+        uint8_t header = *p++;
+        uint32_t delta;
+        uint32_t option_len;
+        if (!read_extended(&p, end, header >> 4, &delta)
+            || !read_extended(&p, end, header & 0x0F, &option_len)
+            || (size_t)(end - p) < option_len)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        p += option_len;
+    }
+    if (p < end)
+    {
+        /* A marker without payload is a format error*/
+        if (end - p == 1)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        m->payload = p + 1;
+        m->payload_len = end - p - 1;
+    }
+    return ESP_OK;
+}
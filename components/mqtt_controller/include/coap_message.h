@@ -0,0 +1,149 @@
+/**
+ * @file coap_message.h
+ * @brief CoAP (RFC 7252) messages written into and parsed from caller
+ * buffers, without allocating.
+ */
+#ifndef COAP_MESSAGE_H
+#define COAP_MESSAGE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief Code from its class and detail, 2.05 is COAP_CODE(2, 5).
+ */
+#define COAP_CODE(class, detail) (((class) << 5) | (detail))
+
+/**
+ * @brief Class of a code, 2 for success.
+ */
+#define COAP_CODE_CLASS(code) ((code) >> 5)
+
+#define COAP_CODE_EMPTY COAP_CODE(0, 0)
+#define COAP_CODE_GET COAP_CODE(0, 1)
+#define COAP_CODE_POST COAP_CODE(0, 2)
+
+#define COAP_OPTION_URI_PATH 11
+#define COAP_OPTION_CONTENT_FORMAT 12
+#define COAP_OPTION_URI_QUERY 15
+
+#define COAP_CONTENT_FORMAT_OCTET_STREAM 42
+#define COAP_CONTENT_FORMAT_JSON 50
+#define COAP_CONTENT_FORMAT_CBOR 60
+
+/**
+ * @brief Longest token.
+ */
+#define COAP_MAX_TOKEN_LEN 8
+
+/**
+ * @brief Message types.
+ */
+typedef enum {
+    COAP_TYPE_CON = 0, /*!< Confirmable, acknowledged by the peer */
+    COAP_TYPE_NON = 1, /*!< Non-confirmable */
+    COAP_TYPE_ACK = 2, /*!< Acknowledgement, may carry the response */
+    COAP_TYPE_RST = 3, /*!< Reset, the peer could not process the message */
+} coap_type_t;
+
+/**
+ * @brief Message being written, options have to be added in increasing
+ * option number.
+ */
+typedef struct {
+    uint8_t *buf;         /*!< Where the message is written */
+    size_t size;          /*!< Size of buf */
+    size_t len;           /*!< Bytes written, past size on overflow */
+    uint16_t last_option; /*!< Number of the previous option */
+} coap_writer_t;
+
+/**
+ * @brief Parsed message, pointing into the received datagram.
+ */
+typedef struct {
+    coap_type_t type;                  /*!< Message type */
+    uint8_t code;                      /*!< Request method or response code */
+    uint16_t message_id;               /*!< Matches an ACK or RST with its message */
+    uint8_t token[COAP_MAX_TOKEN_LEN]; /*!< Matches a response with its request */
+    size_t token_len;                  /*!< Length of token */
+    const uint8_t *payload;            /*!< Payload, NULL if there is none */
+    size_t payload_len;                /*!< Length of payload */
+} coap_message_t;
+
+/**
+ * @brief Write the header and token of a message.
+ *
+ * @param w Writer.
+ * @param buf Buffer where the message will be written.
+ * @param size Size of buf.
+ * @param type Message type.
+ * @param code Request method or response code.
+ * @param message_id Message ID.
+ * @param token Token, can be NULL if token_len is 0.
+ * @param token_len Length of token, at most COAP_MAX_TOKEN_LEN.
+ */
+void coap_message_start(
+    coap_writer_t *w,
+    uint8_t *buf,
+    size_t size,
+    coap_type_t type,
+    uint8_t code,
+    uint16_t message_id,
+    const uint8_t *token,
+    size_t token_len
+);
+
+/**
+ * @brief Add an option.
+ *
+ * @param w Writer.
+ * @param number Option number, not lower than the previous one.
+ * @param value Option value.
+ * @param len Length of value.
+ */
+void coap_message_add_option(coap_writer_t *w, uint16_t number, const void *value, size_t len);
+
+/**
+ * @brief Add an option with an unsigned integer value in its shortest form.
+ *
+ * @param w Writer.
+ * @param number Option number, not lower than the previous one.
+ * @param value Option value.
+ */
+void coap_message_add_uint_option(coap_writer_t *w, uint16_t number, uint32_t value);
+
+/**
+ * @brief Add every segment of a path as a Uri-Path option.
+ *
+ * @param w Writer.
+ * @param path Path with its segments separated by '/', without a leading one.
+ */
+void coap_message_add_path(coap_writer_t *w, const char *path);
+
+/**
+ * @brief Write the payload and get the length of the message.
+ *
+ * @param w Writer.
+ * @param payload Payload, can be NULL if payload_len is 0.
+ * @param payload_len Length of payload.
+ * @param out_len Length of the message.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_SIZE: the message does not fit in the buffer
+ */
+esp_err_t coap_message_finish(coap_writer_t *w, const void *payload, size_t payload_len, size_t *out_len);
+
+/**
+ * @brief Parse a received message.
+ *
+ * @param data Datagram.
+ * @param len Length of data.
+ * @param m Parsed message, pointing into data.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_VERSION: not a CoAP version 1 message
+ * - ESP_ERR_INVALID_SIZE: truncated or malformed message
+ */
+esp_err_t coap_message_parse(const uint8_t *data, size_t len, coap_message_t *m);
+#endif // !COAP_MESSAGE_H
@@ -2,17 +2,43 @@
 #define MQTT_CONTROLLER_H
 #include <stdio.h>
 #include <string.h>
-#include "cJSON.h"
 #include "esp_event_base.h"
 #include "mqtt_client.h"
+#include "runtime_config.h"
 #include "thingsboard_types.h"
 
 ESP_EVENT_DECLARE_BASE(MQTT_THINGSBOARD_EVENT);
 
+/**
+ * @brief ThingsBoard device telemetry topic.
+ */
+#define MQTT_TELEMETRY_TOPIC "v1/devices/me/telemetry"
+
+/**
+ * @brief ThingsBoard gateway telemetry topic, for the devices behind this one.
+ */
+#define MQTT_GATEWAY_TELEMETRY_TOPIC "v1/gateway/telemetry"
+
 typedef enum {
-    MQTT_NEW_SEND_TIME,
+    MQTT_RUNTIME_CONFIG_UPDATE, /*!< Shared attributes changed, data is the runtime_config_update_t to apply and report with mqtt_runtime_config_applied */
+    MQTT_BROKER_CONNECTED,    /*!< Session established with the broker */
+    MQTT_BROKER_DISCONNECTED, /*!< Session lost */
+    MQTT_BROKER_PUBACK,       /*!< QoS 1 publish acknowledged, data is the int msg_id */
+    MQTT_BROKER_DELETED,      /*!< QoS 1 publish expired in the client outbox, data is the int msg_id */
+    MQTT_OUTBOX_DELIVERED,    /*!< Outbox message acknowledged, data is the int id given by mqtt_publish_topic */
+    MQTT_OUTBOX_FULL,         /*!< Every outbox slot is taken, publishers should slow down */
+    MQTT_OUTBOX_AVAILABLE,    /*!< The outbox is half empty again after MQTT_OUTBOX_FULL */
+    MQTT_SHARED_ATTRIBUTES_CHANGED, /*!< data is the thingsboard_shared_attributes_t to store for the next start */
 } mqtt_thingsboard_event_t;
 
+/**
+ * @brief MQTT ThingsBoard event handler registration.
+ */
+typedef struct {
+    mqtt_thingsboard_event_t event_id; /*!< Event ID to register the handler for */
+    esp_event_handler_t event_handler; /*!< Event handler function */
+} mqtt_thingsboard_event_handler_register_t;
+
 typedef struct {
     esp_mqtt_event_id_t esp_mqtt_event_id;
     esp_event_handler_t event_handler;
@@ -32,22 +58,24 @@ void log_error_if_nonzero(const char *message, int error_code);
 /*
  * @brief Function to work with the data received from the subscribed topics.
  *
- * @param cSJON *root Root address to connect with.
- * @param char * topic Topic to subscribe.
- * @param size_t len Length of package to receive.
+ * @param const char *data Complete payload of the message, it does not need to be null terminated.
+ * @param size_t data_len Length of data.
+ * @param const char *topic Topic the message was received on.
+ * @param size_t topic_len Length of topic.
  * @return
  */
-void received_data(cJSON *root, char* topic, size_t len);
+void received_data(const char *data, size_t data_len, const char *topic, size_t topic_len);
 
 /*
  * @brief Function to check if the device is being provision with his access token in this case the access token is store
  *
- * @param cSJON *root Root address to connect with.
- * @param char * topic Topic to subscribe.
- * @param size_t len Length of package to receive.
+ * @param const char *data Complete payload of the message, it does not need to be null terminated.
+ * @param size_t data_len Length of data.
+ * @param const char *topic Topic the message was received on.
+ * @param size_t topic_len Length of topic.
  * @return
  */
-bool is_provision(cJSON *root, char* topic, size_t len);
+bool is_provision(const char *data, size_t data_len, const char *topic, size_t topic_len);
 
 /*
  * @brief Event handler registered to receive MQTT events
@@ -73,10 +101,40 @@ void mqtt_provision_task(void *pvParameters);
 /*
  * @brief Function that starts MQTT. 
  *
+ * The shared attributes are the settings registered with runtime_config_init, which has to be called first. The
+ * cached values are posted as one MQTT_RUNTIME_CONFIG_UPDATE before connecting. On connect only the attributes
+ * missing from the cache are requested, or all of them once it is older than CONFIG_MQTT_SHARED_ATTRIBUTES_MAX_AGE.
+ *
  * @param esp_event_loop_handle_t loop. Event handle used for this system. 
  * @param thingsboard_cfg_t *cfg. It includes uri and port information for thingsboard site.
+ * @param const thingsboard_shared_attributes_t *cached_attributes. Last MQTT_SHARED_ATTRIBUTES_CHANGED stored, it can be NULL.
+ */
+esp_err_t mqtt_init(esp_event_loop_handle_t loop, thingsboard_cfg_t *cfg, const thingsboard_shared_attributes_t *cached_attributes);
+
+/*
+ * @brief Function to report the result of applying an MQTT_RUNTIME_CONFIG_UPDATE.
+ *
+ * MQTT_SHARED_ATTRIBUTES_CHANGED is posted to store the settings only when every one of them was applied. The
+ * settings of a failed update are requested again on the next connection.
+ *
+ * @param const runtime_config_update_t *update. Update received with the event.
+ * @param esp_err_t err. Result of runtime_config_apply.
+ */
+void mqtt_runtime_config_applied(const runtime_config_update_t *update, esp_err_t err);
+
+/*
+ * @brief Function to connect again a client stopped with mqtt_stop.
+ *
+ * It must not be called from an MQTT event handler.
  */
-esp_err_t mqtt_init(esp_event_loop_handle_t loop, thingsboard_cfg_t *cfg);
+esp_err_t mqtt_start(void);
+
+/*
+ * @brief Function to close the session with the broker, MQTT_BROKER_DISCONNECTED is posted.
+ *
+ * Unacknowledged messages stay in the outbox until mqtt_start. It must not be called from an MQTT event handler.
+ */
+esp_err_t mqtt_stop(void);
 
 /*
  * @brief Function to publish data by using MQTT.
@@ -85,4 +143,17 @@ esp_err_t mqtt_init(esp_event_loop_handle_t loop, thingsboard_cfg_t *cfg);
  * @param size_t data_len. Lenght of message to publish.
  */
 esp_err_t mqtt_publish(char* data, size_t data_len);
+
+/*
+ * @brief Function to publish data to a given topic by using MQTT.
+ *
+ * The message is admitted to the bounded outbox, see mqtt_outbox.h. It has to be called from the
+ * event loop given to mqtt_init.
+ *
+ * @param const char* topic. Topic where the data is published.
+ * @param const char* data. Data to publish, it does not need to be null terminated.
+ * @param size_t data_len. Lenght of message to publish.
+ * @param int* id. Where the id is stored to match its MQTT_OUTBOX_DELIVERED, it can be NULL.
+ */
+esp_err_t mqtt_publish_topic(const char* topic, const char* data, size_t data_len, int* id);
 #endif /*MQTT_CONTROLLER_H*/
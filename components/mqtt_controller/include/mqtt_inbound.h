@@ -0,0 +1,125 @@
+/**
+ * @file mqtt_inbound.h
+ * @brief Reassembly of incoming MQTT messages and a non allocating JSON
+ * token scanner to extract keys from them.
+ */
+#ifndef MQTT_INBOUND_H
+#define MQTT_INBOUND_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+/**
+ * @brief Maximum length of the topic of an accepted message.
+ */
+#define MQTT_INBOUND_MAX_TOPIC_LEN 64
+
+/**
+ * @brief Maximum nesting of the scanned JSON documents.
+ */
+#define MQTT_JSON_MAX_DEPTH 8
+
+/**
+ * @brief Complete incoming message.
+ */
+typedef struct {
+    char topic[MQTT_INBOUND_MAX_TOPIC_LEN + 1]; /*!< Null terminated topic */
+    size_t topic_len;                           /*!< Length of topic */
+    char data[CONFIG_MQTT_INBOUND_MAX_DATA_LEN + 1]; /*!< Null terminated payload */
+    size_t data_len;                            /*!< Length of data */
+} mqtt_inbound_message_t;
+
+/**
+ * @brief Decides whether a topic is worth reassembling.
+ *
+ * @param topic Topic of the message, not null terminated.
+ * @param topic_len Length of topic.
+ * @return true if the message has to be reassembled.
+ */
+typedef bool (*mqtt_inbound_topic_filter_t)(const char *topic, size_t topic_len);
+
+/**
+ * @brief JSON value types reported by the scanner.
+ */
+typedef enum {
+    MQTT_JSON_STRING, /*!< String, value excludes the quotes, escapes kept */
+    MQTT_JSON_NUMBER, /*!< Number */
+    MQTT_JSON_TRUE,   /*!< true literal */
+    MQTT_JSON_FALSE,  /*!< false literal */
+    MQTT_JSON_NULL,   /*!< null literal */
+} mqtt_json_type_t;
+
+/**
+ * @brief Object member with a scalar value found by the scanner.
+ */
+typedef struct {
+    const char *parent;  /*!< Key of the enclosing object, NULL at the root */
+    size_t parent_len;   /*!< Length of parent */
+    const char *key;     /*!< Member key, not null terminated */
+    size_t key_len;      /*!< Length of key */
+    mqtt_json_type_t type; /*!< Type of the value */
+    const char *value;   /*!< Value, not null terminated */
+    size_t value_len;    /*!< Length of value */
+} mqtt_json_member_t;
+
+/**
+ * @brief Called by the scanner for every object member with a scalar value.
+ */
+typedef void (*mqtt_json_member_cb_t)(const mqtt_json_member_t *member, void *ctx);
+
+/**
+ * @brief Feed an MQTT_EVENT_DATA event to the reassembly buffer.
+ *
+ * Fragments of a message are copied into a single static buffer. Messages
+ * whose topic is rejected by the filter, or longer than
+ * CONFIG_MQTT_INBOUND_MAX_DATA_LEN, are dropped without being copied.
+ *
+ * @param event Data event received from the MQTT client.
+ * @param filter Topic filter applied on the first fragment.
+ * @return The complete message once its last fragment is fed, NULL
+ * otherwise. It stays valid until the next call.
+ */
+const mqtt_inbound_message_t *mqtt_inbound_feed(
+    const esp_mqtt_event_handle_t event,
+    mqtt_inbound_topic_filter_t filter
+);
+
+/**
+ * @brief Scan a JSON document reporting every object member with a scalar
+ * value, together with the key of the object that contains it.
+ *
+ * The work is linear in len and nothing is allocated.
+ *
+ * @param json Document to scan.
+ * @param len Length of json.
+ * @param cb Called for every member.
+ * @param ctx Passed to cb.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: malformed document
+ * - ESP_ERR_INVALID_SIZE: nesting deeper than MQTT_JSON_MAX_DEPTH
+ */
+esp_err_t mqtt_json_scan(
+    const char *json,
+    size_t len,
+    mqtt_json_member_cb_t cb,
+    void *ctx
+);
+
+/**
+ * @brief Check if a key or parent matches a null terminated string.
+ */
+bool mqtt_json_equals(const char *s, size_t s_len, const char *expected);
+
+/**
+ * @brief Convert a number member to int, truncating any fraction.
+ *
+ * @param member Member reported by the scanner.
+ * @param value Where the value is stored.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: not a number or out of range
+ */
+esp_err_t mqtt_json_to_int(const mqtt_json_member_t *member, int *value);
+#endif // !MQTT_INBOUND_H
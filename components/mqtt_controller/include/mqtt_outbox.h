@@ -0,0 +1,71 @@
+/**
+ * @file mqtt_outbox.h
+ * @brief Bounded pool of QoS 1 messages in front of the MQTT client.
+ *
+ * Messages are copied into one of CONFIG_MQTT_OUTBOX_SLOTS fixed slots and
+ * handed to the client only while connected, at most
+ * CONFIG_MQTT_OUTBOX_MAX_INFLIGHT at a time, so the client outbox never
+ * grows with the time the broker is unreachable. A slot is freed when its
+ * PUBACK arrives. Every function has to be called from the event loop given
+ * to mqtt_init.
+ */
+#ifndef MQTT_OUTBOX_H
+#define MQTT_OUTBOX_H
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "mqtt_client.h"
+
+/**
+ * @brief Outbox metrics since boot.
+ */
+typedef struct {
+    uint16_t slots_used;        /*!< Slots holding a message */
+    uint16_t slots_peak;        /*!< Maximum slots_used */
+    uint32_t admitted;          /*!< Messages accepted */
+    uint32_t rejected;          /*!< Messages refused because the pool was full */
+    uint32_t dropped;           /*!< Accepted messages evicted by the policy */
+    uint32_t delivered;         /*!< Messages acknowledged by the broker */
+    uint32_t retransmits;       /*!< Messages handed again after the client gave up */
+    int64_t time_in_outbox_us;  /*!< Sum of the time from admission to PUBACK */
+    int64_t max_time_in_outbox_us; /*!< Longest time from admission to PUBACK */
+} mqtt_outbox_stats_t;
+
+/**
+ * @brief Initialize the outbox.
+ *
+ * @param loop Event loop where the broker events are posted.
+ * @param client MQTT client the messages are handed to.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: Failure
+ */
+esp_err_t mqtt_outbox_init(esp_event_loop_handle_t loop, esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Admit a QoS 1 message.
+ *
+ * When the pool is full the configured policy either refuses the message
+ * or evicts queued ones. MQTT_OUTBOX_FULL is posted when the pool fills up
+ * and MQTT_OUTBOX_AVAILABLE when it is half empty again.
+ *
+ * @param topic Topic of the message, up to 64 characters.
+ * @param data Payload, it is copied.
+ * @param len Length of data.
+ * @param id Where the id reported by MQTT_OUTBOX_DELIVERED is stored, it
+ * can be NULL.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_SIZE: the payload is larger than a slot or the topic too long
+ * - ESP_ERR_NO_MEM: the pool is full and the policy refused the message
+ */
+esp_err_t mqtt_outbox_publish(const char *topic, const char *data, size_t len, int *id);
+
+/**
+ * @brief Get the outbox metrics.
+ *
+ * @param stats Where the metrics are copied.
+ */
+void mqtt_outbox_get_stats(mqtt_outbox_stats_t *stats);
+#endif // !MQTT_OUTBOX_H
@@ -0,0 +1,96 @@
+/**
+ * @file mqtt_router.h
+ * @brief Dispatch of incoming messages to handlers by topic.
+ */
+#ifndef MQTT_ROUTER_H
+#define MQTT_ROUTER_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief How a route matches a topic.
+ */
+typedef enum {
+    MQTT_ROUTE_EXACT, /*!< The topic is the route topic */
+    MQTT_ROUTE_ID,    /*!< The topic is the route topic followed by a decimal id */
+} mqtt_route_match_t;
+
+/**
+ * @brief Handler of the messages of a route.
+ *
+ * @param id Trailing id of the topic for MQTT_ROUTE_ID routes, 0 otherwise.
+ * @param data Payload of the message, null terminated.
+ * @param data_len Length of data.
+ */
+typedef void (*mqtt_route_handler_t)(uint32_t id, const char *data, size_t data_len);
+
+/**
+ * @brief Route of incoming messages.
+ */
+typedef struct {
+    const char *topic;            /*!< Topic, or prefix ending in '/' for MQTT_ROUTE_ID */
+    mqtt_route_match_t match;     /*!< How the topic is matched */
+    mqtt_route_handler_t handler; /*!< Called for every matching message */
+} mqtt_route_t;
+
+/**
+ * @brief Add a route to the router.
+ *
+ * The route is referenced, not copied, so it has to outlive the router.
+ *
+ * @param route Route to add.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_STATE: a route with the same topic and match exists
+ * - ESP_ERR_NO_MEM: CONFIG_MQTT_ROUTER_TABLE_SIZE routes reached
+ */
+esp_err_t mqtt_router_register(const mqtt_route_t *route);
+
+/**
+ * @brief Find the route of a topic.
+ *
+ * Exact routes are looked up first. Otherwise a trailing decimal segment is
+ * taken as the id and the rest of the topic is looked up as an id route.
+ * The cost is linear in topic_len and independent of the number of routes.
+ *
+ * @param topic Topic, not null terminated.
+ * @param topic_len Length of topic.
+ * @param id Where the id of an MQTT_ROUTE_ID topic is stored.
+ * @return The route, or NULL if there is none.
+ */
+const mqtt_route_t *mqtt_router_lookup(const char *topic, size_t topic_len, uint32_t *id);
+
+/**
+ * @brief Check if a topic has a route, usable as mqtt_inbound topic filter.
+ */
+bool mqtt_router_accepts(const char *topic, size_t topic_len);
+
+/**
+ * @brief Call the handler of the route of a message.
+ *
+ * @param topic Topic of the message, not null terminated.
+ * @param topic_len Length of topic.
+ * @param data Payload of the message.
+ * @param data_len Length of data.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_NOT_FOUND: no route for the topic
+ */
+esp_err_t mqtt_router_dispatch(
+    const char *topic,
+    size_t topic_len,
+    const char *data,
+    size_t data_len
+);
+
+/**
+ * @brief Measure the lookup cost and log the CPU cycles per message.
+ *
+ * @param topics Topics looked up in turn, null terminated.
+ * @param n Number of topics.
+ * @param iterations Times every topic is looked up.
+ */
+void mqtt_router_benchmark(const char *const *topics, size_t n, uint32_t iterations);
+#endif // !MQTT_ROUTER_H
@@ -0,0 +1,75 @@
+/**
+ * @file mqtt_rpc.h
+ * @brief Server-side RPC methods answered on the ThingsBoard RPC topics.
+ *
+ * A request {"method": "...", "params": {...}} received on
+ * v1/devices/me/rpc/request/<id> is passed to the handler registered for its
+ * method, which writes the reply into a static buffer. The reply is published
+ * with QoS 0 on v1/devices/me/rpc/response/<id> from the MQTT task, so
+ * handlers have to be short and must not block.
+ */
+#ifndef MQTT_RPC_H
+#define MQTT_RPC_H
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+/**
+ * @brief Handler of an RPC method.
+ *
+ * The members of "params" can be read with mqtt_json_scan looking for the
+ * parent "params".
+ *
+ * @param request Whole request document, null terminated.
+ * @param request_len Length of request.
+ * @param response Where the JSON reply is written.
+ * @param response_size Size of response.
+ * @param response_len Where the length of the reply is stored.
+ * @return
+ * - ESP_OK: Success, response is sent
+ * - some other error code: Failure, an error naming it is sent instead
+ */
+typedef esp_err_t (*mqtt_rpc_handler_t)(
+    const char *request,
+    size_t request_len,
+    char *response,
+    size_t response_size,
+    size_t *response_len
+);
+
+/**
+ * @brief RPC method.
+ */
+typedef struct {
+    const char *method;         /*!< Name of the method */
+    mqtt_rpc_handler_t handler; /*!< Called for every request of the method */
+} mqtt_rpc_method_t;
+
+/**
+ * @brief Add a method.
+ *
+ * The method is referenced, not copied, so it has to outlive the client.
+ * Methods have to be registered before mqtt_init.
+ *
+ * @param method Method to add.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_STATE: a method with the same name exists
+ * - ESP_ERR_NO_MEM: CONFIG_MQTT_RPC_MAX_METHODS methods reached
+ */
+esp_err_t mqtt_rpc_register(const mqtt_rpc_method_t *method);
+
+/**
+ * @brief Answer a request with the handler of its method.
+ *
+ * A request with an unknown method is answered with an error. A handler
+ * taking longer than CONFIG_MQTT_RPC_BUDGET_MS is logged.
+ *
+ * @param client Client the reply is published with.
+ * @param id Id of the request, from its topic.
+ * @param data Request document, null terminated.
+ * @param data_len Length of data.
+ */
+void mqtt_rpc_dispatch(esp_mqtt_client_handle_t client, uint32_t id, const char *data, size_t data_len);
+#endif // !MQTT_RPC_H
@@ -19,6 +19,7 @@ typedef struct {
 } thingsboard_authentication_t;
 typedef struct {
     thingsboard_authentication_t authentication;
+    char* access_token; /* Of the device for the HTTP and plain CoAP APIs, NULL if not provisioned*/
 } thingsboard_credentials_t;
 typedef struct {
     thingsboard_address_t address;
@@ -26,4 +27,13 @@ typedef struct {
     thingsboard_credentials_t credentials;
 } thingsboard_cfg_t;
 
+/* Shared attributes kept between runs, see mqtt_restore_shared_attributes*/
+#define THINGSBOARD_MAX_SHARED_ATTRIBUTES 8
+typedef struct {
+    uint32_t version;   /* Hash of the attribute keys the values belong to*/
+    int64_t updated_at; /* time() of the last response with every attribute*/
+    uint32_t present;   /* Bit i is set when values[i] was received*/
+    int32_t values[THINGSBOARD_MAX_SHARED_ATTRIBUTES];
+} thingsboard_shared_attributes_t;
+
 #endif /* !THINGSBOARD_TYPES_H*/
@@ -0,0 +1,115 @@
+/**
+ * @file uplink.h
+ * @brief Transports of the ThingsBoard device API under mqtt_publish.
+ *
+ * The transport is selected in menuconfig (`ThingsBoard transport`). Both
+ * post the same MQTT_THINGSBOARD_EVENT events: MQTT_BROKER_CONNECTED once
+ * the server answers, MQTT_BROKER_DISCONNECTED when it stops answering and
+ * MQTT_OUTBOX_DELIVERED with the id of every acknowledged publish, so the
+ * publishers do not depend on the transport in use. Attribute responses are
+ * dispatched through mqtt_router as if received on
+ * `v1/devices/me/attributes/response/<id>`.
+ */
+#ifndef UPLINK_H
+#define UPLINK_H
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "thingsboard_types.h"
+
+/**
+ * @brief Transport settings.
+ */
+typedef struct {
+    esp_event_loop_handle_t loop;     /*!< Loop where the broker events are posted */
+    const thingsboard_cfg_t *cfg;     /*!< Server and certificates, has to outlive the transport */
+    const char *last_will;            /*!< Attributes published when the session is lost, MQTT only */
+    size_t last_will_len;             /*!< Length of last_will */
+    void (*on_connected)(void);       /*!< Called from the transport task before MQTT_BROKER_CONNECTED */
+} uplink_config_t;
+
+/**
+ * @brief Transport metrics since boot.
+ *
+ * Bytes are counted on the same basis for both transports, the messages of
+ * the protocol as written to and read from the secure session: MQTT packets
+ * without the TLS records and handshakes, CoAP messages without the DTLS
+ * records and handshakes or the IP and UDP headers.
+ */
+typedef struct {
+    const char *name;       /*!< Transport in use */
+    uint32_t uploads;       /*!< Publishes acknowledged by the server */
+    uint32_t failures;      /*!< Exchanges the server did not answer */
+    uint32_t retransmits;   /*!< Requests sent again */
+    uint64_t tx_bytes;      /*!< Bytes sent */
+    uint64_t rx_bytes;      /*!< Bytes received */
+    uint64_t latency_us;    /*!< Sum of the time from publish to acknowledgement */
+    uint64_t max_latency_us; /*!< Longest time from publish to acknowledgement */
+} uplink_stats_t;
+
+/**
+ * @brief Transport operations.
+ */
+typedef struct {
+    const char *name; /*!< Name for the logs */
+    /**
+     * @brief Create the transport and connect.
+     */
+    esp_err_t (*init)(const uplink_config_t *config);
+    /**
+     * @brief Connect again after stop.
+     */
+    esp_err_t (*start)(void);
+    /**
+     * @brief Close the session, MQTT_BROKER_DISCONNECTED is posted.
+     */
+    esp_err_t (*stop)(void);
+    /**
+     * @brief Queue a payload to a device API topic, id is reported with MQTT_OUTBOX_DELIVERED.
+     */
+    esp_err_t (*publish)(const char *topic, const char *data, size_t len, int *id);
+    /**
+     * @brief Request the comma separated shared attributes, answered on response/<id>.
+     */
+    esp_err_t (*request_attributes)(int id, const char *shared_keys);
+    /**
+     * @brief Count the publishes not acknowledged yet.
+     */
+    size_t (*pending)(void);
+    /**
+     * @brief Get the transport metrics.
+     */
+    void (*get_stats)(uplink_stats_t *stats);
+} uplink_transport_t;
+
+/**
+ * @brief MQTT over TLS with esp-mqtt, the session is kept open.
+ */
+extern const uplink_transport_t uplink_mqtt;
+
+#if CONFIG_UPLINK_TRANSPORT_COAP
+/**
+ * @brief CoAP requests over UDP, optionally DTLS, without a session to keep.
+ *
+ * Telemetry and attributes are posted with confirmable requests and shared
+ * attributes are fetched on every start. Server-side RPC and attribute
+ * updates pushed by the server are not received.
+ */
+extern const uplink_transport_t uplink_coap;
+#endif
+
+/**
+ * @brief Count the publishes the transport in use holds unacknowledged.
+ *
+ * It can be called from any task.
+ */
+size_t uplink_pending(void);
+
+/**
+ * @brief Get the metrics of the transport in use.
+ *
+ * @param stats Where the metrics will be copied.
+ */
+void uplink_get_stats(uplink_stats_t *stats);
+#endif // !UPLINK_H
@@ -8,51 +8,229 @@
 #include "freertos/idf_additions.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_check.h"
 #include "mbedtls/x509_crt.h"
+#include "fleet.h"
 #include "mqtt_client.h"
 #include "portmacro.h"
 #include "mqtt_controller.h"
+#include "mqtt_inbound.h"
+#include "mqtt_outbox.h"
+#include "mqtt_router.h"
+#include "mqtt_rpc.h"
+#include "runtime_config.h"
+#include "tls_session.h"
+#include "telemetry_codec.h"
 #include "thingsboard_types.h"
+#include "uplink.h"
+#if CONFIG_CERT_STORE_ENABLE
+#include "cert_store.h"
+#endif
 
 #define MAX_ACCESS_TOKEN_LEN 40
 #define MAX_PROVISIONING_WAIT portMAX_DELAY
+#define RUNTIME_CONFIG_POST_WAIT pdMS_TO_TICKS(100)
 #define THINGSBOARD_PROVISION_USERNAME "provision"
 #define DEVICE_ATTRIBUTES_TOPIC "v1/devices/me/attributes"
 #define DEVICE_ATTRIBUTES_REQUEST "v1/devices/me/attributes/request/"
 #define DEVICE_ATTRIBUTES_RESPONSE_RET "v1/devices/me/attributes/response/"
 #define DEVICE_ATTRIBUTES_RESPONSE "v1/devices/me/attributes/response/+"
-#define DEVICE_TELEMETRY_TOPIC "v1/devices/me/telemetry"
+#define DEVICE_TELEMETRY_TOPIC MQTT_TELEMETRY_TOPIC
+#define DEVICE_RPC_REQUEST "v1/devices/me/rpc/request/+"
+#define DEVICE_RPC_REQUEST_RET "v1/devices/me/rpc/request/"
 #define PROVISION_REQUEST_TOPIC "/provision/request/"
 #define PROVISION_RESPONSE_TOPIC "/provision/response/+"
 #define PROVISION_RESPONSE_TOPIC_RET "/provision/response/"
+#define MAX_SHARED_KEYS_LEN 128
+#define MAX_ATTRIBUTES_PAYLOAD_LEN 160
+#define MAX_REQUEST_TOPIC_LEN 48
+#define ROUTER_BENCHMARK_ITERATIONS 1000
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
 
 static const char *TAG = "mqtt_thingsboard";
 esp_event_loop_handle_t event_loop;
 esp_mqtt_client_handle_t client;
 static SemaphoreHandle_t is_provisioned;  /* Queue to handle events*/
 int request_count = 0;
+/* Built once per connection instead of on every message*/
+static char attributes_request_topic[MAX_REQUEST_TOPIC_LEN];
 
 ESP_EVENT_DEFINE_BASE(MQTT_THINGSBOARD_EVENT);
 
+/* The shared attributes are the settings of the runtime_config registry*/
+_Static_assert(
+    RUNTIME_CONFIG_MAX_ENTRIES <= THINGSBOARD_MAX_SHARED_ATTRIBUTES,
+    "THINGSBOARD_MAX_SHARED_ATTRIBUTES too small"
+);
+
+/* Last known value of every shared attribute and the keys asked for on
+ this connection*/
+static thingsboard_shared_attributes_t shared_attributes_cache;
+static uint32_t requested_shared_attributes;
+
+/* Attribute payloads in the configured telemetry format, the request is
+ encoded on connect with the keys still needed*/
+static uint8_t shared_keys_request[MAX_ATTRIBUTES_PAYLOAD_LEN];
+static size_t shared_keys_request_len;
+static uint8_t last_will_msg[MAX_ATTRIBUTES_PAYLOAD_LEN];
+static size_t last_will_msg_len;
+static int64_t connect_started_at;
+/* Reconnections are scheduled here with jitter instead of by the client*/
+static esp_mqtt_client_config_t mqtt_cfg;
+static fleet_backoff_t reconnect_backoff;
+/* Selected in menuconfig, see uplink.h*/
+static const uplink_transport_t *uplink;
+static uplink_config_t uplink_config;
+
+/* Selects the members holding shared attributes in a received document*/
+typedef struct {
+    const char *parent;
+    bool invalid;
+    runtime_config_update_t update;
+} shared_attributes_scan_t;
+
+/* Status of a provision response*/
+typedef struct {
+    bool success;
+} provision_scan_t;
+
+/* Never block the MQTT task on a full application loop, a lost PUBACK is
+ recovered by the publisher's own timeout*/
+static void post_broker_event(mqtt_thingsboard_event_t event_id, const void *data, size_t data_len)
+{
+    if (esp_event_post_to(event_loop, MQTT_THINGSBOARD_EVENT, event_id, data, data_len, 0) != ESP_OK) {
+        ESP_LOGW(TAG, "Could not post broker event %d", event_id);
+    }
+}
+
+/* A cache written by a firmware with other shared attributes is not used*/
+static uint32_t shared_attributes_version(void)
+{
+    uint32_t hash = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < runtime_config_len(); i++)
+    {
+        for (const char *c = runtime_config_entry(i)->key; ; c++)
+        {
+            hash ^= (uint8_t) *c;
+            hash *= FNV_PRIME;
+            if (*c == '\0') {
+                break;
+            }
+        }
+    }
+    return hash;
+}
+
+/* Every key when the cache is stale, otherwise the ones never received*/
+static uint32_t shared_attributes_to_request(void)
+{
+    uint32_t all = (1u << runtime_config_len()) - 1;
+    int64_t now = time(NULL);
+
+    if (shared_attributes_cache.updated_at == 0 || now < shared_attributes_cache.updated_at
+        || now - shared_attributes_cache.updated_at > CONFIG_MQTT_SHARED_ATTRIBUTES_MAX_AGE) {
+        return all;
+    }
+    return all & ~shared_attributes_cache.present;
+}
+
+static void shared_keys_list(uint32_t keys, char *shared_keys, size_t size)
+{
+    shared_keys[0] = '\0';
+    for (size_t i = 0; i < runtime_config_len(); i++)
+    {
+        if (!(keys & (1u << i))) {
+            continue;
+        }
+        if (shared_keys[0] != '\0') {
+            strlcat(shared_keys, ",", size);
+        }
+        strlcat(shared_keys, runtime_config_entry(i)->key, size);
+    }
+}
+
+/* Asks on every connection for what may have been missed while away*/
+static void request_shared_attributes(void)
+{
+    char shared_keys[MAX_SHARED_KEYS_LEN];
+
+    request_count++;
+    requested_shared_attributes = shared_attributes_to_request();
+    if (requested_shared_attributes == 0) {
+        ESP_LOGI(TAG, "Shared attributes cached, not requesting them");
+        return;
+    }
+    shared_keys_list(requested_shared_attributes, shared_keys, sizeof(shared_keys));
+    if (uplink->request_attributes(request_count, shared_keys) != ESP_OK) {
+        ESP_LOGW(TAG, "Could not request shared attributes");
+    }
+}
+
+static esp_err_t mqtt_request_attributes(int id, const char *shared_keys)
+{
+    const telemetry_codec_attribute_t request = {
+        .key = "sharedKeys",
+        .type = TELEMETRY_CODEC_ATTRIBUTE_STRING,
+        .string_value = shared_keys,
+    };
+    /* Requests are read as JSON whatever the payload type of the profile*/
+    ESP_RETURN_ON_ERROR(
+        telemetry_codec_encode_attributes(TELEMETRY_CODEC_JSON, &request, 1, shared_keys_request, sizeof(shared_keys_request), &shared_keys_request_len),
+        TAG,
+        "could not encode shared attributes request"
+    );
+    snprintf(attributes_request_topic, sizeof(attributes_request_topic), "%s%d", DEVICE_ATTRIBUTES_REQUEST, id);
+    if (esp_mqtt_client_publish(client, attributes_request_topic, (const char*) shared_keys_request, shared_keys_request_len, 1, 0) < 0) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/* The client takes reconnect_timeout_ms when a session ends, before
+ MQTT_EVENT_DISCONNECTED, so the wait set here is the one of the next
+ disconnection*/
+static void reconnect_backoff_next(void)
+{
+    mqtt_cfg.network.reconnect_timeout_ms = fleet_backoff_next(&reconnect_backoff);
+    if (client != NULL && esp_mqtt_set_config(client, &mqtt_cfg) != ESP_OK) {
+        ESP_LOGW(TAG, "Could not set the reconnect wait");
+    }
+}
+
 static void mqtt_connected_event_handler(
     void *handler_args,
     esp_event_base_t base,
     int32_t event_id,
     void *event_data
 ) {
-    ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+    tls_session_stats_t tls_stats;
+    tls_session_get_stats(&tls_stats);
+    ESP_LOGI(
+        TAG,
+        "MQTT_EVENT_CONNECTED in %d ms, %s TLS handshake of %d ms",
+        (int) ((esp_timer_get_time() - connect_started_at) / 1000),
+        tls_stats.last_resumed ? "resumed" : "full",
+        (int) (tls_stats.last_us / 1000)
+    );
     esp_mqtt_client_subscribe(client, DEVICE_ATTRIBUTES_TOPIC, 0);
     esp_mqtt_client_subscribe(client, DEVICE_ATTRIBUTES_RESPONSE, 0);
-    request_count++;
-    int required_size = snprintf(NULL, 0, "%s%d", DEVICE_ATTRIBUTES_REQUEST, request_count) + 1; // +1 para el carácter nulo
-    char* topic = (char*) malloc(required_size);
-    if (topic) {
-        snprintf(topic, required_size, "%s%d", DEVICE_ATTRIBUTES_REQUEST, request_count);
-        /*Use topic*/
-        esp_mqtt_client_publish(client, topic, "{\"sharedKeys\":\"send_time\"}", 0, 1, 0);
-        free(topic); /* Free memory when no longer needed*/
-    }
+    esp_mqtt_client_subscribe(client, DEVICE_RPC_REQUEST, 0);
+    /* Values pushed while connected arrive on DEVICE_ATTRIBUTES_TOPIC*/
+    uplink_config.on_connected();
+    fleet_backoff_reset(&reconnect_backoff);
+    reconnect_backoff_next();
+    post_broker_event(MQTT_BROKER_CONNECTED, NULL, 0);
+}
+
+static void mqtt_before_connect_event_handler(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+) {
+    connect_started_at = esp_timer_get_time();
 }
 
 static void mqtt_disconnected_event_handler(
@@ -61,7 +239,9 @@ static void mqtt_disconnected_event_handler(
     int32_t event_id,
     void *event_data
 ) {
-    ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+    ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED, reconnecting in %d ms", mqtt_cfg.network.reconnect_timeout_ms);
+    post_broker_event(MQTT_BROKER_DISCONNECTED, NULL, 0);
+    reconnect_backoff_next();
 }
 
 static void mqtt_subscribed_event_handler(
@@ -92,6 +272,18 @@ static void mqtt_published_event_handler(
 ) {
     esp_mqtt_event_handle_t event = event_data;
     ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+    post_broker_event(MQTT_BROKER_PUBACK, &event->msg_id, sizeof(event->msg_id));
+}
+
+static void mqtt_deleted_event_handler(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+) {
+    esp_mqtt_event_handle_t event = event_data;
+    ESP_LOGW(TAG, "MQTT_EVENT_DELETED, msg_id=%d", event->msg_id);
+    post_broker_event(MQTT_BROKER_DELETED, &event->msg_id, sizeof(event->msg_id));
 }
 
 static void mqtt_data_event_handler(
@@ -101,13 +293,14 @@ static void mqtt_data_event_handler(
     void *event_data
 ) {
     esp_mqtt_event_handle_t event = event_data;
+    const mqtt_inbound_message_t *message = mqtt_inbound_feed(event, mqtt_router_accepts);
+    if (message == NULL) {
+        return;
+    }
     ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-    printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-    printf("DATA=%.*s\r\n", event->data_len, event->data);
-    cJSON *jsonData = NULL;
-    jsonData = cJSON_Parse(event->data);
-    received_data(jsonData, event->topic, event->topic_len);
-    cJSON_Delete(jsonData);
+    ESP_LOGD(TAG, "TOPIC=%.*s", (int) message->topic_len, message->topic);
+    ESP_LOGD(TAG, "DATA=%.*s", (int) message->data_len, message->data);
+    mqtt_router_dispatch(message->topic, message->topic_len, message->data, message->data_len);
 }
 
 static void mqtt_error_event_handler(
@@ -128,17 +321,36 @@ static void mqtt_error_event_handler(
 
 static const mqtt_event_handle_register_t mqtt_registered_events[] =
 {
+    { MQTT_EVENT_BEFORE_CONNECT, mqtt_before_connect_event_handler},
     { MQTT_EVENT_CONNECTED, mqtt_connected_event_handler},
     { MQTT_EVENT_DISCONNECTED, mqtt_disconnected_event_handler},
     { MQTT_EVENT_SUBSCRIBED, mqtt_subscribed_event_handler},
     { MQTT_EVENT_UNSUBSCRIBED, mqtt_unsubscribed_event_handler},
     { MQTT_EVENT_PUBLISHED, mqtt_published_event_handler},
+    { MQTT_EVENT_DELETED, mqtt_deleted_event_handler},
     { MQTT_EVENT_DATA, mqtt_data_event_handler},
     { MQTT_EVENT_ERROR, mqtt_error_event_handler}
 };
 
 static const size_t mqtt_registered_events_len = sizeof(mqtt_registered_events) / sizeof(mqtt_registered_events[0]);
 
+static esp_err_t encode_attribute_payloads(void)
+{
+    const telemetry_codec_attribute_t last_will = {
+        .key = "status",
+        .type = TELEMETRY_CODEC_ATTRIBUTE_STRING,
+        .string_value = "disconnected",
+    };
+    /* The broker publishes it on our behalf, ThingsBoard only reads it as
+     JSON*/
+    ESP_RETURN_ON_ERROR(
+        telemetry_codec_encode_attributes(TELEMETRY_CODEC_JSON, &last_will, 1, last_will_msg, sizeof(last_will_msg), &last_will_msg_len),
+        TAG,
+        "could not encode last will"
+    );
+    return ESP_OK;
+}
+
 void log_error_if_nonzero(const char *message, int error_code)
 {
     if (error_code != 0) {
@@ -146,55 +358,192 @@ void log_error_if_nonzero(const char *message, int error_code)
     }
 }
 
-void received_data(cJSON *root, char* topic, size_t topic_len){
-    cJSON *item = NULL, *shared = NULL;
-    int send_time;
-    int required_size = snprintf(NULL, 0, "%s%d", DEVICE_ATTRIBUTES_RESPONSE_RET, request_count) + 1; // +1 para el carácter nulo
-    char * request_topic = (char*) malloc(required_size);
-    if (request_topic) {
-        snprintf(request_topic, required_size, "%s%d", DEVICE_ATTRIBUTES_RESPONSE_RET, request_count);
+static void stage_shared_attribute(const mqtt_json_member_t *member, void *ctx)
+{
+    shared_attributes_scan_t *scan = ctx;
+    runtime_config_type_t type = RUNTIME_CONFIG_INT;
+    int index;
+    int value = 0;
+
+    if (scan->parent == NULL ? member->parent != NULL : !mqtt_json_equals(member->parent, member->parent_len, scan->parent)) {
+        return;
     }
-    if(strncmp(topic, DEVICE_ATTRIBUTES_TOPIC, topic_len) == 0){
-        if(cJSON_HasObjectItem(root, "send_time")){
-            item = cJSON_GetObjectItem(root, "send_time");
-            if(cJSON_IsNumber(item)){
-                send_time = item->valueint;
-                ESP_ERROR_CHECK(
-                    esp_event_post_to(event_loop, MQTT_THINGSBOARD_EVENT, MQTT_NEW_SEND_TIME, &send_time, sizeof(send_time), portMAX_DELAY));
-            }
+    index = runtime_config_find(member->key, member->key_len);
+    if (index < 0) {
+        return;
+    }
+    switch (member->type) {
+    case MQTT_JSON_NUMBER:
+        type = RUNTIME_CONFIG_INT;
+        if (mqtt_json_to_int(member, &value) != ESP_OK) {
+            scan->invalid = true;
+        }
+        break;
+    case MQTT_JSON_TRUE:
+    case MQTT_JSON_FALSE:
+        type = RUNTIME_CONFIG_BOOL;
+        value = member->type == MQTT_JSON_TRUE;
+        break;
+    default:
+        scan->invalid = true;
+        break;
+    }
+    if (scan->invalid || runtime_config_stage(&scan->update, index, type, value) != ESP_OK) {
+        ESP_LOGW(TAG, "Invalid %.*s: %.*s", (int) member->key_len, member->key, (int) member->value_len, member->value);
+        scan->invalid = true;
+    }
+}
+
+/* Validates the whole document and posts the settings that changed as a
+ single update, returns true if there was one. The cache takes them once
+ mqtt_runtime_config_applied reports them in use*/
+static bool scan_shared_attributes(const char *data, size_t data_len, const char *parent)
+{
+    shared_attributes_scan_t scan = { .parent = parent };
+    runtime_config_update_t *update = &scan.update;
+
+    if (mqtt_json_scan(data, data_len, stage_shared_attribute, &scan) != ESP_OK) {
+        ESP_LOGW(TAG, "Malformed attributes");
+        return false;
+    }
+    if (scan.invalid) {
+        ESP_LOGW(TAG, "Rejecting the attributes, none of them is applied");
+        return false;
+    }
+    for (size_t i = 0; i < runtime_config_len(); i++)
+    {
+        if (!(update->set & (1u << i))) {
+            continue;
+        }
+        if ((shared_attributes_cache.present & (1u << i)) && shared_attributes_cache.values[i] == update->values[i]) {
+            /* Already applied from the cache*/
+            update->set &= ~(1u << i);
         }
     }
-    else if(strncmp(topic, request_topic, topic_len) == 0){
-        if(cJSON_HasObjectItem(root, "shared")){
-            shared = cJSON_GetObjectItem(root, "shared");
-            if(cJSON_HasObjectItem(shared, "send_time")){
-                item = cJSON_GetObjectItem(shared, "send_time");
-                if(cJSON_IsNumber(item)){
-                    send_time = item->valueint;
-                    ESP_LOGI(TAG, "Posteando nuevo tiempo de envio %d", send_time);
-                    ESP_ERROR_CHECK(
-                        esp_event_post_to(event_loop, MQTT_THINGSBOARD_EVENT, MQTT_NEW_SEND_TIME, &send_time, sizeof(send_time), portMAX_DELAY));
-                }
-            }
+    if (update->set == 0) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Posting new settings 0x%" PRIx32, update->set);
+    /* The MQTT task does not wait for a full event loop. The dropped
+     settings are not cached either, the next request gets them again*/
+    if (esp_event_post_to(event_loop, MQTT_THINGSBOARD_EVENT, MQTT_RUNTIME_CONFIG_UPDATE, update, sizeof(*update), RUNTIME_CONFIG_POST_WAIT) != ESP_OK) {
+        ESP_LOGW(TAG, "Event loop full, new settings 0x%" PRIx32 " dropped", update->set);
+    }
+    return true;
+}
+
+/* The application stores the cache, a lost event only costs a full
+ request on the next start*/
+static void post_shared_attributes_cache(void)
+{
+    post_broker_event(MQTT_SHARED_ATTRIBUTES_CHANGED, &shared_attributes_cache, sizeof(shared_attributes_cache));
+}
+
+void mqtt_runtime_config_applied(const runtime_config_update_t *update, esp_err_t err)
+{
+    bool changed = false;
+
+    if (err != ESP_OK) {
+        /* Requested again on the next connection instead of trusting the cache*/
+        shared_attributes_cache.present &= ~update->set;
+        ESP_LOGW(TAG, "Settings 0x%" PRIx32 " not applied, not storing them", update->set);
+        return;
+    }
+    for (size_t i = 0; i < runtime_config_len(); i++)
+    {
+        if (!(update->set & (1u << i))
+            || ((shared_attributes_cache.present & (1u << i)) && shared_attributes_cache.values[i] == update->values[i])) {
+            continue;
         }
+        shared_attributes_cache.values[i] = update->values[i];
+        shared_attributes_cache.present |= 1u << i;
+        changed = true;
+    }
+    if (changed) {
+        post_shared_attributes_cache();
     }
-    free(request_topic);
 }
 
-bool is_provision(cJSON *root, char* topic, size_t topic_len){
-    cJSON *receive = NULL;
+static void attributes_route_handler(uint32_t id, const char *data, size_t data_len)
+{
+    scan_shared_attributes(data, data_len, NULL);
+}
 
-    if(strncmp(topic, PROVISION_RESPONSE_TOPIC, topic_len) == 0){
-        receive = cJSON_GetObjectItem(root, "status");
-        if(strcmp(receive->valuestring, "SUCCESS") == 0){
-            receive = cJSON_GetObjectItem(root, "credentialsValue");
-            /*mqtt_set_access_token(receive->valuestring, strlen(receive->valuestring));*/
-            cJSON_Delete(receive);
-            return true;
+static void attributes_response_route_handler(uint32_t id, const char *data, size_t data_len)
+{
+    if (id != (uint32_t) request_count) {
+        ESP_LOGD(TAG, "Ignoring stale attributes response %" PRIu32, id);
+        return;
+    }
+    bool posted = scan_shared_attributes(data, data_len, "shared");
+    if (requested_shared_attributes == (1u << runtime_config_len()) - 1) {
+        shared_attributes_cache.updated_at = time(NULL);
+        /* Otherwise stored with the new settings once they are applied*/
+        if (!posted) {
+            post_shared_attributes_cache();
         }
     }
-    cJSON_Delete(receive);
-    return false;
+}
+
+static void rpc_request_route_handler(uint32_t id, const char *data, size_t data_len)
+{
+    mqtt_rpc_dispatch(client, id, data, data_len);
+}
+
+static void check_provision_status(const mqtt_json_member_t *member, void *ctx)
+{
+    provision_scan_t *scan = ctx;
+
+    if (member->parent == NULL && member->type == MQTT_JSON_STRING
+        && mqtt_json_equals(member->key, member->key_len, "status")) {
+        scan->success = mqtt_json_equals(member->value, member->value_len, "SUCCESS");
+    }
+    /*credentialsValue would be stored here with mqtt_set_access_token*/
+}
+
+static bool is_provision_success(const char *data, size_t data_len)
+{
+    provision_scan_t scan = { .success = false };
+
+    if(mqtt_json_scan(data, data_len, check_provision_status, &scan) != ESP_OK){
+        ESP_LOGW(TAG, "Malformed provision response");
+        return false;
+    }
+    return scan.success;
+}
+
+static void provision_response_route_handler(uint32_t id, const char *data, size_t data_len)
+{
+    if (is_provision_success(data, data_len)) {
+        xSemaphoreGive(is_provisioned);
+    }
+}
+
+static const mqtt_route_t mqtt_routes[] =
+{
+    { DEVICE_ATTRIBUTES_TOPIC, MQTT_ROUTE_EXACT, attributes_route_handler },
+    { DEVICE_ATTRIBUTES_RESPONSE_RET, MQTT_ROUTE_ID, attributes_response_route_handler },
+    { DEVICE_RPC_REQUEST_RET, MQTT_ROUTE_ID, rpc_request_route_handler },
+    { PROVISION_RESPONSE_TOPIC_RET, MQTT_ROUTE_ID, provision_response_route_handler },
+};
+
+static const size_t mqtt_routes_len = sizeof(mqtt_routes) / sizeof(mqtt_routes[0]);
+static size_t mqtt_routes_registered;
+
+void received_data(const char *data, size_t data_len, const char *topic, size_t topic_len){
+    if (mqtt_router_dispatch(topic, topic_len, data, data_len) != ESP_OK) {
+        ESP_LOGD(TAG, "Ignoring data on %.*s", (int) topic_len, topic);
+    }
+}
+
+bool is_provision(const char *data, size_t data_len, const char *topic, size_t topic_len){
+    uint32_t id;
+    const mqtt_route_t *route = mqtt_router_lookup(topic, topic_len, &id);
+
+    if(route == NULL || route->handler != provision_response_route_handler){
+        return false;
+    }
+    return is_provision_success(data, data_len);
 }
 
 esp_err_t send_messure(char * data_to_send){
@@ -241,19 +590,17 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
     case MQTT_EVENT_PUBLISHED:
         ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
         break;
-    case MQTT_EVENT_DATA:
-        ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-        printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-        printf("DATA=%.*s\r\n", event->data_len, event->data);
-        cJSON *jsonData = cJSON_Parse(event->data);
-        if(is_provision(jsonData, event->topic, event->topic_len)){
-            xSemaphoreGive(is_provisioned);
-        }
-        else{
-            received_data(jsonData, event->topic, event->topic_len);
+    case MQTT_EVENT_DATA: {
+        const mqtt_inbound_message_t *message = mqtt_inbound_feed(event, mqtt_router_accepts);
+        if (message == NULL) {
+            break;
         }
-        cJSON_Delete(jsonData);
+        ESP_LOGI(TAG, "MQTT_EVENT_DATA");
+        ESP_LOGD(TAG, "TOPIC=%.*s", (int) message->topic_len, message->topic);
+        ESP_LOGD(TAG, "DATA=%.*s", (int) message->data_len, message->data);
+        mqtt_router_dispatch(message->topic, message->topic_len, message->data, message->data_len);
         break;
+    }
     case MQTT_EVENT_ERROR:
         ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
         if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
@@ -316,38 +663,63 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
 }
 */
 
-esp_err_t mqtt_init(
-    esp_event_loop_handle_t loop,
-    thingsboard_cfg_t *cfg
-) {
-    event_loop = loop;
-    ESP_LOGI(TAG, "Iniciando MQTT, %s \n %d", (const char*) cfg->verification.certificate,
-    (int) cfg->verification.certificate_len);
-    esp_mqtt_client_config_t mqtt_cfg = {
-        .broker.address.hostname = cfg->address.uri,
-        .broker.address.port = cfg->address.port,
+static esp_err_t mqtt_uplink_init(const uplink_config_t *config)
+{
+    ESP_LOGI(TAG, "Iniciando MQTT, %s:%u", config->cfg->address.uri, (unsigned) config->cfg->address.port);
+    /* The certificates are handed to the TLS session transport, which
+     resumes the last session with the broker when it can*/
+    esp_tls_cfg_t tls_cfg = {
+        .cacert_buf = (const unsigned char*) config->cfg->verification.certificate,
+        .cacert_bytes = config->cfg->verification.certificate_len,
+        .clientcert_buf = (const unsigned char*) config->cfg->credentials.authentication.certificate,
+        .clientcert_bytes = config->cfg->credentials.authentication.certificate_len,
+        .clientkey_buf = (const unsigned char*) config->cfg->credentials.authentication.key,
+        .clientkey_bytes = config->cfg->credentials.authentication.key_len,
+        .skip_common_name = true,
+    };
+#if CONFIG_CERT_STORE_ENABLE
+    /* The DER of the mapped store, so the handshakes do not decode PEM and
+     the PEM need not stay in RAM*/
+    cert_store_der_t der;
+    if (cert_store_ready() && cert_store_get(&der) == ESP_OK) {
+        tls_cfg.cacert_buf = der.ca;
+        tls_cfg.cacert_bytes = der.ca_len;
+        tls_cfg.clientcert_buf = der.chain;
+        tls_cfg.clientcert_bytes = der.chain_len;
+        tls_cfg.clientkey_buf = der.key;
+        tls_cfg.clientkey_bytes = der.key_len;
+    }
+#endif
+    esp_transport_handle_t transport = tls_session_transport_init(&tls_cfg);
+    if (transport == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    fleet_backoff_reset(&reconnect_backoff);
+    mqtt_cfg = (esp_mqtt_client_config_t) {
+        .broker.address.hostname = config->cfg->address.uri,
+        .broker.address.port = config->cfg->address.port,
         .broker.address.transport = MQTT_TRANSPORT_OVER_SSL,
-        .broker.verification.certificate = (const char*) cfg->verification.certificate,
-        .broker.verification.certificate_len = cfg->verification.certificate_len,
-        .broker.verification.skip_cert_common_name_check = true,
-        .credentials.authentication.certificate =
-            (const char*) cfg->credentials.authentication.certificate,
-        .credentials.authentication.certificate_len = cfg->credentials.authentication.certificate_len,
-        .credentials.authentication.key =
-            (const char*) cfg->credentials.authentication.key,
-        .credentials.authentication.key_len = cfg->credentials.authentication.key_len,
+        .network.transport = transport,
+        /* A fleet losing the broker together would retry in lockstep with
+         a fixed timeout, see reconnect_backoff_next*/
+        .network.reconnect_timeout_ms = fleet_backoff_next(&reconnect_backoff),
         .session.last_will = {
              .topic = "v1/devices/me/attributes", /* Tópico LWT*/
-             .msg = "{\"status\":\"disconnected\"}", /* Mensaje LWT*/
+             .msg = config->last_will, /* Mensaje LWT*/
+             .msg_len = config->last_will_len,
              .qos = 1, /* QoS del mensaje LWT*/
              .retain = 0, /* No retener el mensaje LWT*/
         },
+        /* The mqtt_outbox hands at most CONFIG_MQTT_OUTBOX_MAX_INFLIGHT messages at a time, this
+         only guards against the few messages published straight to the client*/
+        .outbox.limit = (CONFIG_MQTT_OUTBOX_MAX_INFLIGHT + 4) * CONFIG_MQTT_OUTBOX_SLOT_BYTES,
     };
 
     client = esp_mqtt_client_init(&mqtt_cfg);
     if (client == NULL) {
         return ESP_FAIL;
     }
+    ESP_RETURN_ON_ERROR(mqtt_outbox_init(event_loop, client), TAG, "could not init the outbox");
 
     for (int i = 0; i < mqtt_registered_events_len; i++)
     {
@@ -373,23 +745,177 @@ esp_err_t mqtt_init(
     return ESP_OK;
 }
 
+esp_err_t mqtt_init(
+    esp_event_loop_handle_t loop,
+    thingsboard_cfg_t *cfg,
+    const thingsboard_shared_attributes_t *cached_attributes
+) {
+    event_loop = loop;
+    /* The router keeps the routes across inits, a failed init resumes
+     after the ones already added*/
+    for (; mqtt_routes_registered < mqtt_routes_len; mqtt_routes_registered++)
+    {
+        ESP_RETURN_ON_ERROR(
+            mqtt_router_register(&mqtt_routes[mqtt_routes_registered]),
+            TAG,
+            "could not route %s",
+            mqtt_routes[mqtt_routes_registered].topic
+        );
+    }
+    ESP_RETURN_ON_ERROR(encode_attribute_payloads(), TAG, "could not encode attribute payloads");
+    shared_attributes_cache = (thingsboard_shared_attributes_t) {
+        .version = shared_attributes_version(),
+    };
+    if (cached_attributes != NULL && cached_attributes->version == shared_attributes_cache.version) {
+        runtime_config_update_t update = { 0 };
+        shared_attributes_cache = *cached_attributes;
+        for (size_t i = 0; i < runtime_config_len(); i++)
+        {
+            if (!(shared_attributes_cache.present & (1u << i))) {
+                continue;
+            }
+            /* The ranges may have changed since it was cached*/
+            if (runtime_config_stage(&update, i, runtime_config_entry(i)->type, shared_attributes_cache.values[i]) != ESP_OK) {
+                shared_attributes_cache.present &= ~(1u << i);
+            }
+        }
+        if (update.set != 0) {
+            ESP_LOGI(TAG, "Applying cached settings 0x%" PRIx32, update.set);
+            if (esp_event_post_to(event_loop, MQTT_THINGSBOARD_EVENT, MQTT_RUNTIME_CONFIG_UPDATE, &update, sizeof(update), RUNTIME_CONFIG_POST_WAIT) != ESP_OK) {
+                ESP_LOGW(TAG, "Event loop full, cached settings left to the server response");
+                /* Not filtered out of the response as applied*/
+                shared_attributes_cache.present = 0;
+            }
+        }
+    } else if (cached_attributes != NULL) {
+        ESP_LOGI(TAG, "Cached shared attributes belong to other keys, ignoring them");
+    }
+#if CONFIG_MQTT_ROUTER_BENCHMARK
+    static const char *const benchmark_topics[] = {
+        DEVICE_ATTRIBUTES_TOPIC,
+        DEVICE_ATTRIBUTES_RESPONSE_RET "12345",
+        DEVICE_RPC_REQUEST_RET "42",
+        "v1/devices/me/unknown/topic",
+    };
+    mqtt_router_benchmark(benchmark_topics, sizeof(benchmark_topics) / sizeof(benchmark_topics[0]), ROUTER_BENCHMARK_ITERATIONS);
+#endif
+    uplink_config = (uplink_config_t) {
+        .loop = event_loop,
+        .cfg = cfg,
+        .last_will = (const char*) last_will_msg,
+        .last_will_len = last_will_msg_len,
+        .on_connected = request_shared_attributes,
+    };
+#if CONFIG_UPLINK_TRANSPORT_COAP
+    uplink = &uplink_coap;
+#if !CONFIG_UPLINK_COAP_DTLS
+    /* Plain CoAP names the device by its access token, MQTT by its certificate*/
+    if (cfg->credentials.access_token == NULL || cfg->credentials.access_token[0] == '\0') {
+        ESP_LOGW(TAG, "No access token provisioned, plain CoAP disabled, using MQTT");
+        uplink = &uplink_mqtt;
+    }
+#endif
+#else
+    uplink = &uplink_mqtt;
+#endif
+    ESP_RETURN_ON_ERROR(uplink->init(&uplink_config), TAG, "could not start the %s transport", uplink->name);
+    return ESP_OK;
+}
+
+static esp_err_t mqtt_uplink_start(void)
+{
+    fleet_backoff_reset(&reconnect_backoff);
+    reconnect_backoff_next();
+    ESP_RETURN_ON_ERROR(esp_mqtt_client_start(client), TAG, "could not start mqtt client");
+    return ESP_OK;
+}
+
+static esp_err_t mqtt_uplink_stop(void)
+{
+    ESP_RETURN_ON_ERROR(esp_mqtt_client_stop(client), TAG, "could not stop mqtt client");
+    /* The client may not report a session it closes itself*/
+    post_broker_event(MQTT_BROKER_DISCONNECTED, NULL, 0);
+    return ESP_OK;
+}
+
+static void mqtt_uplink_get_stats(uplink_stats_t *stats)
+{
+    mqtt_outbox_stats_t outbox;
+    tls_session_stats_t tls;
+
+    mqtt_outbox_get_stats(&outbox);
+    tls_session_get_stats(&tls);
+    *stats = (uplink_stats_t) {
+        .name = uplink_mqtt.name,
+        .uploads = outbox.delivered,
+        .failures = outbox.dropped,
+        .retransmits = outbox.retransmits,
+        .tx_bytes = tls.tx_bytes,
+        .rx_bytes = tls.rx_bytes,
+        .latency_us = outbox.time_in_outbox_us,
+        .max_latency_us = outbox.max_time_in_outbox_us,
+    };
+}
+
+static size_t mqtt_uplink_pending(void)
+{
+    mqtt_outbox_stats_t outbox;
+
+    mqtt_outbox_get_stats(&outbox);
+    return outbox.slots_used;
+}
+
+const uplink_transport_t uplink_mqtt = {
+    .name = "mqtt",
+    .init = mqtt_uplink_init,
+    .start = mqtt_uplink_start,
+    .stop = mqtt_uplink_stop,
+    .publish = mqtt_outbox_publish,
+    .request_attributes = mqtt_request_attributes,
+    .pending = mqtt_uplink_pending,
+    .get_stats = mqtt_uplink_get_stats,
+};
+
+esp_err_t mqtt_start(void)
+{
+    return uplink->start();
+}
+
+esp_err_t mqtt_stop(void)
+{
+    return uplink->stop();
+}
 
 esp_err_t mqtt_publish(
     char* data,
     size_t data_len
 ) {
-    int msg_id = esp_mqtt_client_publish(
-        client,
-        DEVICE_TELEMETRY_TOPIC,
-        data,
-        data_len,
-        1,
-        0
+    return mqtt_publish_topic(DEVICE_TELEMETRY_TOPIC, data, data_len, NULL);
+}
+
+esp_err_t mqtt_publish_topic(
+    const char* topic,
+    const char* data,
+    size_t data_len,
+    int* id
+) {
+    ESP_RETURN_ON_ERROR(
+        uplink->publish(topic, data, data_len, id),
+        TAG,
+        "%d bytes to %s not admitted",
+        (int) data_len,
+        topic
     );
-    if (msg_id < 0) {
-        return ESP_FAIL;
-    } else {
-        ESP_LOGI(TAG, "Telemetry sent:\n%.*s",(int) data_len, data);
-        return ESP_OK;
-    }
+    ESP_LOGI(TAG, "Queued %d bytes to %s", (int) data_len, topic);
+    return ESP_OK;
+}
+
+size_t uplink_pending(void)
+{
+    return uplink == NULL ? 0 : uplink->pending();
+}
+
+void uplink_get_stats(uplink_stats_t *stats)
+{
+    uplink->get_stats(stats);
 }
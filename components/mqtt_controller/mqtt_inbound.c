@@ -0,0 +1,361 @@
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "mqtt_client.h"
+#include "mqtt_inbound.h"
+
+static const char *TAG = "mqtt_inbound";
+
+typedef enum {
+    INBOUND_IDLE,
+    INBOUND_COLLECTING,
+    INBOUND_DISCARDING,
+} mqtt_inbound_state_t;
+
+typedef struct {
+    const char *pos;
+    const char *end;
+    mqtt_json_member_cb_t cb;
+    void *ctx;
+} mqtt_json_scanner_t;
+
+static mqtt_inbound_state_t inbound_state = INBOUND_IDLE;
+static size_t inbound_total_len;
+static mqtt_inbound_message_t inbound_message;
+
+static void inbound_start(const esp_mqtt_event_handle_t event, mqtt_inbound_topic_filter_t filter)
+{
+    inbound_state = INBOUND_DISCARDING;
+    inbound_total_len = event->total_data_len;
+
+    /* The topic only comes with the first fragment*/
+    if (event->topic_len <= 0 || event->topic_len > MQTT_INBOUND_MAX_TOPIC_LEN
+        || !filter(event->topic, event->topic_len))
+    {
+        ESP_LOGD(TAG, "Ignoring topic %.*s", event->topic_len, event->topic);
+        return;
+    }
+    if (inbound_total_len > CONFIG_MQTT_INBOUND_MAX_DATA_LEN)
+    {
+        ESP_LOGW(
+            TAG,
+            "Dropping %d bytes message on %.*s, limit is %d",
+            (int)inbound_total_len,
+            event->topic_len,
+            event->topic,
+            CONFIG_MQTT_INBOUND_MAX_DATA_LEN
+        );
+        return;
+    }
+
+    memcpy(inbound_message.topic, event->topic, event->topic_len);
+    inbound_message.topic[event->topic_len] = '\0';
+    inbound_message.topic_len = event->topic_len;
+    inbound_message.data_len = 0;
+    inbound_state = INBOUND_COLLECTING;
+}
+
+const mqtt_inbound_message_t *mqtt_inbound_feed(
+    const esp_mqtt_event_handle_t event,
+    mqtt_inbound_topic_filter_t filter
+)
+{
+    size_t offset = event->current_data_offset;
+    size_t fragment_len = event->data_len;
+
+    if (offset == 0)
+    {
+        inbound_start(event, filter);
+    }
+    else if (inbound_state == INBOUND_COLLECTING
+             && offset != inbound_message.data_len)
+    {
+        ESP_LOGW(TAG, "Fragment at %d out of sequence, dropping", (int)offset);
+        inbound_state = INBOUND_DISCARDING;
+    }
+
+    if (inbound_state != INBOUND_COLLECTING)
+    {
+        if (offset + fragment_len >= inbound_total_len)
+        {
+            inbound_state = INBOUND_IDLE;
+        }
+        return NULL;
+    }
+
+    if (fragment_len > inbound_total_len - inbound_message.data_len)
+    {
+        ESP_LOGW(TAG, "Fragment exceeds announced length, dropping");
+        inbound_state = INBOUND_IDLE;
+        return NULL;
+    }
+    memcpy(&inbound_message.data[inbound_message.data_len], event->data, fragment_len);
+    inbound_message.data_len += fragment_len;
+
+    if (inbound_message.data_len < inbound_total_len)
+    {
+        return NULL;
+    }
+    inbound_message.data[inbound_message.data_len] = '\0';
+    inbound_state = INBOUND_IDLE;
+    return &inbound_message;
+}
+
+static void json_skip_whitespace(mqtt_json_scanner_t *s)
+{
+    while (s->pos < s->end
+           && (*s->pos == ' ' || *s->pos == '\t' || *s->pos == '\n'
+               || *s->pos == '\r'))
+    {
+        s->pos++;
+    }
+}
+
+static bool json_consume(mqtt_json_scanner_t *s, char c)
+{
+    json_skip_whitespace(s);
+    if (s->pos < s->end && *s->pos == c)
+    {
+        s->pos++;
+        return true;
+    }
+    return false;
+}
+
+/* Leaves the string without quotes in value, escapes are skipped not decoded*/
+static esp_err_t json_scan_string(mqtt_json_scanner_t *s, const char **value, size_t *value_len)
+{
+    if (!json_consume(s, '"'))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *value = s->pos;
+    while (s->pos < s->end && *s->pos != '"')
+    {
+        if (*s->pos == '\\')
+        {
+            s->pos++;
+        }
+        s->pos++;
+    }
+    if (s->pos >= s->end)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *value_len = s->pos - *value;
+    s->pos++;
+    return ESP_OK;
+}
+
+static esp_err_t json_scan_scalar(mqtt_json_scanner_t *s, mqtt_json_member_t *member)
+{
+    static const struct {
+        const char *literal;
+        size_t len;
+        mqtt_json_type_t type;
+    } literals[] = {
+        { "true", 4, MQTT_JSON_TRUE },
+        { "false", 5, MQTT_JSON_FALSE },
+        { "null", 4, MQTT_JSON_NULL },
+    };
+
+    json_skip_whitespace(s);
+    if (s->pos >= s->end)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (*s->pos == '"')
+    {
+        member->type = MQTT_JSON_STRING;
+        return json_scan_string(s, &member->value, &member->value_len);
+    }
+    for (int i = 0; i < sizeof(literals) / sizeof(literals[0]); i++)
+    {
+        if ((size_t)(s->end - s->pos) >= literals[i].len
+            && memcmp(s->pos, literals[i].literal, literals[i].len) == 0)
+        {
+            member->type = literals[i].type;
+            member->value = s->pos;
+            member->value_len = literals[i].len;
+            s->pos += literals[i].len;
+            return ESP_OK;
+        }
+    }
+
+    member->type = MQTT_JSON_NUMBER;
+    member->value = s->pos;
+    while (s->pos < s->end
+           && ((*s->pos >= '0' && *s->pos <= '9') || *s->pos == '-'
+               || *s->pos == '+' || *s->pos == '.' || *s->pos == 'e'
+               || *s->pos == 'E'))
+    {
+        s->pos++;
+    }
+    member->value_len = s->pos - member->value;
+    return member->value_len > 0 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+static esp_err_t json_scan_container(
+    mqtt_json_scanner_t *s,
+    const char *parent,
+    size_t parent_len,
+    int depth
+);
+
+/* Members of a nested container are reported with key as parent, array
+ elements have no key so they keep the parent and scalars are not reported*/
+static esp_err_t json_scan_value(
+    mqtt_json_scanner_t *s,
+    const char *parent,
+    size_t parent_len,
+    const char *key,
+    size_t key_len,
+    int depth
+)
+{
+    mqtt_json_member_t member;
+
+    json_skip_whitespace(s);
+    if (s->pos < s->end && (*s->pos == '{' || *s->pos == '['))
+    {
+        return key != NULL
+            ? json_scan_container(s, key, key_len, depth + 1)
+            : json_scan_container(s, parent, parent_len, depth + 1);
+    }
+    esp_err_t err = json_scan_scalar(s, &member);
+    if (err != ESP_OK || key == NULL)
+    {
+        return err;
+    }
+    member.parent = parent;
+    member.parent_len = parent_len;
+    member.key = key;
+    member.key_len = key_len;
+    s->cb(&member, s->ctx);
+    return ESP_OK;
+}
+
+static esp_err_t json_scan_container(
+    mqtt_json_scanner_t *s,
+    const char *parent,
+    size_t parent_len,
+    int depth
+)
+{
+    const char *key = NULL;
+    size_t key_len = 0;
+    bool is_object;
+    char close;
+
+    if (depth > MQTT_JSON_MAX_DEPTH)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    is_object = json_consume(s, '{');
+    if (!is_object && !json_consume(s, '['))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    close = is_object ? '}' : ']';
+    if (json_consume(s, close))
+    {
+        return ESP_OK;
+    }
+
+    do
+    {
+        esp_err_t err;
+        if (is_object)
+        {
+            if (json_scan_string(s, &key, &key_len) != ESP_OK
+                || !json_consume(s, ':'))
+            {
+                return ESP_ERR_INVALID_ARG;
+            }
+            err = json_scan_value(s, parent, parent_len, key, key_len, depth);
+        }
+        else
+        {
+            /* Objects in arrays keep the key of the array as parent*/
+            err = json_scan_value(s, parent, parent_len, NULL, 0, depth);
+        }
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    } while (json_consume(s, ','));
+
+    return json_consume(s, close) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t mqtt_json_scan(
+    const char *json,
+    size_t len,
+    mqtt_json_member_cb_t cb,
+    void *ctx
+)
+{
+    mqtt_json_scanner_t s = {
+        .pos = json,
+        .end = json + len,
+        .cb = cb,
+        .ctx = ctx,
+    };
+    return json_scan_container(&s, NULL, 0, 1);
+}
+
+bool mqtt_json_equals(const char *s, size_t s_len, const char *expected)
+{
+    return s != NULL && strncmp(s, expected, s_len) == 0
+           && expected[s_len] == '\0';
+}
+
+esp_err_t mqtt_json_to_int(const mqtt_json_member_t *member, int *value)
+{
+    const char *p = member->value;
+    const char *end = member->value + member->value_len;
+    bool negative = false;
+    int64_t result = 0;
+
+    if (member->type != MQTT_JSON_NUMBER)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (p < end && *p == '-')
+    {
+        negative = true;
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9')
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        result = result * 10 + (*p - '0');
+        if (result > (int64_t)INT_MAX + 1)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    /* Fractions are truncated, exponents are not expected in attributes*/
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+        }
+    }
+    if (p != end)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    result = negative ? -result : result;
+    if (result > INT_MAX || result < INT_MIN)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *value = (int)result;
+    return ESP_OK;
+}
@@ -0,0 +1,297 @@
+#include <string.h>
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mqtt_client.h"
+#include "mqtt_controller.h"
+#include "mqtt_outbox.h"
+
+#define OUTBOX_MAX_TOPIC_LEN 64
+
+static const char *TAG = "mqtt_outbox";
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_QUEUED,   /* Waiting to be handed to the client*/
+    SLOT_INFLIGHT, /* Handed, waiting for the PUBACK*/
+} mqtt_outbox_slot_state_t;
+
+typedef struct {
+    mqtt_outbox_slot_state_t state;
+    int id;
+    int msg_id;
+    char topic[OUTBOX_MAX_TOPIC_LEN + 1];
+    size_t len;
+    int64_t admitted_at;
+    char data[CONFIG_MQTT_OUTBOX_SLOT_BYTES];
+} mqtt_outbox_slot_t;
+
+static esp_event_loop_handle_t outbox_event_loop;
+static esp_mqtt_client_handle_t outbox_client;
+static mqtt_outbox_slot_t outbox_slots[CONFIG_MQTT_OUTBOX_SLOTS];
+static mqtt_outbox_stats_t outbox_stats;
+static size_t outbox_inflight_len;
+static int outbox_next_id = 1;
+static bool outbox_connected;
+static bool outbox_full;
+
+static void outbox_post(mqtt_thingsboard_event_t event_id, const void *data, size_t data_len)
+{
+    if (esp_event_post_to(outbox_event_loop, MQTT_THINGSBOARD_EVENT, event_id, data, data_len, 0) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not post outbox event %d", event_id);
+    }
+}
+
+static void outbox_free(mqtt_outbox_slot_t *slot)
+{
+    if (slot->state == SLOT_INFLIGHT)
+    {
+        outbox_inflight_len--;
+    }
+    slot->state = SLOT_FREE;
+    outbox_stats.slots_used--;
+    if (outbox_full && outbox_stats.slots_used <= CONFIG_MQTT_OUTBOX_SLOTS / 2)
+    {
+        outbox_full = false;
+        outbox_post(MQTT_OUTBOX_AVAILABLE, NULL, 0);
+    }
+}
+
+/* Oldest queued slot with an id above after, NULL if none*/
+static mqtt_outbox_slot_t *outbox_oldest_queued(int after)
+{
+    mqtt_outbox_slot_t *oldest = NULL;
+
+    for (size_t i = 0; i < CONFIG_MQTT_OUTBOX_SLOTS; i++)
+    {
+        if (outbox_slots[i].state == SLOT_QUEUED && outbox_slots[i].id > after
+            && (oldest == NULL || outbox_slots[i].id < oldest->id))
+        {
+            oldest = &outbox_slots[i];
+        }
+    }
+    return oldest;
+}
+
+static void outbox_drain(void)
+{
+    mqtt_outbox_slot_t *slot;
+
+    while (outbox_connected && outbox_inflight_len < CONFIG_MQTT_OUTBOX_MAX_INFLIGHT
+           && (slot = outbox_oldest_queued(0)) != NULL)
+    {
+        int msg_id = esp_mqtt_client_publish(outbox_client, slot->topic, slot->data, slot->len, 1, 0);
+        if (msg_id < 0)
+        {
+            return;
+        }
+        slot->msg_id = msg_id;
+        slot->state = SLOT_INFLIGHT;
+        outbox_inflight_len++;
+    }
+}
+
+static mqtt_outbox_slot_t *outbox_find_inflight(int msg_id)
+{
+    for (size_t i = 0; i < CONFIG_MQTT_OUTBOX_SLOTS; i++)
+    {
+        if (outbox_slots[i].state == SLOT_INFLIGHT && outbox_slots[i].msg_id == msg_id)
+        {
+            return &outbox_slots[i];
+        }
+    }
+    return NULL;
+}
+
+/* Make room in a full pool according to the policy, false if the new
+ message has to be refused*/
+static bool outbox_make_room(void)
+{
+#if CONFIG_MQTT_OUTBOX_POLICY_DROP_OLDEST
+    mqtt_outbox_slot_t *oldest = outbox_oldest_queued(0);
+    if (oldest == NULL)
+    {
+        return false;
+    }
+    outbox_free(oldest);
+    outbox_stats.dropped++;
+    return true;
+#elif CONFIG_MQTT_OUTBOX_POLICY_DOWNSAMPLE
+    /* Halve the resolution of the queued messages keeping the oldest*/
+    mqtt_outbox_slot_t *slot = outbox_oldest_queued(0);
+    bool freed = false;
+    while (slot != NULL)
+    {
+        mqtt_outbox_slot_t *drop = outbox_oldest_queued(slot->id);
+        if (drop == NULL)
+        {
+            break;
+        }
+        slot = outbox_oldest_queued(drop->id);
+        outbox_free(drop);
+        outbox_stats.dropped++;
+        freed = true;
+    }
+    return freed;
+#else
+    return false;
+#endif
+}
+
+esp_err_t mqtt_outbox_publish(const char *topic, const char *data, size_t len, int *id)
+{
+    mqtt_outbox_slot_t *slot = NULL;
+
+    if (len > CONFIG_MQTT_OUTBOX_SLOT_BYTES || strlen(topic) > OUTBOX_MAX_TOPIC_LEN)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (outbox_stats.slots_used == CONFIG_MQTT_OUTBOX_SLOTS && !outbox_make_room())
+    {
+        outbox_stats.rejected++;
+        return ESP_ERR_NO_MEM;
+    }
+    for (size_t i = 0; slot == NULL; i++)
+    {
+        if (outbox_slots[i].state == SLOT_FREE)
+        {
+            slot = &outbox_slots[i];
+        }
+    }
+
+    memcpy(slot->data, data, len);
+    slot->len = len;
+    strcpy(slot->topic, topic);
+    slot->id = outbox_next_id++;
+    slot->admitted_at = esp_timer_get_time();
+    slot->state = SLOT_QUEUED;
+    outbox_stats.admitted++;
+    outbox_stats.slots_used++;
+    if (outbox_stats.slots_used > outbox_stats.slots_peak)
+    {
+        outbox_stats.slots_peak = outbox_stats.slots_used;
+    }
+    if (id != NULL)
+    {
+        *id = slot->id;
+    }
+    if (!outbox_full && outbox_stats.slots_used == CONFIG_MQTT_OUTBOX_SLOTS)
+    {
+        outbox_full = true;
+        ESP_LOGW(TAG, "Outbox full, %d messages in flight", (int)outbox_inflight_len);
+        outbox_post(MQTT_OUTBOX_FULL, NULL, 0);
+    }
+
+    outbox_drain();
+    return ESP_OK;
+}
+
+static void outbox_on_connected(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    outbox_connected = true;
+    outbox_drain();
+}
+
+static void outbox_on_disconnected(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    /* Messages in flight stay in the client outbox and are sent again by
+     the client after reconnecting*/
+    outbox_connected = false;
+}
+
+static void outbox_on_puback(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    mqtt_outbox_slot_t *slot = outbox_find_inflight(*((int *)event_data));
+
+    if (slot == NULL)
+    {
+        return;
+    }
+    int64_t time_in_outbox = esp_timer_get_time() - slot->admitted_at;
+    int id = slot->id;
+    outbox_stats.delivered++;
+    outbox_stats.time_in_outbox_us += time_in_outbox;
+    if (time_in_outbox > outbox_stats.max_time_in_outbox_us)
+    {
+        outbox_stats.max_time_in_outbox_us = time_in_outbox;
+    }
+    outbox_free(slot);
+    outbox_post(MQTT_OUTBOX_DELIVERED, &id, sizeof(id));
+    outbox_drain();
+}
+
+static void outbox_on_deleted(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    mqtt_outbox_slot_t *slot = outbox_find_inflight(*((int *)event_data));
+
+    /* The client expired it, hand it again*/
+    if (slot == NULL)
+    {
+        return;
+    }
+    slot->state = SLOT_QUEUED;
+    outbox_inflight_len--;
+    outbox_stats.retransmits++;
+    outbox_drain();
+}
+
+static const mqtt_thingsboard_event_handler_register_t outbox_registered_events[] = {
+    { MQTT_BROKER_CONNECTED, outbox_on_connected },
+    { MQTT_BROKER_DISCONNECTED, outbox_on_disconnected },
+    { MQTT_BROKER_PUBACK, outbox_on_puback },
+    { MQTT_BROKER_DELETED, outbox_on_deleted },
+};
+
+static const size_t outbox_registered_events_len =
+    sizeof(outbox_registered_events) / sizeof(outbox_registered_events[0]);
+
+esp_err_t mqtt_outbox_init(esp_event_loop_handle_t loop, esp_mqtt_client_handle_t client)
+{
+    outbox_event_loop = loop;
+    outbox_client = client;
+
+    for (int i = 0; i < outbox_registered_events_len; i++)
+    {
+        ESP_RETURN_ON_ERROR(
+            esp_event_handler_register_with(
+                outbox_event_loop,
+                MQTT_THINGSBOARD_EVENT,
+                outbox_registered_events[i].event_id,
+                outbox_registered_events[i].event_handler,
+                NULL
+            ),
+            TAG,
+            "Could not register handler %d",
+            outbox_registered_events[i].event_id
+        );
+    }
+    return ESP_OK;
+}
+
+void mqtt_outbox_get_stats(mqtt_outbox_stats_t *stats)
+{
+    *stats = outbox_stats;
+}
@@ -0,0 +1,169 @@
+#include <inttypes.h>
+#include <string.h>
+#include "esp_cpu.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "mqtt_router.h"
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+#define MAX_ID_DIGITS 9
+
+static const char *TAG = "mqtt_router";
+
+typedef struct {
+    const mqtt_route_t *route;
+    uint32_t hash;
+    size_t topic_len;
+} mqtt_router_entry_t;
+
+/* Open addressing with linear probing, one slot is always left empty so
+ a miss ends on it*/
+static mqtt_router_entry_t router_table[CONFIG_MQTT_ROUTER_TABLE_SIZE];
+static size_t router_table_len;
+
+static uint32_t router_hash(const char *topic, size_t topic_len, mqtt_route_match_t match)
+{
+    uint32_t hash = FNV_OFFSET_BASIS ^ match;
+    for (size_t i = 0; i < topic_len; i++)
+    {
+        hash ^= (uint8_t)topic[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static const mqtt_route_t *router_find(
+    const char *topic,
+    size_t topic_len,
+    mqtt_route_match_t match
+)
+{
+    uint32_t hash = router_hash(topic, topic_len, match);
+
+    for (size_t i = hash % CONFIG_MQTT_ROUTER_TABLE_SIZE;
+         router_table[i].route != NULL;
+         i = (i + 1) % CONFIG_MQTT_ROUTER_TABLE_SIZE)
+    {
+        const mqtt_router_entry_t *entry = &router_table[i];
+        if (entry->hash == hash && entry->topic_len == topic_len
+            && entry->route->match == match
+            && memcmp(entry->route->topic, topic, topic_len) == 0)
+        {
+            return entry->route;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t mqtt_router_register(const mqtt_route_t *route)
+{
+    size_t topic_len = strlen(route->topic);
+    uint32_t hash = router_hash(route->topic, topic_len, route->match);
+    size_t i;
+
+    if (router_find(route->topic, topic_len, route->match) != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (router_table_len + 1 >= CONFIG_MQTT_ROUTER_TABLE_SIZE)
+    {
+        ESP_LOGE(TAG, "No room for %s", route->topic);
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (i = hash % CONFIG_MQTT_ROUTER_TABLE_SIZE;
+         router_table[i].route != NULL;
+         i = (i + 1) % CONFIG_MQTT_ROUTER_TABLE_SIZE)
+    {
+    }
+    router_table[i] = (mqtt_router_entry_t) {
+        .route = route,
+        .hash = hash,
+        .topic_len = topic_len,
+    };
+    router_table_len++;
+    return ESP_OK;
+}
+
+const mqtt_route_t *mqtt_router_lookup(const char *topic, size_t topic_len, uint32_t *id)
+{
+    const mqtt_route_t *route = router_find(topic, topic_len, MQTT_ROUTE_EXACT);
+    size_t prefix_len = topic_len;
+    uint32_t value = 0;
+
+    *id = 0;
+    if (route != NULL)
+    {
+        return route;
+    }
+
+    while (prefix_len > 0 && topic[prefix_len - 1] >= '0' && topic[prefix_len - 1] <= '9')
+    {
+        prefix_len--;
+    }
+    if (prefix_len == topic_len || topic_len - prefix_len > MAX_ID_DIGITS
+        || prefix_len == 0 || topic[prefix_len - 1] != '/')
+    {
+        return NULL;
+    }
+    for (size_t i = prefix_len; i < topic_len; i++)
+    {
+        value = value * 10 + (topic[i] - '0');
+    }
+
+    route = router_find(topic, prefix_len, MQTT_ROUTE_ID);
+    if (route != NULL)
+    {
+        *id = value;
+    }
+    return route;
+}
+
+bool mqtt_router_accepts(const char *topic, size_t topic_len)
+{
+    uint32_t id;
+    return mqtt_router_lookup(topic, topic_len, &id) != NULL;
+}
+
+esp_err_t mqtt_router_dispatch(
+    const char *topic,
+    size_t topic_len,
+    const char *data,
+    size_t data_len
+)
+{
+    uint32_t id;
+    const mqtt_route_t *route = mqtt_router_lookup(topic, topic_len, &id);
+
+    if (route == NULL)
+    {
+        ESP_LOGD(TAG, "No route for %.*s", (int)topic_len, topic);
+        return ESP_ERR_NOT_FOUND;
+    }
+    route->handler(id, data, data_len);
+    return ESP_OK;
+}
+
+void mqtt_router_benchmark(const char *const *topics, size_t n, uint32_t iterations)
+{
+    for (size_t t = 0; t < n; t++)
+    {
+        size_t topic_len = strlen(topics[t]);
+        uint32_t id;
+        const mqtt_route_t *route = NULL;
+        uint32_t start = esp_cpu_get_cycle_count();
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+            route = mqtt_router_lookup(topics[t], topic_len, &id);
+        }
+        uint32_t cycles = esp_cpu_get_cycle_count() - start;
+        ESP_LOGI(
+            TAG,
+            "%s: %" PRIu32 " cycles per message (%s)",
+            topics[t],
+            cycles / iterations,
+            route != NULL ? "routed" : "rejected"
+        );
+    }
+}
@@ -0,0 +1,113 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mqtt_client.h"
+#include "mqtt_inbound.h"
+#include "mqtt_rpc.h"
+
+#define RPC_RESPONSE_TOPIC "v1/devices/me/rpc/response/"
+#define RPC_MAX_TOPIC_LEN 48
+
+static const char *TAG = "mqtt_rpc";
+
+static const mqtt_rpc_method_t *rpc_methods[CONFIG_MQTT_RPC_MAX_METHODS];
+static size_t rpc_methods_len;
+
+/* Requests are answered one at a time by the MQTT task*/
+static char rpc_response[CONFIG_MQTT_RPC_RESPONSE_LEN];
+
+/* Method of a received request*/
+typedef struct {
+    const char *method;
+    size_t method_len;
+} rpc_request_scan_t;
+
+static void find_method(const mqtt_json_member_t *member, void *ctx)
+{
+    rpc_request_scan_t *scan = ctx;
+
+    if (member->parent == NULL && member->type == MQTT_JSON_STRING
+        && mqtt_json_equals(member->key, member->key_len, "method"))
+    {
+        scan->method = member->value;
+        scan->method_len = member->value_len;
+    }
+}
+
+static const mqtt_rpc_method_t *rpc_find(const char *method, size_t method_len)
+{
+    for (size_t i = 0; i < rpc_methods_len; i++)
+    {
+        if (mqtt_json_equals(method, method_len, rpc_methods[i]->method))
+        {
+            return rpc_methods[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t mqtt_rpc_register(const mqtt_rpc_method_t *method)
+{
+    if (rpc_find(method->method, strlen(method->method)) != NULL)
+    {
+        ESP_LOGE(TAG, "Method %s already registered", method->method);
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (rpc_methods_len == CONFIG_MQTT_RPC_MAX_METHODS)
+    {
+        ESP_LOGE(TAG, "No room for method %s", method->method);
+        return ESP_ERR_NO_MEM;
+    }
+    rpc_methods[rpc_methods_len++] = method;
+    return ESP_OK;
+}
+
+void mqtt_rpc_dispatch(esp_mqtt_client_handle_t client, uint32_t id, const char *data, size_t data_len)
+{
+    rpc_request_scan_t scan = { .method = NULL };
+    const mqtt_rpc_method_t *method = NULL;
+    char response_topic[RPC_MAX_TOPIC_LEN];
+    size_t response_len = 0;
+    int64_t started_at = esp_timer_get_time();
+    esp_err_t err;
+
+    if (mqtt_json_scan(data, data_len, find_method, &scan) != ESP_OK || scan.method == NULL)
+    {
+        err = ESP_ERR_INVALID_ARG;
+    }
+    else if ((method = rpc_find(scan.method, scan.method_len)) == NULL)
+    {
+        err = ESP_ERR_NOT_SUPPORTED;
+    }
+    else
+    {
+        err = method->handler(data, data_len, rpc_response, sizeof(rpc_response), &response_len);
+        if (err == ESP_OK && response_len >= sizeof(rpc_response))
+        {
+            err = ESP_ERR_INVALID_SIZE;
+        }
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "RPC request %" PRIu32 " failed: %s", id, esp_err_to_name(err));
+        response_len = snprintf(rpc_response, sizeof(rpc_response), "{\"error\":\"%s\"}", esp_err_to_name(err));
+    }
+
+    snprintf(response_topic, sizeof(response_topic), "%s%" PRIu32, RPC_RESPONSE_TOPIC, id);
+    esp_mqtt_client_publish(client, response_topic, rpc_response, response_len, 0, 0);
+
+    int64_t elapsed_ms = (esp_timer_get_time() - started_at) / 1000;
+    if (elapsed_ms > CONFIG_MQTT_RPC_BUDGET_MS)
+    {
+        ESP_LOGW(
+            TAG,
+            "RPC %.*s took %d ms",
+            method == NULL ? 0 : (int)scan.method_len,
+            method == NULL ? "" : scan.method,
+            (int)elapsed_ms
+        );
+    }
+}
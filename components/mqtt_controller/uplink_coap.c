@@ -0,0 +1,736 @@
+#include "sdkconfig.h"
+#if CONFIG_UPLINK_TRANSPORT_COAP
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "mbedtls/net_sockets.h"
+#if CONFIG_UPLINK_COAP_DTLS
+#include "mbedtls/ssl.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+#endif
+#include "coap_message.h"
+#include "fleet.h"
+#include "mqtt_controller.h"
+#include "mqtt_router.h"
+#include "power_manager.h"
+#include "uplink.h"
+
+#define COAP_TASK_PRIORITY 5
+#if CONFIG_UPLINK_COAP_DTLS
+#define COAP_TASK_STACK 8192
+#else
+#define COAP_TASK_STACK 4096
+#endif
+#define COAP_TOKEN_LEN 4
+/* Room for the header, token and options besides the payload*/
+#define COAP_DATAGRAM_LEN (CONFIG_MQTT_OUTBOX_SLOT_BYTES + 128)
+/* IPv4 and UDP headers, counted with every datagram in the radio time*/
+#define COAP_IP_UDP_HEADER_LEN 28
+#define COAP_MAX_PATH_LEN 96
+#define COAP_MAX_QUERY_LEN 128
+#define COAP_MAX_TOPIC_LEN 64
+/* ACK_RANDOM_FACTOR of RFC 7252, 1.5*/
+#define COAP_ACK_RANDOM_PERCENT 50
+/* Wait for a separate response once the request is acknowledged*/
+#define COAP_SEPARATE_TIMEOUT_MS (CONFIG_UPLINK_COAP_ACK_TIMEOUT_MS << CONFIG_UPLINK_COAP_MAX_RETRANSMIT)
+#define DEVICE_ATTRIBUTES_TOPIC "v1/devices/me/attributes"
+#define DEVICE_ATTRIBUTES_RESPONSE_RET "v1/devices/me/attributes/response/"
+
+#if CONFIG_TELEMETRY_CODEC_FORMAT_PROTOBUF
+#define COAP_CONTENT_FORMAT COAP_CONTENT_FORMAT_OCTET_STREAM
+#elif CONFIG_TELEMETRY_CODEC_FORMAT_CBOR
+#define COAP_CONTENT_FORMAT COAP_CONTENT_FORMAT_CBOR
+#else
+#define COAP_CONTENT_FORMAT COAP_CONTENT_FORMAT_JSON
+#endif
+
+static const char *TAG = "uplink_coap";
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_QUEUED,
+} coap_slot_state_t;
+
+typedef struct {
+    coap_slot_state_t state;
+    int id;
+    const char *resource; /* telemetry or attributes*/
+    size_t len;
+    int64_t admitted_at;
+    char data[CONFIG_MQTT_OUTBOX_SLOT_BYTES];
+} coap_slot_t;
+
+static const uplink_config_t *coap_config;
+static TaskHandle_t coap_task_handle;
+static SemaphoreHandle_t coap_lock;
+static coap_slot_t coap_slots[CONFIG_UPLINK_COAP_SLOTS];
+static size_t coap_slots_used;
+static int coap_next_id = 1;
+static bool coap_full;
+/* Pending shared attributes request, sent before the next publish*/
+static int coap_request_id;
+static char coap_request_keys[COAP_MAX_QUERY_LEN];
+static volatile bool coap_running;
+static bool coap_reachable;
+static fleet_backoff_t coap_backoff;
+static uint16_t coap_message_id;
+static uplink_stats_t coap_stats;
+
+static mbedtls_net_context coap_net;
+static uint8_t coap_tx[COAP_DATAGRAM_LEN];
+static uint8_t coap_rx[COAP_DATAGRAM_LEN];
+#if CONFIG_UPLINK_COAP_DTLS
+static mbedtls_ssl_context coap_ssl;
+static mbedtls_ssl_config coap_ssl_conf;
+static mbedtls_x509_crt coap_ca;
+static mbedtls_x509_crt coap_cert;
+static mbedtls_pk_context coap_key;
+/* Kept between starts to resume instead of a full handshake*/
+static mbedtls_ssl_session coap_session;
+static bool coap_session_valid;
+static int64_t coap_timer_intermediate_us;
+static int64_t coap_timer_final_us;
+static int64_t coap_timer_started_us;
+#endif
+
+static void coap_post(mqtt_thingsboard_event_t event_id, const void *data, size_t data_len)
+{
+    if (esp_event_post_to(coap_config->loop, MQTT_THINGSBOARD_EVENT, event_id, data, data_len, portMAX_DELAY) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not post event %d", event_id);
+    }
+}
+
+/* The radio sends whole datagrams, with the DTLS handshakes and records*/
+static int coap_net_send(void *ctx, const unsigned char *buf, size_t len)
+{
+    int ret = mbedtls_net_send(ctx, buf, len);
+    if (ret > 0)
+    {
+        power_manager_energy_count_tx(ret + COAP_IP_UDP_HEADER_LEN);
+    }
+    return ret;
+}
+
+#if CONFIG_UPLINK_COAP_DTLS
+static int coap_rng(void *ctx, unsigned char *buf, size_t len)
+{
+    esp_fill_random(buf, len);
+    return 0;
+}
+
+/* DTLS retransmission timer on esp_timer, mbedtls_timing is not built*/
+static void coap_timer_set(void *ctx, uint32_t intermediate_ms, uint32_t final_ms)
+{
+    coap_timer_started_us = esp_timer_get_time();
+    coap_timer_intermediate_us = (int64_t)intermediate_ms * 1000;
+    coap_timer_final_us = (int64_t)final_ms * 1000;
+}
+
+static int coap_timer_get(void *ctx)
+{
+    int64_t elapsed = esp_timer_get_time() - coap_timer_started_us;
+
+    if (coap_timer_final_us == 0)
+    {
+        return -1;
+    }
+    if (elapsed >= coap_timer_final_us)
+    {
+        return 2;
+    }
+    return elapsed >= coap_timer_intermediate_us ? 1 : 0;
+}
+
+static esp_err_t coap_dtls_setup(void)
+{
+    const thingsboard_cfg_t *cfg = coap_config->cfg;
+
+    mbedtls_ssl_config_init(&coap_ssl_conf);
+    mbedtls_x509_crt_init(&coap_ca);
+    mbedtls_x509_crt_init(&coap_cert);
+    mbedtls_pk_init(&coap_key);
+    mbedtls_ssl_session_init(&coap_session);
+    if (mbedtls_x509_crt_parse(&coap_ca, (const unsigned char*) cfg->verification.certificate, cfg->verification.certificate_len) != 0
+        || mbedtls_x509_crt_parse(&coap_cert, (const unsigned char*) cfg->credentials.authentication.certificate, cfg->credentials.authentication.certificate_len) != 0
+        || mbedtls_pk_parse_key(&coap_key, (const unsigned char*) cfg->credentials.authentication.key, cfg->credentials.authentication.key_len, NULL, 0, coap_rng, NULL) != 0)
+    {
+        ESP_LOGE(TAG, "Could not parse the certificates");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (mbedtls_ssl_config_defaults(&coap_ssl_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_DATAGRAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+    {
+        return ESP_FAIL;
+    }
+    mbedtls_ssl_conf_authmode(&coap_ssl_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&coap_ssl_conf, &coap_ca, NULL);
+    mbedtls_ssl_conf_rng(&coap_ssl_conf, coap_rng, NULL);
+    mbedtls_ssl_conf_handshake_timeout(&coap_ssl_conf, CONFIG_UPLINK_COAP_ACK_TIMEOUT_MS, COAP_SEPARATE_TIMEOUT_MS);
+    if (mbedtls_ssl_conf_own_cert(&coap_ssl_conf, &coap_cert, &coap_key) != 0)
+    {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t coap_dtls_handshake(void)
+{
+    int64_t started_at = esp_timer_get_time();
+    int ret;
+
+    mbedtls_ssl_init(&coap_ssl);
+    if (mbedtls_ssl_setup(&coap_ssl, &coap_ssl_conf) != 0
+        || mbedtls_ssl_set_hostname(&coap_ssl, coap_config->cfg->address.uri) != 0)
+    {
+        return ESP_FAIL;
+    }
+    mbedtls_ssl_set_bio(&coap_ssl, &coap_net, coap_net_send, NULL, mbedtls_net_recv_timeout);
+    mbedtls_ssl_set_timer_cb(&coap_ssl, NULL, coap_timer_set, coap_timer_get);
+    mbedtls_ssl_conf_read_timeout(&coap_ssl_conf, CONFIG_UPLINK_COAP_ACK_TIMEOUT_MS);
+    if (coap_session_valid && mbedtls_ssl_set_session(&coap_ssl, &coap_session) != 0)
+    {
+        coap_session_valid = false;
+    }
+    do
+    {
+        ret = mbedtls_ssl_handshake(&coap_ssl);
+    } while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+    if (ret != 0)
+    {
+        ESP_LOGW(TAG, "DTLS handshake failed: -0x%04x", -ret);
+        coap_session_valid = false;
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "DTLS handshake in %" PRId64 " ms", (esp_timer_get_time() - started_at) / 1000);
+    mbedtls_ssl_session_free(&coap_session);
+    mbedtls_ssl_session_init(&coap_session);
+    coap_session_valid = mbedtls_ssl_get_session(&coap_ssl, &coap_session) == 0;
+    return ESP_OK;
+}
+#endif
+
+static void coap_close(void)
+{
+#if CONFIG_UPLINK_COAP_DTLS
+    mbedtls_ssl_close_notify(&coap_ssl);
+    mbedtls_ssl_free(&coap_ssl);
+#endif
+    mbedtls_net_free(&coap_net);
+}
+
+static esp_err_t coap_open(void)
+{
+    char port[8];
+
+    snprintf(port, sizeof(port), "%d", CONFIG_UPLINK_COAP_PORT);
+    mbedtls_net_init(&coap_net);
+    if (mbedtls_net_connect(&coap_net, coap_config->cfg->address.uri, port, MBEDTLS_NET_PROTO_UDP) != 0)
+    {
+        ESP_LOGW(TAG, "Could not reach %s:%s", coap_config->cfg->address.uri, port);
+        return ESP_FAIL;
+    }
+#if CONFIG_UPLINK_COAP_DTLS
+    return coap_dtls_handshake();
+#else
+    return ESP_OK;
+#endif
+}
+
+/* Messages are counted here, like the MQTT packets under TLS*/
+static int coap_send(const uint8_t *buf, size_t len)
+{
+    int ret;
+
+#if CONFIG_UPLINK_COAP_DTLS
+    ret = mbedtls_ssl_write(&coap_ssl, buf, len);
+#else
+    ret = coap_net_send(&coap_net, buf, len);
+#endif
+    if (ret > 0)
+    {
+        coap_stats.tx_bytes += ret;
+    }
+    return ret;
+}
+
+/* Received length, 0 on timeout and negative on error*/
+static int coap_recv(uint8_t *buf, size_t size, uint32_t timeout_ms)
+{
+    int ret;
+
+#if CONFIG_UPLINK_COAP_DTLS
+    mbedtls_ssl_conf_read_timeout(&coap_ssl_conf, timeout_ms);
+    ret = mbedtls_ssl_read(&coap_ssl, buf, size);
+#else
+    ret = mbedtls_net_recv_timeout(&coap_net, buf, size, timeout_ms);
+#endif
+    if (ret == MBEDTLS_ERR_SSL_TIMEOUT || ret == MBEDTLS_ERR_SSL_WANT_READ)
+    {
+        return 0;
+    }
+    if (ret > 0)
+    {
+        coap_stats.rx_bytes += ret;
+    }
+    return ret;
+}
+
+/* Empty ACK or RST answering a message of the server*/
+static void coap_reply_empty(coap_type_t type, uint16_t message_id)
+{
+    uint8_t reply[4];
+    coap_writer_t w;
+    size_t len;
+
+    coap_message_start(&w, reply, sizeof(reply), type, COAP_CODE_EMPTY, message_id, NULL, 0);
+    if (coap_message_finish(&w, NULL, 0, &len) == ESP_OK)
+    {
+        coap_send(reply, len);
+    }
+}
+
+static bool coap_token_matches(const coap_message_t *m, const uint8_t *token, size_t token_len)
+{
+    return m->token_len == token_len && memcmp(m->token, token, token_len) == 0;
+}
+
+/*
+ * Sends a confirmable message until it is answered. The answer is an RST
+ * or the response, piggybacked on the ACK or sent separately after an
+ * empty ACK. ESP_ERR_TIMEOUT once the retransmissions are exhausted.
+ */
+static esp_err_t coap_transmit(
+    const uint8_t *msg,
+    size_t len,
+    uint16_t message_id,
+    const uint8_t *token,
+    size_t token_len,
+    coap_message_t *response
+)
+{
+    uint32_t timeout_ms = CONFIG_UPLINK_COAP_ACK_TIMEOUT_MS
+                          + esp_random() % (CONFIG_UPLINK_COAP_ACK_TIMEOUT_MS * COAP_ACK_RANDOM_PERCENT / 100 + 1);
+    bool acknowledged = false;
+
+    for (int attempt = 0; attempt <= CONFIG_UPLINK_COAP_MAX_RETRANSMIT; attempt++)
+    {
+        if (attempt > 0)
+        {
+            coap_stats.retransmits++;
+            ESP_LOGD(TAG, "Retransmitting %u, attempt %d", message_id, attempt);
+        }
+        if (coap_send(msg, len) < 0)
+        {
+            return ESP_FAIL;
+        }
+        int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+        int64_t remaining_us;
+        while ((remaining_us = deadline - esp_timer_get_time()) > 0)
+        {
+            int received = coap_recv(coap_rx, sizeof(coap_rx), remaining_us / 1000 + 1);
+            if (received < 0)
+            {
+                return ESP_FAIL;
+            }
+            if (received == 0 || coap_message_parse(coap_rx, received, response) != ESP_OK)
+            {
+                continue;
+            }
+            bool same_exchange = response->message_id == message_id;
+            if ((response->type == COAP_TYPE_ACK || response->type == COAP_TYPE_RST) && same_exchange)
+            {
+                if (response->type == COAP_TYPE_RST || response->code != COAP_CODE_EMPTY)
+                {
+                    return ESP_OK;
+                }
+                /* Separate response, the request is not sent again*/
+                acknowledged = true;
+                deadline = esp_timer_get_time() + (int64_t)COAP_SEPARATE_TIMEOUT_MS * 1000;
+            }
+            else if (response->type == COAP_TYPE_CON || response->type == COAP_TYPE_NON)
+            {
+                if (response->type == COAP_TYPE_CON)
+                {
+                    /* Also stops the retransmissions of an old response*/
+                    coap_reply_empty(COAP_TYPE_ACK, response->message_id);
+                }
+                if (token_len > 0 && response->code != COAP_CODE_EMPTY && coap_token_matches(response, token, token_len))
+                {
+                    return ESP_OK;
+                }
+            }
+        }
+        if (acknowledged)
+        {
+            break;
+        }
+        timeout_ms *= 2;
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+/* CoAP ping, an empty confirmable message answered with an RST*/
+static esp_err_t coap_ping(void)
+{
+    uint16_t message_id = ++coap_message_id;
+    coap_message_t response;
+    coap_writer_t w;
+    size_t len;
+
+    coap_message_start(&w, coap_tx, sizeof(coap_tx), COAP_TYPE_CON, COAP_CODE_EMPTY, message_id, NULL, 0);
+    ESP_RETURN_ON_ERROR(coap_message_finish(&w, NULL, 0, &len), TAG, "ping does not fit");
+    ESP_RETURN_ON_ERROR(coap_transmit(coap_tx, len, message_id, NULL, 0, &response), TAG, "no answer to ping");
+    return response.type == COAP_TYPE_RST ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+}
+
+/* Request on api/v1/resource, or api/v1/token/resource without DTLS.
+ The response points into coap_rx*/
+static esp_err_t coap_request(
+    uint8_t code,
+    const char *resource,
+    const char *query,
+    const void *payload,
+    size_t payload_len,
+    coap_message_t *response
+)
+{
+    uint16_t message_id = ++coap_message_id;
+    uint8_t token[COAP_TOKEN_LEN];
+    char path[COAP_MAX_PATH_LEN];
+    coap_writer_t w;
+    size_t len;
+
+#if CONFIG_UPLINK_COAP_DTLS
+    snprintf(path, sizeof(path), "api/v1/%s", resource);
+#else
+    snprintf(path, sizeof(path), "api/v1/%s/%s", coap_config->cfg->credentials.access_token, resource);
+#endif
+    esp_fill_random(token, sizeof(token));
+    coap_message_start(&w, coap_tx, sizeof(coap_tx), COAP_TYPE_CON, code, message_id, token, sizeof(token));
+    coap_message_add_path(&w, path);
+    if (payload_len > 0)
+    {
+        coap_message_add_uint_option(&w, COAP_OPTION_CONTENT_FORMAT, COAP_CONTENT_FORMAT);
+    }
+    if (query != NULL)
+    {
+        coap_message_add_option(&w, COAP_OPTION_URI_QUERY, query, strlen(query));
+    }
+    ESP_RETURN_ON_ERROR(coap_message_finish(&w, payload, payload_len, &len), TAG, "%s request does not fit", resource);
+    ESP_RETURN_ON_ERROR(coap_transmit(coap_tx, len, message_id, token, sizeof(token), response), TAG, "no answer on %s", resource);
+    if (response->type == COAP_TYPE_RST)
+    {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    return ESP_OK;
+}
+
+static void coap_free(coap_slot_t *slot)
+{
+    xSemaphoreTake(coap_lock, portMAX_DELAY);
+    slot->state = SLOT_FREE;
+    coap_slots_used--;
+    bool available = coap_full && coap_slots_used <= CONFIG_UPLINK_COAP_SLOTS / 2;
+    if (available)
+    {
+        coap_full = false;
+    }
+    xSemaphoreGive(coap_lock);
+    if (available)
+    {
+        coap_post(MQTT_OUTBOX_AVAILABLE, NULL, 0);
+    }
+}
+
+static coap_slot_t *coap_oldest_queued(void)
+{
+    coap_slot_t *oldest = NULL;
+
+    xSemaphoreTake(coap_lock, portMAX_DELAY);
+    for (size_t i = 0; i < CONFIG_UPLINK_COAP_SLOTS; i++)
+    {
+        if (coap_slots[i].state == SLOT_QUEUED && (oldest == NULL || coap_slots[i].id < oldest->id))
+        {
+            oldest = &coap_slots[i];
+        }
+    }
+    xSemaphoreGive(coap_lock);
+    return oldest;
+}
+
+static esp_err_t coap_send_attributes_request(void)
+{
+    char query[COAP_MAX_QUERY_LEN + sizeof("sharedKeys=")];
+    char topic[COAP_MAX_TOPIC_LEN];
+    coap_message_t response;
+    int id;
+
+    xSemaphoreTake(coap_lock, portMAX_DELAY);
+    id = coap_request_id;
+    snprintf(query, sizeof(query), "sharedKeys=%s", coap_request_keys);
+    coap_request_id = 0;
+    xSemaphoreGive(coap_lock);
+
+    ESP_RETURN_ON_ERROR(coap_request(COAP_CODE_GET, "attributes", query, NULL, 0, &response), TAG, "attributes not received");
+    if (COAP_CODE_CLASS(response.code) != 2)
+    {
+        ESP_LOGW(TAG, "Attributes refused with %d.%02d", COAP_CODE_CLASS(response.code), response.code & 0x1F);
+        return ESP_OK;
+    }
+    /* Handled as the response to the MQTT request with the same id*/
+    int topic_len = snprintf(topic, sizeof(topic), "%s%d", DEVICE_ATTRIBUTES_RESPONSE_RET, id);
+    if (mqtt_router_dispatch(topic, topic_len, (const char*) response.payload, response.payload_len) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Attributes response not routed");
+    }
+    return ESP_OK;
+}
+
+static esp_err_t coap_send_slot(coap_slot_t *slot)
+{
+    coap_message_t response;
+
+    ESP_RETURN_ON_ERROR(
+        coap_request(COAP_CODE_POST, slot->resource, NULL, slot->data, slot->len, &response),
+        TAG,
+        "publish %d not acknowledged",
+        slot->id
+    );
+    int id = slot->id;
+    if (COAP_CODE_CLASS(response.code) != 2)
+    {
+        /* Sending it again would be refused the same way*/
+        ESP_LOGE(TAG, "Publish %d refused with %d.%02d, dropping it", id, COAP_CODE_CLASS(response.code), response.code & 0x1F);
+        coap_stats.failures++;
+        coap_free(slot);
+        return ESP_OK;
+    }
+    uint64_t latency_us = esp_timer_get_time() - slot->admitted_at;
+    coap_stats.uploads++;
+    coap_stats.latency_us += latency_us;
+    if (latency_us > coap_stats.max_latency_us)
+    {
+        coap_stats.max_latency_us = latency_us;
+    }
+    ESP_LOGD(TAG, "Publish %d acknowledged in %" PRIu64 " ms", id, latency_us / 1000);
+    coap_free(slot);
+    coap_post(MQTT_OUTBOX_DELIVERED, &id, sizeof(id));
+    return ESP_OK;
+}
+
+static void coap_lost(void)
+{
+    coap_close();
+    coap_reachable = false;
+    coap_post(MQTT_BROKER_DISCONNECTED, NULL, 0);
+}
+
+static void coap_task(void *pvParameters)
+{
+    for (;;)
+    {
+        if (!coap_running)
+        {
+            if (coap_reachable)
+            {
+                coap_lost();
+                /* RPC is not available, the figures of getPerf are logged*/
+                ESP_LOGI(
+                    TAG,
+                    "%" PRIu32 " uploads, %" PRIu32 " failures, %" PRIu32 " retransmits, %" PRIu64 " B sent, %" PRIu64 " B received",
+                    coap_stats.uploads,
+                    coap_stats.failures,
+                    coap_stats.retransmits,
+                    coap_stats.tx_bytes,
+                    coap_stats.rx_bytes
+                );
+            }
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if (!coap_reachable)
+        {
+            if (coap_open() != ESP_OK || coap_ping() != ESP_OK)
+            {
+                uint32_t wait_ms = fleet_backoff_next(&coap_backoff);
+                coap_close();
+                coap_stats.failures++;
+                ESP_LOGW(TAG, "Server unreachable, retrying in %" PRIu32 " ms", wait_ms);
+                coap_post(MQTT_BROKER_DISCONNECTED, NULL, 0);
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
+                continue;
+            }
+            coap_reachable = true;
+            fleet_backoff_reset(&coap_backoff);
+            coap_config->on_connected();
+            coap_post(MQTT_BROKER_CONNECTED, NULL, 0);
+            continue;
+        }
+        esp_err_t err = ESP_OK;
+        coap_slot_t *slot;
+        if (coap_request_id != 0)
+        {
+            err = coap_send_attributes_request();
+        }
+        else if ((slot = coap_oldest_queued()) != NULL)
+        {
+            err = coap_send_slot(slot);
+        }
+        else
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if (err != ESP_OK)
+        {
+            coap_stats.failures++;
+            coap_lost();
+        }
+    }
+}
+
+static esp_err_t coap_uplink_init(const uplink_config_t *config)
+{
+#if !CONFIG_UPLINK_COAP_DTLS
+    const char *token = config->cfg->credentials.access_token;
+
+    ESP_RETURN_ON_FALSE(token != NULL && token[0] != '\0', ESP_ERR_INVALID_ARG, TAG, "no access token provisioned");
+#endif
+    coap_config = config;
+    coap_stats.name = uplink_coap.name;
+    coap_message_id = esp_random();
+    coap_lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(coap_lock != NULL, ESP_ERR_NO_MEM, TAG, "could not create lock");
+#if CONFIG_UPLINK_COAP_DTLS
+    ESP_RETURN_ON_ERROR(coap_dtls_setup(), TAG, "could not set up DTLS");
+#endif
+    coap_running = true;
+    ESP_RETURN_ON_FALSE(
+        xTaskCreate(coap_task, TAG, COAP_TASK_STACK, NULL, COAP_TASK_PRIORITY, &coap_task_handle) == pdPASS,
+        ESP_ERR_NO_MEM,
+        TAG,
+        "could not create task"
+    );
+    ESP_LOGI(TAG, "Posting to %s:%d", config->cfg->address.uri, CONFIG_UPLINK_COAP_PORT);
+    return ESP_OK;
+}
+
+static esp_err_t coap_uplink_start(void)
+{
+    coap_running = true;
+    fleet_backoff_reset(&coap_backoff);
+    xTaskNotifyGive(coap_task_handle);
+    return ESP_OK;
+}
+
+/* The exchange in progress is completed before the task closes*/
+static esp_err_t coap_uplink_stop(void)
+{
+    coap_running = false;
+    xTaskNotifyGive(coap_task_handle);
+    return ESP_OK;
+}
+
+static esp_err_t coap_uplink_publish(const char *topic, const char *data, size_t len, int *id)
+{
+    const char *resource;
+    coap_slot_t *slot = NULL;
+    bool full = false;
+
+    if (strcmp(topic, MQTT_TELEMETRY_TOPIC) == 0)
+    {
+        resource = "telemetry";
+    }
+    else if (strcmp(topic, DEVICE_ATTRIBUTES_TOPIC) == 0)
+    {
+        resource = "attributes";
+    }
+    else
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (len > CONFIG_MQTT_OUTBOX_SLOT_BYTES)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(coap_lock, portMAX_DELAY);
+    for (size_t i = 0; i < CONFIG_UPLINK_COAP_SLOTS && slot == NULL; i++)
+    {
+        if (coap_slots[i].state == SLOT_FREE)
+        {
+            slot = &coap_slots[i];
+        }
+    }
+    if (slot != NULL)
+    {
+        slot->state = SLOT_QUEUED;
+        slot->id = coap_next_id++;
+        slot->resource = resource;
+        slot->len = len;
+        slot->admitted_at = esp_timer_get_time();
+        memcpy(slot->data, data, len);
+        coap_slots_used++;
+        full = coap_slots_used == CONFIG_UPLINK_COAP_SLOTS && !coap_full;
+        coap_full = coap_full || full;
+        if (id != NULL)
+        {
+            *id = slot->id;
+        }
+    }
+    xSemaphoreGive(coap_lock);
+
+    if (slot == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if (full)
+    {
+        coap_post(MQTT_OUTBOX_FULL, NULL, 0);
+    }
+    xTaskNotifyGive(coap_task_handle);
+    return ESP_OK;
+}
+
+/* Called on the CoAP task from on_connected, sent before the publishes*/
+static esp_err_t coap_uplink_request_attributes(int id, const char *shared_keys)
+{
+    xSemaphoreTake(coap_lock, portMAX_DELAY);
+    coap_request_id = id;
+    strlcpy(coap_request_keys, shared_keys, sizeof(coap_request_keys));
+    xSemaphoreGive(coap_lock);
+    xTaskNotifyGive(coap_task_handle);
+    return ESP_OK;
+}
+
+static size_t coap_uplink_pending(void)
+{
+    return coap_slots_used;
+}
+
+static void coap_uplink_get_stats(uplink_stats_t *stats)
+{
+    *stats = coap_stats;
+}
+
+const uplink_transport_t uplink_coap = {
+    .name = "coap",
+    .init = coap_uplink_init,
+    .start = coap_uplink_start,
+    .stop = coap_uplink_stop,
+    .publish = coap_uplink_publish,
+    .request_attributes = coap_uplink_request_attributes,
+    .pending = coap_uplink_pending,
+    .get_stats = coap_uplink_get_stats,
+};
+#endif
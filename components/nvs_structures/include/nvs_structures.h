@@ -15,6 +15,7 @@
         (X),                                                                  \
         sgp30_timed_measurement_t* : storage_get_sgp30_baseline ,             \
         thingsboard_cfg_t* : storage_get_thingsboard_cfg ,                    \
+        thingsboard_shared_attributes_t* : storage_get_shared_attributes ,    \
         wifi_credentials_t* : storage_get_wifi_credentials                    \
     ) ( (X) )
 
@@ -23,8 +24,67 @@
         (X),                                                                  \
         const sgp30_timed_measurement_t* : storage_set_sgp30_baseline ,       \
         const thingsboard_cfg_t* : storage_set_thingsboard_cfg ,              \
+        const thingsboard_shared_attributes_t* : storage_set_shared_attributes , \
         const wifi_credentials_t* : storage_set_wifi_credentials              \
     ) ( (X) )
+
+#define storage_txn_set(T, X)                                                 \
+    _Generic (                                                                \
+        (X),                                                                  \
+        const sgp30_timed_measurement_t* : storage_txn_set_sgp30_baseline ,   \
+        const thingsboard_cfg_t* : storage_txn_set_thingsboard_cfg ,          \
+        const thingsboard_shared_attributes_t* : storage_txn_set_shared_attributes , \
+        const wifi_credentials_t* : storage_txn_set_wifi_credentials          \
+    ) ( (T), (X) )
+
+#define STORAGE_STATS_NAMESPACES 2 /*!< thingsboard and sgp30*/
+
+/**
+ * @brief Operations on one namespace since power on.
+ */
+typedef struct {
+    const char *name;       /*!< Namespace*/
+    uint32_t reads;         /*!< Values read from NVS, cached reads not included*/
+    uint32_t writes;        /*!< Values written*/
+    uint32_t skipped;       /*!< Writes left out because the value was stored already*/
+    uint32_t commits;       /*!< Commits*/
+    uint32_t read_bytes;    /*!< Bytes read*/
+    uint32_t written_bytes; /*!< Bytes written*/
+    uint32_t read_us;       /*!< Time spent reading*/
+    uint32_t write_us;      /*!< Time spent writing*/
+    uint32_t commit_us;     /*!< Time spent committing*/
+    uint32_t max_us;        /*!< Slowest operation*/
+} storage_namespace_stats_t;
+
+/**
+ * @brief NVS usage. The counters are kept over deep sleep, the entries are
+ * the last nvs_get_stats sample.
+ */
+typedef struct {
+    storage_namespace_stats_t namespaces[STORAGE_STATS_NAMESPACES]; /*!< Per namespace*/
+    uint32_t opens;           /*!< Namespaces opened*/
+    uint32_t used_entries;    /*!< Entries in use in the NVS partition*/
+    uint32_t free_entries;    /*!< Entries free*/
+    uint32_t total_entries;   /*!< Entries of the partition*/
+    uint32_t namespace_count; /*!< Namespaces in the partition*/
+} storage_stats_t;
+
+/**
+ * @brief Values staged with storage_txn_set, written by storage_txn_commit.
+ * Values equal to the stored ones are not written. The ThingsBoard
+ * configuration and the Wi-Fi credentials share one NVS blob and are
+ * replaced together. More than one value to write are first stored as one
+ * journal blob, so they are all stored or none. Storage is locked from
+ * storage_txn_begin to the commit or abort, so no storage call can be made
+ * in between.
+ */
+typedef struct {
+    uint8_t staged;                                    /*!< Values set*/
+    sgp30_timed_measurement_t sgp30_baseline;          /*!< Staged baseline*/
+    thingsboard_cfg_t thingsboard_cfg;                 /*!< Staged configuration, its strings must outlive the commit*/
+    thingsboard_shared_attributes_t shared_attributes; /*!< Staged shared attributes*/
+    wifi_credentials_t wifi_credentials;               /*!< Staged credentials*/
+} storage_txn_t;
 /**
  * @brief Initialize the storage.
  * @return
@@ -36,6 +96,7 @@ esp_err_t storage_init();
  * @brief Erase the storage.
  * @return
  * - ESP_OK: Success
+ * - ESP_ERR_INVALID_STATE: storage_init was not called
  * - some other error code: Failure
  */
 esp_err_t storage_erase();
@@ -44,6 +105,7 @@ esp_err_t storage_erase();
  * @param baseline Pointer to the sgp30 baseline.
  * @return
  * - ESP_OK: Success
+ * - ESP_ERR_INVALID_STATE: storage_init was not called
  * - some other error code: Failure
  */
 esp_err_t storage_get_sgp30_baseline (
@@ -61,13 +123,48 @@ esp_err_t storage_set_sgp30_baseline(
     const sgp30_timed_measurement_t *baseline
 );
 /**
- * @brief Get the thingsboard configuration from the storage.
+ * @brief Get the thingsboard configuration from the storage. After a timer
+ * wake with CONFIG_STORAGE_RTC_CONFIG_CACHE or storage_release_certificates
+ * the certificates and key are NULL, see storage_load_certificates.
  * @param thingsboard_cfg Pointer to the thingsboard configuration.
  * @return
  * - ESP_OK: Success
+ * - ESP_ERR_INVALID_STATE: storage_init was not called
  * - some other error code: Failure
  */
 esp_err_t storage_get_thingsboard_cfg (thingsboard_cfg_t *thingsboard_cfg);
+/**
+ * @brief Get the CRC of the certificates and key left out of a configuration
+ * taken from RTC memory, to find them with cert_store_open.
+ * @param crc CRC of their PEM, see cert_store_source_crc.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_NOT_FOUND: No certificates are known
+ * - ESP_ERR_NOT_SUPPORTED: CONFIG_STORAGE_RTC_CONFIG_CACHE is disabled
+ * - some other error code: Not provisioned
+ */
+esp_err_t storage_get_certificates_crc(uint32_t *crc);
+/**
+ * @brief Get the thingsboard configuration with its certificates and key. A
+ * configuration taken from RTC memory or released has none, they are read
+ * from NVS.
+ * @param thingsboard_cfg Pointer to the thingsboard configuration.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: Failure
+ */
+esp_err_t storage_load_certificates(thingsboard_cfg_t *thingsboard_cfg);
+/**
+ * @brief Drop the certificates and key from the configuration kept in RAM,
+ * once they are in the certificate store. The views of earlier gets of the
+ * thingsboard configuration are no longer valid, thingsboard_cfg gets new
+ * ones without certificates. A later write reads them from NVS to keep them.
+ * @param thingsboard_cfg Pointer to the thingsboard configuration.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: Failure
+ */
+esp_err_t storage_release_certificates(thingsboard_cfg_t *thingsboard_cfg);
 /**
 * @brief Set the thingsboard configuration in the storage.
 * @param thingsboard_cfg Pointer to the thingsboard configuration.
@@ -76,11 +173,29 @@ esp_err_t storage_get_thingsboard_cfg (thingsboard_cfg_t *thingsboard_cfg);
 * - some other error code: Failure
 */
 esp_err_t storage_set_thingsboard_cfg (const thingsboard_cfg_t *thingsboard_cfg);
+/**
+ * @brief Get the cached thingsboard shared attributes from the storage.
+ * @param shared_attributes Pointer to the shared attributes.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_STATE: storage_init was not called
+ * - some other error code: Failure
+ */
+esp_err_t storage_get_shared_attributes (thingsboard_shared_attributes_t *shared_attributes);
+/**
+ * @brief Set the cached thingsboard shared attributes in the storage.
+ * @param shared_attributes Pointer to the shared attributes.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: Failure
+ */
+esp_err_t storage_set_shared_attributes (const thingsboard_shared_attributes_t *shared_attributes);
 /**
  * @brief Get the wifi credentials from the storage.
  * @param wifi_credentials Pointer to the wifi credentials.
  * @return
  * - ESP_OK: Success
+ * - ESP_ERR_INVALID_STATE: storage_init was not called
  * - some other error code: Failure
  */
 esp_err_t storage_get_wifi_credentials (wifi_credentials_t *wifi_credentiasl);
@@ -92,4 +207,71 @@ esp_err_t storage_get_wifi_credentials (wifi_credentials_t *wifi_credentiasl);
  * - some other error code: Failure
  */
 esp_err_t storage_set_wifi_credentials (const wifi_credentials_t *wifi_credentiasl);
+/**
+ * @brief Start a transaction, locking the storage until it is committed or
+ * aborted.
+ * @param txn Transaction to start.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_STATE: storage_init was not called
+ */
+esp_err_t storage_txn_begin(storage_txn_t *txn);
+/**
+ * @brief Stage the sgp30 baseline.
+ * @param txn Started transaction.
+ * @param baseline Pointer to the sgp30 baseline, copied.
+ * @return
+ * - ESP_OK: Success
+ */
+esp_err_t storage_txn_set_sgp30_baseline(storage_txn_t *txn, const sgp30_timed_measurement_t *baseline);
+/**
+ * @brief Stage the thingsboard configuration.
+ * @param txn Started transaction.
+ * @param thingsboard_cfg Pointer to the thingsboard configuration, copied without its strings.
+ * @return
+ * - ESP_OK: Success
+ */
+esp_err_t storage_txn_set_thingsboard_cfg(storage_txn_t *txn, const thingsboard_cfg_t *thingsboard_cfg);
+/**
+ * @brief Stage the thingsboard shared attributes.
+ * @param txn Started transaction.
+ * @param shared_attributes Pointer to the shared attributes, copied.
+ * @return
+ * - ESP_OK: Success
+ */
+esp_err_t storage_txn_set_shared_attributes(
+    storage_txn_t *txn,
+    const thingsboard_shared_attributes_t *shared_attributes
+);
+/**
+ * @brief Stage the wifi credentials.
+ * @param txn Started transaction.
+ * @param wifi_credentials Pointer to the wifi credentials, copied.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_SIZE: The ssid or the password are not terminated
+ */
+esp_err_t storage_txn_set_wifi_credentials(storage_txn_t *txn, const wifi_credentials_t *wifi_credentials);
+/**
+ * @brief Write the staged values that changed, with one commit per
+ * namespace, and unlock the storage.
+ * @param txn Started transaction.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: Failure. Nothing of the transaction is stored,
+ *   or once its journal is, the next storage call or storage_init stores
+ *   all of it
+ */
+esp_err_t storage_txn_commit(storage_txn_t *txn);
+/**
+ * @brief Drop the staged values and unlock the storage.
+ * @param txn Started transaction.
+ */
+void storage_txn_abort(storage_txn_t *txn);
+/**
+ * @brief Get the NVS operation counters and the last usage sample, zeros
+ * before storage_init.
+ * @param stats Filled with the statistics.
+ */
+void storage_get_stats(storage_stats_t *stats);
 #endif // !NVS_STRUCTURES_H
@@ -1,11 +1,25 @@
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include "nvs_flash.h"
 #include "nvs_structures.h"
+#include "esp_attr.h"
+#include "esp_check.h"
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_rom_crc.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "nvs.h"
 #include "sgp30_types.h"
 #include "softap_provision_types.h"
 #include "thingsboard_types.h"
+#if CONFIG_STORAGE_RTC_CONFIG_CACHE
+#include "cert_store.h"
+#endif
 
 #define NVS_SGP30_STORAGE_NAMESPACE    "sgp30"
 #define NVS_SGP30_BASELINE_KEY         "baseline"
@@ -18,10 +32,176 @@
 #define NVS_THINGSBOARD_CACERT_KEY     "ca_cert"
 #define NVS_THINGSBOARD_DEVCERT_KEY    "dev_key"
 #define NVS_THINGSBOARD_CHAINCERT_KEY  "chain_cert"
+#define NVS_THINGSBOARD_SHARED_KEY     "shared_attrs"
+#define NVS_CONFIG_KEY                 "config"
+#define NVS_CONFIG_GENERATION_KEY      "config_gen"
+#define NVS_TXN_JOURNAL_KEY            "txn_journal"
+#define NVS_CONFIG_MAGIC               0x47464354 /* "TCFG"*/
+#define NVS_CONFIG_VERSION             2
 
 #define TAG "NVS"
 
-static esp_err_t nvs_get_thingsboard_cfg(thingsboard_cfg_t *cfg)
+#define CONFIG_HAS_THINGSBOARD 0x01
+#define CONFIG_HAS_WIFI        0x02
+
+enum {
+    CONFIG_FIELD_URI,
+    CONFIG_FIELD_CA_CERT,
+    CONFIG_FIELD_DEV_KEY,
+    CONFIG_FIELD_CHAIN_CERT,
+    CONFIG_FIELD_SSID,
+    CONFIG_FIELD_PASS,
+    CONFIG_FIELD_ACCESS_TOKEN, /* Added in version 2, kept last*/
+    CONFIG_FIELDS,
+};
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t crc;     /* Of the rest of the header and the fields*/
+    uint8_t version;
+    uint8_t present;  /* CONFIG_HAS_* of the parts stored*/
+    uint16_t port;
+    uint32_t generation; /* Bumped on every write*/
+    uint16_t len[CONFIG_FIELDS]; /* With the terminator, 0 if absent*/
+} config_blob_header_t;
+
+#define STORAGE_HANDLES STORAGE_STATS_NAMESPACES
+
+#define STORAGE_TXN_SGP30_BASELINE    0x01
+#define STORAGE_TXN_THINGSBOARD_CFG   0x02
+#define STORAGE_TXN_SHARED_ATTRIBUTES 0x04
+#define STORAGE_TXN_WIFI_CREDENTIALS  0x08
+
+typedef enum {
+    STORAGE_OP_READ,
+    STORAGE_OP_WRITE,
+    STORAGE_OP_COMMIT,
+} storage_op_t;
+
+enum {
+    STORAGE_KEY_SGP30_BASELINE,
+    STORAGE_KEY_SHARED_ATTRIBUTES,
+    STORAGE_KEYS,
+};
+
+typedef struct {
+    const char *name; /* Namespace, NULL if the slot is free*/
+    nvs_handle_t handle;
+    nvs_open_mode_t mode;
+    bool dirty;       /* Written since the last commit*/
+} storage_handle_t;
+
+typedef struct {
+    const char *name; /* Namespace*/
+    const char *key;
+    void *value;      /* Copy of the stored value*/
+    size_t len;
+    bool valid;       /* value was read or written*/
+} storage_key_t;
+
+/* A value a transaction writes*/
+typedef struct {
+    const char *name; /* Namespace*/
+    const char *key;
+    const void *value;
+    size_t len;
+} storage_txn_write_t;
+
+#define STORAGE_TXN_WRITES 3
+
+/* A transaction of more than one value is first written whole as one blob,
+ the journal: a header, then an entry and the value for each. NVS stores a
+ blob at once or not at all, so a journal found is complete and its values
+ are written again*/
+typedef struct __attribute__((packed)) {
+    uint32_t crc;     /* Of what follows*/
+    uint8_t count;
+} storage_journal_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t name;     /* Index in storage_namespaces*/
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint32_t len;
+} storage_journal_entry_t;
+
+static uint8_t *config_blob; /* Loaded or last stored*/
+static size_t config_blob_len;
+static bool config_blob_lent; /* Views into it were handed out*/
+static bool config_blob_stripped; /* Without the certificates, from RTC memory or released*/
+
+static SemaphoreHandle_t storage_lock; /* Held by reads and by transactions*/
+static storage_handle_t storage_handles[STORAGE_HANDLES];
+#if CONFIG_STORAGE_STATS_SAMPLE_PERIOD > 0
+static esp_timer_handle_t storage_stats_timer;
+#endif
+static sgp30_timed_measurement_t sgp30_baseline_value;
+static thingsboard_shared_attributes_t shared_attributes_value;
+static storage_key_t storage_keys[STORAGE_KEYS] = {
+    [STORAGE_KEY_SGP30_BASELINE] = {
+        .name = NVS_SGP30_STORAGE_NAMESPACE,
+        .key = NVS_SGP30_BASELINE_KEY,
+        .value = &sgp30_baseline_value,
+        .len = sizeof(sgp30_baseline_value),
+    },
+    [STORAGE_KEY_SHARED_ATTRIBUTES] = {
+        .name = NVS_THINGSBOARD_NAMESPACE,
+        .key = NVS_THINGSBOARD_SHARED_KEY,
+        .value = &shared_attributes_value,
+        .len = sizeof(shared_attributes_value),
+    },
+};
+
+#if CONFIG_STORAGE_RTC_CONFIG_CACHE
+#define CONFIG_SNAPSHOT_MAGIC 0x50414E53 /* "SNAP"*/
+
+/* The blob without the certificates, kept over deep sleep so a timer wake
+ only reads the generation from NVS. The certificates are found in
+ cert_store by the CRC of their PEM*/
+typedef struct {
+    uint32_t magic;
+    uint32_t certificates_crc; /* cert_store_source_crc of the PEM left out*/
+    uint32_t len;
+    uint8_t data[CONFIG_STORAGE_RTC_CONFIG_MAX_LEN];
+} config_snapshot_t;
+
+RTC_DATA_ATTR static config_snapshot_t config_snapshot;
+#endif
+
+/* Namespaces counted, in the order of storage_stats_t*/
+static const char *const storage_namespaces[STORAGE_STATS_NAMESPACES] = {
+    NVS_THINGSBOARD_NAMESPACE,
+    NVS_SGP30_STORAGE_NAMESPACE,
+};
+
+/* Counted since power on, deep sleep keeps them*/
+RTC_DATA_ATTR static storage_stats_t storage_stats;
+
+/* No journal is left in NVS. Cleared at power on, when a transaction writes
+ its journal and until it is erased, so a timer wake does not look for it*/
+RTC_DATA_ATTR static bool storage_journal_clear;
+
+/* RTC slow memory of the ESP32 holds these, the TLS session when it is kept
+ there and a few bytes of the other components*/
+#define STORAGE_RTC_SLOW_MEM_LEN 8192
+#define STORAGE_RTC_OTHERS_LEN   512
+#if CONFIG_TLS_SESSION_STORE_RTC
+#define STORAGE_RTC_TLS_SESSION_LEN (CONFIG_TLS_SESSION_MAX_LEN + 24)
+#else
+#define STORAGE_RTC_TLS_SESSION_LEN 0
+#endif
+#if CONFIG_STORAGE_RTC_CONFIG_CACHE
+#define STORAGE_RTC_CONFIG_LEN sizeof(config_snapshot_t)
+#else
+#define STORAGE_RTC_CONFIG_LEN 0
+#endif
+_Static_assert(
+    STORAGE_RTC_CONFIG_LEN + sizeof(storage_stats_t) + STORAGE_RTC_TLS_SESSION_LEN + STORAGE_RTC_OTHERS_LEN
+        <= STORAGE_RTC_SLOW_MEM_LEN,
+    "RTC slow memory overflows, lower STORAGE_RTC_CONFIG_MAX_LEN or TLS_SESSION_MAX_LEN"
+);
+
+/* Layout before the configuration blob, only read to migrate it*/
+static esp_err_t nvs_get_legacy_thingsboard_cfg(thingsboard_cfg_t *cfg)
 {
     nvs_handle_t storage_handle;
     if (nvs_open(NVS_THINGSBOARD_NAMESPACE, NVS_READONLY, &storage_handle)
@@ -162,200 +342,12 @@ static esp_err_t nvs_get_thingsboard_cfg(thingsboard_cfg_t *cfg)
     cfg->credentials.authentication.certificate_len = chain_cert_len + 1;
     cfg->credentials.authentication.key = dev_cert;
     cfg->credentials.authentication.key_len = dev_cert_len + 1;
+    cfg->credentials.access_token = NULL;
 
     return ESP_OK;
 }
 
-static esp_err_t nvs_set_thingsboard_cfg(const thingsboard_cfg_t *thingsboard_cfg)
-{
-    nvs_handle_t storage_handle;
-    esp_err_t err;
-
-    /* Open namespace*/
-    err = nvs_open(NVS_THINGSBOARD_NAMESPACE, NVS_READWRITE, &storage_handle);
-    if (err != ESP_OK)
-    {
-        ESP_LOGE(TAG, "Could not open thingsboard namespace to write");
-        return err;
-    }
-
-    /* Set address*/
-    err = nvs_set_str(
-        storage_handle,
-        NVS_THINGSBOARD_URI_KEY,
-        thingsboard_cfg->address.uri
-    );
-    if (err != ESP_OK)
-    {
-        nvs_close(storage_handle);
-        ESP_LOGE(TAG, "Could not store thingsboard uri");
-        return err;
-    }
-
-    err = nvs_set_u16(
-        storage_handle,
-        NVS_THINGSBOARD_PORT_KEY,
-        thingsboard_cfg->address.port
-    );
-    if (err != ESP_OK)
-    {
-        nvs_close(storage_handle);
-        ESP_LOGE(TAG, "Could not store thingsboard port");
-        return err;
-    }
-
-    /* Set verification*/
-    err = nvs_set_str(
-        storage_handle,
-        NVS_THINGSBOARD_CACERT_KEY,
-        thingsboard_cfg->verification.certificate
-    );
-    if (err != ESP_OK)
-    {
-        nvs_close(storage_handle);
-        ESP_LOGE(TAG, "Could not store thingsboard verification certificate");
-        return err;
-    }
-
-    /* Set credentials*/
-    err = nvs_set_str(
-        storage_handle,
-        NVS_THINGSBOARD_DEVCERT_KEY,
-        thingsboard_cfg->credentials.authentication.key
-    );
-    if (err != ESP_OK)
-    {
-        nvs_close(storage_handle);
-
-        ESP_LOGE(
-            TAG,
-            "Could not store thingsboard credentials authentication "
-            "certificate"
-        );
-        return err;
-    }
-
-    err = nvs_set_str(
-        storage_handle,
-        NVS_THINGSBOARD_CHAINCERT_KEY,
-        thingsboard_cfg->credentials.authentication.certificate
-    );
-    if (err != ESP_OK)
-    {
-        nvs_close(storage_handle);
-        ESP_LOGE(
-            TAG,
-            "Could not store thingsboard credentials authentication key"
-        );
-        return err;
-    }
-
-    /* Commit and close*/
-    err = nvs_commit(storage_handle);
-    if (err != ESP_OK)
-    {
-        nvs_close(storage_handle);
-        ESP_LOGE(TAG, "Could not commit changes in nvs");
-        return err;
-    }
-    nvs_close(storage_handle);
-    return ESP_OK;
-}
-static esp_err_t nvs_set_sgp30_baseline(
-    const sgp30_timed_measurement_t *timed_measurement
-)
-{
-    nvs_handle_t storage_handle;
-    esp_err_t err;
-
-    /* open namespace*/
-    err =
-        nvs_open(NVS_SGP30_STORAGE_NAMESPACE, NVS_READWRITE, &storage_handle);
-    if (err != ESP_OK)
-    {
-        ESP_LOGE(TAG, "Could not open sgp30 namespace to write");
-        return err;
-    }
-    err = nvs_set_blob(
-        storage_handle,
-        NVS_SGP30_BASELINE_KEY,
-        (void *)timed_measurement,
-        sizeof(sgp30_timed_measurement_t)
-    );
-    if (err != ESP_OK)
-    {
-        nvs_close(storage_handle);
-        ESP_LOGE(TAG, "Could not store thingsboard port");
-        return err;
-    }
-
-    /* Commit and close*/
-    err = nvs_commit(storage_handle);
-    if (err != ESP_OK)
-    {
-        nvs_close(storage_handle);
-        ESP_LOGE(TAG, "Could not commit changes in nvs");
-        return err;
-    }
-    nvs_close(storage_handle);
-    return ESP_OK;
-}
-
-static esp_err_t nvs_set_wifi_credentials(const wifi_credentials_t *wifi_credentials)
-{
-    nvs_handle_t storage_handle;
-    esp_err_t err;
-
-    /* open namespace*/
-    err = nvs_open(
-        NVS_WIFI_CREDENTIALS_NAMESPACE,
-        NVS_READWRITE,
-        &storage_handle
-    );
-    if (err != ESP_OK)
-    {
-        ESP_LOGE(TAG, "Could not open wifi credentials namespace to write");
-        return err;
-    }
-
-    /* Set SSID*/
-    err = nvs_set_str(
-        storage_handle,
-        NVS_WIFI_CREDENTIALS_SSID_KEY,
-        wifi_credentials->ssid
-    );
-    if (err != ESP_OK)
-    {
-        nvs_close(storage_handle);
-        ESP_LOGE(TAG, "Could not store wifi credentials ssid");
-        return err;
-    }
-
-    /* Set password*/
-    err = nvs_set_str(
-        storage_handle,
-        NVS_WIFI_CREDENTIALS_PASS_KEY,
-        wifi_credentials->password
-    );
-    if (err != ESP_OK)
-    {
-        nvs_close(storage_handle);
-        ESP_LOGE(TAG, "Could not store wifi credentials password");
-        return err;
-    }
-
-    err = nvs_commit(storage_handle);
-    if (err != ESP_OK)
-    {
-        nvs_close(storage_handle);
-        ESP_LOGE(TAG, "Could not commit changes in nvs");
-        return err;
-    }
-    nvs_close(storage_handle);
-    return ESP_OK;
-}
-
-static esp_err_t nvs_get_wifi_credentials(wifi_credentials_t *wifi_credentials)
+static esp_err_t nvs_get_legacy_wifi_credentials(wifi_credentials_t *wifi_credentials)
 {
     nvs_handle_t storage_handle;
     esp_err_t err;
@@ -426,107 +418,1407 @@ static esp_err_t nvs_get_wifi_credentials(wifi_credentials_t *wifi_credentials)
 
     return ESP_OK;
 }
-static esp_err_t nvs_get_sgp30_baseline(
-    sgp30_timed_measurement_t *sgp30_timed_measurement_handle
-)
+/* Configuration blob: header, then the fields one after another, each with
+ its terminator. One nvs_get_blob reads the whole provisioning state*/
+static uint16_t config_blob_field_len(const char *field)
 {
-    nvs_handle_t storage_handle;
-    esp_err_t err;
-    err = nvs_open(NVS_SGP30_STORAGE_NAMESPACE, NVS_READONLY, &storage_handle);
-    if (err != ESP_OK)
+    return field != NULL ? strlen(field) + 1 : 0;
+}
+
+static const config_blob_header_t *config_blob_header(void)
+{
+    return (const config_blob_header_t *)config_blob;
+}
+
+/* View into a blob, NULL if the field is absent*/
+static char *config_blob_field_of(const uint8_t *blob, int field)
+{
+    const config_blob_header_t *header = (const config_blob_header_t *)blob;
+    size_t offset = sizeof(*header);
+
+    for (int i = 0; i < field; i++)
     {
-        ESP_LOGE(TAG, "Could not open sgp30 namespace in NVS");
-        return err;
+        offset += header->len[i];
     }
-    /* Get*/
-    size_t timed_measurement_len;
-    err = nvs_get_blob(
-        storage_handle,
-        NVS_SGP30_BASELINE_KEY,
-        NULL,
-        &timed_measurement_len
-    );
-    if (err != ESP_OK)
+    return header->len[field] != 0 ? (char *)blob + offset : NULL;
+}
+
+/* View into the loaded blob*/
+static char *config_blob_field(int field)
+{
+    return config_blob_field_of(config_blob, field);
+}
+
+static uint32_t config_blob_crc(const uint8_t *blob, size_t len)
+{
+    const config_blob_header_t *header = (const config_blob_header_t *)blob;
+    size_t skip = (const uint8_t *)&header->version - blob;
+
+    return esp_rom_crc32_le(0, blob + skip, len - skip);
+}
+
+static esp_err_t config_blob_check(const uint8_t *blob, size_t len)
+{
+    const config_blob_header_t *header = (const config_blob_header_t *)blob;
+    size_t offset = sizeof(*header);
+
+    if (len < sizeof(*header) || header->magic != NVS_CONFIG_MAGIC)
     {
-        nvs_close(storage_handle);
-        ESP_LOGE(TAG, "Could not get baseline len from NVS");
-        return err;
+        return ESP_ERR_INVALID_STATE;
     }
-
-    err = nvs_get_blob(
-        storage_handle,
-        NVS_SGP30_BASELINE_KEY,
-        sgp30_timed_measurement_handle,
-        &timed_measurement_len
-    );
-    if (err != ESP_OK)
+    if (header->version != NVS_CONFIG_VERSION)
     {
-        nvs_close(storage_handle);
-        ESP_LOGE(TAG, "Could not get baseline from NVS");
-        return err;
+        return ESP_ERR_NOT_SUPPORTED;
     }
-
-    nvs_close(storage_handle);
-    return ESP_OK;
+    for (int i = 0; i < CONFIG_FIELDS; i++)
+    {
+        offset += header->len[i];
+        if (offset > len || (header->len[i] != 0 && blob[offset - 1] != '\0'))
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    if (offset != len
+        || header->len[CONFIG_FIELD_SSID] > SOFT_AP_PROVISION_TYPES_MAX_SSID_LEN
+        || header->len[CONFIG_FIELD_PASS] > SOFT_AP_PROVISION_TYPES_MAX_PASS_LEN)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return config_blob_crc(blob, len) == header->crc ? ESP_OK : ESP_ERR_INVALID_CRC;
 }
 
-esp_err_t storage_init()
+/* A version 1 blob has no access token, its length is inserted after the
+ others. The blob is replaced, it is stored in version 2 on the next write*/
+static esp_err_t config_blob_upgrade(uint8_t **blob, size_t *len)
 {
-    esp_err_t err = nvs_flash_init();
-    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
+    const config_blob_header_t *header = (const config_blob_header_t *)*blob;
+    size_t header_v1 = offsetof(config_blob_header_t, len[CONFIG_FIELD_ACCESS_TOKEN]);
+
+    if (*len < header_v1 || header->magic != NVS_CONFIG_MAGIC || header->version != 1)
     {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        err = nvs_flash_init();
+        return ESP_OK;
     }
-    if (err != ESP_OK)
+    if (config_blob_crc(*blob, *len) != header->crc)
     {
-        ESP_LOGE(TAG, "Could not initialize NVS");
-        return err;
+        return ESP_ERR_INVALID_CRC;
+    }
+    uint8_t *upgraded = malloc(*len + sizeof(header->len[0]));
+    if (upgraded == NULL)
+    {
+        return ESP_ERR_NO_MEM;
     }
+    memcpy(upgraded, *blob, header_v1);
+    memcpy(upgraded + sizeof(*header), *blob + header_v1, *len - header_v1);
+    free(*blob);
+    *blob = upgraded;
+    *len += sizeof(header->len[0]);
+    config_blob_header_t *upgraded_header = (config_blob_header_t *)upgraded;
+    upgraded_header->version = NVS_CONFIG_VERSION;
+    upgraded_header->len[CONFIG_FIELD_ACCESS_TOKEN] = 0;
+    upgraded_header->crc = config_blob_crc(upgraded, *len);
     return ESP_OK;
 }
 
-esp_err_t storage_erase()
+static bool config_field_is_certificate(int field)
 {
-    esp_err_t err = nvs_flash_erase();
-    if (err != ESP_OK)
+    return field == CONFIG_FIELD_CA_CERT || field == CONFIG_FIELD_DEV_KEY || field == CONFIG_FIELD_CHAIN_CERT;
+}
+
+/* Length of a blob without its certificates*/
+static size_t config_blob_stripped_len(const uint8_t *blob, size_t len)
+{
+    const config_blob_header_t *header = (const config_blob_header_t *)blob;
+
+    for (int i = 0; i < CONFIG_FIELDS; i++)
     {
-        ESP_LOGE(TAG, "Could not erase NVS");
-        return err;
+        len -= config_field_is_certificate(i) ? header->len[i] : 0;
     }
-    return ESP_OK;
+    return len;
 }
 
-esp_err_t storage_get_sgp30_baseline(
-    sgp30_timed_measurement_t *sgp30_log_entry_handle
-)
+/* Copy a blob without its certificates, with the same generation, to
+ config_blob_stripped_len bytes*/
+static void config_blob_strip(const uint8_t *blob, uint8_t *stripped)
 {
-    return nvs_get_sgp30_baseline(sgp30_log_entry_handle);
+    const config_blob_header_t *header = (const config_blob_header_t *)blob;
+    config_blob_header_t *stripped_header = (config_blob_header_t *)stripped;
+    size_t offset = sizeof(*header);
+    uint8_t *cursor = stripped + sizeof(*header);
+
+    memcpy(stripped_header, header, sizeof(*header));
+    for (int i = 0; i < CONFIG_FIELDS; offset += header->len[i], i++)
+    {
+        if (config_field_is_certificate(i))
+        {
+            stripped_header->len[i] = 0;
+            continue;
+        }
+        memcpy(cursor, blob + offset, header->len[i]);
+        cursor += header->len[i];
+    }
+    stripped_header->crc = config_blob_crc(stripped, cursor - stripped);
 }
 
-esp_err_t storage_set_sgp30_baseline(
-    const sgp30_timed_measurement_t *timed_measurement
-)
+#if CONFIG_STORAGE_RTC_CONFIG_CACHE
+/* Keep the blob without its certificates, with the same generation*/
+static void config_snapshot_save(const uint8_t *blob, size_t len)
 {
-    return nvs_set_sgp30_baseline(timed_measurement);
+    config_snapshot.magic = 0;
+    if (blob == NULL)
+    {
+        return;
+    }
+    len = config_blob_stripped_len(blob, len);
+    if (len > sizeof(config_snapshot.data))
+    {
+        ESP_LOGW(TAG, "Configuration of %u bytes without certificates does not fit in RTC memory", (unsigned)len);
+        return;
+    }
+    config_blob_strip(blob, config_snapshot.data);
+    const char *ca_cert = config_blob_field_of(blob, CONFIG_FIELD_CA_CERT);
+    const char *chain_cert = config_blob_field_of(blob, CONFIG_FIELD_CHAIN_CERT);
+    const char *dev_key = config_blob_field_of(blob, CONFIG_FIELD_DEV_KEY);
+    config_snapshot.certificates_crc = ca_cert != NULL && chain_cert != NULL && dev_key != NULL
+        ? cert_store_source_crc(ca_cert, chain_cert, dev_key)
+        : 0;
+    config_snapshot.len = len;
+    config_snapshot.magic = CONFIG_SNAPSHOT_MAGIC;
 }
+#endif
 
-esp_err_t storage_get_wifi_credentials(wifi_credentials_t *sgp30_log_entry_handle)
+/* Replace the loaded blob. One whose views were handed out is kept, the
+ configuration is used for the whole run*/
+static void config_blob_replace(uint8_t *blob, size_t len)
 {
-    return nvs_get_wifi_credentials(sgp30_log_entry_handle);
+    if (!config_blob_lent)
+    {
+        free(config_blob);
+    }
+    config_blob = blob;
+    config_blob_len = len;
+    config_blob_lent = false;
+    config_blob_stripped = false;
+#if CONFIG_STORAGE_RTC_CONFIG_CACHE
+    config_snapshot_save(blob, len);
+#endif
 }
 
-esp_err_t storage_set_wifi_credentials(const wifi_credentials_t *wifi_credentials)
+/* Build a blob in one allocation, NULL parts are left out*/
+static esp_err_t config_blob_build(
+    const thingsboard_cfg_t *thingsboard_cfg,
+    const wifi_credentials_t *wifi_credentials,
+    uint8_t **blob,
+    size_t *len
+)
 {
-    return nvs_set_wifi_credentials(wifi_credentials);
+    const char *fields[CONFIG_FIELDS] = { 0 };
+    config_blob_header_t header = {
+        .magic = NVS_CONFIG_MAGIC,
+        .version = NVS_CONFIG_VERSION,
+        .generation = config_blob != NULL ? config_blob_header()->generation + 1 : 1,
+    };
+
+    if (thingsboard_cfg != NULL)
+    {
+        header.present |= CONFIG_HAS_THINGSBOARD;
+        header.port = thingsboard_cfg->address.port;
+        fields[CONFIG_FIELD_URI] = thingsboard_cfg->address.uri;
+        fields[CONFIG_FIELD_CA_CERT] = thingsboard_cfg->verification.certificate;
+        fields[CONFIG_FIELD_DEV_KEY] = thingsboard_cfg->credentials.authentication.key;
+        fields[CONFIG_FIELD_CHAIN_CERT] = thingsboard_cfg->credentials.authentication.certificate;
+        fields[CONFIG_FIELD_ACCESS_TOKEN] = thingsboard_cfg->credentials.access_token;
+    }
+    if (wifi_credentials != NULL)
+    {
+        header.present |= CONFIG_HAS_WIFI;
+        fields[CONFIG_FIELD_SSID] = wifi_credentials->ssid;
+        fields[CONFIG_FIELD_PASS] = wifi_credentials->password;
+    }
+    *len = sizeof(header);
+    for (int i = 0; i < CONFIG_FIELDS; i++)
+    {
+        if (fields[i] != NULL && strlen(fields[i]) >= UINT16_MAX)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        header.len[i] = config_blob_field_len(fields[i]);
+        *len += header.len[i];
+    }
+    *blob = malloc(*len);
+    if (*blob == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    uint8_t *cursor = *blob + sizeof(header);
+    for (int i = 0; i < CONFIG_FIELDS; i++)
+    {
+        memcpy(cursor, fields[i], header.len[i]);
+        cursor += header.len[i];
+    }
+    memcpy(*blob, &header, sizeof(header));
+    ((config_blob_header_t *)*blob)->crc = config_blob_crc(*blob, *len);
+    return ESP_OK;
 }
 
-esp_err_t storage_get_thingsboard_cfg(thingsboard_cfg_t *thingsboard_cfg)
+static storage_namespace_stats_t *storage_stats_of(const char *name)
 {
-    return nvs_get_thingsboard_cfg(thingsboard_cfg);
+    for (size_t i = 0; i < STORAGE_STATS_NAMESPACES; i++)
+    {
+        if (strcmp(storage_namespaces[i], name) == 0)
+        {
+            return &storage_stats.namespaces[i];
+        }
+    }
+    return NULL;
 }
 
-esp_err_t storage_set_thingsboard_cfg(const thingsboard_cfg_t *thingsboard_cfg)
+/* Count an operation on a namespace with its bytes and time*/
+static void storage_stats_count(const char *name, storage_op_t op, size_t len, int64_t started_at)
 {
-    return nvs_set_thingsboard_cfg(thingsboard_cfg);
+    storage_namespace_stats_t *stats = storage_stats_of(name);
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - started_at);
+
+    if (stats == NULL)
+    {
+        return;
+    }
+    switch (op)
+    {
+    case STORAGE_OP_READ:
+        stats->reads++;
+        stats->read_bytes += len;
+        stats->read_us += elapsed;
+        break;
+    case STORAGE_OP_WRITE:
+        stats->writes++;
+        stats->written_bytes += len;
+        stats->write_us += elapsed;
+        break;
+    case STORAGE_OP_COMMIT:
+        stats->commits++;
+        stats->commit_us += elapsed;
+        break;
+    }
+    if (elapsed > stats->max_us)
+    {
+        stats->max_us = elapsed;
+    }
+}
+
+static void storage_stats_sample(void)
+{
+    nvs_stats_t nvs_stats;
+
+    if (nvs_get_stats(NULL, &nvs_stats) == ESP_OK)
+    {
+        storage_stats.used_entries = nvs_stats.used_entries;
+        storage_stats.free_entries = nvs_stats.free_entries;
+        storage_stats.total_entries = nvs_stats.total_entries;
+        storage_stats.namespace_count = nvs_stats.namespace_count;
+    }
+}
+
+#if CONFIG_STORAGE_STATS_SAMPLE_PERIOD > 0
+/* Runs on the esp_timer task, which must not wait for a transaction. A
+ busy storage is sampled on the next tick, or by the commit if it writes*/
+static void storage_stats_timer_callback(void *arg)
+{
+    if (xSemaphoreTake(storage_lock, 0) != pdTRUE)
+    {
+        ESP_LOGD(TAG, "Storage busy, NVS usage not sampled");
+        return;
+    }
+    storage_stats_sample();
+    xSemaphoreGive(storage_lock);
+}
+#endif
+
+/* Namespaces are opened once and kept open. A read-only handle is reopened
+ read-write on the first write, so reading a namespace that does not exist
+ yet does not create it*/
+static esp_err_t storage_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    storage_handle_t *slot = NULL;
+
+    for (size_t i = 0; i < STORAGE_HANDLES; i++)
+    {
+        if (storage_handles[i].name == NULL)
+        {
+            slot = slot != NULL ? slot : &storage_handles[i];
+        }
+        else if (strcmp(storage_handles[i].name, name) == 0)
+        {
+            slot = &storage_handles[i];
+            if (slot->mode == NVS_READWRITE || mode == NVS_READONLY)
+            {
+                *handle = slot->handle;
+                return ESP_OK;
+            }
+            nvs_close(slot->handle);
+            slot->name = NULL;
+            break;
+        }
+    }
+    ESP_RETURN_ON_FALSE(slot != NULL, ESP_ERR_NO_MEM, TAG, "No handle left for namespace %s", name);
+    esp_err_t err = nvs_open(name, mode, handle);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    *slot = (storage_handle_t){ .name = name, .handle = *handle, .mode = mode };
+    storage_stats.opens++;
+    return ESP_OK;
+}
+
+static void storage_mark_dirty(const char *name)
+{
+    for (size_t i = 0; i < STORAGE_HANDLES; i++)
+    {
+        if (storage_handles[i].name != NULL && strcmp(storage_handles[i].name, name) == 0)
+        {
+            storage_handles[i].dirty = true;
+        }
+    }
+}
+
+/* Write a blob on the read-write handle of its namespace, committed by
+ storage_commit*/
+static esp_err_t storage_write(const char *name, const char *key, const void *value, size_t len)
+{
+    nvs_handle_t handle;
+
+    ESP_RETURN_ON_ERROR(storage_open(name, NVS_READWRITE, &handle), TAG, "Could not open %s namespace to write", name);
+    int64_t started_at = esp_timer_get_time();
+    ESP_RETURN_ON_ERROR(nvs_set_blob(handle, key, value, len), TAG, "Could not store %s", key);
+    storage_stats_count(name, STORAGE_OP_WRITE, len, started_at);
+    storage_mark_dirty(name);
+    return ESP_OK;
+}
+
+/* Stored next to the blob and committed with it, a wake checks the copy in
+ RTC memory against it without reading the blob*/
+static esp_err_t config_generation_write(const uint8_t *blob)
+{
+    uint32_t generation = ((const config_blob_header_t *)blob)->generation;
+    nvs_handle_t handle;
+
+    ESP_RETURN_ON_ERROR(
+        storage_open(NVS_THINGSBOARD_NAMESPACE, NVS_READWRITE, &handle),
+        TAG,
+        "Could not open %s namespace to write",
+        NVS_THINGSBOARD_NAMESPACE
+    );
+    int64_t started_at = esp_timer_get_time();
+    ESP_RETURN_ON_ERROR(
+        nvs_set_u32(handle, NVS_CONFIG_GENERATION_KEY, generation),
+        TAG,
+        "Could not store the configuration generation"
+    );
+    storage_stats_count(NVS_THINGSBOARD_NAMESPACE, STORAGE_OP_WRITE, sizeof(generation), started_at);
+    storage_mark_dirty(NVS_THINGSBOARD_NAMESPACE);
+    return ESP_OK;
+}
+
+static esp_err_t config_generation_read(uint32_t *generation)
+{
+    nvs_handle_t handle;
+
+    esp_err_t err = storage_open(NVS_THINGSBOARD_NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_OK)
+    {
+        int64_t started_at = esp_timer_get_time();
+        err = nvs_get_u32(handle, NVS_CONFIG_GENERATION_KEY, generation);
+        storage_stats_count(
+            NVS_THINGSBOARD_NAMESPACE,
+            STORAGE_OP_READ,
+            err == ESP_OK ? sizeof(*generation) : 0,
+            started_at
+        );
+    }
+    return err;
+}
+
+/* One commit per namespace written*/
+static esp_err_t storage_commit(size_t *commits)
+{
+    esp_err_t result = ESP_OK;
+
+    for (size_t i = 0; i < STORAGE_HANDLES; i++)
+    {
+        if (storage_handles[i].name != NULL && storage_handles[i].dirty)
+        {
+            int64_t started_at = esp_timer_get_time();
+            esp_err_t err = nvs_commit(storage_handles[i].handle);
+            storage_stats_count(storage_handles[i].name, STORAGE_OP_COMMIT, 0, started_at);
+            if (err != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Could not commit changes in %s", storage_handles[i].name);
+                result = err;
+            }
+            storage_handles[i].dirty = false;
+            (*commits)++;
+        }
+    }
+    return result;
+}
+
+static void storage_close_all(void)
+{
+    for (size_t i = 0; i < STORAGE_HANDLES; i++)
+    {
+        if (storage_handles[i].name != NULL)
+        {
+            nvs_close(storage_handles[i].handle);
+            storage_handles[i].name = NULL;
+        }
+    }
+}
+
+/* Write a value. A snapshot of the configuration is dropped before its blob
+ is replaced, the generation written after it only spares a wake the read
+ of the blob*/
+static esp_err_t storage_value_write(const char *name, const char *key, const void *value, size_t len)
+{
+    bool config = strcmp(key, NVS_CONFIG_KEY) == 0;
+
+#if CONFIG_STORAGE_RTC_CONFIG_CACHE
+    if (config)
+    {
+        config_snapshot.magic = 0;
+    }
+#endif
+    ESP_RETURN_ON_ERROR(storage_write(name, key, value, len), TAG, "Could not store %s", key);
+    if (config && config_generation_write(value) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Configuration stored without its generation");
+    }
+    return ESP_OK;
+}
+
+static esp_err_t storage_journal_write(const storage_txn_write_t *writes, size_t count)
+{
+    size_t len = sizeof(storage_journal_header_t);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        len += sizeof(storage_journal_entry_t) + writes[i].len;
+    }
+    uint8_t *journal = malloc(len);
+    ESP_RETURN_ON_FALSE(journal != NULL, ESP_ERR_NO_MEM, TAG, "No memory for the transaction journal");
+    uint8_t *at = journal + sizeof(storage_journal_header_t);
+    for (size_t i = 0; i < count; i++)
+    {
+        storage_journal_entry_t entry = { .len = writes[i].len };
+        while (strcmp(storage_namespaces[entry.name], writes[i].name) != 0)
+        {
+            entry.name++;
+        }
+        strncpy(entry.key, writes[i].key, sizeof(entry.key) - 1);
+        memcpy(at, &entry, sizeof(entry));
+        memcpy(at + sizeof(entry), writes[i].value, writes[i].len);
+        at += sizeof(entry) + writes[i].len;
+    }
+    storage_journal_header_t header = { .count = count };
+    memcpy(journal, &header, sizeof(header));
+    header.crc = esp_rom_crc32_le(0, journal + sizeof(header.crc), len - sizeof(header.crc));
+    memcpy(journal, &header, sizeof(header));
+    storage_journal_clear = false;
+    esp_err_t err = storage_write(NVS_THINGSBOARD_NAMESPACE, NVS_TXN_JOURNAL_KEY, journal, len);
+    free(journal);
+    ESP_RETURN_ON_ERROR(err, TAG, "Could not store the transaction journal");
+    return ESP_OK;
+}
+
+static esp_err_t storage_journal_erase(void)
+{
+    nvs_handle_t handle;
+
+    ESP_RETURN_ON_ERROR(
+        storage_open(NVS_THINGSBOARD_NAMESPACE, NVS_READWRITE, &handle),
+        TAG,
+        "Could not open %s namespace to write",
+        NVS_THINGSBOARD_NAMESPACE
+    );
+    int64_t started_at = esp_timer_get_time();
+    ESP_RETURN_ON_ERROR(nvs_erase_key(handle, NVS_TXN_JOURNAL_KEY), TAG, "Could not erase the transaction journal");
+    storage_stats_count(NVS_THINGSBOARD_NAMESPACE, STORAGE_OP_WRITE, 0, started_at);
+    storage_mark_dirty(NVS_THINGSBOARD_NAMESPACE);
+    return ESP_OK;
+}
+
+static esp_err_t storage_journal_apply(const uint8_t *journal, size_t len)
+{
+    storage_journal_header_t header;
+    size_t at = sizeof(header);
+
+    ESP_RETURN_ON_FALSE(len >= sizeof(header), ESP_ERR_INVALID_SIZE, TAG, "Transaction journal truncated");
+    memcpy(&header, journal, sizeof(header));
+    ESP_RETURN_ON_FALSE(
+        header.crc == esp_rom_crc32_le(0, journal + sizeof(header.crc), len - sizeof(header.crc)),
+        ESP_ERR_INVALID_CRC,
+        TAG,
+        "Transaction journal corrupted"
+    );
+    for (size_t i = 0; i < header.count; i++)
+    {
+        storage_journal_entry_t entry;
+        ESP_RETURN_ON_FALSE(len - at >= sizeof(entry), ESP_ERR_INVALID_SIZE, TAG, "Transaction journal truncated");
+        memcpy(&entry, journal + at, sizeof(entry));
+        at += sizeof(entry);
+        ESP_RETURN_ON_FALSE(
+            entry.name < STORAGE_STATS_NAMESPACES && entry.len <= len - at,
+            ESP_ERR_INVALID_SIZE,
+            TAG,
+            "Transaction journal truncated"
+        );
+        entry.key[sizeof(entry.key) - 1] = '\0';
+        ESP_RETURN_ON_ERROR(
+            storage_value_write(storage_namespaces[entry.name], entry.key, journal + at, entry.len),
+            TAG,
+            "Could not write the transaction journal again"
+        );
+        at += entry.len;
+    }
+    return ESP_OK;
+}
+
+/* Finish the transaction whose journal was left by a reset or a failed
+ write: its values are written again and the journal erased. A corrupted
+ one is erased without writing them. The values kept in RAM are read again*/
+static esp_err_t storage_journal_replay(void)
+{
+    nvs_handle_t handle;
+    size_t len = 0;
+    size_t commits = 0;
+
+    if (storage_journal_clear)
+    {
+        return ESP_OK;
+    }
+    esp_err_t err = storage_open(NVS_THINGSBOARD_NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_OK)
+    {
+        int64_t started_at = esp_timer_get_time();
+        err = nvs_get_blob(handle, NVS_TXN_JOURNAL_KEY, NULL, &len);
+        storage_stats_count(NVS_THINGSBOARD_NAMESPACE, STORAGE_OP_READ, 0, started_at);
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        storage_journal_clear = true;
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(err, TAG, "Could not read the transaction journal");
+    uint8_t *journal = malloc(len);
+    ESP_RETURN_ON_FALSE(journal != NULL, ESP_ERR_NO_MEM, TAG, "No memory for the transaction journal");
+    int64_t started_at = esp_timer_get_time();
+    err = nvs_get_blob(handle, NVS_TXN_JOURNAL_KEY, journal, &len);
+    storage_stats_count(NVS_THINGSBOARD_NAMESPACE, STORAGE_OP_READ, len, started_at);
+    if (err == ESP_OK)
+    {
+        err = storage_journal_apply(journal, len);
+        if (err == ESP_ERR_INVALID_CRC || err == ESP_ERR_INVALID_SIZE)
+        {
+            err = ESP_OK;
+        }
+    }
+    free(journal);
+    for (size_t i = 0; i < STORAGE_KEYS; i++)
+    {
+        storage_keys[i].valid = false;
+    }
+    config_blob_replace(NULL, 0);
+    if (err == ESP_OK)
+    {
+        err = storage_journal_erase();
+    }
+    if (err == ESP_OK)
+    {
+        err = storage_commit(&commits);
+    }
+    ESP_RETURN_ON_ERROR(err, TAG, "Could not finish the transaction of the journal");
+    storage_journal_clear = true;
+    ESP_LOGW(TAG, "Transaction finished from its journal");
+    return ESP_OK;
+}
+
+/* Same parts as the loaded blob, whatever its generation*/
+static bool config_blob_unchanged(const uint8_t *blob, size_t len)
+{
+    size_t version = offsetof(config_blob_header_t, version);
+    size_t generation = offsetof(config_blob_header_t, generation);
+    size_t lens = offsetof(config_blob_header_t, len);
+
+    return config_blob != NULL && len == config_blob_len
+        && memcmp(blob + version, config_blob + version, generation - version) == 0
+        && memcmp(blob + lens, config_blob + lens, len - lens) == 0;
+}
+
+static esp_err_t config_blob_write(uint8_t *blob, size_t len)
+{
+    size_t commits = 0;
+
+    ESP_RETURN_ON_ERROR(
+        storage_value_write(NVS_THINGSBOARD_NAMESPACE, NVS_CONFIG_KEY, blob, len),
+        TAG,
+        "Could not store the configuration"
+    );
+    ESP_RETURN_ON_ERROR(storage_commit(&commits), TAG, "Could not store the configuration");
+    config_blob_replace(blob, len);
+    return ESP_OK;
+}
+
+static void config_blob_erase_legacy(void)
+{
+    static const char *thingsboard_keys[] = {
+        NVS_THINGSBOARD_URI_KEY,
+        NVS_THINGSBOARD_PORT_KEY,
+        NVS_THINGSBOARD_CACERT_KEY,
+        NVS_THINGSBOARD_DEVCERT_KEY,
+        NVS_THINGSBOARD_CHAINCERT_KEY,
+    };
+    nvs_handle_t storage_handle;
+
+    if (nvs_open(NVS_THINGSBOARD_NAMESPACE, NVS_READWRITE, &storage_handle) == ESP_OK)
+    {
+        for (size_t i = 0; i < sizeof(thingsboard_keys) / sizeof(thingsboard_keys[0]); i++)
+        {
+            nvs_erase_key(storage_handle, thingsboard_keys[i]);
+        }
+        nvs_commit(storage_handle);
+        nvs_close(storage_handle);
+    }
+    if (nvs_open(NVS_WIFI_CREDENTIALS_NAMESPACE, NVS_READWRITE, &storage_handle) == ESP_OK)
+    {
+        nvs_erase_all(storage_handle);
+        nvs_commit(storage_handle);
+        nvs_close(storage_handle);
+    }
+}
+
+/* Move the configuration stored key by key into the blob. The old keys are
+ erased once the blob is committed, a reset in between migrates again*/
+static esp_err_t config_blob_migrate(void)
+{
+    thingsboard_cfg_t thingsboard_cfg;
+    wifi_credentials_t wifi_credentials;
+    uint8_t *blob;
+    size_t len;
+    int64_t started_at = esp_timer_get_time();
+
+    bool has_thingsboard = nvs_get_legacy_thingsboard_cfg(&thingsboard_cfg) == ESP_OK;
+    bool has_wifi = nvs_get_legacy_wifi_credentials(&wifi_credentials) == ESP_OK;
+    ESP_LOGI(
+        TAG,
+        "Configuration read key by key in %" PRId64 " us",
+        esp_timer_get_time() - started_at
+    );
+    if (!has_thingsboard && !has_wifi)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    esp_err_t err = config_blob_build(
+        has_thingsboard ? &thingsboard_cfg : NULL,
+        has_wifi ? &wifi_credentials : NULL,
+        &blob,
+        &len
+    );
+    if (has_thingsboard)
+    {
+        free(thingsboard_cfg.address.uri);
+        free(thingsboard_cfg.verification.certificate);
+        free(thingsboard_cfg.credentials.authentication.key);
+        free(thingsboard_cfg.credentials.authentication.certificate);
+    }
+    ESP_RETURN_ON_ERROR(err, TAG, "Could not build the configuration blob");
+    err = config_blob_write(blob, len);
+    if (err != ESP_OK)
+    {
+        free(blob);
+        return err;
+    }
+    config_blob_erase_legacy();
+    ESP_LOGI(TAG, "Configuration migrated to a %u byte blob", (unsigned)len);
+    return ESP_OK;
+}
+
+#if CONFIG_STORAGE_RTC_CONFIG_CACHE
+/* Take the blob without certificates from RTC memory if its CRC holds and
+ it is the generation stored in NVS*/
+static esp_err_t config_snapshot_load(void)
+{
+    const config_blob_header_t *header = (const config_blob_header_t *)config_snapshot.data;
+    uint32_t generation;
+
+    if (config_snapshot.magic != CONFIG_SNAPSHOT_MAGIC
+        || config_snapshot.len > sizeof(config_snapshot.data)
+        || config_blob_check(config_snapshot.data, config_snapshot.len) != ESP_OK
+        || config_generation_read(&generation) != ESP_OK
+        || header->generation != generation)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    config_blob = malloc(config_snapshot.len);
+    if (config_blob == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(config_blob, config_snapshot.data, config_snapshot.len);
+    config_blob_len = config_snapshot.len;
+    config_blob_lent = false;
+    config_blob_stripped = true;
+    return ESP_OK;
+}
+
+/* A blob stored without its generation, or whose generation was not
+ committed with it, is not taken from RTC memory until this writes it*/
+static void config_generation_sync(void)
+{
+    uint32_t generation;
+    size_t commits = 0;
+
+    if (config_generation_read(&generation) == ESP_OK && generation == config_blob_header()->generation)
+    {
+        return;
+    }
+    if (config_generation_write(config_blob) != ESP_OK || storage_commit(&commits) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not store the configuration generation");
+    }
+}
+#endif
+
+/* Read the blob from NVS, or migrate the keys of the old layout to it*/
+static esp_err_t config_blob_read(void)
+{
+    nvs_handle_t storage_handle;
+    size_t len = 0;
+    int64_t started_at = esp_timer_get_time();
+
+    ESP_RETURN_ON_ERROR(storage_journal_replay(), TAG, "Could not read the configuration");
+    esp_err_t err = storage_open(NVS_THINGSBOARD_NAMESPACE, NVS_READONLY, &storage_handle);
+    if (err == ESP_OK)
+    {
+        err = nvs_get_blob(storage_handle, NVS_CONFIG_KEY, NULL, &len);
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        return config_blob_migrate();
+    }
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    uint8_t *blob = malloc(len);
+    if (blob == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    int64_t read_at = esp_timer_get_time();
+    err = nvs_get_blob(storage_handle, NVS_CONFIG_KEY, blob, &len);
+    storage_stats_count(NVS_THINGSBOARD_NAMESPACE, STORAGE_OP_READ, len, read_at);
+    if (err == ESP_OK)
+    {
+        err = config_blob_upgrade(&blob, &len);
+    }
+    if (err == ESP_OK)
+    {
+        err = config_blob_check(blob, len);
+    }
+    if (err != ESP_OK)
+    {
+        free(blob);
+        ESP_LOGE(TAG, "Stored configuration is not valid: %s", esp_err_to_name(err));
+        return err;
+    }
+    config_blob_replace(blob, len);
+    ESP_LOGI(
+        TAG,
+        "Configuration generation %" PRIu32 " of %u bytes read in %" PRId64 " us",
+        config_blob_header()->generation,
+        (unsigned)len,
+        esp_timer_get_time() - started_at
+    );
+#if CONFIG_STORAGE_RTC_CONFIG_CACHE
+    config_generation_sync();
+#endif
+    return ESP_OK;
+}
+
+/* Read the blob once per boot, the views handed out point into it*/
+static esp_err_t config_blob_load(void)
+{
+    ESP_RETURN_ON_ERROR(storage_journal_replay(), TAG, "Could not read the configuration");
+    if (config_blob != NULL)
+    {
+        return ESP_OK;
+    }
+#if CONFIG_STORAGE_RTC_CONFIG_CACHE
+    int64_t started_at = esp_timer_get_time();
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER && config_snapshot_load() == ESP_OK)
+    {
+        ESP_LOGI(
+            TAG,
+            "Configuration generation %" PRIu32 " taken from RTC memory in %" PRId64 " us",
+            config_blob_header()->generation,
+            esp_timer_get_time() - started_at
+        );
+        return ESP_OK;
+    }
+#endif
+    return config_blob_read();
+}
+
+static esp_err_t nvs_get_thingsboard_cfg(thingsboard_cfg_t *cfg)
+{
+    esp_err_t err = config_blob_load();
+
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (!(config_blob_header()->present & CONFIG_HAS_THINGSBOARD))
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    cfg->address.uri = config_blob_field(CONFIG_FIELD_URI);
+    cfg->address.port = config_blob_header()->port;
+    cfg->verification.certificate = config_blob_field(CONFIG_FIELD_CA_CERT);
+    cfg->verification.certificate_len = config_blob_header()->len[CONFIG_FIELD_CA_CERT];
+    cfg->credentials.authentication.certificate = config_blob_field(CONFIG_FIELD_CHAIN_CERT);
+    cfg->credentials.authentication.certificate_len = config_blob_header()->len[CONFIG_FIELD_CHAIN_CERT];
+    cfg->credentials.authentication.key = config_blob_field(CONFIG_FIELD_DEV_KEY);
+    cfg->credentials.authentication.key_len = config_blob_header()->len[CONFIG_FIELD_DEV_KEY];
+    cfg->credentials.access_token = config_blob_field(CONFIG_FIELD_ACCESS_TOKEN);
+    config_blob_lent = true;
+    return ESP_OK;
+}
+
+static esp_err_t nvs_get_wifi_credentials(wifi_credentials_t *wifi_credentials)
+{
+    esp_err_t err = config_blob_load();
+
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (!(config_blob_header()->present & CONFIG_HAS_WIFI))
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    memcpy(
+        wifi_credentials->ssid,
+        config_blob_field(CONFIG_FIELD_SSID),
+        config_blob_header()->len[CONFIG_FIELD_SSID]
+    );
+    memcpy(
+        wifi_credentials->password,
+        config_blob_field(CONFIG_FIELD_PASS),
+        config_blob_header()->len[CONFIG_FIELD_PASS]
+    );
+    return ESP_OK;
+}
+
+/* Rebuild the blob with the staged parts, keeping the stored others. NULL
+ if it would not change*/
+static esp_err_t config_blob_stage(
+    const thingsboard_cfg_t *thingsboard_cfg,
+    const wifi_credentials_t *wifi_credentials,
+    uint8_t **blob,
+    size_t *len
+)
+{
+    thingsboard_cfg_t stored_thingsboard_cfg;
+    wifi_credentials_t stored_wifi_credentials;
+    bool lent;
+
+    /* A blob without certificates has none to keep, read the stored one*/
+    if (config_blob_stripped)
+    {
+        ESP_RETURN_ON_ERROR(config_blob_read(), TAG, "Could not read the stored configuration");
+    }
+    lent = config_blob_lent;
+    if (config_blob_load() == ESP_OK)
+    {
+        if (thingsboard_cfg == NULL
+            && nvs_get_thingsboard_cfg(&stored_thingsboard_cfg) == ESP_OK)
+        {
+            thingsboard_cfg = &stored_thingsboard_cfg;
+        }
+        if (wifi_credentials == NULL
+            && nvs_get_wifi_credentials(&stored_wifi_credentials) == ESP_OK)
+        {
+            wifi_credentials = &stored_wifi_credentials;
+        }
+        /* The stored part is copied, these views are not handed out*/
+        config_blob_lent = lent;
+    }
+    ESP_RETURN_ON_ERROR(
+        config_blob_build(thingsboard_cfg, wifi_credentials, blob, len),
+        TAG,
+        "Could not build the configuration blob"
+    );
+    if (config_blob_unchanged(*blob, *len))
+    {
+        free(*blob);
+        *blob = NULL;
+    }
+    return ESP_OK;
+}
+
+/* Read a key once, later reads and writes of the same value are answered
+ from RAM*/
+static esp_err_t storage_key_load(storage_key_t *key)
+{
+    nvs_handle_t handle;
+    size_t len = key->len;
+
+    ESP_RETURN_ON_ERROR(storage_journal_replay(), TAG, "Could not read %s", key->key);
+    if (key->valid)
+    {
+        return ESP_OK;
+    }
+    esp_err_t err = storage_open(key->name, NVS_READONLY, &handle);
+    if (err == ESP_OK)
+    {
+        int64_t started_at = esp_timer_get_time();
+        err = nvs_get_blob(handle, key->key, key->value, &len);
+        storage_stats_count(key->name, STORAGE_OP_READ, err == ESP_OK ? len : 0, started_at);
+    }
+    if (err != ESP_OK || len != key->len)
+    {
+        ESP_LOGI(TAG, "No %s in NVS", key->key);
+        return err != ESP_OK ? err : ESP_ERR_INVALID_SIZE;
+    }
+    key->valid = true;
+    return ESP_OK;
+}
+
+static esp_err_t storage_key_get(storage_key_t *key, void *value)
+{
+    esp_err_t err = storage_key_load(key);
+
+    if (err == ESP_OK)
+    {
+        memcpy(value, key->value, key->len);
+    }
+    return err;
+}
+
+/* A staged key is not written if it holds the value already*/
+static bool storage_key_unchanged(storage_key_t *key, const void *value)
+{
+    if (storage_key_load(key) == ESP_OK && memcmp(key->value, value, key->len) == 0)
+    {
+        storage_stats_of(key->name)->skipped++;
+        return true;
+    }
+    return false;
+}
+
+esp_err_t storage_init()
+{
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
+    {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Could not initialize NVS");
+        return err;
+    }
+    if (storage_lock == NULL)
+    {
+        storage_lock = xSemaphoreCreateMutex();
+        ESP_RETURN_ON_FALSE(storage_lock != NULL, ESP_ERR_NO_MEM, TAG, "Could not create the storage lock");
+    }
+    if (storage_journal_replay() != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Transaction journal left, it is tried again on the next access");
+    }
+    storage_stats_sample();
+#if CONFIG_STORAGE_STATS_SAMPLE_PERIOD > 0
+    if (storage_stats_timer == NULL)
+    {
+        const esp_timer_create_args_t timer_args = {
+            .callback = storage_stats_timer_callback,
+            .name = "storage_stats",
+        };
+        ESP_RETURN_ON_ERROR(esp_timer_create(&timer_args, &storage_stats_timer), TAG, "Could not create the stats timer");
+        ESP_RETURN_ON_ERROR(
+            esp_timer_start_periodic(storage_stats_timer, (uint64_t)CONFIG_STORAGE_STATS_SAMPLE_PERIOD * 1000000),
+            TAG,
+            "Could not start the stats timer"
+        );
+    }
+#endif
+    return ESP_OK;
+}
+
+esp_err_t storage_erase()
+{
+    ESP_RETURN_ON_FALSE(storage_lock != NULL, ESP_ERR_INVALID_STATE, TAG, "Storage not initialized");
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    storage_close_all();
+    for (size_t i = 0; i < STORAGE_KEYS; i++)
+    {
+        storage_keys[i].valid = false;
+    }
+    config_blob_replace(NULL, 0);
+    esp_err_t err = nvs_flash_erase();
+    storage_journal_clear = err == ESP_OK;
+    xSemaphoreGive(storage_lock);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Could not erase NVS");
+        return err;
+    }
+    return ESP_OK;
+}
+
+esp_err_t storage_txn_begin(storage_txn_t *txn)
+{
+    ESP_RETURN_ON_FALSE(storage_lock != NULL, ESP_ERR_INVALID_STATE, TAG, "Storage not initialized");
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    memset(txn, 0, sizeof(*txn));
+    return ESP_OK;
+}
+
+esp_err_t storage_txn_set_sgp30_baseline(storage_txn_t *txn, const sgp30_timed_measurement_t *baseline)
+{
+    txn->sgp30_baseline = *baseline;
+    txn->staged |= STORAGE_TXN_SGP30_BASELINE;
+    return ESP_OK;
+}
+
+esp_err_t storage_txn_set_thingsboard_cfg(storage_txn_t *txn, const thingsboard_cfg_t *thingsboard_cfg)
+{
+    txn->thingsboard_cfg = *thingsboard_cfg;
+    txn->staged |= STORAGE_TXN_THINGSBOARD_CFG;
+    return ESP_OK;
+}
+
+esp_err_t storage_txn_set_shared_attributes(
+    storage_txn_t *txn,
+    const thingsboard_shared_attributes_t *shared_attributes
+)
+{
+    txn->shared_attributes = *shared_attributes;
+    txn->staged |= STORAGE_TXN_SHARED_ATTRIBUTES;
+    return ESP_OK;
+}
+
+esp_err_t storage_txn_set_wifi_credentials(storage_txn_t *txn, const wifi_credentials_t *wifi_credentials)
+{
+    if (strnlen(wifi_credentials->ssid, SOFT_AP_PROVISION_TYPES_MAX_SSID_LEN) == SOFT_AP_PROVISION_TYPES_MAX_SSID_LEN
+        || strnlen(wifi_credentials->password, SOFT_AP_PROVISION_TYPES_MAX_PASS_LEN) == SOFT_AP_PROVISION_TYPES_MAX_PASS_LEN)
+    {
+        ESP_LOGE(TAG, "Wifi credentials are not terminated");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    txn->wifi_credentials = *wifi_credentials;
+    txn->staged |= STORAGE_TXN_WIFI_CREDENTIALS;
+    return ESP_OK;
+}
+
+esp_err_t storage_txn_commit(storage_txn_t *txn)
+{
+    static const struct {
+        uint8_t staged;
+        int key;
+        size_t offset;
+    } staged_keys[] = {
+        { STORAGE_TXN_SGP30_BASELINE, STORAGE_KEY_SGP30_BASELINE, offsetof(storage_txn_t, sgp30_baseline) },
+        { STORAGE_TXN_SHARED_ATTRIBUTES, STORAGE_KEY_SHARED_ATTRIBUTES, offsetof(storage_txn_t, shared_attributes) },
+    };
+    storage_txn_write_t writes[STORAGE_TXN_WRITES];
+    uint8_t *blob = NULL;
+    size_t len = 0;
+    size_t written = 0;
+    size_t unchanged = 0;
+    size_t commits = 0;
+    uint32_t opens = storage_stats.opens;
+    int64_t started_at = esp_timer_get_time();
+
+    /* A journal left behind is finished first, it would overwrite these*/
+    esp_err_t err = storage_journal_replay();
+    /* Both parts of the configuration go in one blob, replaced at once*/
+    if (err == ESP_OK && (txn->staged & (STORAGE_TXN_THINGSBOARD_CFG | STORAGE_TXN_WIFI_CREDENTIALS)))
+    {
+        err = config_blob_stage(
+            txn->staged & STORAGE_TXN_THINGSBOARD_CFG ? &txn->thingsboard_cfg : NULL,
+            txn->staged & STORAGE_TXN_WIFI_CREDENTIALS ? &txn->wifi_credentials : NULL,
+            &blob,
+            &len
+        );
+        if (err == ESP_OK && blob != NULL)
+        {
+            writes[written++] = (storage_txn_write_t){ NVS_THINGSBOARD_NAMESPACE, NVS_CONFIG_KEY, blob, len };
+        }
+        else if (err == ESP_OK)
+        {
+            storage_stats_of(NVS_THINGSBOARD_NAMESPACE)->skipped++;
+            unchanged++;
+        }
+    }
+    for (size_t i = 0; err == ESP_OK && i < sizeof(staged_keys) / sizeof(staged_keys[0]); i++)
+    {
+        storage_key_t *key = &storage_keys[staged_keys[i].key];
+        const void *value = (const uint8_t *)txn + staged_keys[i].offset;
+        if (!(txn->staged & staged_keys[i].staged))
+        {
+            continue;
+        }
+        if (storage_key_unchanged(key, value))
+        {
+            unchanged++;
+            continue;
+        }
+        writes[written++] = (storage_txn_write_t){ key->name, key->key, value, key->len };
+    }
+    /* NVS stores each value at once, so more than one is written through
+     the journal to store them all or none*/
+    if (err == ESP_OK && written > 1)
+    {
+        err = storage_journal_write(writes, written);
+    }
+    for (size_t i = 0; err == ESP_OK && i < written; i++)
+    {
+        err = storage_value_write(writes[i].name, writes[i].key, writes[i].value, writes[i].len);
+    }
+    if (err == ESP_OK && written > 1)
+    {
+        err = storage_journal_erase();
+    }
+    if (err == ESP_OK)
+    {
+        err = storage_commit(&commits);
+    }
+    if (err == ESP_OK)
+    {
+        storage_journal_clear = true;
+        for (size_t i = 0; i < sizeof(staged_keys) / sizeof(staged_keys[0]); i++)
+        {
+            if (txn->staged & staged_keys[i].staged)
+            {
+                storage_key_t *key = &storage_keys[staged_keys[i].key];
+                memcpy(key->value, (const uint8_t *)txn + staged_keys[i].offset, key->len);
+                key->valid = true;
+            }
+        }
+    }
+    else if (!storage_journal_clear)
+    {
+        /* Some values may be written, the next access finishes the
+         transaction from its journal and reads them again*/
+        for (size_t i = 0; i < STORAGE_KEYS; i++)
+        {
+            storage_keys[i].valid = false;
+        }
+    }
+    if (written > 0)
+    {
+        storage_stats_sample();
+    }
+    if (err == ESP_OK && blob != NULL)
+    {
+        config_blob_replace(blob, len);
+    }
+    else
+    {
+        free(blob);
+    }
+    xSemaphoreGive(storage_lock);
+    ESP_RETURN_ON_ERROR(err, TAG, "Could not commit the storage transaction");
+    if (written > 0)
+    {
+        ESP_LOGI(
+            TAG,
+            "Stored %u keys, %u unchanged, %u opens and %u commits in %" PRId64 " us",
+            (unsigned)written,
+            (unsigned)unchanged,
+            (unsigned)(storage_stats.opens - opens),
+            (unsigned)commits,
+            esp_timer_get_time() - started_at
+        );
+    }
+    return ESP_OK;
+}
+
+void storage_txn_abort(storage_txn_t *txn)
+{
+    txn->staged = 0;
+    xSemaphoreGive(storage_lock);
+}
+
+esp_err_t storage_get_sgp30_baseline(
+    sgp30_timed_measurement_t *sgp30_log_entry_handle
+)
+{
+    ESP_RETURN_ON_FALSE(storage_lock != NULL, ESP_ERR_INVALID_STATE, TAG, "Storage not initialized");
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    esp_err_t err = storage_key_get(&storage_keys[STORAGE_KEY_SGP30_BASELINE], sgp30_log_entry_handle);
+    xSemaphoreGive(storage_lock);
+    return err;
+}
+
+esp_err_t storage_set_sgp30_baseline(
+    const sgp30_timed_measurement_t *timed_measurement
+)
+{
+    storage_txn_t txn;
+
+    ESP_RETURN_ON_ERROR(storage_txn_begin(&txn), TAG, "Could not store the baseline");
+    storage_txn_set_sgp30_baseline(&txn, timed_measurement);
+    return storage_txn_commit(&txn);
+}
+
+esp_err_t storage_get_wifi_credentials(wifi_credentials_t *sgp30_log_entry_handle)
+{
+    ESP_RETURN_ON_FALSE(storage_lock != NULL, ESP_ERR_INVALID_STATE, TAG, "Storage not initialized");
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    esp_err_t err = nvs_get_wifi_credentials(sgp30_log_entry_handle);
+    xSemaphoreGive(storage_lock);
+    return err;
+}
+
+esp_err_t storage_set_wifi_credentials(const wifi_credentials_t *wifi_credentials)
+{
+    storage_txn_t txn;
+
+    ESP_RETURN_ON_ERROR(storage_txn_begin(&txn), TAG, "Could not store the wifi credentials");
+    esp_err_t err = storage_txn_set_wifi_credentials(&txn, wifi_credentials);
+    if (err != ESP_OK)
+    {
+        storage_txn_abort(&txn);
+        return err;
+    }
+    return storage_txn_commit(&txn);
+}
+
+esp_err_t storage_get_thingsboard_cfg(thingsboard_cfg_t *thingsboard_cfg)
+{
+    ESP_RETURN_ON_FALSE(storage_lock != NULL, ESP_ERR_INVALID_STATE, TAG, "Storage not initialized");
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    esp_err_t err = nvs_get_thingsboard_cfg(thingsboard_cfg);
+    xSemaphoreGive(storage_lock);
+    return err;
+}
+
+esp_err_t storage_set_thingsboard_cfg(const thingsboard_cfg_t *thingsboard_cfg)
+{
+    storage_txn_t txn;
+
+    ESP_RETURN_ON_ERROR(storage_txn_begin(&txn), TAG, "Could not store the thingsboard configuration");
+    storage_txn_set_thingsboard_cfg(&txn, thingsboard_cfg);
+    return storage_txn_commit(&txn);
+}
+
+esp_err_t storage_get_shared_attributes(thingsboard_shared_attributes_t *shared_attributes)
+{
+    ESP_RETURN_ON_FALSE(storage_lock != NULL, ESP_ERR_INVALID_STATE, TAG, "Storage not initialized");
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    esp_err_t err = storage_key_get(&storage_keys[STORAGE_KEY_SHARED_ATTRIBUTES], shared_attributes);
+    xSemaphoreGive(storage_lock);
+    return err;
+}
+
+esp_err_t storage_set_shared_attributes(const thingsboard_shared_attributes_t *shared_attributes)
+{
+    storage_txn_t txn;
+
+    ESP_RETURN_ON_ERROR(storage_txn_begin(&txn), TAG, "Could not store the shared attributes");
+    storage_txn_set_shared_attributes(&txn, shared_attributes);
+    return storage_txn_commit(&txn);
+}
+
+esp_err_t storage_get_certificates_crc(uint32_t *crc)
+{
+#if CONFIG_STORAGE_RTC_CONFIG_CACHE
+    ESP_RETURN_ON_FALSE(storage_lock != NULL, ESP_ERR_INVALID_STATE, TAG, "Storage not initialized");
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    esp_err_t err = config_blob_load();
+    if (err == ESP_OK && !(config_blob_header()->present & CONFIG_HAS_THINGSBOARD))
+    {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (err == ESP_OK)
+    {
+        /* The snapshot is saved with every blob loaded or stored*/
+        *crc = config_snapshot.certificates_crc;
+        err = config_snapshot.magic == CONFIG_SNAPSHOT_MAGIC && *crc != 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+    }
+    xSemaphoreGive(storage_lock);
+    return err;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t storage_load_certificates(thingsboard_cfg_t *thingsboard_cfg)
+{
+    ESP_RETURN_ON_FALSE(storage_lock != NULL, ESP_ERR_INVALID_STATE, TAG, "Storage not initialized");
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    esp_err_t err = config_blob_load();
+    if (err == ESP_OK && config_blob_stripped)
+    {
+        /* The blob without certificates stays allocated, its views were handed out*/
+        err = config_blob_read();
+    }
+    if (err == ESP_OK)
+    {
+        err = nvs_get_thingsboard_cfg(thingsboard_cfg);
+    }
+    xSemaphoreGive(storage_lock);
+    return err;
+}
+
+esp_err_t storage_release_certificates(thingsboard_cfg_t *thingsboard_cfg)
+{
+    ESP_RETURN_ON_FALSE(storage_lock != NULL, ESP_ERR_INVALID_STATE, TAG, "Storage not initialized");
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    esp_err_t err = config_blob_load();
+    if (err == ESP_OK && !config_blob_stripped)
+    {
+        size_t len = config_blob_stripped_len(config_blob, config_blob_len);
+        uint8_t *blob = malloc(len);
+        if (blob == NULL)
+        {
+            err = ESP_ERR_NO_MEM;
+        }
+        else
+        {
+            config_blob_strip(config_blob, blob);
+            ESP_LOGI(TAG, "Certificates released, %u of %u bytes kept", (unsigned)len, (unsigned)config_blob_len);
+            /* Its views are replaced by those given back*/
+            free(config_blob);
+            config_blob = blob;
+            config_blob_len = len;
+            config_blob_lent = false;
+            config_blob_stripped = true;
+        }
+    }
+    if (err == ESP_OK)
+    {
+        err = nvs_get_thingsboard_cfg(thingsboard_cfg);
+    }
+    xSemaphoreGive(storage_lock);
+    return err;
+}
+
+void storage_get_stats(storage_stats_t *stats)
+{
+    if (storage_lock == NULL)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    *stats = storage_stats;
+    xSemaphoreGive(storage_lock);
+    for (size_t i = 0; i < STORAGE_STATS_NAMESPACES; i++)
+    {
+        stats->namespaces[i].name = storage_namespaces[i];
+    }
 }
@@ -1,57 +1,142 @@
-#ifndef POWER_MANAGER_H_
-#define POWER_MANAGER_H_
-
-#include "esp_event.h"
-#include <time.h>
-
-ESP_EVENT_DECLARE_BASE(POWER_MANAGER_EVENT);
-
-#define POWER_MANAGER_DEEP_SLEEP_EVENT 0
-
-/* Configuration of the active default time range*/
-#define DEFAULT_START_HOUR 8
-#define DEFAULT_END_HOUR 22
-
-/* Default duration if there is no RTC (14 hours active, 10 in Deep Sleep)*/
-#define DEFAULT_ACTIVE_HOURS 14
-#define DEFAULT_SLEEP_HOURS 10
-
-/* 1 hour = 36 * 100.000.000 microseconds*/
-#define CONVERSION_HOURS_TO_MICROSECONDS (36ULL * 100 * 1000 * 1000)
-/* 1 minute = 60 * 1.000.000 microseconds*/
-#define CONVERSION_MINUTES_TO_MICROSECONDS (60L * 1000 * 1000)
-
-/**
- * @brief Initial configuration of power manager. It is used if SNTP time is not got correctly.
- * @param 
- * @return
- * 
- */
-void power_manager_init();
-
-/**
- * @brief Power manager configuration if SNTP time has been got successfuly.
- * @param Time got from SNTP.
- * @return
- * 
- */
-esp_err_t power_manager_set_sntp_time(struct tm *timeinfo);
-
-/**
- * @brief Procedure to switch power option to deep sleep mode.
- * @param 
- * @return
- * 
- */
-void power_manager_enter_deep_sleep();
-
-/**
- * @brief Get the wifi credentials from the storage.
- * @param wifi_credentials Pointer to the wifi credentials.
- * @return
- * - ESP_OK: Success
- * - some other error code: Failure
- */
-void power_manager_deinit();
-
-#endif /* POWER_MANAGER_H_ */
+#ifndef POWER_MANAGER_H_
+#define POWER_MANAGER_H_
+
+#include "esp_event.h"
+#include "esp_wifi_types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+ESP_EVENT_DECLARE_BASE(POWER_MANAGER_EVENT);
+
+#define POWER_MANAGER_DEEP_SLEEP_EVENT 0
+
+/* Configuration of the active default time range*/
+#define DEFAULT_START_HOUR 8
+#define DEFAULT_END_HOUR 22
+
+/* Default duration if there is no RTC (14 hours active, 10 in Deep Sleep)*/
+#define DEFAULT_ACTIVE_HOURS 14
+#define DEFAULT_SLEEP_HOURS 10
+
+/* 1 hour = 36 * 100.000.000 microseconds*/
+#define CONVERSION_HOURS_TO_MICROSECONDS (36ULL * 100 * 1000 * 1000)
+/* 1 minute = 60 * 1.000.000 microseconds*/
+#define CONVERSION_MINUTES_TO_MICROSECONDS (60L * 1000 * 1000)
+
+/**
+ * @brief States of the energy ledger. The radio states overlap the chip
+ * states, their current is drawn on top of the chip current.
+ */
+typedef enum {
+    POWER_STATE_ACTIVE,      /*!< CPU running */
+    POWER_STATE_LIGHT_SLEEP, /*!< CPU in automatic light sleep */
+    POWER_STATE_DEEP_SLEEP,  /*!< Chip in deep sleep */
+    POWER_STATE_MODEM_SLEEP, /*!< Radio on with Wi-Fi power save */
+    POWER_STATE_RADIO_RX,    /*!< Radio on and listening */
+    POWER_STATE_RADIO_TX,    /*!< Radio transmitting, estimated from the bytes sent */
+    POWER_STATE_MAX,
+} power_state_t;
+
+/**
+ * @brief Energy ledger since power on, kept in RTC memory across deep sleep.
+ */
+typedef struct {
+    uint64_t time_us[POWER_STATE_MAX];   /*!< Time spent in each state */
+    uint32_t charge_uah[POWER_STATE_MAX]; /*!< Charge drawn in each state after the current model */
+    uint32_t charge_total_uah;           /*!< Charge drawn in all the states */
+    uint32_t wakeups;                    /*!< Wakeups from deep sleep */
+    bool light_sleep_counted;            /*!< Automatic light sleep is counted, otherwise it is part of active */
+    wifi_ps_type_t wifi_ps;              /*!< Current Wi-Fi power save mode */
+} power_energy_t;
+
+/**
+ * @brief Initial configuration of power manager. It is used if SNTP time is not got correctly.
+ * @param 
+ * @return
+ * 
+ */
+void power_manager_init();
+
+/**
+ * @brief Power manager configuration if SNTP time has been got successfuly.
+ * @param Time got from SNTP.
+ * @return
+ * 
+ */
+esp_err_t power_manager_set_sntp_time(struct tm *timeinfo);
+
+/**
+ * @brief Change the active range, CONFIG_PM_ACTIVE_START_HOUR and CONFIG_PM_ACTIVE_END_HOUR until then.
+ * With SNTP time the timers are programmed again, out of the new range POWER_MANAGER_DEEP_SLEEP_EVENT is posted.
+ * @param start_minute Start of the range, in minutes of the day.
+ * @param end_minute End of the range, in minutes of the day, before the start if it crosses midnight. Equal to the
+ * start the node is active all day.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: a minute out of the day
+ * - some other error code: the timers could not be programmed
+ */
+esp_err_t power_manager_set_active_range(int32_t start_minute, int32_t end_minute);
+
+/**
+ * @brief Get the active range in use.
+ * @param start_minute Start of the range, in minutes of the day.
+ * @param end_minute End of the range, in minutes of the day.
+ * @return
+ *
+ */
+void power_manager_get_active_range(int32_t *start_minute, int32_t *end_minute);
+
+/**
+ * @brief Procedure to switch power option to deep sleep mode.
+ * @param 
+ * @return
+ * 
+ */
+void power_manager_enter_deep_sleep();
+
+/**
+ * @brief Get the energy ledger, with the time of the current boot.
+ * @param energy Where the ledger is copied.
+ * @return
+ *
+ */
+void power_manager_energy_get(power_energy_t *energy);
+
+/**
+ * @brief Short name of a ledger state, as used in the published keys.
+ * @param state Ledger state.
+ * @return Name of the state.
+ *
+ */
+const char *power_manager_energy_state_name(power_state_t state);
+
+/**
+ * @brief Account a change of the Wi-Fi power save mode, called by whoever sets it.
+ * @param ps New power save mode.
+ * @return
+ *
+ */
+void power_manager_energy_set_wifi_ps(wifi_ps_type_t ps);
+
+/**
+ * @brief Account bytes handed to the radio, their airtime is moved to POWER_STATE_RADIO_TX
+ * at CONFIG_POWER_MANAGER_TX_KBPS.
+ * @param bytes Bytes sent, with the protocol overhead the caller knows of.
+ * @return
+ *
+ */
+void power_manager_energy_count_tx(size_t bytes);
+
+/**
+ * @brief Get the wifi credentials from the storage.
+ * @param wifi_credentials Pointer to the wifi credentials.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: Failure
+ */
+void power_manager_deinit();
+
+#endif /* POWER_MANAGER_H_ */
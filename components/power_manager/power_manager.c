@@ -1,215 +1,473 @@
-#include <stdio.h>
-#include <string.h>
-
-#include <esp_log.h>
-#include <esp_timer.h>
-#include <esp_event.h>
-#include <esp_sleep.h>
-#include <freertos/FreeRTOS.h>
-#include <esp_system.h>
-#include <esp_err.h>
-#include <esp_check.h>
-
-#include "power_manager.h"
-
-static const char *TAG = "POWER_MANAGER";
-
-ESP_EVENT_DEFINE_BASE(POWER_MANAGER_EVENT);
-
-static esp_timer_handle_t deep_sleep_timer;
-
-static int64_t start_time = 0;
-
-static void deep_sleep_timer_callback(void *arg)
-{
-    /*Get the final timestamp when the timer is triggered*/
-
-    int64_t end_time = esp_timer_get_time();
-
-    /*  Calculate elapsed time (in microseconds)*/
-    int64_t elapsed_time = end_time - start_time;
-
-    /* Show elapsed time in seconds*/
-    ESP_LOGI(TAG, "Timer execution time: %lld microseconds", elapsed_time);
-
-    esp_event_post(POWER_MANAGER_EVENT, POWER_MANAGER_DEEP_SLEEP_EVENT, NULL, 0, portMAX_DELAY);
-}
-
-void power_manager_enter_deep_sleep()
-{
-    ESP_LOGI(TAG, "Entering deep_sleep.");
-    esp_deep_sleep_start();
-}
-
-void power_manager_init()
-{
-/*Configure energy manager to automatically enter light_sleep*/
-#if CONFIG_PM_ENABLE
-    /* Configure dynamic frequency scaling:
-       maximum and minimum frequencies are set in sdkconfig,
-       automatic light sleep is enabled if tickless idle support is enabled.
-    */
-    esp_pm_config_t pm_config = {
-        .max_freq_mhz = 160, // ESP32c3: 160 MHz, ESP32-devkit-c: 240 MHz
-        .min_freq_mhz = 80,  // 80 MHz
-#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
-        .light_sleep_enable = true
-#endif
-    };
-    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
-    ESP_LOGI(TAG, "Configured automatic power manager");
-#endif /* CONFIG_PM_ENABLE*/
-
-    uint64_t sleep_hours = DEFAULT_SLEEP_HOURS * CONVERSION_HOURS_TO_MICROSECONDS;
-    uint64_t active_hours = DEFAULT_ACTIVE_HOURS * CONVERSION_HOURS_TO_MICROSECONDS;
-
-    /* Set timer to wake up from deep_sleep every 10 hours */
-    ESP_ERROR_CHECK(esp_sleep_enable_timer_wakeup(sleep_hours));
-    ESP_LOGI(TAG, "Configured wakeup by timer in %d hours", (DEFAULT_SLEEP_HOURS));
-
-    /* Set timer to enter deep_sleep mode every 14 hours */
-    esp_timer_create_args_t deep_sleep_timer_args = {
-        .callback = deep_sleep_timer_callback,
-        .name = "deep_sleep_timer"};
-
-    ESP_ERROR_CHECK(esp_timer_create(&deep_sleep_timer_args, &deep_sleep_timer));
-    ESP_ERROR_CHECK(esp_timer_start_once(deep_sleep_timer, active_hours));
-    ESP_LOGI(TAG, "Set deep_sleep to %d hours", (DEFAULT_ACTIVE_HOURS));
-}
-
-esp_err_t power_manager_set_sntp_time(struct tm *timeinfo)
-{
-    esp_err_t errcode = ESP_OK;
-
-    int64_t wakeup_time_in_minutes = 0;     /* time sleeping until wakeup occurs*/
-    int64_t time_till_sleep_in_minutes = 0; /*remaining time until end of active range*/
-
-    bool enter_deep_sleep_now = false;
-
-    /*  We have SNTP time, disable previous timers and wakeup source */
-    if (esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER) != ESP_OK) /* Try to deactivate timer trigger only*/
-        errcode = esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);   /* disable all*/
-
-    ESP_RETURN_ON_ERROR(errcode, TAG, "Error disabling the default wakeup timer");
-
-    errcode = esp_timer_stop(deep_sleep_timer);
-    ESP_RETURN_ON_ERROR(errcode, TAG, "Error stopping the timer from entering deep_sleep by default");
-
-    /* Enable with new values ​​calculated using SNTP time
-       Get start and end times from Kconfig settings*/
-    const char *start_time_str = CONFIG_PM_ACTIVE_START_HOUR;
-    const char *end_time_str = CONFIG_PM_ACTIVE_END_HOUR;
-
-    /* Convert time strings (HH:MM) to hours and minutes*/
-    int start_hour, start_minute;
-    int end_hour, end_minute;
-
-    /* Parse start time*/
-    sscanf(start_time_str, "%2d:%2d", &start_hour, &start_minute);
-    /* Parse the end time*/
-    sscanf(end_time_str, "%2d:%2d", &end_hour, &end_minute);
-
-    /* Module with 24 to avoid 24 hours and stay with 00 hours*/
-    start_hour = start_hour % 24;
-    end_hour = end_hour % 24;
-
-    /* Convert current time to minutes of day to make comparison easier*/
-    int64_t current_time_in_minutes = timeinfo->tm_hour * 60 + timeinfo->tm_min;
-    int64_t start_time_in_minutes = start_hour * 60 + start_minute;
-    int64_t end_time_in_minutes = end_hour * 60 + end_minute;
-
-    /* Counter for total time in active range*/
-    int64_t total_active_time_in_minutes = 0;
-
-    ESP_LOGI(TAG, "Configuring power manager with active range: %s - %s.",
-             start_time_str, end_time_str);
-
-    /* Cross active range, e.g. from 22:00 to 08:00*/
-    if (start_time_in_minutes > end_time_in_minutes)
-    {
-        total_active_time_in_minutes =
-            (24 * 60) - start_time_in_minutes + end_time_in_minutes;
-
-        if (current_time_in_minutes >= start_time_in_minutes ||
-            current_time_in_minutes < end_time_in_minutes)
-        {
-            /* We are in active range, configure timer to notify us when it is time to sleep*/
-
-            /* Current time less than end time, we are on the day*/
-            if (current_time_in_minutes < end_time_in_minutes)
-                time_till_sleep_in_minutes = end_time_in_minutes - current_time_in_minutes;
-            else /* Current time greater than end time, we are on the previous day*/
-                time_till_sleep_in_minutes = (24 * 60) - current_time_in_minutes + end_time_in_minutes;
-
-            /* We calculate the time of the wakeup timer
-             (total minutes of the day - minutes_active_range)*/
-            wakeup_time_in_minutes = (24 * 60) - total_active_time_in_minutes;
-        }
-        else
-        {
-            /* We are out of active range, force deep_sleep
-               Calculate the time until the start of the next time range*/
-
-            /* Current time less than end time, we are on the day*/
-            if (current_time_in_minutes < start_time_in_minutes)
-                wakeup_time_in_minutes = start_time_in_minutes - current_time_in_minutes;
-            else /* Current time greater than end time, we are on the previous day*/
-                wakeup_time_in_minutes = (24 * 60) - current_time_in_minutes + start_time_in_minutes;
-
-            enter_deep_sleep_now = true;
-        }
-    }
-    else /* Normal active range, e.g. from 08:00 to 22:00*/
-    {
-        total_active_time_in_minutes = end_time_in_minutes - start_time_in_minutes;
-
-        if (current_time_in_minutes >= start_time_in_minutes &&
-            current_time_in_minutes < end_time_in_minutes)
-        {
-            /* We are in active range, set timer to notify us when it is time to sleep*/
-            time_till_sleep_in_minutes = end_time_in_minutes - current_time_in_minutes;
-
-            /* We calculate the time of the wakeup timer 
-            (total minutes of the day - minutes_active_range)*/
-            wakeup_time_in_minutes = (24 * 60) - total_active_time_in_minutes;
-        }
-        else
-        {
-            /* We are out of active range, force deep_sleep*/
-            /* Calculate the time until the start of the next time range*/
-            wakeup_time_in_minutes = start_time_in_minutes - current_time_in_minutes;
-
-            if (wakeup_time_in_minutes < 0)
-            {
-                /* Set if negative (i.e. if current time is greater than start time)*/
-                wakeup_time_in_minutes += 24 * 60;
-            }
-
-            enter_deep_sleep_now = true;
-        }
-    }
-
-    uint64_t wkup_time_us = (uint64_t)(wakeup_time_in_minutes * CONVERSION_MINUTES_TO_MICROSECONDS);
-    uint64_t time_till_sleep_us = (uint64_t)(time_till_sleep_in_minutes * CONVERSION_MINUTES_TO_MICROSECONDS);
-
-    ESP_LOGI(TAG, "Configured wakeup after deep_sleep to %" PRId64 " hours and %" PRId64 " minutes (%" PRId64 " minutes, %" PRIu64 " us).",
-             wakeup_time_in_minutes / 60, wakeup_time_in_minutes % 60, wakeup_time_in_minutes, wkup_time_us);
-
-    errcode = esp_sleep_enable_timer_wakeup(wkup_time_us); /* In microsecondss*/
-    ESP_RETURN_ON_ERROR(errcode, TAG, "Error activating the new wakeup timer by time range");
-
-    start_time = esp_timer_get_time(); /* Time before starting the deep_sleep timer, something is wrong and I don't know what it is, let's check it*/
-
-    if (enter_deep_sleep_now)
-        power_manager_enter_deep_sleep();
-    else
-    { /*Enable timer to notify us when it is time to enter deep_sleep*/ 
-        errcode = esp_timer_start_once(deep_sleep_timer, time_till_sleep_us);
-        ESP_RETURN_ON_ERROR(errcode, TAG, "Error activating the new timer to enter deep_sleep due to time range");
-
-        ESP_LOGI(TAG, "Time until entering deep_sleep: %" PRId64 " hours and %" PRId64 " minutes (%" PRId64 " minutes, %" PRIu64 " us)",
-                 time_till_sleep_in_minutes / 60, time_till_sleep_in_minutes % 60, time_till_sleep_in_minutes, time_till_sleep_us);
-    }
-
-    return errcode;
-}
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_event.h>
+#include <esp_sleep.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_system.h>
+#include <esp_err.h>
+#include <esp_check.h>
+#include <esp_attr.h>
+#include <esp_pm.h>
+#include <esp_wifi.h>
+
+#include "power_manager.h"
+
+#define ENERGY_UA_US_PER_UAH 3600000000ULL
+
+static const char *TAG = "POWER_MANAGER";
+
+ESP_EVENT_DEFINE_BASE(POWER_MANAGER_EVENT);
+
+static esp_timer_handle_t deep_sleep_timer;
+
+static int64_t deep_sleep_timer_started_at;
+static uint64_t deep_sleep_timer_us;
+
+/* Active range in minutes of the day, from Kconfig until the server sets
+ another*/
+static int32_t active_start_minute = -1;
+static int32_t active_end_minute;
+static bool active_range_timed; /* The timers follow the range, SNTP time is known*/
+
+/* Time of the previous boots, RTC memory keeps it across deep sleep and
+ power on clears it*/
+typedef struct {
+    uint64_t time_us[POWER_STATE_MAX];
+    uint32_t wakeups;
+    int64_t deep_sleep_at_us; /* Wall time deep sleep was entered, 0 when awake*/
+} energy_ledger_t;
+
+RTC_DATA_ATTR static energy_ledger_t energy_ledger;
+
+static const char *const energy_state_names[POWER_STATE_MAX] = {
+    [POWER_STATE_ACTIVE] = "active",
+    [POWER_STATE_LIGHT_SLEEP] = "light_sleep",
+    [POWER_STATE_DEEP_SLEEP] = "deep_sleep",
+    [POWER_STATE_MODEM_SLEEP] = "modem_sleep",
+    [POWER_STATE_RADIO_RX] = "rx",
+    [POWER_STATE_RADIO_TX] = "tx",
+};
+
+static const uint32_t energy_state_ua[POWER_STATE_MAX] = {
+    [POWER_STATE_ACTIVE] = CONFIG_POWER_MANAGER_ACTIVE_UA,
+    [POWER_STATE_LIGHT_SLEEP] = CONFIG_POWER_MANAGER_LIGHT_SLEEP_UA,
+    [POWER_STATE_DEEP_SLEEP] = CONFIG_POWER_MANAGER_DEEP_SLEEP_UA,
+    [POWER_STATE_MODEM_SLEEP] = CONFIG_POWER_MANAGER_MODEM_SLEEP_UA,
+    [POWER_STATE_RADIO_RX] = CONFIG_POWER_MANAGER_RADIO_RX_UA,
+    [POWER_STATE_RADIO_TX] = CONFIG_POWER_MANAGER_RADIO_TX_UA,
+};
+
+/* Time of this boot. The light sleep callback runs with the scheduler
+ stopped, everything is updated under the spinlock*/
+static portMUX_TYPE energy_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t energy_light_sleep_us;
+static int64_t energy_radio_us[POWER_STATE_MAX];
+static int64_t energy_radio_since;
+static bool energy_sta_on;
+static bool energy_ap_on;
+static bool energy_light_sleep_counted;
+static wifi_ps_type_t energy_wifi_ps = WIFI_PS_MIN_MODEM; /* Default of the station*/
+
+/* Radio state while it is on, the access point never sleeps*/
+static power_state_t energy_radio_state(void)
+{
+    return energy_ap_on || energy_wifi_ps == WIFI_PS_NONE ? POWER_STATE_RADIO_RX : POWER_STATE_MODEM_SLEEP;
+}
+
+/* Closes the current radio segment, called with the lock taken*/
+static void energy_radio_close(int64_t now)
+{
+    if (energy_sta_on || energy_ap_on)
+    {
+        energy_radio_us[energy_radio_state()] += now - energy_radio_since;
+    }
+    energy_radio_since = now;
+}
+
+static void energy_boot_time(int64_t time_us[POWER_STATE_MAX])
+{
+    int64_t now = esp_timer_get_time();
+
+    memset(time_us, 0, POWER_STATE_MAX * sizeof(time_us[0]));
+    portENTER_CRITICAL(&energy_lock);
+    energy_radio_close(now);
+    time_us[POWER_STATE_LIGHT_SLEEP] = energy_light_sleep_us;
+    time_us[POWER_STATE_MODEM_SLEEP] = energy_radio_us[POWER_STATE_MODEM_SLEEP];
+    time_us[POWER_STATE_RADIO_RX] = energy_radio_us[POWER_STATE_RADIO_RX];
+    time_us[POWER_STATE_RADIO_TX] = energy_radio_us[POWER_STATE_RADIO_TX];
+    portEXIT_CRITICAL(&energy_lock);
+    /* esp_timer keeps counting through light sleep*/
+    time_us[POWER_STATE_ACTIVE] = now - time_us[POWER_STATE_LIGHT_SLEEP];
+}
+
+#if CONFIG_PM_ENABLE && CONFIG_PM_LIGHT_SLEEP_CALLBACKS && CONFIG_FREERTOS_USE_TICKLESS_IDLE
+static esp_err_t IRAM_ATTR energy_on_light_sleep_exit(int64_t sleep_time_us, void *arg)
+{
+    portENTER_CRITICAL_ISR(&energy_lock);
+    energy_light_sleep_us += sleep_time_us;
+    portEXIT_CRITICAL_ISR(&energy_lock);
+    return ESP_OK;
+}
+#endif
+
+static void energy_on_wifi_event(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    portENTER_CRITICAL(&energy_lock);
+    energy_radio_close(esp_timer_get_time());
+    switch (event_id)
+    {
+    case WIFI_EVENT_STA_START: energy_sta_on = true; break;
+    case WIFI_EVENT_STA_STOP: energy_sta_on = false; break;
+    case WIFI_EVENT_AP_START: energy_ap_on = true; break;
+    case WIFI_EVENT_AP_STOP: energy_ap_on = false; break;
+    default: break;
+    }
+    portEXIT_CRITICAL(&energy_lock);
+}
+
+/* Adds the time slept to the ledger once awake again*/
+static void energy_ledger_wakeup(void)
+{
+    struct timeval now;
+
+    if (energy_ledger.deep_sleep_at_us == 0)
+    {
+        return;
+    }
+    gettimeofday(&now, NULL);
+    int64_t slept_us = (int64_t)now.tv_sec * 1000000 + now.tv_usec - energy_ledger.deep_sleep_at_us;
+    if (slept_us > 0)
+    {
+        energy_ledger.time_us[POWER_STATE_DEEP_SLEEP] += slept_us;
+    }
+    energy_ledger.deep_sleep_at_us = 0;
+    energy_ledger.wakeups++;
+    ESP_LOGI(TAG, "Slept %" PRId64 " s, %" PRIu32 " wakeups since power on", slept_us / 1000000, energy_ledger.wakeups);
+}
+
+static void energy_init(void)
+{
+    energy_ledger_wakeup();
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, energy_on_wifi_event, NULL));
+#if CONFIG_PM_ENABLE && CONFIG_PM_LIGHT_SLEEP_CALLBACKS && CONFIG_FREERTOS_USE_TICKLESS_IDLE
+    esp_pm_sleep_cbs_register_config_t cbs_conf = {
+        .exit_cb = energy_on_light_sleep_exit,
+    };
+    if (esp_pm_light_sleep_register_cbs(&cbs_conf) == ESP_OK)
+    {
+        energy_light_sleep_counted = true;
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Light sleep is counted as active");
+    }
+#endif
+}
+
+void power_manager_energy_get(power_energy_t *energy)
+{
+    int64_t boot_us[POWER_STATE_MAX];
+
+    energy_boot_time(boot_us);
+    memset(energy, 0, sizeof(*energy));
+    for (size_t i = 0; i < POWER_STATE_MAX; i++)
+    {
+        energy->time_us[i] = energy_ledger.time_us[i] + (boot_us[i] > 0 ? boot_us[i] : 0);
+        energy->charge_uah[i] = (uint32_t)(energy->time_us[i] * energy_state_ua[i] / ENERGY_UA_US_PER_UAH);
+        energy->charge_total_uah += energy->charge_uah[i];
+    }
+    energy->wakeups = energy_ledger.wakeups;
+    energy->light_sleep_counted = energy_light_sleep_counted;
+    energy->wifi_ps = energy_wifi_ps;
+}
+
+const char *power_manager_energy_state_name(power_state_t state)
+{
+    return state < POWER_STATE_MAX ? energy_state_names[state] : "unknown";
+}
+
+void power_manager_energy_set_wifi_ps(wifi_ps_type_t ps)
+{
+    portENTER_CRITICAL(&energy_lock);
+    energy_radio_close(esp_timer_get_time());
+    energy_wifi_ps = ps;
+    portEXIT_CRITICAL(&energy_lock);
+}
+
+void power_manager_energy_count_tx(size_t bytes)
+{
+    int64_t airtime_us = (int64_t)bytes * 8000 / CONFIG_POWER_MANAGER_TX_KBPS;
+
+    portENTER_CRITICAL(&energy_lock);
+    if (energy_sta_on || energy_ap_on)
+    {
+        /* Taken from the state the radio was in*/
+        energy_radio_us[POWER_STATE_RADIO_TX] += airtime_us;
+        energy_radio_us[energy_radio_state()] -= airtime_us;
+    }
+    portEXIT_CRITICAL(&energy_lock);
+}
+
+static void deep_sleep_timer_callback(void *arg)
+{
+    int64_t elapsed_us = esp_timer_get_time() - deep_sleep_timer_started_at;
+
+    /* esp_timer is compensated for light sleep, both should match*/
+    ESP_LOGI(TAG, "Active range over after %" PRId64 " s of %" PRIu64 " s programmed",
+             elapsed_us / 1000000, deep_sleep_timer_us / 1000000);
+
+    esp_event_post(POWER_MANAGER_EVENT, POWER_MANAGER_DEEP_SLEEP_EVENT, NULL, 0, portMAX_DELAY);
+}
+
+static esp_err_t deep_sleep_timer_start(uint64_t timeout_us)
+{
+    deep_sleep_timer_started_at = esp_timer_get_time();
+    deep_sleep_timer_us = timeout_us;
+    return esp_timer_start_once(deep_sleep_timer, timeout_us);
+}
+
+void power_manager_enter_deep_sleep()
+{
+    int64_t boot_us[POWER_STATE_MAX];
+    struct timeval now;
+
+    /* The time of this boot goes to RTC memory, the wakeup adds the time slept*/
+    energy_boot_time(boot_us);
+    for (size_t i = 0; i < POWER_STATE_MAX; i++)
+    {
+        energy_ledger.time_us[i] += boot_us[i] > 0 ? boot_us[i] : 0;
+    }
+    gettimeofday(&now, NULL);
+    energy_ledger.deep_sleep_at_us = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+
+    ESP_LOGI(TAG, "Entering deep_sleep.");
+    esp_deep_sleep_start();
+}
+
+void power_manager_init()
+{
+    energy_init();
+
+/*Configure energy manager to automatically enter light_sleep*/
+#if CONFIG_PM_ENABLE
+    /* Configure dynamic frequency scaling:
+       maximum and minimum frequencies are set in sdkconfig,
+       automatic light sleep is enabled if tickless idle support is enabled.
+    */
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = 160, // ESP32c3: 160 MHz, ESP32-devkit-c: 240 MHz
+        .min_freq_mhz = 80,  // 80 MHz
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true
+#endif
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+    ESP_LOGI(TAG, "Configured automatic power manager");
+#endif /* CONFIG_PM_ENABLE*/
+
+    uint64_t sleep_hours = DEFAULT_SLEEP_HOURS * CONVERSION_HOURS_TO_MICROSECONDS;
+    uint64_t active_hours = DEFAULT_ACTIVE_HOURS * CONVERSION_HOURS_TO_MICROSECONDS;
+
+    /* Set timer to wake up from deep_sleep every 10 hours */
+    ESP_ERROR_CHECK(esp_sleep_enable_timer_wakeup(sleep_hours));
+    ESP_LOGI(TAG, "Configured wakeup by timer in %d hours", (DEFAULT_SLEEP_HOURS));
+
+    /* Set timer to enter deep_sleep mode every 14 hours */
+    esp_timer_create_args_t deep_sleep_timer_args = {
+        .callback = deep_sleep_timer_callback,
+        .name = "deep_sleep_timer"};
+
+    ESP_ERROR_CHECK(esp_timer_create(&deep_sleep_timer_args, &deep_sleep_timer));
+    ESP_ERROR_CHECK(deep_sleep_timer_start(active_hours));
+    ESP_LOGI(TAG, "Set deep_sleep to %d hours", (DEFAULT_ACTIVE_HOURS));
+}
+
+static void active_range_load(void)
+{
+    int start_hour = 0, start_minute = 0;
+    int end_hour = 0, end_minute = 0;
+
+    if (active_start_minute >= 0)
+        return;
+
+    /* Convert time strings (HH:MM) to hours and minutes*/
+    sscanf(CONFIG_PM_ACTIVE_START_HOUR, "%2d:%2d", &start_hour, &start_minute);
+    sscanf(CONFIG_PM_ACTIVE_END_HOUR, "%2d:%2d", &end_hour, &end_minute);
+
+    /* Module with 24 to avoid 24 hours and stay with 00 hours*/
+    active_start_minute = (start_hour % 24) * 60 + start_minute;
+    active_end_minute = (end_hour % 24) * 60 + end_minute;
+}
+
+/* Program the wakeup and the end of the active range from the time of day.
+ Out of the range it sleeps at once, or posts the event of the end of the
+ range when sleep_now is false*/
+static esp_err_t active_range_start(const struct tm *timeinfo, bool sleep_now)
+{
+    esp_err_t errcode = ESP_OK;
+
+    int64_t wakeup_time_in_minutes = 0;     /* time sleeping until wakeup occurs*/
+    int64_t time_till_sleep_in_minutes = 0; /*remaining time until end of active range*/
+
+    bool enter_deep_sleep_now = false;
+
+    /*  We have SNTP time, disable previous timers and wakeup source */
+    if (esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER) != ESP_OK) /* Try to deactivate timer trigger only*/
+        errcode = esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);   /* disable all*/
+
+    ESP_RETURN_ON_ERROR(errcode, TAG, "Error disabling the default wakeup timer");
+
+    errcode = esp_timer_stop(deep_sleep_timer);
+    ESP_RETURN_ON_ERROR(errcode, TAG, "Error stopping the timer from entering deep_sleep by default");
+
+    /* Enable with new values ​​calculated using SNTP time
+       Get start and end times from Kconfig settings or the server*/
+    active_range_load();
+
+    /* Convert current time to minutes of day to make comparison easier*/
+    int64_t current_time_in_minutes = timeinfo->tm_hour * 60 + timeinfo->tm_min;
+    int64_t start_time_in_minutes = active_start_minute;
+    int64_t end_time_in_minutes = active_end_minute;
+
+    /* Counter for total time in active range*/
+    int64_t total_active_time_in_minutes = 0;
+
+    ESP_LOGI(TAG, "Configuring power manager with active range: %02" PRIi64 ":%02" PRIi64 " - %02" PRIi64 ":%02" PRIi64 ".",
+             start_time_in_minutes / 60, start_time_in_minutes % 60, end_time_in_minutes / 60, end_time_in_minutes % 60);
+
+    /* Same start and end, active all day without timers*/
+    if (start_time_in_minutes == end_time_in_minutes)
+        return ESP_OK;
+
+    /* Cross active range, e.g. from 22:00 to 08:00*/
+    if (start_time_in_minutes > end_time_in_minutes)
+    {
+        total_active_time_in_minutes =
+            (24 * 60) - start_time_in_minutes + end_time_in_minutes;
+
+        if (current_time_in_minutes >= start_time_in_minutes ||
+            current_time_in_minutes < end_time_in_minutes)
+        {
+            /* We are in active range, configure timer to notify us when it is time to sleep*/
+
+            /* Current time less than end time, we are on the day*/
+            if (current_time_in_minutes < end_time_in_minutes)
+                time_till_sleep_in_minutes = end_time_in_minutes - current_time_in_minutes;
+            else /* Current time greater than end time, we are on the previous day*/
+                time_till_sleep_in_minutes = (24 * 60) - current_time_in_minutes + end_time_in_minutes;
+
+            /* We calculate the time of the wakeup timer
+             (total minutes of the day - minutes_active_range)*/
+            wakeup_time_in_minutes = (24 * 60) - total_active_time_in_minutes;
+        }
+        else
+        {
+            /* We are out of active range, force deep_sleep
+               Calculate the time until the start of the next time range*/
+
+            /* Current time less than end time, we are on the day*/
+            if (current_time_in_minutes < start_time_in_minutes)
+                wakeup_time_in_minutes = start_time_in_minutes - current_time_in_minutes;
+            else /* Current time greater than end time, we are on the previous day*/
+                wakeup_time_in_minutes = (24 * 60) - current_time_in_minutes + start_time_in_minutes;
+
+            enter_deep_sleep_now = true;
+        }
+    }
+    else /* Normal active range, e.g. from 08:00 to 22:00*/
+    {
+        total_active_time_in_minutes = end_time_in_minutes - start_time_in_minutes;
+
+        if (current_time_in_minutes >= start_time_in_minutes &&
+            current_time_in_minutes < end_time_in_minutes)
+        {
+            /* We are in active range, set timer to notify us when it is time to sleep*/
+            time_till_sleep_in_minutes = end_time_in_minutes - current_time_in_minutes;
+
+            /* We calculate the time of the wakeup timer 
+            (total minutes of the day - minutes_active_range)*/
+            wakeup_time_in_minutes = (24 * 60) - total_active_time_in_minutes;
+        }
+        else
+        {
+            /* We are out of active range, force deep_sleep*/
+            /* Calculate the time until the start of the next time range*/
+            wakeup_time_in_minutes = start_time_in_minutes - current_time_in_minutes;
+
+            if (wakeup_time_in_minutes < 0)
+            {
+                /* Set if negative (i.e. if current time is greater than start time)*/
+                wakeup_time_in_minutes += 24 * 60;
+            }
+
+            enter_deep_sleep_now = true;
+        }
+    }
+
+    uint64_t wkup_time_us = (uint64_t)(wakeup_time_in_minutes * CONVERSION_MINUTES_TO_MICROSECONDS);
+    uint64_t time_till_sleep_us = (uint64_t)(time_till_sleep_in_minutes * CONVERSION_MINUTES_TO_MICROSECONDS);
+
+    ESP_LOGI(TAG, "Configured wakeup after deep_sleep to %" PRId64 " hours and %" PRId64 " minutes (%" PRId64 " minutes, %" PRIu64 " us).",
+             wakeup_time_in_minutes / 60, wakeup_time_in_minutes % 60, wakeup_time_in_minutes, wkup_time_us);
+
+    errcode = esp_sleep_enable_timer_wakeup(wkup_time_us); /* In microsecondss*/
+    ESP_RETURN_ON_ERROR(errcode, TAG, "Error activating the new wakeup timer by time range");
+
+    if (enter_deep_sleep_now && sleep_now)
+        power_manager_enter_deep_sleep();
+    else if (enter_deep_sleep_now)
+        esp_event_post(POWER_MANAGER_EVENT, POWER_MANAGER_DEEP_SLEEP_EVENT, NULL, 0, portMAX_DELAY);
+    else
+    { /*Enable timer to notify us when it is time to enter deep_sleep*/ 
+        errcode = deep_sleep_timer_start(time_till_sleep_us);
+        ESP_RETURN_ON_ERROR(errcode, TAG, "Error activating the new timer to enter deep_sleep due to time range");
+
+        ESP_LOGI(TAG, "Time until entering deep_sleep: %" PRId64 " hours and %" PRId64 " minutes (%" PRId64 " minutes, %" PRIu64 " us)",
+                 time_till_sleep_in_minutes / 60, time_till_sleep_in_minutes % 60, time_till_sleep_in_minutes, time_till_sleep_us);
+    }
+
+    return errcode;
+}
+
+esp_err_t power_manager_set_sntp_time(struct tm *timeinfo)
+{
+    esp_err_t errcode = active_range_start(timeinfo, true);
+
+    active_range_timed = errcode == ESP_OK;
+    return errcode;
+}
+
+esp_err_t power_manager_set_active_range(int32_t start_minute, int32_t end_minute)
+{
+    time_t now;
+    struct tm timeinfo;
+
+    ESP_RETURN_ON_FALSE(start_minute >= 0 && start_minute < 24 * 60 && end_minute >= 0 && end_minute < 24 * 60,
+                        ESP_ERR_INVALID_ARG, TAG, "Active range %" PRIi32 " - %" PRIi32 " not within a day", start_minute, end_minute);
+
+    active_start_minute = start_minute;
+    active_end_minute = end_minute;
+    if (!active_range_timed)
+        return ESP_OK; /* Taken by power_manager_set_sntp_time*/
+
+    time(&now);
+    localtime_r(&now, &timeinfo);
+    return active_range_start(&timeinfo, false);
+}
+
+void power_manager_get_active_range(int32_t *start_minute, int32_t *end_minute)
+{
+    active_range_load();
+    *start_minute = active_start_minute;
+    *end_minute = active_end_minute;
+}
@@ -0,0 +1,141 @@
+/**
+ * @file runtime_config.h
+ * @brief Registry of the settings the server can change at run time.
+ *
+ * Every entry declares its key, type, range and the callback applying it.
+ * An update is staged and validated as a whole, then applied in a single
+ * call that runs each callback once, so a message changing several
+ * settings causes one reconfiguration instead of one per key.
+ */
+#ifndef RUNTIME_CONFIG_H
+#define RUNTIME_CONFIG_H
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define RUNTIME_CONFIG_MAX_ENTRIES 8
+
+/**
+ * @brief Type of a setting.
+ */
+typedef enum {
+    RUNTIME_CONFIG_INT,  /*!< Integer between min and max */
+    RUNTIME_CONFIG_BOOL, /*!< 0 or 1 */
+} runtime_config_type_t;
+
+/**
+ * @brief Apply a new value of a setting.
+ *
+ * @param value Validated value.
+ * @return ESP_OK if the value is in use.
+ */
+typedef esp_err_t (*runtime_config_apply_t)(int32_t value);
+
+/**
+ * @brief Setting of the registry.
+ */
+typedef struct {
+    const char *key;              /*!< Shared attribute key */
+    runtime_config_type_t type;   /*!< Expected type */
+    int32_t min;                  /*!< Smallest value, RUNTIME_CONFIG_INT only */
+    int32_t max;                  /*!< Largest value, RUNTIME_CONFIG_INT only */
+    runtime_config_apply_t apply; /*!< Called by runtime_config_apply */
+} runtime_config_entry_t;
+
+/**
+ * @brief Set of new values, indexed like the registry.
+ */
+typedef struct {
+    uint32_t set;                                /*!< Bit i: values[i] is staged */
+    int32_t values[RUNTIME_CONFIG_MAX_ENTRIES];  /*!< Staged values */
+} runtime_config_update_t;
+
+/**
+ * @brief Set the registry.
+ *
+ * @param entries Settings, referenced so they have to outlive the registry.
+ * @param n Number of entries, up to RUNTIME_CONFIG_MAX_ENTRIES.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_SIZE: too many entries
+ */
+esp_err_t runtime_config_init(const runtime_config_entry_t *entries, size_t n);
+
+/**
+ * @brief Number of settings in the registry.
+ */
+size_t runtime_config_len(void);
+
+/**
+ * @brief Setting at an index of the registry.
+ */
+const runtime_config_entry_t *runtime_config_entry(size_t index);
+
+/**
+ * @brief Find a setting by key.
+ *
+ * @param key Key, not null terminated.
+ * @param key_len Length of key.
+ * @return Index of the setting, or -1 if there is none.
+ */
+int runtime_config_find(const char *key, size_t key_len);
+
+/**
+ * @brief Validate a value and add it to an update.
+ *
+ * @param update Update being built, zero it before the first value.
+ * @param index Index of the setting.
+ * @param type Type of the received value.
+ * @param value Received value, 0 or 1 for RUNTIME_CONFIG_BOOL.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: wrong type or out of range, the whole update has
+ * to be discarded
+ */
+esp_err_t runtime_config_stage(
+    runtime_config_update_t *update,
+    size_t index,
+    runtime_config_type_t type,
+    int32_t value
+);
+
+/**
+ * @brief Apply a validated update.
+ *
+ * Calls the apply callback of every staged setting whose value changed. It
+ * has to be called from the task owning the settings. The first callback
+ * failing stops the update, and the settings it already changed get their
+ * previous value back. Only values recorded with runtime_config_set_current
+ * or by a former update can be restored.
+ *
+ * @param update Update built with runtime_config_stage.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_FAIL: a callback failed, the previous values are in use again
+ */
+esp_err_t runtime_config_apply(const runtime_config_update_t *update);
+
+/**
+ * @brief Record the values in use without calling the callbacks.
+ *
+ * Called after runtime_config_init with the values set at start, so the
+ * first update skips the ones that do not change and a failed one can
+ * restore them.
+ *
+ * @param current Values in use, indexed like the registry.
+ * @return
+ * - ESP_OK: Success
+ */
+esp_err_t runtime_config_set_current(const runtime_config_update_t *current);
+
+/**
+ * @brief Get the value in use of a setting.
+ *
+ * @param key Null terminated key.
+ * @param value Where the value is stored.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_NOT_FOUND: unknown key or never applied
+ */
+esp_err_t runtime_config_get(const char *key, int32_t *value);
+#endif // !RUNTIME_CONFIG_H
@@ -0,0 +1,150 @@
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "runtime_config.h"
+
+static const char *TAG = "runtime_config";
+
+static const runtime_config_entry_t *config_entries;
+static size_t config_entries_len;
+static uint32_t config_applied; /* Bit i: config_values[i] is in use*/
+static int32_t config_values[RUNTIME_CONFIG_MAX_ENTRIES];
+
+esp_err_t runtime_config_init(const runtime_config_entry_t *entries, size_t n)
+{
+    if (n > RUNTIME_CONFIG_MAX_ENTRIES)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    config_entries = entries;
+    config_entries_len = n;
+    config_applied = 0;
+    return ESP_OK;
+}
+
+size_t runtime_config_len(void)
+{
+    return config_entries_len;
+}
+
+const runtime_config_entry_t *runtime_config_entry(size_t index)
+{
+    return index < config_entries_len ? &config_entries[index] : NULL;
+}
+
+int runtime_config_find(const char *key, size_t key_len)
+{
+    for (size_t i = 0; i < config_entries_len; i++)
+    {
+        if (strlen(config_entries[i].key) == key_len
+            && memcmp(config_entries[i].key, key, key_len) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+esp_err_t runtime_config_stage(
+    runtime_config_update_t *update,
+    size_t index,
+    runtime_config_type_t type,
+    int32_t value
+)
+{
+    const runtime_config_entry_t *entry = runtime_config_entry(index);
+
+    if (entry == NULL || entry->type != type)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (entry->type == RUNTIME_CONFIG_INT && (value < entry->min || value > entry->max))
+    {
+        ESP_LOGW(
+            TAG,
+            "%s %d out of [%d, %d]",
+            entry->key,
+            (int)value,
+            (int)entry->min,
+            (int)entry->max
+        );
+        return ESP_ERR_INVALID_ARG;
+    }
+    update->values[index] = value;
+    update->set |= 1u << index;
+    return ESP_OK;
+}
+
+esp_err_t runtime_config_set_current(const runtime_config_update_t *current)
+{
+    for (size_t i = 0; i < config_entries_len; i++)
+    {
+        if (current->set & (1u << i))
+        {
+            config_values[i] = current->values[i];
+            config_applied |= 1u << i;
+        }
+    }
+    return ESP_OK;
+}
+
+/* Applies again the previous values of the settings changed by the update,
+ the ones never applied before keep the new value*/
+static void runtime_config_restore(uint32_t changed, const int32_t *previous, uint32_t had_previous)
+{
+    for (size_t i = 0; i < config_entries_len; i++)
+    {
+        if (!(changed & (1u << i)) || !(had_previous & (1u << i)))
+        {
+            continue;
+        }
+        if (config_entries[i].apply(previous[i]) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Could not restore %s %d", config_entries[i].key, (int)previous[i]);
+            continue;
+        }
+        config_values[i] = previous[i];
+    }
+}
+
+esp_err_t runtime_config_apply(const runtime_config_update_t *update)
+{
+    int32_t previous[RUNTIME_CONFIG_MAX_ENTRIES];
+    uint32_t had_previous = config_applied;
+    uint32_t changed = 0;
+    int applied = 0;
+
+    memcpy(previous, config_values, sizeof(previous));
+    for (size_t i = 0; i < config_entries_len; i++)
+    {
+        if (!(update->set & (1u << i))
+            || ((config_applied & (1u << i)) && config_values[i] == update->values[i]))
+        {
+            continue;
+        }
+        if (config_entries[i].apply(update->values[i]) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Could not apply %s %d", config_entries[i].key, (int)update->values[i]);
+            runtime_config_restore(changed, previous, had_previous);
+            return ESP_FAIL;
+        }
+        config_values[i] = update->values[i];
+        config_applied |= 1u << i;
+        changed |= 1u << i;
+        applied++;
+    }
+    ESP_LOGI(TAG, "Applied %d settings", applied);
+    return ESP_OK;
+}
+
+esp_err_t runtime_config_get(const char *key, int32_t *value)
+{
+    int index = runtime_config_find(key, strlen(key));
+
+    if (index < 0 || !(config_applied & (1u << index)))
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *value = config_values[index];
+    return ESP_OK;
+}
@@ -0,0 +1,164 @@
+/**
+ * @file series_codec.h
+ * @brief Compression of measurement series in the manner of Gorilla.
+ *
+ * A series is a run of blocks. A block starts with a header holding its
+ * length, the number of samples and the first sample as it is. Every other
+ * sample is bit packed from the one before it: the delta of the delta of
+ * its time, which is 0 with a steady interval, and the zig-zag deltas of
+ * eCO2 and TVOC, each behind a prefix choosing its width. A sample with a
+ * steady interval and unchanged values takes 3 bits.
+ *
+ * Blocks decode on their own, so a reader can seek by the times in the
+ * headers and only decode the block it needs. All integers of the header
+ * are little endian, the bits are written from the most significant one.
+ * tools/series_decode.py decodes it.
+ */
+#ifndef SERIES_CODEC_H
+#define SERIES_CODEC_H
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "esp_err.h"
+#include "sgp30_types.h"
+
+/**
+ * @brief Bytes of the block header.
+ */
+#define SERIES_CODEC_HEADER_LEN 12
+
+/**
+ * @brief Most bits a sample after the first takes.
+ */
+#define SERIES_CODEC_MAX_SAMPLE_BITS 76
+
+/**
+ * @brief Upper bound of the bytes of a block of n samples, n > 0.
+ */
+#define SERIES_CODEC_MAX_BLOCK_LEN(n) \
+    (SERIES_CODEC_HEADER_LEN + ((n) - 1) * SERIES_CODEC_MAX_SAMPLE_BITS / 8 + 1)
+
+/**
+ * @brief Encoder of a block.
+ */
+typedef struct {
+    uint8_t *buf;     /*!< Block */
+    size_t size;      /*!< Size of buf */
+    size_t bits;      /*!< Bits written after the header */
+    uint16_t count;   /*!< Samples in the block */
+    uint32_t time;    /*!< Previous sample */
+    int64_t delta;    /*!< Previous time delta */
+    uint16_t eCO2;    /*!< Previous sample */
+    uint16_t TVOC;    /*!< Previous sample */
+} series_codec_encoder_t;
+
+/**
+ * @brief Decoder of a block.
+ */
+typedef struct {
+    const uint8_t *buf; /*!< Block */
+    size_t len;         /*!< Length of the block */
+    size_t bits;        /*!< Bits read after the header */
+    uint16_t count;     /*!< Samples in the block */
+    uint16_t index;     /*!< Next sample */
+    uint32_t time;      /*!< Previous sample */
+    int64_t delta;      /*!< Previous time delta */
+    uint16_t eCO2;      /*!< Previous sample */
+    uint16_t TVOC;      /*!< Previous sample */
+} series_codec_decoder_t;
+
+/**
+ * @brief Start a block.
+ *
+ * @param enc Encoder to set up.
+ * @param buf Where the block is written.
+ * @param size Size of buf, at most 65535 bytes are used.
+ * @return
+ *   - ESP_OK: Success
+ *   - ESP_ERR_INVALID_SIZE: buf cannot hold the header
+ */
+esp_err_t series_codec_encoder_init(series_codec_encoder_t *enc, uint8_t *buf, size_t size);
+
+/**
+ * @brief Add a sample to the block.
+ *
+ * @param enc Encoder.
+ * @param m Sample, its time from 1970 to 2106.
+ * @return
+ *   - ESP_OK: Success
+ *   - ESP_ERR_INVALID_SIZE: The block is full, the sample has to start the next one
+ *   - ESP_ERR_INVALID_ARG: The time jumps too far for the block, the same
+ */
+esp_err_t series_codec_encoder_add(series_codec_encoder_t *enc, const sgp30_timed_measurement_t *m);
+
+/**
+ * @brief Complete the header of the block.
+ *
+ * @param enc Encoder.
+ * @return Length of the block, 0 if it has no samples.
+ */
+size_t series_codec_encoder_finish(series_codec_encoder_t *enc);
+
+/**
+ * @brief Encode a series as blocks of up to block_samples samples.
+ *
+ * @param m Samples.
+ * @param n Number of samples.
+ * @param block_samples Most samples per block, 0 for as many as fit.
+ * @param buf Where the blocks are written.
+ * @param size Size of buf.
+ * @param out_len Length of the blocks.
+ * @return
+ *   - ESP_OK: Success
+ *   - ESP_ERR_INVALID_SIZE: buf is too small
+ */
+esp_err_t series_codec_encode(
+    const sgp30_timed_measurement_t *m,
+    size_t n,
+    size_t block_samples,
+    uint8_t *buf,
+    size_t size,
+    size_t *out_len
+);
+
+/**
+ * @brief Find the block to decode for the samples from a time.
+ *
+ * Only the headers are read.
+ *
+ * @param buf Blocks.
+ * @param len Length of the blocks.
+ * @param time Time looked for.
+ * @param offset Where the offset of the last block starting at or before
+ * time is written, the first block if none does.
+ * @return
+ *   - ESP_OK: Success
+ *   - ESP_ERR_NOT_FOUND: There are no blocks
+ *   - ESP_ERR_INVALID_SIZE: A header is damaged
+ */
+esp_err_t series_codec_seek(const uint8_t *buf, size_t len, time_t time, size_t *offset);
+
+/**
+ * @brief Start decoding a block.
+ *
+ * @param dec Decoder to set up.
+ * @param buf Block.
+ * @param len Bytes available from buf, the block may be followed by others.
+ * @return
+ *   - ESP_OK: Success
+ *   - ESP_ERR_INVALID_SIZE: The header is damaged or the block is cut
+ */
+esp_err_t series_codec_decoder_init(series_codec_decoder_t *dec, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Decode the next sample of the block.
+ *
+ * @param dec Decoder.
+ * @param m Where the sample is written.
+ * @return
+ *   - ESP_OK: Success
+ *   - ESP_ERR_NOT_FOUND: No more samples, the next block starts dec->len bytes on
+ *   - ESP_ERR_INVALID_SIZE: The block is damaged
+ */
+esp_err_t series_codec_decoder_next(series_codec_decoder_t *dec, sgp30_timed_measurement_t *m);
+#endif // !SERIES_CODEC_H
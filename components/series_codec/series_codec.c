@@ -0,0 +1,358 @@
+#include <stdbool.h>
+#include <string.h>
+#include "esp_err.h"
+#include "series_codec.h"
+
+#define SERIES_MAX_BLOCK_LEN 0xFFFF
+
+static void put_le16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t value)
+{
+    put_le16(p, (uint16_t)value);
+    put_le16(p + 2, (uint16_t)(value >> 16));
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return get_le16(p) | (uint32_t)get_le16(p + 2) << 16;
+}
+
+static uint32_t series_time(time_t time)
+{
+    return time < 0 ? 0 : time > UINT32_MAX ? UINT32_MAX : (uint32_t)time;
+}
+
+static uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+/* Prefix and width of the delta of delta of the time, two's complement*/
+static size_t dod_bits(int64_t dod, uint32_t *prefix, size_t *prefix_bits)
+{
+    if (dod == 0)
+    {
+        *prefix = 0x0, *prefix_bits = 1;
+        return 0;
+    }
+    if (dod >= -64 && dod <= 63)
+    {
+        *prefix = 0x2, *prefix_bits = 2;
+        return 7;
+    }
+    if (dod >= -256 && dod <= 255)
+    {
+        *prefix = 0x6, *prefix_bits = 3;
+        return 9;
+    }
+    if (dod >= -2048 && dod <= 2047)
+    {
+        *prefix = 0xE, *prefix_bits = 4;
+        return 12;
+    }
+    *prefix = 0xF, *prefix_bits = 4;
+    return 32;
+}
+
+/* Prefix and width of a zig-zag value delta*/
+static size_t value_bits(uint32_t zz, uint32_t *prefix, size_t *prefix_bits)
+{
+    if (zz == 0)
+    {
+        *prefix = 0x0, *prefix_bits = 1;
+        return 0;
+    }
+    if (zz < 16)
+    {
+        *prefix = 0x2, *prefix_bits = 2;
+        return 4;
+    }
+    if (zz < 256)
+    {
+        *prefix = 0x6, *prefix_bits = 3;
+        return 8;
+    }
+    *prefix = 0x7, *prefix_bits = 3;
+    return 17;
+}
+
+static void write_bits(series_codec_encoder_t *enc, uint64_t value, size_t n)
+{
+    uint8_t *data = enc->buf + SERIES_CODEC_HEADER_LEN;
+
+    while (n > 0)
+    {
+        size_t used = enc->bits % 8;
+        size_t take = 8 - used < n ? 8 - used : n;
+        uint8_t chunk = (uint8_t)((value >> (n - take)) & ((1u << take) - 1));
+
+        if (used == 0)
+        {
+            data[enc->bits / 8] = 0;
+        }
+        data[enc->bits / 8] |= chunk << (8 - used - take);
+        enc->bits += take;
+        n -= take;
+    }
+}
+
+static bool read_bits(series_codec_decoder_t *dec, size_t n, uint64_t *value)
+{
+    const uint8_t *data = dec->buf + SERIES_CODEC_HEADER_LEN;
+
+    if (dec->bits + n > (dec->len - SERIES_CODEC_HEADER_LEN) * 8)
+    {
+        return false;
+    }
+    *value = 0;
+    while (n > 0)
+    {
+        size_t used = dec->bits % 8;
+        size_t take = 8 - used < n ? 8 - used : n;
+        uint8_t chunk = (data[dec->bits / 8] >> (8 - used - take)) & ((1u << take) - 1);
+
+        *value = *value << take | chunk;
+        dec->bits += take;
+        n -= take;
+    }
+    return true;
+}
+
+/* Ones before the first zero, at most max*/
+static bool read_prefix(series_codec_decoder_t *dec, size_t max, size_t *ones)
+{
+    uint64_t bit;
+
+    for (*ones = 0; *ones < max; (*ones)++)
+    {
+        if (!read_bits(dec, 1, &bit))
+        {
+            return false;
+        }
+        if (bit == 0)
+        {
+            break;
+        }
+    }
+    return true;
+}
+
+esp_err_t series_codec_encoder_init(series_codec_encoder_t *enc, uint8_t *buf, size_t size)
+{
+    if (size < SERIES_CODEC_HEADER_LEN)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(enc, 0, sizeof(*enc));
+    enc->buf = buf;
+    enc->size = size < SERIES_MAX_BLOCK_LEN ? size : SERIES_MAX_BLOCK_LEN;
+    return ESP_OK;
+}
+
+esp_err_t series_codec_encoder_add(series_codec_encoder_t *enc, const sgp30_timed_measurement_t *m)
+{
+    uint32_t time = series_time(m->time);
+
+    if (enc->count == UINT16_MAX)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (enc->count == 0)
+    {
+        put_le32(enc->buf + 4, time);
+        put_le16(enc->buf + 8, m->measurement.eCO2);
+        put_le16(enc->buf + 10, m->measurement.TVOC);
+    }
+    else
+    {
+        int64_t delta = (int64_t)time - enc->time;
+        int64_t dod = delta - enc->delta;
+        uint32_t eCO2_zz = zigzag((int32_t)m->measurement.eCO2 - enc->eCO2);
+        uint32_t TVOC_zz = zigzag((int32_t)m->measurement.TVOC - enc->TVOC);
+        uint32_t dod_prefix, eCO2_prefix, TVOC_prefix;
+        size_t dod_prefix_bits, eCO2_prefix_bits, TVOC_prefix_bits;
+
+        if (dod < INT32_MIN || dod > INT32_MAX)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        size_t dod_len = dod_bits(dod, &dod_prefix, &dod_prefix_bits);
+        size_t eCO2_len = value_bits(eCO2_zz, &eCO2_prefix, &eCO2_prefix_bits);
+        size_t TVOC_len = value_bits(TVOC_zz, &TVOC_prefix, &TVOC_prefix_bits);
+        size_t bits = enc->bits + dod_prefix_bits + dod_len + eCO2_prefix_bits + eCO2_len
+            + TVOC_prefix_bits + TVOC_len;
+        if (SERIES_CODEC_HEADER_LEN + (bits + 7) / 8 > enc->size)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        write_bits(enc, dod_prefix, dod_prefix_bits);
+        write_bits(enc, (uint64_t)dod & ((1ull << dod_len) - 1), dod_len);
+        write_bits(enc, eCO2_prefix, eCO2_prefix_bits);
+        write_bits(enc, eCO2_zz, eCO2_len);
+        write_bits(enc, TVOC_prefix, TVOC_prefix_bits);
+        write_bits(enc, TVOC_zz, TVOC_len);
+        enc->delta = delta;
+    }
+    enc->time = time;
+    enc->eCO2 = m->measurement.eCO2;
+    enc->TVOC = m->measurement.TVOC;
+    enc->count++;
+    return ESP_OK;
+}
+
+size_t series_codec_encoder_finish(series_codec_encoder_t *enc)
+{
+    if (enc->count == 0)
+    {
+        return 0;
+    }
+    size_t len = SERIES_CODEC_HEADER_LEN + (enc->bits + 7) / 8;
+    put_le16(enc->buf, (uint16_t)len);
+    put_le16(enc->buf + 2, enc->count);
+    return len;
+}
+
+esp_err_t series_codec_encode(
+    const sgp30_timed_measurement_t *m,
+    size_t n,
+    size_t block_samples,
+    uint8_t *buf,
+    size_t size,
+    size_t *out_len
+)
+{
+    series_codec_encoder_t enc;
+    size_t pos = 0;
+    size_t i = 0;
+
+    while (i < n)
+    {
+        if (series_codec_encoder_init(&enc, buf + pos, size - pos) != ESP_OK)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        while (i < n && (block_samples == 0 || enc.count < block_samples)
+               && series_codec_encoder_add(&enc, &m[i]) == ESP_OK)
+        {
+            i++;
+        }
+        size_t len = series_codec_encoder_finish(&enc);
+        if (len == 0)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        pos += len;
+    }
+    *out_len = pos;
+    return ESP_OK;
+}
+
+esp_err_t series_codec_seek(const uint8_t *buf, size_t len, time_t time, size_t *offset)
+{
+    size_t pos = 0;
+
+    if (len < SERIES_CODEC_HEADER_LEN)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *offset = 0;
+    while (pos + SERIES_CODEC_HEADER_LEN <= len)
+    {
+        size_t block_len = get_le16(buf + pos);
+        if (block_len < SERIES_CODEC_HEADER_LEN || block_len > len - pos)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if (pos > 0 && (time < 0 || get_le32(buf + pos + 4) > (uint64_t)time))
+        {
+            break;
+        }
+        *offset = pos;
+        pos += block_len;
+    }
+    return ESP_OK;
+}
+
+esp_err_t series_codec_decoder_init(series_codec_decoder_t *dec, const uint8_t *buf, size_t len)
+{
+    if (len < SERIES_CODEC_HEADER_LEN)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t block_len = get_le16(buf);
+    if (block_len < SERIES_CODEC_HEADER_LEN || block_len > len)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(dec, 0, sizeof(*dec));
+    dec->buf = buf;
+    dec->len = block_len;
+    dec->count = get_le16(buf + 2);
+    return ESP_OK;
+}
+
+esp_err_t series_codec_decoder_next(series_codec_decoder_t *dec, sgp30_timed_measurement_t *m)
+{
+    static const size_t dod_widths[] = { 0, 7, 9, 12, 32 };
+    static const size_t value_widths[] = { 0, 4, 8, 17 };
+    uint64_t raw;
+    size_t ones;
+
+    if (dec->index == dec->count)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (dec->index == 0)
+    {
+        dec->time = get_le32(dec->buf + 4);
+        dec->eCO2 = get_le16(dec->buf + 8);
+        dec->TVOC = get_le16(dec->buf + 10);
+    }
+    else
+    {
+        int64_t dod = 0;
+        if (!read_prefix(dec, 4, &ones) || !read_bits(dec, dod_widths[ones], &raw))
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if (ones > 0)
+        {
+            /* Sign extension*/
+            size_t width = dod_widths[ones];
+            dod = (int64_t)(raw << (64 - width)) >> (64 - width);
+        }
+        dec->delta += dod;
+        dec->time = (uint32_t)(dec->time + dec->delta);
+
+        uint16_t *values[] = { &dec->eCO2, &dec->TVOC };
+        for (size_t i = 0; i < 2; i++)
+        {
+            if (!read_prefix(dec, 3, &ones) || !read_bits(dec, value_widths[ones], &raw))
+            {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            *values[i] = (uint16_t)(*values[i] + unzigzag((uint32_t)raw));
+        }
+    }
+    dec->index++;
+    m->time = dec->time;
+    m->measurement.eCO2 = dec->eCO2;
+    m->measurement.TVOC = dec->TVOC;
+    return ESP_OK;
+}
@@ -305,6 +305,13 @@ esp_err_t sgp30_set_baseline_and_post_esp_event();
  *     - ESP_ERR_INVALID_CRC: Received wrong chechsum
  */
 esp_err_t sgp30_get_id();
+
+/**
+ * @brief Get the I2C error counters of the sensor.
+ *
+ * @param errors Where the counters are copied.
+ */
+void sgp30_get_i2c_errors(sgp30_i2c_errors_t *errors);
 /**
  * TODO DOCUMENTATION
  */
@@ -36,4 +36,13 @@ typedef struct {
     sgp30_measurement_t measurement; /**< Measurement */
     time_t time; /**< Time */
 } sgp30_timed_measurement_t;
+
+/**
+ * @brief SGP30 I2C error counters since boot.
+ */
+typedef struct {
+    uint32_t write; /**< Commands that could not be written */
+    uint32_t read;  /**< Responses that could not be read */
+    uint32_t crc;   /**< Responses with a wrong checksum */
+} sgp30_i2c_errors_t;
 #endif // !SGP30_TYPES_H
@@ -35,6 +35,7 @@ static esp_timer_handle_t sgp30_measurement_timer_handle;
 static SemaphoreHandle_t sgp30_measurement_requested;
 static SemaphoreHandle_t device_in_use_mutex;
 static uint16_t id[3];
+static sgp30_i2c_errors_t sgp30_i2c_errors;
 
 static void sgp30_request_measurement_callback ()
 {
@@ -323,6 +324,7 @@ static esp_err_t sgp30_execute_command (
     esp_err_t got_sent = i2c_master_transmit (dev_handle, msg_buffer, 2, -1);
     if (got_sent != ESP_OK)
     {
+        sgp30_i2c_errors.write++;
         xSemaphoreGive (device_in_use_mutex);
         ESP_LOGE (TAG, "Could not write %x", command);
         return got_sent;
@@ -340,6 +342,7 @@ static esp_err_t sgp30_execute_command (
         );
         if (got_received != ESP_OK)
         {
+            sgp30_i2c_errors.read++;
             xSemaphoreGive (device_in_use_mutex);
             ESP_LOGE (TAG, "Could not read %x", command);
             return got_received;
@@ -350,12 +353,13 @@ static esp_err_t sgp30_execute_command (
         /* Check received CRC's*/
         for (int i = 0; i < response_len; i++)
         {
-            ESP_RETURN_ON_ERROR (
-                crc8_check (response_buffer + 3 * i, 3),
-                TAG,
-                "I2C get %d item CRC failed",
-                i
-            );
+            esp_err_t got_checked = crc8_check (response_buffer + 3 * i, 3);
+            if (got_checked != ESP_OK)
+            {
+                sgp30_i2c_errors.crc++;
+                ESP_LOGE (TAG, "I2C get %d item CRC failed", i);
+                return got_checked;
+            }
         }
         vTaskDelay (pdMS_TO_TICKS (read_delay));
         /* Store the output into a uint16*/
@@ -773,3 +777,8 @@ esp_err_t sgp30_measurement_log_get_mean (
     m->TVOC = (uint16_t)(mean_TVOC / q->size);
     return ESP_OK;
 }
+
+void sgp30_get_i2c_errors (sgp30_i2c_errors_t *errors)
+{
+    *errors = sgp30_i2c_errors;
+}
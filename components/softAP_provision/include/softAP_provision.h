@@ -148,7 +148,8 @@ esp_err_t data_to_receive_prov_data_handler(uint32_t session_id, const uint8_t *
 
 /**
  * @brief This function handles data received during a provisioning session for ThingsBoard, assigning different configurations based on the value of data_to_receive, 
-   preparing a 'SUCCESS' response, and handling memory errors if necessary.
+   preparing a 'SUCCESS' response, and handling memory errors if necessary. The values are 0 uri, 1 port, 2 CA certificate, 3 device certificate,
+   4 device key and 5 access token.
  *
  * @param uint32_t session_id. Session ID.
  * @param const uint8_t *inbuf. Pointer to the input buffer.
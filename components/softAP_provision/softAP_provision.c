@@ -4,8 +4,10 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include "esp_attr.h"
 #include "esp_err.h"
 #include "esp_check.h"
+#include "esp_sleep.h"
 #include "cJSON.h"
 #include <esp_log.h>
 #include <esp_wifi.h>
@@ -25,6 +27,66 @@ thingsboard_cfg_t provision_thingsboard_cfg;
 static SemaphoreHandle_t is_provisioned;
 int data_to_receive = 0;
 
+#if CONFIG_SOFTAP_PROVISION_FAST_RECONNECT
+#define FAST_RECONNECT_MAGIC 0x43525041 /* "APRC"*/
+
+/* Access point of the last connection, kept over deep sleep*/
+typedef struct {
+    uint32_t magic;
+    uint8_t ssid[SOFT_AP_PROVISION_TYPES_MAX_SSID_LEN];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t channel;
+} fast_reconnect_ap_t;
+
+RTC_DATA_ATTR static fast_reconnect_ap_t fast_reconnect_ap;
+static bool fast_reconnect_pending; /* Joining the remembered access point*/
+
+static void fast_reconnect_event_handler(
+    void *arg,
+    esp_event_base_t event_base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    if (event_id == WIFI_EVENT_STA_CONNECTED)
+    {
+        wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+
+        fast_reconnect_ap.ssid_len = event->ssid_len < sizeof(fast_reconnect_ap.ssid) ? event->ssid_len : sizeof(fast_reconnect_ap.ssid);
+        memcpy(fast_reconnect_ap.ssid, event->ssid, fast_reconnect_ap.ssid_len);
+        memcpy(fast_reconnect_ap.bssid, event->bssid, sizeof(fast_reconnect_ap.bssid));
+        fast_reconnect_ap.channel = event->channel;
+        fast_reconnect_ap.magic = FAST_RECONNECT_MAGIC;
+        fast_reconnect_pending = false;
+    }
+    else if (event_id == WIFI_EVENT_STA_DISCONNECTED && fast_reconnect_pending)
+    {
+        /* The access point is gone or changed channel, the next attempt scans*/
+        wifi_config_t wifi_config;
+
+        ESP_LOGW(TAG, "Remembered access point not joined, scanning");
+        fast_reconnect_pending = false;
+        fast_reconnect_ap.magic = 0;
+        if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) == ESP_OK)
+        {
+            wifi_config.sta.bssid_set = false;
+            wifi_config.sta.channel = 0;
+            esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+        }
+    }
+}
+
+static bool fast_reconnect_matches(const wifi_credentials_t *wifi_credentials)
+{
+    size_t ssid_len = strlen(wifi_credentials->ssid);
+
+    return fast_reconnect_ap.magic == FAST_RECONNECT_MAGIC
+           && fast_reconnect_ap.ssid_len == ssid_len
+           && memcmp(fast_reconnect_ap.ssid, wifi_credentials->ssid, ssid_len) == 0;
+}
+#endif
+
 #if CONFIG_EXAMPLE_PROV_SECURITY_VERSION_2
 esp_err_t example_get_sec2_salt(const char **salt, uint16_t *salt_len) {
 #if CONFIG_EXAMPLE_PROV_SEC2_DEV_MODE
@@ -188,6 +250,13 @@ esp_err_t thingsboard_cnf_prov_data_handler(uint32_t session_id, const uint8_t *
             provision_thingsboard_cfg.credentials.authentication.key[inlen] = '\0';
             ESP_LOGI(TAG, "%s", provision_thingsboard_cfg.credentials.authentication.key);
         }
+        else if(data_to_receive == 5){
+            /* Access token of the device for the HTTP and plain CoAP APIs*/
+            provision_thingsboard_cfg.credentials.access_token = strndup((char*) inbuf, inlen);
+            if (provision_thingsboard_cfg.credentials.access_token == NULL) {
+                return ESP_ERR_NO_MEM;
+            }
+        }
         else {
             return ESP_FAIL;
         }
@@ -228,12 +297,14 @@ esp_err_t softAP_provision_init(thingsboard_cfg_t *thingsboard_cfg, wifi_credent
 
     /* Initialize Wi-Fi including netif with default config */
     esp_netif_create_default_wifi_sta();
-    esp_netif_create_default_wifi_ap();
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_RETURN_ON_ERROR(esp_wifi_init(&cfg), TAG, "Error iniciando la configuracion Wifi");
 
     if(thingsboard_cfg == NULL || wifi_credentials == NULL){ 
+        /* The access point interface is only needed to provision*/
+        esp_netif_create_default_wifi_ap();
+
         /* Configuration for the provisioning manager */
         wifi_prov_mgr_config_t config = {
             .scheme = wifi_prov_scheme_softap,
@@ -324,6 +395,21 @@ esp_err_t softAP_provision_init(thingsboard_cfg_t *thingsboard_cfg, wifi_credent
         };
         memcpy(wifi_config.sta.ssid, wifi_credentials->ssid, strlen(wifi_credentials->ssid));
         memcpy(wifi_config.sta.password, wifi_credentials->password, strlen(wifi_credentials->password));
+#if CONFIG_SOFTAP_PROVISION_FAST_RECONNECT
+        ESP_RETURN_ON_ERROR(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, fast_reconnect_event_handler, NULL), TAG, "Fallo en creacion del handler");
+        ESP_RETURN_ON_ERROR(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, fast_reconnect_event_handler, NULL), TAG, "Fallo en creacion del handler");
+        if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER && fast_reconnect_matches(wifi_credentials))
+        {
+            /* Join the access point of the last connection without scanning every channel*/
+            wifi_config.sta.channel = fast_reconnect_ap.channel;
+            wifi_config.sta.bssid_set = true;
+            memcpy(wifi_config.sta.bssid, fast_reconnect_ap.bssid, sizeof(wifi_config.sta.bssid));
+            fast_reconnect_pending = true;
+            ESP_LOGI(TAG, "Joining the remembered access point on channel %d", fast_reconnect_ap.channel);
+        }
+#endif
+        /* The credentials come from storage, the driver does not keep its own copy in NVS*/
+        ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
         ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
         ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
         ESP_ERROR_CHECK(esp_wifi_start());
@@ -0,0 +1,89 @@
+/**
+ * @file telemetry_batch.h
+ * @brief Collects measurement windows into ThingsBoard array payloads.
+ */
+#ifndef TELEMETRY_BATCH_H
+#define TELEMETRY_BATCH_H
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "sgp30_types.h"
+
+ESP_EVENT_DECLARE_BASE(TELEMETRY_BATCH_EVENT);
+
+/**
+ * @brief Telemetry batch event IDs.
+ */
+typedef enum {
+    TELEMETRY_BATCH_EVENT_DEADLINE, /*!< The oldest window reached its deadline */
+    TELEMETRY_BATCH_EVENT_FLUSHED,  /*!< A batch was handed for publishing */
+    TELEMETRY_BATCH_EVENT_SLOT,     /*!< The upload slot of a due batch started */
+} telemetry_batch_event_id_t;
+
+/**
+ * @brief Initialize the telemetry batch.
+ *
+ * Deadline expirations are handled on the given event loop, so every call
+ * to this module has to be made from that loop.
+ *
+ * @param loop Event loop where the batch is operated.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: Failure
+ */
+esp_err_t telemetry_batch_init(esp_event_loop_handle_t loop);
+
+/**
+ * @brief Add a window to the batch.
+ *
+ * The batch is due when it reaches the configured number of windows, and
+ * published in the next upload slot. It is published at once before adding
+ * the window if it would exceed the byte budget or the capacity.
+ *
+ * @param m Timed measurement of the window.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: the batch could not be published
+ */
+esp_err_t telemetry_batch_add(const sgp30_timed_measurement_t *m);
+
+/**
+ * @brief Publish every window held in the batch.
+ * @return
+ * - ESP_OK: Success or empty batch
+ * - some other error code: the windows are kept for the next flush
+ */
+esp_err_t telemetry_batch_flush(void);
+
+/**
+ * @brief Set the number of windows published together.
+ * @param n Windows per batch, clamped to CONFIG_TELEMETRY_BATCH_CAPACITY.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: n is 0
+ */
+esp_err_t telemetry_batch_set_size(uint16_t n);
+
+/**
+ * @brief Set the maximum time a window waits in the batch.
+ * @param s Deadline in seconds, 0 disables the deadline.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: the deadline timer could not be rearmed
+ */
+esp_err_t telemetry_batch_set_deadline(uint32_t s);
+
+/**
+ * @brief Set the upload slot, due batches wait for it.
+ *
+ * The slot starts offset_ms after every multiple of period_ms of wall clock
+ * time, so devices with different offsets publish apart.
+ *
+ * @param period_ms Slot period in milliseconds, 0 publishes due batches at once.
+ * @param offset_ms Start of the slot within the period.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: offset_ms is not within the period
+ */
+esp_err_t telemetry_batch_set_slot(uint32_t period_ms, uint32_t offset_ms);
+#endif // !TELEMETRY_BATCH_H
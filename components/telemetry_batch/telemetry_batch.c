@@ -0,0 +1,426 @@
+#include <string.h>
+#include <sys/time.h>
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mqtt_controller.h"
+#include "sgp30_types.h"
+#include "telemetry_batch.h"
+#include "telemetry_codec.h"
+#if CONFIG_TELEMETRY_BATCH_COMPRESS
+#include "telemetry_compress.h"
+#endif
+#if CONFIG_TELEMETRY_BATCH_STORE_AND_FORWARD
+#include "telemetry_queue.h"
+#endif
+
+static const char *TAG = "telemetry_batch";
+
+ESP_EVENT_DEFINE_BASE(TELEMETRY_BATCH_EVENT);
+
+static esp_event_loop_handle_t batch_event_loop;
+static esp_timer_handle_t batch_deadline_timer;
+static esp_timer_handle_t batch_slot_timer;
+static uint32_t batch_slot_period_ms;
+static uint32_t batch_slot_offset_ms;
+static sgp30_timed_measurement_t batch_records[CONFIG_TELEMETRY_BATCH_CAPACITY];
+static size_t batch_records_len;
+static size_t batch_records_bytes;
+static uint16_t batch_size = CONFIG_TELEMETRY_BATCH_DEFAULT_SIZE;
+static uint32_t batch_deadline = CONFIG_TELEMETRY_BATCH_DEFAULT_DEADLINE;
+static uint8_t batch_payload[CONFIG_TELEMETRY_BATCH_MAX_BYTES];
+#if CONFIG_TELEMETRY_BATCH_COMPRESS
+static uint8_t batch_compressed[CONFIG_TELEMETRY_BATCH_MAX_BYTES];
+#endif
+
+static void batch_deadline_callback(void *args)
+{
+    /* Posted with no wait, if the loop is full the next window arms the
+     deadline again*/
+    esp_event_post_to(
+        batch_event_loop,
+        TELEMETRY_BATCH_EVENT,
+        TELEMETRY_BATCH_EVENT_DEADLINE,
+        NULL,
+        0,
+        0
+    );
+}
+
+static void batch_slot_callback(void *args)
+{
+    /* A lost slot is retried by the deadline or the next window*/
+    esp_event_post_to(
+        batch_event_loop,
+        TELEMETRY_BATCH_EVENT,
+        TELEMETRY_BATCH_EVENT_SLOT,
+        NULL,
+        0,
+        0
+    );
+}
+
+/* Publishes now if the upload slot is open, otherwise when it starts*/
+static esp_err_t batch_flush_in_slot(void)
+{
+    struct timeval now;
+
+    if (batch_slot_period_ms == 0)
+    {
+        return telemetry_batch_flush();
+    }
+    if (esp_timer_is_active(batch_slot_timer))
+    {
+        return ESP_OK;
+    }
+    gettimeofday(&now, NULL);
+    uint64_t period_us = ((uint64_t)batch_slot_period_ms) * 1000;
+    uint64_t now_us = ((uint64_t)now.tv_sec) * 1000000 + now.tv_usec;
+    uint64_t wait_us = (((uint64_t)batch_slot_offset_ms) * 1000 + period_us - now_us % period_us) % period_us;
+    if (wait_us == 0)
+    {
+        return telemetry_batch_flush();
+    }
+    ESP_LOGD(TAG, "Batch due, publishing in %d ms", (int)(wait_us / 1000));
+    return esp_timer_start_once(batch_slot_timer, wait_us);
+}
+
+static esp_err_t batch_arm_deadline(void)
+{
+    if (batch_deadline == 0)
+    {
+        return ESP_OK;
+    }
+    if (esp_timer_is_active(batch_deadline_timer))
+    {
+        return esp_timer_restart(
+            batch_deadline_timer,
+            ((uint64_t)batch_deadline) * 1000000
+        );
+    }
+    return esp_timer_start_once(
+        batch_deadline_timer,
+        ((uint64_t)batch_deadline) * 1000000
+    );
+}
+
+static void batch_on_deadline(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    ESP_LOGI(TAG, "Deadline reached with %d windows", (int)batch_records_len);
+    if (batch_flush_in_slot() != ESP_OK)
+    {
+        batch_arm_deadline();
+    }
+}
+
+static void batch_on_slot(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    if (telemetry_batch_flush() != ESP_OK)
+    {
+        batch_arm_deadline();
+    }
+}
+
+/* Upper bound of the payload with one more record*/
+static size_t batch_bytes_with(size_t record_len)
+{
+    return batch_records_bytes + record_len;
+}
+
+/* Removes the n oldest windows*/
+static void batch_forget(size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        batch_records_bytes -= telemetry_codec_record_len(TELEMETRY_CODEC_FORMAT, &batch_records[i]);
+    }
+    memmove(
+        &batch_records[0],
+        &batch_records[n],
+        (batch_records_len - n) * sizeof(sgp30_timed_measurement_t)
+    );
+    batch_records_len -= n;
+}
+
+static void batch_drop_oldest(void)
+{
+    batch_forget(1);
+    ESP_LOGW(TAG, "Batch full and unpublished, dropped oldest window");
+}
+
+esp_err_t telemetry_batch_init(esp_event_loop_handle_t loop)
+{
+    batch_event_loop = loop;
+    batch_records_len = 0;
+    batch_records_bytes = TELEMETRY_CODEC_BATCH_OVERHEAD;
+
+    esp_timer_create_args_t deadline_timer_args = {
+        .callback = batch_deadline_callback,
+        .name = "batch_deadline"
+    };
+    ESP_RETURN_ON_ERROR(
+        esp_timer_create(&deadline_timer_args, &batch_deadline_timer),
+        TAG,
+        "Could not create deadline timer"
+    );
+
+    ESP_RETURN_ON_ERROR(
+        esp_event_handler_register_with(
+            batch_event_loop,
+            TELEMETRY_BATCH_EVENT,
+            TELEMETRY_BATCH_EVENT_DEADLINE,
+            batch_on_deadline,
+            NULL
+        ),
+        TAG,
+        "Could not register deadline handler"
+    );
+
+    esp_timer_create_args_t slot_timer_args = {
+        .callback = batch_slot_callback,
+        .name = "batch_slot"
+    };
+    ESP_RETURN_ON_ERROR(
+        esp_timer_create(&slot_timer_args, &batch_slot_timer),
+        TAG,
+        "Could not create slot timer"
+    );
+
+    ESP_RETURN_ON_ERROR(
+        esp_event_handler_register_with(
+            batch_event_loop,
+            TELEMETRY_BATCH_EVENT,
+            TELEMETRY_BATCH_EVENT_SLOT,
+            batch_on_slot,
+            NULL
+        ),
+        TAG,
+        "Could not register slot handler"
+    );
+
+    return ESP_OK;
+}
+
+esp_err_t telemetry_batch_add(const sgp30_timed_measurement_t *m)
+{
+    esp_err_t err = ESP_OK;
+    size_t record_len = telemetry_codec_record_len(TELEMETRY_CODEC_FORMAT, m);
+
+    /* Publish what we have if this window would overflow the byte budget,
+     or the capacity while waiting for the upload slot*/
+    if (batch_records_len > 0
+        && (batch_records_len == CONFIG_TELEMETRY_BATCH_CAPACITY
+            || batch_bytes_with(record_len) > CONFIG_TELEMETRY_BATCH_MAX_BYTES))
+    {
+        err = telemetry_batch_flush();
+    }
+    /* If the broker could not take it make room for the newest window*/
+    while (batch_records_len > 0
+           && (batch_records_len == CONFIG_TELEMETRY_BATCH_CAPACITY
+               || batch_bytes_with(record_len)
+                      > CONFIG_TELEMETRY_BATCH_MAX_BYTES))
+    {
+        batch_drop_oldest();
+    }
+
+    batch_records_bytes = batch_bytes_with(record_len);
+    batch_records[batch_records_len++] = *m;
+    if (batch_records_len == 1)
+    {
+        batch_arm_deadline();
+    }
+
+    if (batch_records_len >= batch_size)
+    {
+        err = batch_flush_in_slot();
+    }
+    return err;
+}
+
+/* Compressed payloads go to their own topic, and only when smaller. So do
+ series, which ThingsBoard does not read either*/
+static esp_err_t batch_publish(size_t payload_len)
+{
+#if CONFIG_TELEMETRY_CODEC_FORMAT_SERIES
+    const char *topic = CONFIG_TELEMETRY_CODEC_SERIES_TOPIC;
+#else
+    const char *topic = MQTT_TELEMETRY_TOPIC;
+#endif
+    const uint8_t *payload = batch_payload;
+#if CONFIG_TELEMETRY_BATCH_COMPRESS
+    size_t compressed_len;
+
+    if (payload_len >= CONFIG_TELEMETRY_BATCH_COMPRESS_MIN_BYTES
+        && telemetry_compress(
+               batch_payload,
+               payload_len,
+               batch_compressed,
+               payload_len - 1,
+               &compressed_len
+           ) == ESP_OK)
+    {
+        topic = CONFIG_TELEMETRY_BATCH_COMPRESS_TOPIC;
+        payload = batch_compressed;
+        payload_len = compressed_len;
+    }
+#endif
+#if CONFIG_TELEMETRY_BATCH_STORE_AND_FORWARD
+    return telemetry_queue_append(topic, payload, payload_len);
+#else
+    return mqtt_publish_topic(topic, (const char *)payload, payload_len, NULL);
+#endif
+}
+
+/* Publishes the windows in as few payloads as the format allows, the
+ published ones are forgotten even if a later payload fails*/
+static esp_err_t batch_publish_records(void)
+{
+    size_t published = 0;
+    size_t payloads = 0;
+    size_t bytes = 0;
+    esp_err_t err = ESP_OK;
+
+    while (published < batch_records_len)
+    {
+        size_t n = batch_records_len - published;
+        size_t payload_len;
+
+        if (n > TELEMETRY_CODEC_MAX_WINDOWS(TELEMETRY_CODEC_FORMAT))
+        {
+            n = TELEMETRY_CODEC_MAX_WINDOWS(TELEMETRY_CODEC_FORMAT);
+        }
+        err = telemetry_codec_encode_telemetry(
+            TELEMETRY_CODEC_FORMAT,
+            &batch_records[published],
+            n,
+            batch_payload,
+            sizeof(batch_payload),
+            &payload_len
+        );
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Could not encode %d windows", (int)n);
+            break;
+        }
+        err = batch_publish(payload_len);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Could not publish %d windows", (int)n);
+            break;
+        }
+        published += n;
+        payloads++;
+        bytes += payload_len;
+    }
+    if (published > 0)
+    {
+        ESP_LOGI(TAG, "Published %d windows in %d payloads, %d bytes", (int)published, (int)payloads, (int)bytes);
+        batch_forget(published);
+    }
+    return err;
+}
+
+esp_err_t telemetry_batch_flush(void)
+{
+    if (batch_records_len == 0)
+    {
+        return ESP_OK;
+    }
+
+    ESP_RETURN_ON_ERROR(batch_publish_records(), TAG, "%d windows wait for the next flush", (int)batch_records_len);
+    if (esp_timer_is_active(batch_deadline_timer))
+    {
+        esp_timer_stop(batch_deadline_timer);
+    }
+    if (esp_timer_is_active(batch_slot_timer))
+    {
+        esp_timer_stop(batch_slot_timer);
+    }
+    /* Posted from the batch loop itself, so it must not wait for room*/
+    if (esp_event_post_to(batch_event_loop, TELEMETRY_BATCH_EVENT, TELEMETRY_BATCH_EVENT_FLUSHED, NULL, 0, 0) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not post flushed event");
+    }
+    return ESP_OK;
+}
+
+esp_err_t telemetry_batch_set_size(uint16_t n)
+{
+    if (n == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (n > CONFIG_TELEMETRY_BATCH_CAPACITY)
+    {
+        ESP_LOGW(
+            TAG,
+            "Batch size %d clamped to %d",
+            n,
+            CONFIG_TELEMETRY_BATCH_CAPACITY
+        );
+        n = CONFIG_TELEMETRY_BATCH_CAPACITY;
+    }
+    batch_size = n;
+    ESP_LOGI(TAG, "Publishing every %d windows", batch_size);
+
+    if (batch_records_len >= batch_size)
+    {
+        return batch_flush_in_slot();
+    }
+    return ESP_OK;
+}
+
+esp_err_t telemetry_batch_set_deadline(uint32_t s)
+{
+    batch_deadline = s;
+    ESP_LOGI(TAG, "Batch deadline set to %" PRIu32 " seconds", batch_deadline);
+
+    if (batch_deadline == 0)
+    {
+        if (esp_timer_is_active(batch_deadline_timer))
+        {
+            return esp_timer_stop(batch_deadline_timer);
+        }
+        return ESP_OK;
+    }
+    if (batch_records_len > 0)
+    {
+        return batch_arm_deadline();
+    }
+    return ESP_OK;
+}
+
+esp_err_t telemetry_batch_set_slot(uint32_t period_ms, uint32_t offset_ms)
+{
+    if (period_ms != 0 && offset_ms >= period_ms)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    batch_slot_period_ms = period_ms;
+    batch_slot_offset_ms = offset_ms;
+    ESP_LOGI(
+        TAG,
+        "Upload slot at %" PRIu32 " ms of every %" PRIu32 " ms",
+        batch_slot_offset_ms,
+        batch_slot_period_ms
+    );
+    /* A batch waiting for the old slot waits for the new one*/
+    if (esp_timer_is_active(batch_slot_timer))
+    {
+        esp_timer_stop(batch_slot_timer);
+        return batch_flush_in_slot();
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file telemetry_bulk.h
+ * @brief Catches up a large store and forward backlog over HTTP.
+ *
+ * When the telemetry queue holds CONFIG_TELEMETRY_BULK_THRESHOLD payloads,
+ * they are streamed from flash into chunked POSTs to the ThingsBoard HTTP
+ * telemetry API instead of one MQTT publish each. A request merges up to
+ * CONFIG_TELEMETRY_BULK_MAX_RECORDS stored JSON payloads into one array,
+ * written CONFIG_TELEMETRY_BULK_CHUNK_BYTES at a time, and its payloads are
+ * released when the server answers 2xx. An interrupted request is sent
+ * again from its first payload, also after a reboot since the releases are
+ * kept in flash. Payloads on other topics, or not JSON, stop the bulk
+ * upload and are replayed over MQTT.
+ */
+#ifndef TELEMETRY_BULK_H
+#define TELEMETRY_BULK_H
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "thingsboard_types.h"
+
+ESP_EVENT_DECLARE_BASE(TELEMETRY_BULK_EVENT);
+
+/**
+ * @brief Telemetry bulk event IDs.
+ */
+typedef enum {
+    TELEMETRY_BULK_EVENT_DONE, /*!< A request ended, data is the telemetry_bulk_result_t */
+} telemetry_bulk_event_id_t;
+
+/**
+ * @brief Outcome of a request.
+ */
+typedef struct {
+    uint32_t acked_seq; /*!< Last payload delivered, see telemetry_queue_bulk_done */
+    esp_err_t result;   /*!< ESP_OK, or why the bulk upload stopped */
+} telemetry_bulk_result_t;
+
+/**
+ * @brief Totals since boot.
+ */
+typedef struct {
+    uint32_t requests; /*!< Requests answered 2xx */
+    uint32_t failures; /*!< Requests refused or cut */
+    uint32_t records;  /*!< Stored payloads delivered */
+    uint64_t bytes;    /*!< Body bytes delivered */
+    uint64_t time_us;  /*!< Time from opening to the response of the delivered requests */
+} telemetry_bulk_stats_t;
+
+/**
+ * @brief Take over the large backlogs of the telemetry queue.
+ *
+ * It has to be called from the event loop of the telemetry queue, after
+ * telemetry_queue_init.
+ * Without an access token it logs a warning and the backlog is replayed
+ * over the uplink.
+ *
+ * @param loop Event loop of the telemetry queue.
+ * @param cfg Server address, CA certificate and access token of the device, it has to outlive the component.
+ * @return
+ * - ESP_OK: Success, or bulk upload disabled without an access token
+ * - some other error code: Failure
+ */
+esp_err_t telemetry_bulk_init(esp_event_loop_handle_t loop, const thingsboard_cfg_t *cfg);
+
+/**
+ * @brief Get the totals, it can be called from any task.
+ *
+ * @param stats Where the totals will be copied.
+ */
+void telemetry_bulk_get_stats(telemetry_bulk_stats_t *stats);
+#endif // !TELEMETRY_BULK_H
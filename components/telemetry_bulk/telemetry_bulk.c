@@ -0,0 +1,353 @@
+#include "sdkconfig.h"
+#if CONFIG_TELEMETRY_BULK_ENABLE
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mqtt_controller.h"
+#include "telemetry_bulk.h"
+#include "telemetry_queue.h"
+
+#define BULK_TASK_STACK 6144
+#define BULK_TASK_PRIORITY 4
+#define BULK_MAX_URL_LEN 192
+/* Room around the data of a chunk for its size line, its CRLF and the
+ last chunk, so each is a single write and not three small segments*/
+#define BULK_CHUNK_HEAD_LEN 10
+#define BULK_CHUNK_TAIL "\r\n"
+#define BULK_LAST_CHUNK "0\r\n\r\n"
+#define BULK_CHUNK_TAIL_LEN (sizeof(BULK_CHUNK_TAIL BULK_LAST_CHUNK) - 1)
+
+static const char *TAG = "telemetry_bulk";
+
+ESP_EVENT_DEFINE_BASE(TELEMETRY_BULK_EVENT);
+
+static esp_event_loop_handle_t bulk_event_loop;
+static TaskHandle_t bulk_task_handle;
+static esp_http_client_handle_t bulk_client;
+static char bulk_url[BULK_MAX_URL_LEN];
+/* Set by the backlog handler, cleared when its request is done*/
+static bool bulk_busy;
+static telemetry_queue_range_t bulk_range;
+static bool bulk_connected;
+static telemetry_bulk_stats_t bulk_stats;
+static uint8_t bulk_record[TELEMETRY_QUEUE_MAX_RECORD_LEN];
+static char bulk_chunk[BULK_CHUNK_HEAD_LEN + CONFIG_TELEMETRY_BULK_CHUNK_BYTES + BULK_CHUNK_TAIL_LEN];
+static size_t bulk_chunk_len;
+static size_t bulk_body_len;
+
+static esp_err_t bulk_write(const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        int written = esp_http_client_write(bulk_client, data, len);
+        if (written <= 0)
+        {
+            return ESP_FAIL;
+        }
+        data += written;
+        len -= written;
+    }
+    return ESP_OK;
+}
+
+/* Chunked transfer coding is framed here, the client only adds the header*/
+static esp_err_t bulk_flush_chunk(bool last)
+{
+    char size_line[BULK_CHUNK_HEAD_LEN + 1];
+    char *data = &bulk_chunk[BULK_CHUNK_HEAD_LEN];
+    size_t size_line_len = 0;
+    size_t len = bulk_chunk_len;
+
+    if (bulk_chunk_len > 0)
+    {
+        size_line_len = snprintf(size_line, sizeof(size_line), "%x\r\n", (unsigned)bulk_chunk_len);
+        memcpy(data - size_line_len, size_line, size_line_len);
+        memcpy(&data[len], BULK_CHUNK_TAIL, strlen(BULK_CHUNK_TAIL));
+        len += strlen(BULK_CHUNK_TAIL);
+    }
+    if (last)
+    {
+        memcpy(&data[len], BULK_LAST_CHUNK, strlen(BULK_LAST_CHUNK));
+        len += strlen(BULK_LAST_CHUNK);
+    }
+    ESP_RETURN_ON_ERROR(bulk_write(data - size_line_len, size_line_len + len), TAG, "chunk not sent");
+    bulk_body_len += bulk_chunk_len;
+    bulk_chunk_len = 0;
+    return ESP_OK;
+}
+
+static esp_err_t bulk_append(const void *data, size_t len)
+{
+    const char *p = data;
+
+    while (len > 0)
+    {
+        size_t n = CONFIG_TELEMETRY_BULK_CHUNK_BYTES - bulk_chunk_len;
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy(&bulk_chunk[BULK_CHUNK_HEAD_LEN + bulk_chunk_len], p, n);
+        bulk_chunk_len += n;
+        p += n;
+        len -= n;
+        if (bulk_chunk_len == CONFIG_TELEMETRY_BULK_CHUNK_BYTES)
+        {
+            ESP_RETURN_ON_ERROR(bulk_flush_chunk(false), TAG, "body not sent");
+        }
+    }
+    return ESP_OK;
+}
+
+/* Elements of a stored telemetry payload, an array of timed measurements
+ or a single one, false if it cannot be merged*/
+static bool bulk_elements(const telemetry_queue_record_t *record, const uint8_t **elements, size_t *len)
+{
+    if (record->topic_len != strlen(MQTT_TELEMETRY_TOPIC)
+        || memcmp(record->topic, MQTT_TELEMETRY_TOPIC, record->topic_len) != 0
+        || record->len < 2)
+    {
+        return false;
+    }
+    if (record->data[0] == '[' && record->data[record->len - 1] == ']')
+    {
+        *elements = &record->data[1];
+        *len = record->len - 2;
+        return true;
+    }
+    if (record->data[0] == '{' && record->data[record->len - 1] == '}')
+    {
+        *elements = record->data;
+        *len = record->len;
+        return true;
+    }
+    return false;
+}
+
+static esp_err_t bulk_open(void)
+{
+    bulk_chunk_len = 0;
+    bulk_body_len = 0;
+    /* -1 sends Transfer-Encoding: chunked, the length is not known*/
+    ESP_RETURN_ON_ERROR(esp_http_client_open(bulk_client, -1), TAG, "could not connect to %s", bulk_url);
+    bulk_connected = true;
+    return ESP_OK;
+}
+
+static void bulk_close(void)
+{
+    esp_http_client_close(bulk_client);
+    bulk_connected = false;
+}
+
+/* One request from the start of range, acked_seq is only advanced when
+ the server answers 2xx*/
+static esp_err_t bulk_request(telemetry_queue_range_t *range, uint32_t *acked_seq)
+{
+    telemetry_queue_record_t record;
+    uint32_t last_seq = *acked_seq;
+    size_t records = 0;
+    bool open = false;
+    bool first = true;
+    esp_err_t stop = ESP_OK;
+    int64_t started_at = esp_timer_get_time();
+
+    while (records < CONFIG_TELEMETRY_BULK_MAX_RECORDS)
+    {
+        const uint8_t *elements;
+        size_t len;
+        esp_err_t err = telemetry_queue_read(range, bulk_record, sizeof(bulk_record), &record);
+        if (err == ESP_ERR_NOT_FOUND)
+        {
+            break;
+        }
+        if (err == ESP_ERR_INVALID_CRC)
+        {
+            /* Released with the payloads around it*/
+            ESP_LOGE(TAG, "Payload %" PRIu32 " is corrupt, skipping it", record.seq);
+            last_seq = record.seq;
+            continue;
+        }
+        if (err != ESP_OK)
+        {
+            stop = err;
+            break;
+        }
+        if (!bulk_elements(&record, &elements, &len))
+        {
+            stop = ESP_ERR_NOT_SUPPORTED;
+            break;
+        }
+        if (!open)
+        {
+            ESP_RETURN_ON_ERROR(bulk_open(), TAG, "request not sent");
+            open = true;
+            ESP_RETURN_ON_ERROR(bulk_append("[", 1), TAG, "request not sent");
+        }
+        if (len > 0)
+        {
+            if (!first)
+            {
+                ESP_RETURN_ON_ERROR(bulk_append(",", 1), TAG, "request not sent");
+            }
+            ESP_RETURN_ON_ERROR(bulk_append(elements, len), TAG, "request not sent");
+            first = false;
+        }
+        last_seq = record.seq;
+        records++;
+    }
+    if (!open)
+    {
+        *acked_seq = last_seq;
+        return stop;
+    }
+
+    ESP_RETURN_ON_ERROR(bulk_append("]", 1), TAG, "request not sent");
+    ESP_RETURN_ON_ERROR(bulk_flush_chunk(true), TAG, "request not sent");
+    ESP_RETURN_ON_FALSE(esp_http_client_fetch_headers(bulk_client) >= 0, ESP_FAIL, TAG, "no response");
+    int status = esp_http_client_get_status_code(bulk_client);
+    esp_http_client_flush_response(bulk_client, NULL);
+    if (status < 200 || status > 299)
+    {
+        ESP_LOGE(TAG, "%d payloads refused with HTTP %d", (int)records, status);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    int64_t elapsed_us = esp_timer_get_time() - started_at;
+    *acked_seq = last_seq;
+    bulk_stats.requests++;
+    bulk_stats.records += records;
+    bulk_stats.bytes += bulk_body_len;
+    bulk_stats.time_us += elapsed_us;
+    ESP_LOGI(
+        TAG,
+        "Delivered %d payloads up to %" PRIu32 ", %d B in %" PRId64 " ms, %" PRId64 " B/s",
+        (int)records,
+        last_seq,
+        (int)bulk_body_len,
+        elapsed_us / 1000,
+        (int64_t)bulk_body_len * 1000000 / (elapsed_us > 0 ? elapsed_us : 1)
+    );
+    return stop;
+}
+
+static void bulk_task(void *pvParameters)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        telemetry_queue_range_t range = bulk_range;
+        telemetry_bulk_result_t done = {
+            .acked_seq = range.min_seq - 1,
+        };
+        bool reused = bulk_connected;
+
+        done.result = bulk_request(&range, &done.acked_seq);
+        if (done.result == ESP_FAIL && reused)
+        {
+            /* The server may have closed the kept connection, the request
+             is sent again from its first payload*/
+            ESP_LOGD(TAG, "Kept connection failed, reconnecting");
+            bulk_close();
+            range = bulk_range;
+            done.result = bulk_request(&range, &done.acked_seq);
+        }
+        if (done.result != ESP_OK && done.result != ESP_ERR_NOT_SUPPORTED)
+        {
+            bulk_stats.failures++;
+            bulk_close();
+        }
+        if (esp_event_post_to(bulk_event_loop, TELEMETRY_BULK_EVENT, TELEMETRY_BULK_EVENT_DONE, &done, sizeof(done), portMAX_DELAY) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Could not post the result");
+        }
+    }
+}
+
+static esp_err_t bulk_on_backlog(const telemetry_queue_range_t *range)
+{
+    if (bulk_busy)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    bulk_busy = true;
+    bulk_range = *range;
+    xTaskNotifyGive(bulk_task_handle);
+    return ESP_OK;
+}
+
+static void bulk_on_done(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    const telemetry_bulk_result_t *done = event_data;
+
+    bulk_busy = false;
+    telemetry_queue_bulk_done(done->acked_seq, done->result);
+}
+
+esp_err_t telemetry_bulk_init(esp_event_loop_handle_t loop, const thingsboard_cfg_t *cfg)
+{
+    const char *token = cfg->credentials.access_token;
+
+    /* The backlog is left to the uplink, as without this component*/
+    if (token == NULL || token[0] == '\0')
+    {
+        ESP_LOGW(TAG, "No access token provisioned for the HTTP API, bulk upload disabled");
+        return ESP_OK;
+    }
+    bulk_event_loop = loop;
+    if (CONFIG_TELEMETRY_BULK_URL[0] != '\0')
+    {
+        snprintf(bulk_url, sizeof(bulk_url), "%s/api/v1/%s/telemetry", CONFIG_TELEMETRY_BULK_URL, token);
+    }
+    else
+    {
+        snprintf(bulk_url, sizeof(bulk_url), "https://%s/api/v1/%s/telemetry", cfg->address.uri, token);
+    }
+    esp_http_client_config_t http_cfg = {
+        .url = bulk_url,
+        .method = HTTP_METHOD_POST,
+        .cert_pem = cfg->verification.certificate,
+        .timeout_ms = CONFIG_TELEMETRY_BULK_TIMEOUT_MS,
+        .keep_alive_enable = true,
+    };
+    bulk_client = esp_http_client_init(&http_cfg);
+    ESP_RETURN_ON_FALSE(bulk_client != NULL, ESP_ERR_NO_MEM, TAG, "Could not create the HTTP client");
+    ESP_RETURN_ON_ERROR(
+        esp_http_client_set_header(bulk_client, "Content-Type", "application/json"),
+        TAG,
+        "Could not set the content type"
+    );
+    ESP_RETURN_ON_ERROR(
+        esp_event_handler_register_with(loop, TELEMETRY_BULK_EVENT, TELEMETRY_BULK_EVENT_DONE, bulk_on_done, NULL),
+        TAG,
+        "Could not register done handler"
+    );
+    ESP_RETURN_ON_FALSE(
+        xTaskCreate(bulk_task, TAG, BULK_TASK_STACK, NULL, BULK_TASK_PRIORITY, &bulk_task_handle) == pdPASS,
+        ESP_ERR_NO_MEM,
+        TAG,
+        "Could not create task"
+    );
+    telemetry_queue_set_backlog_cb(CONFIG_TELEMETRY_BULK_THRESHOLD, bulk_on_backlog);
+    ESP_LOGI(TAG, "Backlogs of %d payloads go to %s", CONFIG_TELEMETRY_BULK_THRESHOLD, CONFIG_TELEMETRY_BULK_URL[0] != '\0' ? CONFIG_TELEMETRY_BULK_URL : cfg->address.uri);
+    return ESP_OK;
+}
+
+void telemetry_bulk_get_stats(telemetry_bulk_stats_t *stats)
+{
+    *stats = bulk_stats;
+}
+#endif
@@ -0,0 +1,145 @@
+/**
+ * @file telemetry_codec.h
+ * @brief Encoders of telemetry and attribute payloads into fixed buffers.
+ */
+#ifndef TELEMETRY_CODEC_H
+#define TELEMETRY_CODEC_H
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sgp30_types.h"
+
+/**
+ * @brief Payload formats.
+ */
+typedef enum {
+    TELEMETRY_CODEC_JSON,     /*!< ThingsBoard JSON */
+    TELEMETRY_CODEC_PROTOBUF, /*!< Protocol Buffers, see proto/telemetry.proto and proto/attributes.proto */
+    TELEMETRY_CODEC_CBOR,     /*!< CBOR (RFC 8949) with the JSON layout */
+    TELEMETRY_CODEC_SERIES,   /*!< Compressed series, see series_codec.h. Attributes are JSON */
+} telemetry_codec_format_t;
+
+#if CONFIG_TELEMETRY_CODEC_FORMAT_PROTOBUF
+#define TELEMETRY_CODEC_FORMAT TELEMETRY_CODEC_PROTOBUF
+#elif CONFIG_TELEMETRY_CODEC_FORMAT_CBOR
+#define TELEMETRY_CODEC_FORMAT TELEMETRY_CODEC_CBOR
+#elif CONFIG_TELEMETRY_CODEC_FORMAT_SERIES
+#define TELEMETRY_CODEC_FORMAT TELEMETRY_CODEC_SERIES
+#else
+#define TELEMETRY_CODEC_FORMAT TELEMETRY_CODEC_JSON
+#endif
+
+/**
+ * @brief Most windows a telemetry payload holds, a protobuf message is a
+ * single window.
+ */
+#define TELEMETRY_CODEC_MAX_WINDOWS(format) ((format) == TELEMETRY_CODEC_PROTOBUF ? 1 : SIZE_MAX)
+
+/**
+ * @brief Upper bound of the framing bytes a batch adds to its records.
+ */
+#define TELEMETRY_CODEC_BATCH_OVERHEAD 3
+
+/**
+ * @brief Attribute value types.
+ */
+typedef enum {
+    TELEMETRY_CODEC_ATTRIBUTE_INT,    /*!< Integer value */
+    TELEMETRY_CODEC_ATTRIBUTE_STRING, /*!< Null terminated string value */
+} telemetry_codec_attribute_type_t;
+
+/**
+ * @brief Attribute to encode.
+ */
+typedef struct {
+    const char *key;                       /*!< Attribute key */
+    telemetry_codec_attribute_type_t type; /*!< Type of the value */
+    union {
+        int64_t int_value;                 /*!< Value if type is INT */
+        const char *string_value;          /*!< Value if type is STRING */
+    };
+} telemetry_codec_attribute_t;
+
+/**
+ * @brief Accumulated encoder statistics.
+ */
+typedef struct {
+    uint32_t payloads;       /*!< Payloads encoded */
+    uint64_t encoded_bytes;  /*!< Bytes produced in the selected format */
+    uint64_t encode_cycles;  /*!< CPU cycles spent in the selected format */
+    uint64_t json_bytes;     /*!< Bytes the same payloads take as JSON */
+    uint64_t json_cycles;    /*!< CPU cycles the same payloads take as JSON */
+} telemetry_codec_stats_t;
+
+/**
+ * @brief Get the number of bytes a record adds to a batch.
+ *
+ * The sum of the records plus TELEMETRY_CODEC_BATCH_OVERHEAD is an upper
+ * bound of the encoded batch.
+ *
+ * @param format Payload format.
+ * @param m Timed measurement of the record.
+ * @return Bytes of the record, including its separator or field header.
+ */
+size_t telemetry_codec_record_len(
+    telemetry_codec_format_t format,
+    const sgp30_timed_measurement_t *m
+);
+
+/**
+ * @brief Encode a batch of timed measurements as a telemetry payload.
+ *
+ * @param format Payload format.
+ * @param m Array of timed measurements.
+ * @param n Number of timed measurements in m.
+ * @param buf Buffer where the payload will be written.
+ * @param buf_len Size of buf.
+ * @param out_len Length of the written payload.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_SIZE: buf is too small for the payload
+ * - ESP_ERR_INVALID_ARG: unknown format, or more than
+ *   TELEMETRY_CODEC_MAX_WINDOWS windows
+ */
+esp_err_t telemetry_codec_encode_telemetry(
+    telemetry_codec_format_t format,
+    const sgp30_timed_measurement_t *m,
+    size_t n,
+    uint8_t *buf,
+    size_t buf_len,
+    size_t *out_len
+);
+
+/**
+ * @brief Encode a set of attributes as an attributes payload.
+ *
+ * @param format Payload format.
+ * @param attributes Array of attributes.
+ * @param n Number of attributes.
+ * @param buf Buffer where the payload will be written.
+ * @param buf_len Size of buf.
+ * @param out_len Length of the written payload.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_SIZE: buf is too small for the payload
+ * - ESP_ERR_INVALID_ARG: unknown format, or a protobuf value out of range
+ * - ESP_ERR_NOT_SUPPORTED: a key that is not in proto/attributes.proto
+ */
+esp_err_t telemetry_codec_encode_attributes(
+    telemetry_codec_format_t format,
+    const telemetry_codec_attribute_t *attributes,
+    size_t n,
+    uint8_t *buf,
+    size_t buf_len,
+    size_t *out_len
+);
+
+/**
+ * @brief Get the statistics of the telemetry payloads encoded so far.
+ *
+ * JSON figures are only gathered with CONFIG_TELEMETRY_CODEC_REPORT_STATS.
+ *
+ * @param stats Where the statistics will be copied.
+ */
+void telemetry_codec_get_stats(telemetry_codec_stats_t *stats);
+#endif // !TELEMETRY_CODEC_H
@@ -0,0 +1,261 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_cpu.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "json_structures.h"
+#include "series_codec.h"
+#include "sgp30_types.h"
+#include "telemetry_codec.h"
+#include "telemetry_codec_priv.h"
+
+static const char *TAG = "telemetry_codec";
+
+static telemetry_codec_stats_t codec_stats;
+
+#if CONFIG_TELEMETRY_CODEC_REPORT_STATS
+static char codec_json_scratch[CONFIG_TELEMETRY_CODEC_STATS_SCRATCH_BYTES];
+#endif
+
+static const char *codec_format_name(telemetry_codec_format_t format)
+{
+    switch (format)
+    {
+        case TELEMETRY_CODEC_JSON:
+            return "json";
+        case TELEMETRY_CODEC_PROTOBUF:
+            return "protobuf";
+        case TELEMETRY_CODEC_CBOR:
+            return "cbor";
+        case TELEMETRY_CODEC_SERIES:
+            return "series";
+        default:
+            return "unknown";
+    }
+}
+
+static void json_write_string(telemetry_codec_writer_t *w, const char *s)
+{
+    telemetry_codec_write_byte(w, '"');
+    for (; *s != '\0'; s++)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            telemetry_codec_write_byte(w, '\\');
+        }
+        telemetry_codec_write_byte(w, (uint8_t)*s);
+    }
+    telemetry_codec_write_byte(w, '"');
+}
+
+static void json_encode_attributes(
+    telemetry_codec_writer_t *w,
+    const telemetry_codec_attribute_t *attributes,
+    size_t n
+)
+{
+    char number[24];
+
+    telemetry_codec_write_byte(w, '{');
+    for (size_t i = 0; i < n; i++)
+    {
+        if (i > 0)
+        {
+            telemetry_codec_write_byte(w, ',');
+        }
+        json_write_string(w, attributes[i].key);
+        telemetry_codec_write_byte(w, ':');
+        if (attributes[i].type == TELEMETRY_CODEC_ATTRIBUTE_INT)
+        {
+            int len = snprintf(
+                number,
+                sizeof(number),
+                "%" PRId64,
+                attributes[i].int_value
+            );
+            telemetry_codec_write(w, number, len);
+        }
+        else
+        {
+            json_write_string(w, attributes[i].string_value);
+        }
+    }
+    telemetry_codec_write_byte(w, '}');
+}
+
+static esp_err_t codec_encode_telemetry(
+    telemetry_codec_format_t format,
+    const sgp30_timed_measurement_t *m,
+    size_t n,
+    uint8_t *buf,
+    size_t buf_len,
+    size_t *out_len
+)
+{
+    telemetry_codec_writer_t w = { .buf = buf, .len = buf_len };
+    esp_err_t err = ESP_OK;
+
+    switch (format)
+    {
+        case TELEMETRY_CODEC_JSON:
+            return json_structures_write_timed_measurement_array(
+                m,
+                n,
+                (char *)buf,
+                buf_len,
+                out_len
+            );
+        case TELEMETRY_CODEC_PROTOBUF:
+            err = telemetry_codec_protobuf_encode_telemetry(&w, m, n);
+            break;
+        case TELEMETRY_CODEC_CBOR:
+            telemetry_codec_cbor_encode_telemetry(&w, m, n);
+            break;
+        case TELEMETRY_CODEC_SERIES:
+            return series_codec_encode(m, n, 0, buf, buf_len, out_len);
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (w.overflow)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *out_len = w.pos;
+    return ESP_OK;
+}
+
+size_t telemetry_codec_record_len(
+    telemetry_codec_format_t format,
+    const sgp30_timed_measurement_t *m
+)
+{
+    switch (format)
+    {
+        case TELEMETRY_CODEC_JSON:
+            /* The record and its comma*/
+            return json_structures_write_timed_measurement(NULL, 0, m) + 1;
+        case TELEMETRY_CODEC_PROTOBUF:
+            return telemetry_codec_protobuf_record_len(m);
+        case TELEMETRY_CODEC_CBOR:
+            return telemetry_codec_cbor_record_len(m);
+        case TELEMETRY_CODEC_SERIES:
+            /* The header holds the first record, the rounding of the last
+             byte stays within TELEMETRY_CODEC_BATCH_OVERHEAD*/
+            return (SERIES_CODEC_MAX_SAMPLE_BITS + 7) / 8;
+        default:
+            return 0;
+    }
+}
+
+esp_err_t telemetry_codec_encode_telemetry(
+    telemetry_codec_format_t format,
+    const sgp30_timed_measurement_t *m,
+    size_t n,
+    uint8_t *buf,
+    size_t buf_len,
+    size_t *out_len
+)
+{
+    uint32_t start = esp_cpu_get_cycle_count();
+    esp_err_t err = codec_encode_telemetry(format, m, n, buf, buf_len, out_len);
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    codec_stats.payloads++;
+    codec_stats.encoded_bytes += *out_len;
+    codec_stats.encode_cycles += cycles;
+
+#if CONFIG_TELEMETRY_CODEC_REPORT_STATS
+    size_t json_len = 0;
+    start = esp_cpu_get_cycle_count();
+    esp_err_t json_err = json_structures_write_timed_measurement_array(
+        m,
+        n,
+        codec_json_scratch,
+        sizeof(codec_json_scratch),
+        &json_len
+    );
+    uint32_t json_cycles = esp_cpu_get_cycle_count() - start;
+    if (json_err == ESP_OK)
+    {
+        codec_stats.json_bytes += json_len;
+        codec_stats.json_cycles += json_cycles;
+        ESP_LOGI(
+            TAG,
+            "%d windows: %s %d B in %" PRIu32 " cycles, json %d B in %" PRIu32
+            " cycles (%d%% of json size)",
+            (int)n,
+            codec_format_name(format),
+            (int)*out_len,
+            cycles,
+            (int)json_len,
+            json_cycles,
+            (int)(*out_len * 100 / json_len)
+        );
+    }
+#else
+    ESP_LOGD(
+        TAG,
+        "%d windows: %s %d B in %" PRIu32 " cycles",
+        (int)n,
+        codec_format_name(format),
+        (int)*out_len,
+        cycles
+    );
+#endif
+    return ESP_OK;
+}
+
+esp_err_t telemetry_codec_encode_attributes(
+    telemetry_codec_format_t format,
+    const telemetry_codec_attribute_t *attributes,
+    size_t n,
+    uint8_t *buf,
+    size_t buf_len,
+    size_t *out_len
+)
+{
+    telemetry_codec_writer_t w = { .buf = buf, .len = buf_len };
+    esp_err_t err = ESP_OK;
+
+    switch (format)
+    {
+        case TELEMETRY_CODEC_JSON:
+            json_encode_attributes(&w, attributes, n);
+            break;
+        case TELEMETRY_CODEC_PROTOBUF:
+            err = telemetry_codec_protobuf_encode_attributes(&w, attributes, n);
+            break;
+        case TELEMETRY_CODEC_CBOR:
+            telemetry_codec_cbor_encode_attributes(&w, attributes, n);
+            break;
+        case TELEMETRY_CODEC_SERIES:
+            json_encode_attributes(&w, attributes, n);
+            break;
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (w.overflow)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *out_len = w.pos;
+    return ESP_OK;
+}
+
+void telemetry_codec_get_stats(telemetry_codec_stats_t *stats)
+{
+    *stats = codec_stats;
+}
@@ -0,0 +1,130 @@
+#include <string.h>
+#include "sgp30_types.h"
+#include "telemetry_codec.h"
+#include "telemetry_codec_priv.h"
+
+/* Major types of RFC 8949*/
+#define CBOR_UINT   0
+#define CBOR_NEGINT 1
+#define CBOR_TEXT   3
+#define CBOR_ARRAY  4
+#define CBOR_MAP    5
+
+static size_t cbor_head_len(uint64_t value)
+{
+    if (value < 24)
+    {
+        return 1;
+    }
+    else if (value <= UINT8_MAX)
+    {
+        return 2;
+    }
+    else if (value <= UINT16_MAX)
+    {
+        return 3;
+    }
+    else if (value <= UINT32_MAX)
+    {
+        return 5;
+    }
+    return 9;
+}
+
+static void cbor_write_head(
+    telemetry_codec_writer_t *w,
+    uint8_t major,
+    uint64_t value
+)
+{
+    uint8_t head[9];
+    size_t len = cbor_head_len(value);
+
+    if (len == 1)
+    {
+        head[0] = (major << 5) | (uint8_t)value;
+    }
+    else
+    {
+        /* Additional information 24, 25, 26 or 27 followed by the big
+         endian argument*/
+        static const uint8_t additional[] = { 0, 24, 25, 0, 26, 0, 0, 0, 27 };
+        head[0] = (major << 5) | additional[len - 1];
+        for (size_t i = 1; i < len; i++)
+        {
+            head[i] = (uint8_t)(value >> (8 * (len - 1 - i)));
+        }
+    }
+    telemetry_codec_write(w, head, len);
+}
+
+static void cbor_write_text(telemetry_codec_writer_t *w, const char *text)
+{
+    size_t len = strlen(text);
+    cbor_write_head(w, CBOR_TEXT, len);
+    telemetry_codec_write(w, text, len);
+}
+
+static void cbor_write_int(telemetry_codec_writer_t *w, int64_t value)
+{
+    if (value < 0)
+    {
+        cbor_write_head(w, CBOR_NEGINT, (uint64_t)(-1 - value));
+    }
+    else
+    {
+        cbor_write_head(w, CBOR_UINT, (uint64_t)value);
+    }
+}
+
+size_t telemetry_codec_cbor_record_len(const sgp30_timed_measurement_t *m)
+{
+    /* {"ts":<uint>,"values":{"eCO2":<uint>,"TVOC":<uint>}}*/
+    return 1                                                /* map(2)*/
+           + 3 + cbor_head_len((uint64_t)m->time * 1000)    /* "ts"*/
+           + 7 + 1                                          /* "values" map(2)*/
+           + 5 + cbor_head_len(m->measurement.eCO2)         /* "eCO2"*/
+           + 5 + cbor_head_len(m->measurement.TVOC);        /* "TVOC"*/
+}
+
+void telemetry_codec_cbor_encode_telemetry(
+    telemetry_codec_writer_t *w,
+    const sgp30_timed_measurement_t *m,
+    size_t n
+)
+{
+    cbor_write_head(w, CBOR_ARRAY, n);
+    for (size_t i = 0; i < n; i++)
+    {
+        cbor_write_head(w, CBOR_MAP, 2);
+        cbor_write_text(w, "ts");
+        cbor_write_int(w, (int64_t)m[i].time * 1000);
+        cbor_write_text(w, "values");
+        cbor_write_head(w, CBOR_MAP, 2);
+        cbor_write_text(w, "eCO2");
+        cbor_write_int(w, m[i].measurement.eCO2);
+        cbor_write_text(w, "TVOC");
+        cbor_write_int(w, m[i].measurement.TVOC);
+    }
+}
+
+void telemetry_codec_cbor_encode_attributes(
+    telemetry_codec_writer_t *w,
+    const telemetry_codec_attribute_t *attributes,
+    size_t n
+)
+{
+    cbor_write_head(w, CBOR_MAP, n);
+    for (size_t i = 0; i < n; i++)
+    {
+        cbor_write_text(w, attributes[i].key);
+        if (attributes[i].type == TELEMETRY_CODEC_ATTRIBUTE_INT)
+        {
+            cbor_write_int(w, attributes[i].int_value);
+        }
+        else
+        {
+            cbor_write_text(w, attributes[i].string_value);
+        }
+    }
+}
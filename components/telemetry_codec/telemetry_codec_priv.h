@@ -0,0 +1,74 @@
+/**
+ * @file telemetry_codec_priv.h
+ * @brief Format specific encoders used by telemetry_codec.c.
+ */
+#ifndef TELEMETRY_CODEC_PRIV_H
+#define TELEMETRY_CODEC_PRIV_H
+#include <stdbool.h>
+#include <string.h>
+#include "telemetry_codec.h"
+
+/**
+ * @brief Bounded writer over a caller provided buffer.
+ */
+typedef struct {
+    uint8_t *buf;  /*!< Destination buffer */
+    size_t len;    /*!< Size of buf */
+    size_t pos;    /*!< Bytes written so far */
+    bool overflow; /*!< Set when a write did not fit */
+} telemetry_codec_writer_t;
+
+/**
+ * @brief Append bytes to the writer, flagging overflow if they do not fit.
+ */
+static inline void telemetry_codec_write(
+    telemetry_codec_writer_t *w,
+    const void *data,
+    size_t len
+)
+{
+    if (w->overflow || len > w->len - w->pos)
+    {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->pos, data, len);
+    w->pos += len;
+}
+
+static inline void telemetry_codec_write_byte(
+    telemetry_codec_writer_t *w,
+    uint8_t byte
+)
+{
+    telemetry_codec_write(w, &byte, 1);
+}
+
+size_t telemetry_codec_protobuf_record_len(const sgp30_timed_measurement_t *m);
+
+esp_err_t telemetry_codec_protobuf_encode_telemetry(
+    telemetry_codec_writer_t *w,
+    const sgp30_timed_measurement_t *m,
+    size_t n
+);
+
+esp_err_t telemetry_codec_protobuf_encode_attributes(
+    telemetry_codec_writer_t *w,
+    const telemetry_codec_attribute_t *attributes,
+    size_t n
+);
+
+size_t telemetry_codec_cbor_record_len(const sgp30_timed_measurement_t *m);
+
+void telemetry_codec_cbor_encode_telemetry(
+    telemetry_codec_writer_t *w,
+    const sgp30_timed_measurement_t *m,
+    size_t n
+);
+
+void telemetry_codec_cbor_encode_attributes(
+    telemetry_codec_writer_t *w,
+    const telemetry_codec_attribute_t *attributes,
+    size_t n
+);
+#endif // !TELEMETRY_CODEC_PRIV_H
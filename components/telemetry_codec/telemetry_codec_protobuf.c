@@ -0,0 +1,159 @@
+#include <string.h>
+#include "sgp30_types.h"
+#include "telemetry_codec.h"
+#include "telemetry_codec_priv.h"
+
+/* Wire types of the protobuf encoding*/
+#define PB_WIRE_VARINT 0
+#define PB_WIRE_LEN    2
+
+#define PB_TAG(field, wire) (((uint32_t)(field) << 3) | (wire))
+
+/* Field numbers of proto/telemetry.proto*/
+#define PB_READING_TS     1
+#define PB_READING_VALUES 2
+#define PB_VALUES_ECO2    1
+#define PB_VALUES_TVOC    2
+
+/* Fields of the ClientAttributes message of proto/attributes.proto, a key
+ published without a field here is refused*/
+typedef struct {
+    const char *key;
+    uint32_t field;
+} pb_attribute_field_t;
+
+static const pb_attribute_field_t pb_attribute_fields[] = {
+    { "nvs_used", 1 },
+    { "nvs_free", 2 },
+    { "nvs_namespaces", 3 },
+    { "nvs_opens", 4 },
+    { "nvs_thingsboard_reads", 5 },
+    { "nvs_thingsboard_writes", 6 },
+    { "nvs_thingsboard_skipped", 7 },
+    { "nvs_thingsboard_commits", 8 },
+    { "nvs_thingsboard_written_bytes", 9 },
+    { "nvs_thingsboard_us", 10 },
+    { "nvs_thingsboard_max_us", 11 },
+    { "nvs_sgp30_reads", 12 },
+    { "nvs_sgp30_writes", 13 },
+    { "nvs_sgp30_skipped", 14 },
+    { "nvs_sgp30_commits", 15 },
+    { "nvs_sgp30_written_bytes", 16 },
+    { "nvs_sgp30_us", 17 },
+    { "nvs_sgp30_max_us", 18 },
+    { "energy_active_s", 19 },
+    { "energy_active_uah", 20 },
+    { "energy_light_sleep_s", 21 },
+    { "energy_light_sleep_uah", 22 },
+    { "energy_deep_sleep_s", 23 },
+    { "energy_deep_sleep_uah", 24 },
+    { "energy_modem_sleep_s", 25 },
+    { "energy_modem_sleep_uah", 26 },
+    { "energy_rx_s", 27 },
+    { "energy_rx_uah", 28 },
+    { "energy_tx_s", 29 },
+    { "energy_tx_uah", 30 },
+    { "energy_uah", 31 },
+    { "energy_wakeups", 32 },
+    { "energy_light_sleep", 33 },
+    { "energy_wifi_ps", 34 },
+};
+
+static size_t pb_varint_len(uint64_t value)
+{
+    size_t len = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        len++;
+    }
+    return len;
+}
+
+static void pb_write_varint(telemetry_codec_writer_t *w, uint64_t value)
+{
+    uint8_t varint[10];
+    size_t len = 0;
+    while (value >= 0x80)
+    {
+        varint[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    varint[len++] = (uint8_t)value;
+    telemetry_codec_write(w, varint, len);
+}
+
+static size_t pb_values_len(const sgp30_measurement_t *m)
+{
+    return 1 + pb_varint_len(m->eCO2) + 1 + pb_varint_len(m->TVOC);
+}
+
+size_t telemetry_codec_protobuf_record_len(const sgp30_timed_measurement_t *m)
+{
+    size_t values_len = pb_values_len(&m->measurement);
+    return 1 + pb_varint_len((uint64_t)((int64_t)m->time * 1000))
+           + 1 + pb_varint_len(values_len) + values_len;
+}
+
+esp_err_t telemetry_codec_protobuf_encode_telemetry(
+    telemetry_codec_writer_t *w,
+    const sgp30_timed_measurement_t *m,
+    size_t n
+)
+{
+    /* ThingsBoard reads one window per message*/
+    if (n != 1)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* SensorDataReading*/
+    pb_write_varint(w, PB_TAG(PB_READING_TS, PB_WIRE_VARINT));
+    pb_write_varint(w, (uint64_t)((int64_t)m->time * 1000));
+    pb_write_varint(w, PB_TAG(PB_READING_VALUES, PB_WIRE_LEN));
+    pb_write_varint(w, pb_values_len(&m->measurement));
+
+    /* Values, zero values are written so the keys are always present*/
+    pb_write_varint(w, PB_TAG(PB_VALUES_ECO2, PB_WIRE_VARINT));
+    pb_write_varint(w, m->measurement.eCO2);
+    pb_write_varint(w, PB_TAG(PB_VALUES_TVOC, PB_WIRE_VARINT));
+    pb_write_varint(w, m->measurement.TVOC);
+    return ESP_OK;
+}
+
+static const pb_attribute_field_t *pb_attribute_field(const char *key)
+{
+    for (size_t i = 0; i < sizeof(pb_attribute_fields) / sizeof(pb_attribute_fields[0]); i++)
+    {
+        if (strcmp(pb_attribute_fields[i].key, key) == 0)
+        {
+            return &pb_attribute_fields[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t telemetry_codec_protobuf_encode_attributes(
+    telemetry_codec_writer_t *w,
+    const telemetry_codec_attribute_t *attributes,
+    size_t n
+)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        const pb_attribute_field_t *field = pb_attribute_field(attributes[i].key);
+
+        /* Only the keys of the schema, all of them uint32*/
+        if (field == NULL || attributes[i].type != TELEMETRY_CODEC_ATTRIBUTE_INT)
+        {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        if (attributes[i].int_value < 0 || attributes[i].int_value > UINT32_MAX)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        pb_write_varint(w, PB_TAG(field->field, PB_WIRE_VARINT));
+        pb_write_varint(w, (uint64_t)attributes[i].int_value);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,63 @@
+/**
+ * @file telemetry_compress.h
+ * @brief LZSS compression of telemetry payloads with a fixed window.
+ *
+ * A compressed payload starts with TELEMETRY_COMPRESS_MAGIC, the window
+ * bits and the original length as a base 128 varint. The stream follows as
+ * groups of a flag byte, least significant bit first, and eight tokens: a
+ * literal byte when the flag is 0, or a two byte back reference when it is
+ * 1, holding distance - 1 in the low byte and the upper 4 bits of the
+ * second byte, and length - 3 in its lower 4 bits.
+ */
+#ifndef TELEMETRY_COMPRESS_H
+#define TELEMETRY_COMPRESS_H
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief First byte of a compressed payload.
+ */
+#define TELEMETRY_COMPRESS_MAGIC 0x4C
+
+/**
+ * @brief Accumulated compression statistics.
+ */
+typedef struct {
+    uint32_t payloads;      /*!< Payloads sent compressed */
+    uint32_t skipped;       /*!< Payloads that would not have been smaller */
+    uint64_t input_bytes;   /*!< Bytes given to the compressor */
+    uint64_t output_bytes;  /*!< Bytes of the compressed payloads */
+    uint64_t cycles;        /*!< CPU cycles spent, skipped payloads included */
+} telemetry_compress_stats_t;
+
+/**
+ * @brief Compress a payload.
+ *
+ * The search stops as soon as the output reaches out_len, so passing
+ * in_len - 1 bounds the cost of payloads that do not compress.
+ *
+ * @param in Payload to compress.
+ * @param in_len Length of in.
+ * @param out Buffer where the compressed payload is written.
+ * @param out_len Size of out.
+ * @param compressed_len Length of the compressed payload.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_SIZE: the compressed payload does not fit in out_len
+ */
+esp_err_t telemetry_compress(
+    const uint8_t *in,
+    size_t in_len,
+    uint8_t *out,
+    size_t out_len,
+    size_t *compressed_len
+);
+
+/**
+ * @brief Get the statistics accumulated since boot.
+ *
+ * @param stats Where the statistics are copied.
+ */
+void telemetry_compress_get_stats(telemetry_compress_stats_t *stats);
+#endif // !TELEMETRY_COMPRESS_H
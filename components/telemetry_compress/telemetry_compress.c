@@ -0,0 +1,204 @@
+#include <inttypes.h>
+#include <string.h>
+#include "esp_cpu.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "telemetry_compress.h"
+
+#define LZSS_WINDOW_SIZE (1 << CONFIG_TELEMETRY_COMPRESS_WINDOW_BITS)
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + 15)
+
+static const char *TAG = "telemetry_compress";
+
+static telemetry_compress_stats_t compress_stats;
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t pos;
+    size_t flag_pos;   /* Position of the flag byte of the current group*/
+    uint8_t flag_bit;  /* Next bit of the flag byte, 8 opens a new group*/
+} lzss_writer_t;
+
+static bool lzss_put(lzss_writer_t *w, uint8_t byte)
+{
+    if (w->pos >= w->len)
+    {
+        return false;
+    }
+    w->buf[w->pos++] = byte;
+    return true;
+}
+
+static bool lzss_put_varint(lzss_writer_t *w, size_t value)
+{
+    while (value >= 0x80)
+    {
+        if (!lzss_put(w, (uint8_t)(value | 0x80)))
+        {
+            return false;
+        }
+        value >>= 7;
+    }
+    return lzss_put(w, (uint8_t)value);
+}
+
+/* Reserve the flag byte of a new group when the current one is full*/
+static bool lzss_next_token(lzss_writer_t *w, bool is_match)
+{
+    if (w->flag_bit == 8)
+    {
+        w->flag_pos = w->pos;
+        w->flag_bit = 0;
+        if (!lzss_put(w, 0))
+        {
+            return false;
+        }
+    }
+    if (is_match)
+    {
+        w->buf[w->flag_pos] |= 1 << w->flag_bit;
+    }
+    w->flag_bit++;
+    return true;
+}
+
+/* Longest match of in[pos...] within the window, the match may run into
+ the bytes being encoded as the decoder copies byte by byte*/
+static size_t lzss_find_match(
+    const uint8_t *in,
+    size_t in_len,
+    size_t pos,
+    size_t *distance
+)
+{
+    size_t start = pos > LZSS_WINDOW_SIZE ? pos - LZSS_WINDOW_SIZE : 0;
+    size_t max_len = in_len - pos < LZSS_MAX_MATCH ? in_len - pos : LZSS_MAX_MATCH;
+    size_t best_len = 0;
+
+    for (size_t candidate = pos; candidate-- > start;)
+    {
+        size_t len = 0;
+        /* Cheap reject on the first byte before comparing the rest*/
+        if (in[candidate] != in[pos])
+        {
+            continue;
+        }
+        while (len < max_len && in[candidate + len] == in[pos + len])
+        {
+            len++;
+        }
+        if (len > best_len)
+        {
+            best_len = len;
+            *distance = pos - candidate;
+            if (best_len == max_len)
+            {
+                break;
+            }
+        }
+    }
+    return best_len;
+}
+
+static esp_err_t lzss_encode(
+    const uint8_t *in,
+    size_t in_len,
+    lzss_writer_t *w
+)
+{
+    size_t pos = 0;
+
+    if (!lzss_put(w, TELEMETRY_COMPRESS_MAGIC)
+        || !lzss_put(w, CONFIG_TELEMETRY_COMPRESS_WINDOW_BITS)
+        || !lzss_put_varint(w, in_len))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    while (pos < in_len)
+    {
+        size_t distance = 0;
+        size_t len = lzss_find_match(in, in_len, pos, &distance);
+
+        if (len >= LZSS_MIN_MATCH)
+        {
+            uint16_t back = distance - 1;
+            if (!lzss_next_token(w, true)
+                || !lzss_put(w, (uint8_t)back)
+                || !lzss_put(w, (uint8_t)(((back >> 8) << 4) | (len - LZSS_MIN_MATCH))))
+            {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            pos += len;
+        }
+        else
+        {
+            if (!lzss_next_token(w, false) || !lzss_put(w, in[pos]))
+            {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            pos++;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t telemetry_compress(
+    const uint8_t *in,
+    size_t in_len,
+    uint8_t *out,
+    size_t out_len,
+    size_t *compressed_len
+)
+{
+    lzss_writer_t w = { .buf = out, .len = out_len, .flag_bit = 8 };
+    int64_t start_us = esp_timer_get_time();
+    uint32_t start = esp_cpu_get_cycle_count();
+    esp_err_t err = lzss_encode(in, in_len, &w);
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+
+    compress_stats.input_bytes += in_len;
+    compress_stats.cycles += cycles;
+    if (err != ESP_OK)
+    {
+        compress_stats.skipped++;
+        ESP_LOGD(TAG, "%d B do not compress below %d B", (int)in_len, (int)out_len);
+        return err;
+    }
+    compress_stats.payloads++;
+    compress_stats.output_bytes += w.pos;
+    *compressed_len = w.pos;
+
+#if CONFIG_TELEMETRY_COMPRESS_REPORT_STATS
+    ESP_LOGI(
+        TAG,
+        "%d B -> %d B (%d%%) in %" PRIu32 " cycles, %" PRIu32
+        " cycles/KB, %d KB/s",
+        (int)in_len,
+        (int)w.pos,
+        (int)(w.pos * 100 / in_len),
+        cycles,
+        (uint32_t)((uint64_t)cycles * 1024 / in_len),
+        elapsed_us > 0 ? (int)(in_len * 1000000 / 1024 / elapsed_us) : 0
+    );
+#else
+    ESP_LOGD(
+        TAG,
+        "%d B -> %d B in %" PRIu32 " cycles",
+        (int)in_len,
+        (int)w.pos,
+        cycles
+    );
+    (void)elapsed_us;
+#endif
+    return ESP_OK;
+}
+
+void telemetry_compress_get_stats(telemetry_compress_stats_t *stats)
+{
+    *stats = compress_stats;
+}
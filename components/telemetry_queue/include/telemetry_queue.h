@@ -0,0 +1,140 @@
+/**
+ * @file telemetry_queue.h
+ * @brief Store and forward queue of payloads on a flash partition.
+ *
+ * Payloads are appended to a circular log and published from the oldest
+ * one. A record is only released when the broker acknowledges it, so the
+ * payloads survive disconnections, reboots and deep sleep.
+ */
+#ifndef TELEMETRY_QUEUE_H
+#define TELEMETRY_QUEUE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+ESP_EVENT_DECLARE_BASE(TELEMETRY_QUEUE_EVENT);
+
+/**
+ * @brief Telemetry queue event IDs.
+ */
+typedef enum {
+    TELEMETRY_QUEUE_EVENT_REPLAY, /*!< Time to publish the next stored payload */
+} telemetry_queue_event_id_t;
+
+/**
+ * @brief Largest record, topic and payload.
+ */
+#define TELEMETRY_QUEUE_MAX_RECORD_LEN 4096
+
+/**
+ * @brief Stored payloads handed to the backlog handler.
+ *
+ * It only covers the payloads stored when it was taken. Payloads lost
+ * afterwards to a full partition end it early.
+ */
+typedef struct {
+    uint32_t offset;   /*!< Next record to read */
+    uint32_t min_seq;  /*!< Sequence number of the next payload or later */
+    uint32_t next_seq; /*!< Sequence number of the first payload not covered */
+} telemetry_queue_range_t;
+
+/**
+ * @brief Stored payload read from a range.
+ */
+typedef struct {
+    uint32_t seq;        /*!< Sequence number, acknowledged with telemetry_queue_bulk_done */
+    const char *topic;   /*!< Topic, not null terminated */
+    size_t topic_len;    /*!< Length of topic */
+    const uint8_t *data; /*!< Payload */
+    size_t len;          /*!< Length of data */
+} telemetry_queue_record_t;
+
+/**
+ * @brief Takes over the stored payloads instead of the MQTT replay.
+ *
+ * It is called from the event loop and must not block. Returning ESP_OK
+ * pauses the replay until telemetry_queue_bulk_done.
+ */
+typedef esp_err_t (*telemetry_queue_backlog_cb_t)(const telemetry_queue_range_t *range);
+
+/**
+ * @brief Recover the queue from its partition.
+ *
+ * MQTT connection and PUBACK events are handled on the given event loop, so
+ * every call to this module has to be made from that loop.
+ *
+ * @param loop Event loop where MQTT_THINGSBOARD_EVENT is posted.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_NOT_FOUND: the partition does not exist
+ * - some other error code: Failure
+ */
+esp_err_t telemetry_queue_init(esp_event_loop_handle_t loop);
+
+/**
+ * @brief Append a payload to the queue.
+ *
+ * The payload is published as soon as the rate allows. When the partition
+ * is full the oldest sector is erased and its payloads are lost.
+ *
+ * @param topic Topic where the payload is published.
+ * @param data Payload.
+ * @param len Length of data.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_SIZE: the record does not fit in a flash sector
+ * - some other error code: flash failure
+ */
+esp_err_t telemetry_queue_append(const char *topic, const uint8_t *data, size_t len);
+
+/**
+ * @brief Get the number of payloads not acknowledged yet.
+ */
+size_t telemetry_queue_pending(void);
+
+/**
+ * @brief Hand large backlogs to another uploader.
+ *
+ * While connected, with nothing waiting for a PUBACK and at least threshold
+ * payloads stored, the next replay calls cb instead of publishing.
+ *
+ * @param threshold Payloads stored to call cb.
+ * @param cb Backlog handler, NULL to always replay over MQTT.
+ */
+void telemetry_queue_set_backlog_cb(size_t threshold, telemetry_queue_backlog_cb_t cb);
+
+/**
+ * @brief Read the next payload of a range.
+ *
+ * It can be called from any task. The range is advanced past the payload.
+ *
+ * @param range Range given to the backlog handler.
+ * @param buf Where the record is read, at least TELEMETRY_QUEUE_MAX_RECORD_LEN bytes.
+ * @param size Size of buf.
+ * @param record Payload read, pointing into buf.
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_NOT_FOUND: no more payloads in the range
+ * - ESP_ERR_INVALID_CRC: the payload is corrupt, record->seq is still valid
+ * - ESP_ERR_INVALID_SIZE: buf is too small
+ * - some other error code: flash failure
+ */
+esp_err_t telemetry_queue_read(
+    telemetry_queue_range_t *range,
+    uint8_t *buf,
+    size_t size,
+    telemetry_queue_record_t *record
+);
+
+/**
+ * @brief Release the payloads acknowledged by the backlog handler and
+ * resume the replay.
+ *
+ * @param acked_seq Payloads up to this sequence number were delivered, the
+ * first payload of the range minus one if none.
+ * @param result ESP_OK, or the error that stopped the upload. The rest of
+ * the backlog is then replayed over MQTT until the next connection.
+ */
+void telemetry_queue_bulk_done(uint32_t acked_seq, esp_err_t result);
+#endif // !TELEMETRY_QUEUE_H
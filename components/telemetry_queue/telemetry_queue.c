@@ -0,0 +1,700 @@
+#include <inttypes.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "mqtt_controller.h"
+#include "telemetry_queue.h"
+
+#define QUEUE_PARTITION_SUBTYPE 0x40
+#define QUEUE_MAX_RECORD_LEN    TELEMETRY_QUEUE_MAX_RECORD_LEN
+#define QUEUE_MAX_TOPIC_LEN     64
+
+/* Record states, every transition only clears bits so it is a single
+ byte write over the programmed header*/
+#define RECORD_ERASED   0xFF
+#define RECORD_WRITING  0xFE
+#define RECORD_VALID    0xFC
+#define RECORD_RELEASED 0xF8
+
+#define RECORD_ALIGN(len) (((len) + 3) & ~3)
+
+static const char *TAG = "telemetry_queue";
+
+ESP_EVENT_DEFINE_BASE(TELEMETRY_QUEUE_EVENT);
+
+typedef struct __attribute__((packed)) {
+    uint8_t state;
+    uint8_t topic_len;
+    uint16_t data_len;
+    uint32_t seq;
+    uint32_t crc; /* Of topic_len, data_len, seq, topic and data*/
+} queue_record_header_t;
+
+typedef struct {
+    int id; /* Given by mqtt_publish_topic*/
+    uint32_t offset;
+    int64_t published_at;
+} queue_inflight_t;
+
+static const esp_partition_t *queue_partition;
+static esp_event_loop_handle_t queue_event_loop;
+static esp_timer_handle_t queue_replay_timer;
+static uint32_t queue_sector_size;
+static uint32_t queue_head;   /* Where the next record is written*/
+static uint32_t queue_tail;   /* Oldest unreleased record, queue_head if none*/
+static uint32_t queue_cursor; /* Next record to publish*/
+static uint32_t queue_next_seq;
+static size_t queue_pending_len;
+static bool queue_connected;
+static bool queue_paused; /* Between MQTT_OUTBOX_FULL and MQTT_OUTBOX_AVAILABLE*/
+static telemetry_queue_backlog_cb_t queue_backlog_cb;
+static size_t queue_backlog_threshold;
+static bool queue_claimed;     /* Between the backlog handler and telemetry_queue_bulk_done*/
+static bool queue_bulk_failed; /* Replay over MQTT until the next connection*/
+static queue_inflight_t queue_inflight[CONFIG_TELEMETRY_QUEUE_MAX_INFLIGHT];
+static size_t queue_inflight_len;
+static uint8_t queue_record[QUEUE_MAX_RECORD_LEN];
+
+static uint32_t queue_sector_start(uint32_t offset)
+{
+    return offset - offset % queue_sector_size;
+}
+
+static uint32_t queue_next_sector(uint32_t offset)
+{
+    return (queue_sector_start(offset) + queue_sector_size) % queue_partition->size;
+}
+
+static size_t queue_record_size(const queue_record_header_t *header)
+{
+    return RECORD_ALIGN(sizeof(*header) + header->topic_len + header->data_len);
+}
+
+static uint32_t queue_record_crc(const queue_record_header_t *header, const uint8_t *body)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&header->topic_len, 7);
+    return esp_rom_crc32_le(crc, body, header->topic_len + header->data_len);
+}
+
+/* Read the header at offset, false if there is no record there*/
+static bool queue_read_header(uint32_t offset, queue_record_header_t *header)
+{
+    if (offset % queue_sector_size + sizeof(*header) > queue_sector_size
+        || esp_partition_read(queue_partition, offset, header, sizeof(*header)) != ESP_OK)
+    {
+        return false;
+    }
+    return (header->state == RECORD_WRITING || header->state == RECORD_VALID
+            || header->state == RECORD_RELEASED)
+           && offset % queue_sector_size + queue_record_size(header) <= queue_sector_size;
+}
+
+/* Offset of the record after the one at offset, the end of a sector is
+ marked by an erased or unreadable header*/
+static uint32_t queue_next(uint32_t offset)
+{
+    queue_record_header_t header;
+
+    if (!queue_read_header(offset, &header))
+    {
+        return queue_next_sector(offset);
+    }
+    return (offset + queue_record_size(&header)) % queue_partition->size;
+}
+
+/* First unreleased record from offset, queue_head if none*/
+static uint32_t queue_find_valid(uint32_t offset)
+{
+    queue_record_header_t header;
+
+    while (offset != queue_head)
+    {
+        if (queue_read_header(offset, &header) && header.state == RECORD_VALID)
+        {
+            return offset;
+        }
+        offset = queue_next(offset);
+    }
+    return offset;
+}
+
+static esp_err_t queue_set_state(uint32_t offset, uint8_t state)
+{
+    return esp_partition_write(queue_partition, offset, &state, sizeof(state));
+}
+
+static esp_err_t queue_recover(void)
+{
+    queue_record_header_t header;
+    bool have_records = false;
+    bool head_dirty = false;
+    uint32_t max_seq = 0;
+    uint32_t min_valid_seq = UINT32_MAX;
+    uint32_t head_sector = 0;
+
+    queue_head = 0;
+    queue_tail = UINT32_MAX;
+    queue_pending_len = 0;
+
+    for (uint32_t sector = 0; sector < queue_partition->size; sector += queue_sector_size)
+    {
+        uint32_t offset = sector;
+        bool dirty = false;
+
+        while (offset < sector + queue_sector_size)
+        {
+            if (!queue_read_header(offset, &header))
+            {
+                /* Anything but erased flash is a torn write or erase*/
+                dirty = offset % queue_sector_size + sizeof(header) <= queue_sector_size
+                        && header.state != RECORD_ERASED;
+                break;
+            }
+            if (!have_records || header.seq > max_seq)
+            {
+                have_records = true;
+                max_seq = header.seq;
+                head_sector = sector;
+                queue_head = offset + queue_record_size(&header);
+            }
+            if (header.state == RECORD_VALID)
+            {
+                queue_pending_len++;
+                if (header.seq < min_valid_seq)
+                {
+                    min_valid_seq = header.seq;
+                    queue_tail = offset;
+                }
+            }
+            offset += queue_record_size(&header);
+        }
+        if (have_records && head_sector == sector)
+        {
+            head_dirty = dirty;
+        }
+    }
+
+    if (head_dirty)
+    {
+        queue_head = queue_next_sector(head_sector);
+    }
+    queue_head %= queue_partition->size;
+    if (queue_pending_len == 0)
+    {
+        queue_tail = queue_head;
+    }
+    queue_cursor = queue_tail;
+    queue_next_seq = max_seq + 1;
+    ESP_LOGI(
+        TAG,
+        "Recovered %d pending payloads, next sequence %" PRIu32,
+        (int)queue_pending_len,
+        queue_next_seq
+    );
+    return ESP_OK;
+}
+
+/* Erase the sector at offset, dropping the pending records it holds*/
+static esp_err_t queue_prepare_sector(uint32_t offset)
+{
+    if (queue_pending_len > 0 && queue_sector_start(queue_tail) == offset)
+    {
+        queue_record_header_t header;
+        size_t dropped = 0;
+        uint32_t next_sector = queue_next_sector(offset);
+
+        for (uint32_t record = queue_tail; queue_sector_start(record) == offset;)
+        {
+            if (queue_read_header(record, &header) && header.state == RECORD_VALID)
+            {
+                dropped++;
+            }
+            uint32_t next = queue_next(record);
+            if (next == next_sector || next == queue_head)
+            {
+                break;
+            }
+            record = next;
+        }
+        for (size_t i = 0; i < queue_inflight_len;)
+        {
+            if (queue_sector_start(queue_inflight[i].offset) == offset)
+            {
+                queue_inflight[i] = queue_inflight[--queue_inflight_len];
+            }
+            else
+            {
+                i++;
+            }
+        }
+        queue_pending_len -= dropped;
+        queue_tail = queue_find_valid(next_sector);
+        if (queue_sector_start(queue_cursor) == offset)
+        {
+            queue_cursor = queue_tail;
+        }
+        ESP_LOGW(TAG, "Queue full, dropped %d oldest payloads", (int)dropped);
+    }
+    return esp_partition_erase_range(queue_partition, offset, queue_sector_size);
+}
+
+static void queue_release(size_t inflight_index)
+{
+    uint32_t offset = queue_inflight[inflight_index].offset;
+
+    queue_inflight[inflight_index] = queue_inflight[--queue_inflight_len];
+    if (queue_set_state(offset, RECORD_RELEASED) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Could not release payload at 0x%" PRIx32, offset);
+        return;
+    }
+    queue_pending_len--;
+    if (offset == queue_tail)
+    {
+        queue_tail = queue_find_valid(queue_tail);
+    }
+}
+
+static void queue_publish_next(void)
+{
+    queue_record_header_t header;
+    char topic[QUEUE_MAX_TOPIC_LEN + 1];
+    int id;
+
+    for (size_t i = 0; i < queue_inflight_len; i++)
+    {
+        if (esp_timer_get_time() - queue_inflight[i].published_at
+            > (int64_t)CONFIG_TELEMETRY_QUEUE_ACK_TIMEOUT * 1000000)
+        {
+            ESP_LOGW(TAG, "PUBACK timed out, publishing again from the oldest payload");
+            queue_inflight_len = 0;
+            queue_cursor = queue_tail;
+            break;
+        }
+    }
+    if (!queue_connected || queue_paused || queue_claimed
+        || queue_inflight_len == CONFIG_TELEMETRY_QUEUE_MAX_INFLIGHT)
+    {
+        return;
+    }
+    if (queue_backlog_cb != NULL && !queue_bulk_failed && queue_inflight_len == 0
+        && queue_pending_len >= queue_backlog_threshold
+        && queue_read_header(queue_tail, &header))
+    {
+        telemetry_queue_range_t range = {
+            .offset = queue_tail,
+            .min_seq = header.seq,
+            .next_seq = queue_next_seq,
+        };
+        if (queue_backlog_cb(&range) == ESP_OK)
+        {
+            ESP_LOGI(TAG, "Handing %d stored payloads to the backlog handler", (int)queue_pending_len);
+            queue_claimed = true;
+            return;
+        }
+    }
+
+    queue_cursor = queue_find_valid(queue_cursor);
+    if (queue_cursor == queue_head)
+    {
+        if (queue_pending_len == 0 && esp_timer_is_active(queue_replay_timer))
+        {
+            esp_timer_stop(queue_replay_timer);
+        }
+        return;
+    }
+
+    uint32_t offset = queue_cursor;
+    queue_read_header(offset, &header);
+    queue_cursor = queue_next(offset);
+    if (esp_partition_read(queue_partition, offset + sizeof(header), queue_record, header.topic_len + header.data_len) != ESP_OK
+        || queue_record_crc(&header, queue_record) != header.crc
+        || header.topic_len > QUEUE_MAX_TOPIC_LEN)
+    {
+        ESP_LOGE(TAG, "Payload %" PRIu32 " is corrupt, skipping it", header.seq);
+        if (queue_set_state(offset, RECORD_RELEASED) == ESP_OK)
+        {
+            queue_pending_len--;
+            if (offset == queue_tail)
+            {
+                queue_tail = queue_find_valid(queue_tail);
+            }
+        }
+        return;
+    }
+
+    memcpy(topic, queue_record, header.topic_len);
+    topic[header.topic_len] = '\0';
+    if (mqtt_publish_topic(
+            topic,
+            (const char *)&queue_record[header.topic_len],
+            header.data_len,
+            &id
+        ) != ESP_OK)
+    {
+        /* Retried on the next replay*/
+        queue_cursor = offset;
+        return;
+    }
+    queue_inflight[queue_inflight_len++] = (queue_inflight_t) {
+        .id = id,
+        .offset = offset,
+        .published_at = esp_timer_get_time(),
+    };
+    ESP_LOGD(TAG, "Published payload %" PRIu32 " as outbox id %d", header.seq, id);
+}
+
+static void queue_kick(void)
+{
+    if (!queue_connected || esp_timer_is_active(queue_replay_timer))
+    {
+        return;
+    }
+    queue_publish_next();
+    esp_timer_start_periodic(
+        queue_replay_timer,
+        (uint64_t)CONFIG_TELEMETRY_QUEUE_REPLAY_INTERVAL_MS * 1000
+    );
+}
+
+static void queue_replay_callback(void *args)
+{
+    /* Posted with no wait, the timer is periodic*/
+    esp_event_post_to(
+        queue_event_loop,
+        TELEMETRY_QUEUE_EVENT,
+        TELEMETRY_QUEUE_EVENT_REPLAY,
+        NULL,
+        0,
+        0
+    );
+}
+
+static void queue_on_replay(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    queue_publish_next();
+}
+
+static void queue_on_connected(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    queue_connected = true;
+    queue_bulk_failed = false;
+    /* Payloads in flight are still in the MQTT outbox, the ack timeout only
+     counts while connected*/
+    for (size_t i = 0; i < queue_inflight_len; i++)
+    {
+        queue_inflight[i].published_at = esp_timer_get_time();
+    }
+    if (queue_pending_len > 0)
+    {
+        ESP_LOGI(TAG, "Replaying %d stored payloads", (int)queue_pending_len);
+    }
+    queue_kick();
+}
+
+static void queue_on_disconnected(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    queue_connected = false;
+    if (esp_timer_is_active(queue_replay_timer))
+    {
+        esp_timer_stop(queue_replay_timer);
+    }
+}
+
+static void queue_on_delivered(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    int id = *((int *)event_data);
+
+    for (size_t i = 0; i < queue_inflight_len; i++)
+    {
+        if (queue_inflight[i].id == id)
+        {
+            queue_release(i);
+            return;
+        }
+    }
+}
+
+static void queue_on_outbox_full(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    queue_paused = true;
+}
+
+static void queue_on_outbox_available(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    queue_paused = false;
+    queue_kick();
+}
+
+static const mqtt_thingsboard_event_handler_register_t queue_mqtt_events[] = {
+    { MQTT_BROKER_CONNECTED, queue_on_connected },
+    { MQTT_BROKER_DISCONNECTED, queue_on_disconnected },
+    { MQTT_OUTBOX_DELIVERED, queue_on_delivered },
+    { MQTT_OUTBOX_FULL, queue_on_outbox_full },
+    { MQTT_OUTBOX_AVAILABLE, queue_on_outbox_available },
+};
+
+static const size_t queue_mqtt_events_len =
+    sizeof(queue_mqtt_events) / sizeof(queue_mqtt_events[0]);
+
+esp_err_t telemetry_queue_init(esp_event_loop_handle_t loop)
+{
+    queue_event_loop = loop;
+    queue_partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA,
+        QUEUE_PARTITION_SUBTYPE,
+        CONFIG_TELEMETRY_QUEUE_PARTITION_LABEL
+    );
+    if (queue_partition == NULL)
+    {
+        ESP_LOGE(TAG, "No %s partition", CONFIG_TELEMETRY_QUEUE_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    queue_sector_size = queue_partition->erase_size;
+    if (queue_partition->size < 2 * queue_sector_size)
+    {
+        ESP_LOGE(TAG, "The partition needs at least two sectors");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    ESP_RETURN_ON_ERROR(queue_recover(), TAG, "Could not recover the queue");
+
+    esp_timer_create_args_t replay_timer_args = {
+        .callback = queue_replay_callback,
+        .name = "queue_replay"
+    };
+    ESP_RETURN_ON_ERROR(
+        esp_timer_create(&replay_timer_args, &queue_replay_timer),
+        TAG,
+        "Could not create replay timer"
+    );
+
+    ESP_RETURN_ON_ERROR(
+        esp_event_handler_register_with(
+            queue_event_loop,
+            TELEMETRY_QUEUE_EVENT,
+            TELEMETRY_QUEUE_EVENT_REPLAY,
+            queue_on_replay,
+            NULL
+        ),
+        TAG,
+        "Could not register replay handler"
+    );
+    for (int i = 0; i < queue_mqtt_events_len; i++)
+    {
+        ESP_RETURN_ON_ERROR(
+            esp_event_handler_register_with(
+                queue_event_loop,
+                MQTT_THINGSBOARD_EVENT,
+                queue_mqtt_events[i].event_id,
+                queue_mqtt_events[i].event_handler,
+                NULL
+            ),
+            TAG,
+            "Could not register MQTT handler %d",
+            queue_mqtt_events[i].event_id
+        );
+    }
+    return ESP_OK;
+}
+
+esp_err_t telemetry_queue_append(const char *topic, const uint8_t *data, size_t len)
+{
+    size_t topic_len = strlen(topic);
+    queue_record_header_t header = {
+        .state = RECORD_WRITING,
+        .topic_len = topic_len,
+        .data_len = len,
+        .seq = queue_next_seq,
+    };
+    size_t record_size = queue_record_size(&header);
+    bool was_empty = queue_pending_len == 0;
+    bool caught_up = queue_cursor == queue_head;
+
+    if (topic_len > QUEUE_MAX_TOPIC_LEN || len > UINT16_MAX
+        || record_size > queue_sector_size || record_size > QUEUE_MAX_RECORD_LEN)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (queue_head % queue_sector_size + record_size > queue_sector_size)
+    {
+        queue_head = queue_next_sector(queue_head);
+    }
+    if (queue_head % queue_sector_size == 0)
+    {
+        ESP_RETURN_ON_ERROR(
+            queue_prepare_sector(queue_head),
+            TAG,
+            "Could not erase sector at 0x%" PRIx32,
+            queue_head
+        );
+    }
+
+    /* The record only counts once the final state byte is written, a
+     power loss before leaves it as WRITING and it is skipped*/
+    memcpy(queue_record, topic, topic_len);
+    memcpy(&queue_record[topic_len], data, len);
+    header.crc = queue_record_crc(&header, queue_record);
+    uint32_t offset = queue_head;
+    ESP_RETURN_ON_ERROR(
+        esp_partition_write(queue_partition, offset, &header, sizeof(header)),
+        TAG,
+        "Could not write header"
+    );
+    ESP_RETURN_ON_ERROR(
+        esp_partition_write(queue_partition, offset + sizeof(header), queue_record, topic_len + len),
+        TAG,
+        "Could not write payload"
+    );
+    ESP_RETURN_ON_ERROR(
+        queue_set_state(offset, RECORD_VALID),
+        TAG,
+        "Could not commit payload"
+    );
+
+    queue_head = (offset + record_size) % queue_partition->size;
+    queue_next_seq++;
+    queue_pending_len++;
+    if (was_empty)
+    {
+        queue_tail = offset;
+    }
+    if (caught_up)
+    {
+        queue_cursor = offset;
+    }
+    ESP_LOGD(TAG, "Stored payload %" PRIu32 ", %d pending", header.seq, (int)queue_pending_len);
+
+    queue_kick();
+    return ESP_OK;
+}
+
+size_t telemetry_queue_pending(void)
+{
+    return queue_pending_len;
+}
+
+void telemetry_queue_set_backlog_cb(size_t threshold, telemetry_queue_backlog_cb_t cb)
+{
+    queue_backlog_threshold = threshold;
+    queue_backlog_cb = cb;
+}
+
+/* Only reads the flash, the records may be erased meanwhile but the
+ sequence numbers and the CRC tell*/
+esp_err_t telemetry_queue_read(
+    telemetry_queue_range_t *range,
+    uint8_t *buf,
+    size_t size,
+    telemetry_queue_record_t *record
+)
+{
+    queue_record_header_t header;
+    uint32_t sectors_left = queue_partition->size / queue_sector_size;
+
+    for (;;)
+    {
+        uint32_t offset = range->offset;
+        if (!queue_read_header(offset, &header))
+        {
+            /* End of a sector, or an erased one*/
+            if (--sectors_left == 0)
+            {
+                return ESP_ERR_NOT_FOUND;
+            }
+            range->offset = queue_next_sector(offset);
+            continue;
+        }
+        if (header.seq < range->min_seq || header.seq >= range->next_seq)
+        {
+            return ESP_ERR_NOT_FOUND;
+        }
+        range->offset = (offset + queue_record_size(&header)) % queue_partition->size;
+        range->min_seq = header.seq + 1;
+        if (header.state != RECORD_VALID)
+        {
+            continue;
+        }
+        if (header.topic_len + header.data_len > size)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        ESP_RETURN_ON_ERROR(
+            esp_partition_read(queue_partition, offset + sizeof(header), buf, header.topic_len + header.data_len),
+            TAG,
+            "Could not read payload %" PRIu32,
+            header.seq
+        );
+        *record = (telemetry_queue_record_t) {
+            .seq = header.seq,
+            .topic = (const char *)buf,
+            .topic_len = header.topic_len,
+            .data = &buf[header.topic_len],
+            .len = header.data_len,
+        };
+        return queue_record_crc(&header, buf) == header.crc ? ESP_OK : ESP_ERR_INVALID_CRC;
+    }
+}
+
+void telemetry_queue_bulk_done(uint32_t acked_seq, esp_err_t result)
+{
+    queue_record_header_t header;
+    size_t released = 0;
+
+    /* Acknowledged payloads are always the oldest ones*/
+    while (queue_pending_len > 0 && queue_read_header(queue_tail, &header) && header.seq <= acked_seq)
+    {
+        if (queue_set_state(queue_tail, RECORD_RELEASED) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Could not release payload at 0x%" PRIx32, queue_tail);
+            break;
+        }
+        queue_pending_len--;
+        released++;
+        queue_tail = queue_find_valid(queue_tail);
+    }
+    queue_cursor = queue_tail;
+    queue_claimed = false;
+    if (result != ESP_OK)
+    {
+        queue_bulk_failed = true;
+        ESP_LOGW(TAG, "Backlog handler stopped: %s, replaying over MQTT", esp_err_to_name(result));
+    }
+    ESP_LOGI(TAG, "Released %d payloads up to %" PRIu32 ", %d pending", (int)released, acked_seq, (int)queue_pending_len);
+    queue_kick();
+}
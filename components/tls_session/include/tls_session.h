@@ -0,0 +1,55 @@
+/**
+ * @file tls_session.h
+ * @brief TLS transport for the MQTT client resuming the last session.
+ *
+ * The session negotiated with the broker is serialized to RTC memory or NVS
+ * and offered on the next connection, also after deep sleep, so the
+ * certificate exchange and key agreement of the mutual TLS handshake are
+ * skipped while the broker accepts it. A rejected session is forgotten and
+ * the connection is retried with a full handshake.
+ */
+#ifndef TLS_SESSION_H
+#define TLS_SESSION_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_tls.h"
+#include "esp_transport.h"
+
+/**
+ * @brief Handshake metrics since boot.
+ */
+typedef struct {
+    uint32_t full_handshakes;    /*!< Handshakes without a stored session */
+    uint32_t resumed_handshakes; /*!< Handshakes offering a stored session */
+    uint32_t fallbacks;          /*!< Stored sessions rejected by the broker */
+    uint64_t full_us;            /*!< Time spent in full handshakes */
+    uint64_t resumed_us;         /*!< Time spent in resumed handshakes */
+    uint32_t last_us;            /*!< Duration of the last handshake */
+    bool last_resumed;           /*!< The last handshake offered a stored session */
+    uint64_t tx_bytes;           /*!< Application bytes written, without TLS records */
+    uint64_t rx_bytes;           /*!< Application bytes read, without TLS records */
+    uint32_t last_heap_peak;     /*!< Most heap taken during the last connection, bytes */
+    uint32_t last_heap_held;     /*!< Heap the last connection still holds, bytes */
+} tls_session_stats_t;
+
+/**
+ * @brief Create the transport to give to the MQTT client as network.transport.
+ *
+ * @param cfg TLS configuration with the certificates, copied. The buffers it
+ * points to have to outlive the transport. client_session is ignored.
+ * @return The transport, or NULL if it could not be allocated.
+ */
+esp_transport_handle_t tls_session_transport_init(const esp_tls_cfg_t *cfg);
+
+/**
+ * @brief Drop the stored session so the next connection does a full handshake.
+ */
+void tls_session_forget(void);
+
+/**
+ * @brief Get the handshake metrics.
+ *
+ * @param stats Where the metrics are copied.
+ */
+void tls_session_get_stats(tls_session_stats_t *stats);
+#endif // !TLS_SESSION_H
@@ -0,0 +1,455 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <time.h>
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_idf_version.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "esp_transport.h"
+#include "mbedtls/ssl.h"
+#include "nvs.h"
+#include "power_manager.h"
+#include "tls_session.h"
+
+#define SESSION_MAGIC 0x544C5331 /* "TLS1"*/
+#define SESSION_NVS_NAMESPACE "tls_session"
+#define SESSION_NVS_KEY "session"
+
+static const char *TAG = "tls_session";
+
+typedef struct {
+    esp_tls_cfg_t cfg;
+    esp_tls_t *tls;
+} tls_session_transport_t;
+
+static tls_session_stats_t session_stats;
+
+#if CONFIG_TLS_SESSION_RESUMPTION
+typedef struct {
+    uint32_t magic;
+    uint32_t crc; /* Of saved_at, len and data*/
+    int64_t saved_at;
+    uint32_t len;
+    uint8_t data[CONFIG_TLS_SESSION_MAX_LEN];
+} tls_session_store_t;
+
+#if CONFIG_TLS_SESSION_STORE_RTC
+RTC_DATA_ATTR static tls_session_store_t session_store;
+#else
+static tls_session_store_t session_store;
+#endif
+static uint8_t session_serialized[CONFIG_TLS_SESSION_MAX_LEN];
+
+static uint32_t session_store_crc(void)
+{
+    return esp_rom_crc32_le(
+        0,
+        (const uint8_t *)&session_store.saved_at,
+        sizeof(session_store.saved_at) + sizeof(session_store.len) + session_store.len
+    );
+}
+
+static bool session_store_valid(void)
+{
+#if CONFIG_TLS_SESSION_STORE_NVS
+    nvs_handle_t handle;
+    size_t len = sizeof(session_store);
+
+    if (session_store.magic != SESSION_MAGIC)
+    {
+        if (nvs_open(SESSION_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        {
+            return false;
+        }
+        if (nvs_get_blob(handle, SESSION_NVS_KEY, &session_store, &len) != ESP_OK)
+        {
+            session_store.magic = 0;
+        }
+        nvs_close(handle);
+    }
+#endif
+    return session_store.magic == SESSION_MAGIC
+           && session_store.len <= CONFIG_TLS_SESSION_MAX_LEN
+           && session_store.crc == session_store_crc();
+}
+
+static void session_store_write(void)
+{
+    session_store.magic = SESSION_MAGIC;
+    session_store.crc = session_store_crc();
+#if CONFIG_TLS_SESSION_STORE_NVS
+    nvs_handle_t handle;
+    if (nvs_open(SESSION_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not open NVS, the session is kept until reboot");
+        return;
+    }
+    if (nvs_set_blob(
+            handle,
+            SESSION_NVS_KEY,
+            &session_store,
+            offsetof(tls_session_store_t, data) + session_store.len
+        ) != ESP_OK
+        || nvs_commit(handle) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not store the session in NVS");
+    }
+    nvs_close(handle);
+#endif
+}
+
+/* esp_tls_client_session_t only wraps an mbedtls_ssl_session, so the
+ session is restored in place and released with esp_tls_free_client_session*/
+static esp_tls_client_session_t *session_load(void)
+{
+    int64_t now = time(NULL);
+    mbedtls_ssl_session *session;
+
+    if (!session_store_valid())
+    {
+        return NULL;
+    }
+    if (now < session_store.saved_at || now - session_store.saved_at > CONFIG_TLS_SESSION_MAX_AGE)
+    {
+        ESP_LOGI(TAG, "Stored session expired");
+        return NULL;
+    }
+
+    session = calloc(1, sizeof(*session));
+    if (session == NULL)
+    {
+        return NULL;
+    }
+    mbedtls_ssl_session_init(session);
+    if (mbedtls_ssl_session_load(session, session_store.data, session_store.len) != 0)
+    {
+        ESP_LOGW(TAG, "Stored session does not match this mbedtls build");
+        mbedtls_ssl_session_free(session);
+        free(session);
+        return NULL;
+    }
+    return (esp_tls_client_session_t *)session;
+}
+
+static void session_save(esp_tls_t *tls)
+{
+    esp_tls_client_session_t *session = esp_tls_get_client_session(tls);
+    size_t len;
+    int ret;
+
+    if (session == NULL)
+    {
+        return;
+    }
+    ret = mbedtls_ssl_session_save(
+        (mbedtls_ssl_session *)session,
+        session_serialized,
+        sizeof(session_serialized),
+        &len
+    );
+    esp_tls_free_client_session(session);
+    if (ret != 0)
+    {
+        ESP_LOGW(TAG, "Session not stored, it needs more than %d bytes", CONFIG_TLS_SESSION_MAX_LEN);
+        return;
+    }
+    /* A resumed session comes back unchanged unless the broker issued a
+     new ticket, skip the write then*/
+    if (session_store_valid() && session_store.len == len
+        && memcmp(session_store.data, session_serialized, len) == 0)
+    {
+        return;
+    }
+    memcpy(session_store.data, session_serialized, len);
+    session_store.len = len;
+    session_store.saved_at = time(NULL);
+    session_store_write();
+}
+#endif
+
+void tls_session_forget(void)
+{
+#if CONFIG_TLS_SESSION_RESUMPTION
+    session_store.magic = 0;
+#if CONFIG_TLS_SESSION_STORE_NVS
+    nvs_handle_t handle;
+    if (nvs_open(SESSION_NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK)
+    {
+        nvs_erase_key(handle, SESSION_NVS_KEY);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+#endif
+#endif
+}
+
+/* Returns the esp-tls error of a failed connection*/
+static esp_err_t tls_connect(
+    tls_session_transport_t *ctx,
+    const char *host,
+    int port,
+    int timeout_ms,
+    esp_tls_client_session_t *session
+)
+{
+    esp_tls_cfg_t cfg = ctx->cfg;
+    esp_tls_error_handle_t error_handle;
+    esp_err_t err = ESP_FAIL;
+
+    ctx->tls = esp_tls_init();
+    if (ctx->tls == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    cfg.timeout_ms = timeout_ms;
+#if CONFIG_TLS_SESSION_RESUMPTION
+    cfg.client_session = session;
+#endif
+    if (esp_tls_conn_new_sync(host, strlen(host), port, &cfg, ctx->tls) > 0)
+    {
+        return ESP_OK;
+    }
+
+    if (esp_tls_get_error_handle(ctx->tls, &error_handle) == ESP_OK)
+    {
+        err = error_handle->last_error;
+    }
+    esp_tls_conn_destroy(ctx->tls);
+    ctx->tls = NULL;
+    return err;
+}
+
+static int tls_transport_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    tls_session_transport_t *ctx = esp_transport_get_context_data(t);
+    esp_tls_client_session_t *session = NULL;
+    int64_t start = esp_timer_get_time();
+    bool resumed;
+    esp_err_t err;
+
+#if CONFIG_TLS_SESSION_RESUMPTION
+    session = session_load();
+#endif
+    resumed = session != NULL;
+    size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
+    heap_caps_monitor_local_minimum_free_size_start();
+#endif
+    size_t heap_min_before = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    err = tls_connect(ctx, host, port, timeout_ms, session);
+    if (resumed)
+    {
+        esp_tls_free_client_session(session);
+        if (err == ESP_ERR_MBEDTLS_SSL_HANDSHAKE_FAILED)
+        {
+            /* Only a handshake failure blames the session, a network
+             error keeps it for the next attempt*/
+            ESP_LOGW(TAG, "Stored session rejected, doing a full handshake");
+            session_stats.fallbacks++;
+            tls_session_forget();
+            resumed = false;
+            start = esp_timer_get_time();
+            err = tls_connect(ctx, host, port, timeout_ms, NULL);
+        }
+    }
+    size_t heap_min = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
+    heap_caps_monitor_local_minimum_free_size_stop();
+#endif
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Could not connect to %s:%d: %s", host, port, esp_err_to_name(err));
+        return -1;
+    }
+
+    /* Other tasks allocate meanwhile, so both are approximate. Without
+     the local minimum of IDF 5.3 the low water mark since boot only
+     shows a peak lower than any before it, otherwise the held heap is
+     the best known bound*/
+    size_t heap_after = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    session_stats.last_heap_held = heap_before > heap_after ? heap_before - heap_after : 0;
+    session_stats.last_heap_peak = heap_min < heap_min_before && heap_before > heap_min
+        ? heap_before - heap_min
+        : session_stats.last_heap_held;
+    uint32_t elapsed = esp_timer_get_time() - start;
+    session_stats.last_us = elapsed;
+    session_stats.last_resumed = resumed;
+    if (resumed)
+    {
+        session_stats.resumed_handshakes++;
+        session_stats.resumed_us += elapsed;
+    }
+    else
+    {
+        session_stats.full_handshakes++;
+        session_stats.full_us += elapsed;
+    }
+    /* mA * ms = uC*/
+    ESP_LOGI(
+        TAG,
+        "%s handshake in %d ms, ~%d uC, heap peak %d bytes, %d held",
+        resumed ? "Resumed" : "Full",
+        (int)(elapsed / 1000),
+        (int)(elapsed / 1000 * CONFIG_TLS_SESSION_ACTIVE_CURRENT_MA),
+        (int)session_stats.last_heap_peak,
+        (int)session_stats.last_heap_held
+    );
+#if CONFIG_TLS_SESSION_RESUMPTION
+    session_save(ctx->tls);
+#endif
+    return 0;
+}
+
+static int tls_transport_poll(tls_session_transport_t *ctx, bool read, int timeout_ms)
+{
+    struct timeval timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    fd_set set;
+    fd_set errset;
+    int fd;
+    int ret;
+
+    if (ctx->tls == NULL || esp_tls_get_conn_sockfd(ctx->tls, &fd) != ESP_OK)
+    {
+        return -1;
+    }
+    if (read && esp_tls_get_bytes_avail(ctx->tls) > 0)
+    {
+        return 1;
+    }
+    FD_ZERO(&set);
+    FD_ZERO(&errset);
+    FD_SET(fd, &set);
+    FD_SET(fd, &errset);
+    ret = select(
+        fd + 1,
+        read ? &set : NULL,
+        read ? NULL : &set,
+        &errset,
+        timeout_ms < 0 ? NULL : &timeout
+    );
+    if (ret > 0 && FD_ISSET(fd, &errset))
+    {
+        return -1;
+    }
+    return ret;
+}
+
+static int tls_transport_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    return tls_transport_poll(esp_transport_get_context_data(t), true, timeout_ms);
+}
+
+static int tls_transport_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    return tls_transport_poll(esp_transport_get_context_data(t), false, timeout_ms);
+}
+
+static int tls_transport_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    tls_session_transport_t *ctx = esp_transport_get_context_data(t);
+    int ret = tls_transport_poll(ctx, true, timeout_ms);
+
+    if (ret <= 0)
+    {
+        return ret;
+    }
+    ret = esp_tls_conn_read(ctx->tls, buffer, len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE)
+    {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    if (ret == 0)
+    {
+        return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    }
+    if (ret > 0)
+    {
+        session_stats.rx_bytes += ret;
+    }
+    return ret;
+}
+
+static int tls_transport_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    tls_session_transport_t *ctx = esp_transport_get_context_data(t);
+    int ret = tls_transport_poll(ctx, false, timeout_ms);
+
+    if (ret <= 0)
+    {
+        return ret;
+    }
+    ret = esp_tls_conn_write(ctx->tls, buffer, len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE)
+    {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    if (ret > 0)
+    {
+        session_stats.tx_bytes += ret;
+        power_manager_energy_count_tx(ret);
+    }
+    return ret;
+}
+
+static int tls_transport_close(esp_transport_handle_t t)
+{
+    tls_session_transport_t *ctx = esp_transport_get_context_data(t);
+
+    if (ctx->tls != NULL)
+    {
+        esp_tls_conn_destroy(ctx->tls);
+        ctx->tls = NULL;
+    }
+    return 0;
+}
+
+static int tls_transport_destroy(esp_transport_handle_t t)
+{
+    tls_transport_close(t);
+    free(esp_transport_get_context_data(t));
+    return 0;
+}
+
+esp_transport_handle_t tls_session_transport_init(const esp_tls_cfg_t *cfg)
+{
+    esp_transport_handle_t t = esp_transport_init();
+    tls_session_transport_t *ctx = calloc(1, sizeof(*ctx));
+
+    if (t == NULL || ctx == NULL)
+    {
+        ESP_LOGE(TAG, "Could not allocate the transport");
+        free(ctx);
+        if (t != NULL)
+        {
+            esp_transport_destroy(t);
+        }
+        return NULL;
+    }
+    ctx->cfg = *cfg;
+    esp_transport_set_context_data(t, ctx);
+    esp_transport_set_func(
+        t,
+        tls_transport_connect,
+        tls_transport_read,
+        tls_transport_write,
+        tls_transport_close,
+        tls_transport_poll_read,
+        tls_transport_poll_write,
+        tls_transport_destroy
+    );
+    return t;
+}
+
+void tls_session_get_stats(tls_session_stats_t *stats)
+{
+    *stats = session_stats;
+}
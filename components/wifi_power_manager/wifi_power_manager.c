@@ -4,6 +4,7 @@
 #include "esp_log.h"
 #include "esp_event.h"
 #include "esp_pm.h"
+#include "power_manager.h"
 #include "wifi_power_manager.h"
 
 static const char *TAG = "wifi_power_manager";
@@ -19,14 +20,17 @@ esp_err_t wifi_set_power_mode(wifi_power_mode_t mode) {
         case WIFI_POWER_MODE_MIN_MODEM:
             ESP_LOGI(TAG, "Setting Wi-Fi power mode to MIN_MODEM");
             esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+            power_manager_energy_set_wifi_ps(WIFI_PS_MIN_MODEM);
             break;
         case WIFI_POWER_MODE_MAX_MODEM:
             ESP_LOGI(TAG, "Setting Wi-Fi power mode to MAX_MODEM");
             esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+            power_manager_energy_set_wifi_ps(WIFI_PS_MAX_MODEM);
             break;
         case WIFI_POWER_MODE_NONE:
             ESP_LOGI(TAG, "Setting Wi-Fi power mode to NONE");
             esp_wifi_set_ps(WIFI_PS_NONE);
+            power_manager_energy_set_wifi_ps(WIFI_PS_NONE);
             break;
         default:
             ESP_LOGE(TAG, "Invalid power mode");
@@ -6,6 +6,9 @@ Variables:
   - image: URL to an image of the device (default: "https://eu.robotshop.com/cdn/shop/files/elecrow-gas-sensor-sgp30-air-quality-sensor-breakout-voc-eco2-img1.webp?v=1720492889&width=500").
   - certificateRegExPattern: Regex pattern for the device certificate (default: "(.*).MIoT.pablicdomain.com").
   - certificate_file: Path to the certificate file.
+  - access_token: Access token of a device of the profile, optional. It is written to <name>-credentials.json
+    for /api/device/{deviceId}/credentials and has to be provisioned with esp_prov.py --thingsboard_access_token,
+    the HTTP bulk upload and CoAP without DTLS need it.
 The script constructs the following configurations:
   - transport_payload_type_configuration: JSON payload type configuration.
   - sparkplug_attributes_metric_names: List of Sparkplug attribute metric names.
@@ -17,16 +20,16 @@ The script constructs the following configurations:
 The final output is a JSON object containing all the above configurations.
 
 Usage:
-  ./create_device.sh -n <name> -d <description> -i <image> -r <certificateRegExPattern> -c <certificate_file>
+  ./create_device.sh -n <name> -d <description> -i <image> -r <certificateRegExPattern> -c <certificate_file> [-t <access_token>]
 
 Example:
-  ./create_device.sh -n "NewDevice" -d "New device description" -i "https://example.com/image.jpg" -r "(.*).example.com" -c /path/to/certificate.pem
+  ./create_device.sh -n "NewDevice" -d "New device description" -i "https://example.com/image.jpg" -r "(.*).example.com" -c /path/to/certificate.pem -t A1_TEST_TOKEN
 '
 name=AQDevice
 description="Mox sensor for a room"
 image="https://eu.robotshop.com/cdn/shop/files/elecrow-gas-sensor-sgp30-air-quality-sensor-breakout-voc-eco2-img1.webp?v=1720492889&width=500"
 certificateRegExPattern="(.*).MIoT.pablicdomain.com"
-while getopts ":n:d:i:r:c:" opt; do
+while getopts ":n:d:i:r:c:t:" opt; do
     case ${opt} in
     n)
         name=${OPTARG}
@@ -43,6 +46,9 @@ while getopts ":n:d:i:r:c:" opt; do
     c)
         certificate_file=${OPTARG}
         ;;
+    t)
+        access_token=${OPTARG}
+        ;;
     :)
         echo $docstring
         ;;
@@ -54,6 +60,13 @@ if [ -z name ] || [ -z description ] || [ -z image ] || [ -z certificateRegExPat
     echo $docstring
     exit 1
 fi
+# Credentials of a device of the profile, named by its access token
+if [ -n "${access_token}" ]; then
+    jq -n \
+        --arg credentialsType "ACCESS_TOKEN" \
+        --arg credentialsId "${access_token}" \
+        '$ARGS.named' > "${name}-credentials.json"
+fi
 # Form the device json
 transport_payload_type_configuration=$(jq -n \
     --arg transportPayloadType "JSON" \
@@ -205,6 +205,17 @@ async def thingsboard_port(tp, sec, url):
         on_except(e)
         return None
 
+async def thingsboard_access_token(tp, sec, token):
+    try:
+        data_to_receive = prov.custom_data_request(sec, '5')
+        response = await tp.send_data('data-to-receive', data_to_receive)
+        message = prov.custom_data_request(sec, token)
+        response = await tp.send_data('thingsboard-cnf', message)
+        return (prov.custom_data_response(sec, response) == 0)
+    except RuntimeError as e:
+        on_except(e)
+        return None
+
 async def thingsboard_certs(tp, sec, file_path, num):
     try:
         # Verificar que el archivo exista
@@ -498,6 +509,11 @@ async def main():
                             'This is a parameter to provide the port for '
                             'thingsboard server'))
 
+    parser.add_argument('--thingsboard_access_token', dest='thingsboard_access_token', type=str, default='',
+                        help=desc_format(
+                            'This is a parameter to provide the access token of the device, '
+                            'used by the HTTP bulk upload and CoAP without DTLS'))
+
     parser.add_argument('--reset', help='Reset WiFi', action='store_true')
 
     parser.add_argument('--reprov', help='Reprovision WiFi', action='store_true')
@@ -608,6 +624,12 @@ async def main():
                 raise RuntimeError('Error in Thingsboard CNF')
             print('==== Thingsboard CNF sent successfully ====')
 
+        if args.thingsboard_access_token != '':
+            print('\n==== Sending Thingsboard access token to Target ====')
+            if not await thingsboard_access_token(obj_transport, obj_security, args.thingsboard_access_token):
+                raise RuntimeError('Error in Thingsboard CNF')
+            print('==== Thingsboard access token sent successfully ====')
+
         if args.ssid == '':
             if not await has_capability(obj_transport, 'wifi_scan'):
                 raise RuntimeError('Wi-Fi Scan List is not supported by provisioning service')
@@ -6,6 +6,7 @@ Development of a system for measuring air quality (CO2 levels) in the classrooms
 Group 5. Members: Pablo Alcalde, Diego Alejandro de Celis, Diego Pellicer, Jaime Garzón.
 */
 
+#include <inttypes.h>
 #include "cJSON.h"
 #include "driver/i2c_master.h"
 #include "driver/i2c_types.h"
@@ -14,6 +15,7 @@ Group 5. Members: Pablo Alcalde, Diego Alejandro de Celis, Diego Pellicer, Jaime
 #include "esp_event.h"
 #include "esp_event_base.h"
 #include "esp_log.h"
+#include "esp_sleep.h"
 #include "freertos/idf_additions.h"
 #include "freertos/projdefs.h"
 #include "softAP_provision.h"
@@ -29,6 +31,24 @@ Group 5. Members: Pablo Alcalde, Diego Alejandro de Celis, Diego Pellicer, Jaime
 #include "power_manager.h"
 #include "wifi_power_manager.h"
 #include "sntp_sync.h"
+#include "runtime_config.h"
+#include "runtime_settings.h"
+#include "diagnostics.h"
+#include "link_manager.h"
+#include "fleet.h"
+#include "gateway.h"
+#include "esp_timer.h"
+#include "telemetry_batch.h"
+#include "telemetry_queue.h"
+#include "telemetry_bulk.h"
+#include "telemetry_codec.h"
+#include "esp_attr.h"
+#if CONFIG_CERT_STORE_ENABLE
+#include "cert_store.h"
+#endif
+#if CONFIG_MEASUREMENT_HISTORY_ENABLE
+#include "measurement_history.h"
+#endif
 
 #include "esp_log.h"
 
@@ -36,6 +56,12 @@ Group 5. Members: Pablo Alcalde, Diego Alejandro de Celis, Diego Pellicer, Jaime
 #define DEVICE_SDA_IO_NUM 21
 #define DEVICE_SCL_IO_NUM 22
 #define PROVISIONING_SOFTAP
+/* The HTTP bulk upload and DTLS take the PEM certificates, not the store*/
+#if CONFIG_TELEMETRY_BULK_ENABLE || CONFIG_UPLINK_COAP_DTLS
+#define CERTIFICATES_PEM_NEEDED 1
+#else
+#define CERTIFICATES_PEM_NEEDED 0
+#endif
 
 static char *TAG = "MAIN";
 
@@ -45,17 +71,57 @@ i2c_master_bus_handle_t i2c_master_bus_handle;
 esp_event_loop_handle_t imc_event_loop_handle;
 SemaphoreHandle_t sgp30_req_measurement;
 sgp30_measurement_log_t sgp30_log;
-uint16_t send_time = 30;
+uint32_t send_time = 30;
 thingsboard_cfg_t thingsboard_cfg;
 wifi_credentials_t wifi_credentials;
+esp_timer_handle_t wifi_retry_timer;
+
+#if CONFIG_STORAGE_STATS_PUBLISH_PERIOD > 0 || CONFIG_POWER_MANAGER_ENERGY_PUBLISH_PERIOD > 0
+#if CONFIG_TELEMETRY_CODEC_FORMAT_JSON
+#define STATS_TOPIC "v1/devices/me/telemetry"
+#else
+/* The telemetry schema of the other formats only holds measurements*/
+#define STATS_TOPIC "v1/devices/me/attributes"
+#endif
+#define STATS_KEY_LEN 32
+
+/* Shared by the statistics, they are published one after the other*/
+static uint8_t stats_payload[1024];
+#endif
+
+#if CONFIG_STORAGE_STATS_PUBLISH_PERIOD > 0
+#define STORAGE_STATS_VALUES  (4 + STORAGE_STATS_NAMESPACES * 7)
 
+static char storage_stats_keys[STORAGE_STATS_VALUES][STATS_KEY_LEN];
+static telemetry_codec_attribute_t storage_stats_values[STORAGE_STATS_VALUES];
+RTC_DATA_ATTR static time_t storage_stats_published_at;
+#endif
+
+#if CONFIG_POWER_MANAGER_ENERGY_PUBLISH_PERIOD > 0
+#define ENERGY_VALUES (4 + POWER_STATE_MAX * 2)
 
+static char energy_keys[ENERGY_VALUES][STATS_KEY_LEN];
+static telemetry_codec_attribute_t energy_values[ENERGY_VALUES];
+RTC_DATA_ATTR static time_t energy_published_at;
+#endif
 
-char *prepare_meassure_send(long ts, sgp30_measurement_t measurement);
 
 /**
- * @brief This function handles Wi-Fi connection events, attempting to reconnect automatically with an exponential backoff if a disconnection occurs. 
-   It logs important events and resets the retry counter when the connection is successful.
+ * @brief This function retries the Wi-Fi connection once the backoff wait expires.
+ *
+ * @param void *arg. Additional argument passed to the function.
+ * @return
+ *
+ */
+static void wifi_retry_timer_callback(void *arg)
+{
+    esp_wifi_connect();
+}
+
+/**
+ * @brief This function handles Wi-Fi connection events, attempting to reconnect automatically with a jittered backoff if a disconnection occurs,
+   so the nodes of a classroom do not retry together after an access point restart.
+   It logs important events and resets the backoff when the connection is successful.
  *
  * @param void *arg. Additional argument passed to the function.
  * @param esp_event_base_t event_base. Event base.
@@ -71,7 +137,7 @@ static void wifi_event_handler(
     void *event_data
 )
 {
-    static int retry_count = 0;
+    static fleet_backoff_t backoff;
 
     switch (event_id)
     {
@@ -80,27 +146,21 @@ static void wifi_event_handler(
             esp_wifi_connect(); /*Trying to connect*/
             break;
         case WIFI_EVENT_STA_CONNECTED:
-            retry_count = 0; /* We reset the retry counter*/
+            fleet_backoff_reset(&backoff); /* We reset the backoff*/
             ESP_LOGI(TAG, "Successfully connected to WiFi connection.");
             break;
         case WIFI_EVENT_STA_DISCONNECTED:
-            ESP_LOGI(TAG, "Disconnected from WiFi...trying again");
-            if (retry_count < 5)
+            if (!link_manager_is_up())
             {
-                int delay = (1 << retry_count)
-                            * 1000; /* Backoff exponential (1s, 2s, 4s...)*/
-                ESP_LOGI(TAG, "Retrying in %d ms...", delay);
-                vTaskDelay(pdMS_TO_TICKS(delay)
-                ); // Wait before trying again
-                esp_wifi_connect();
-                retry_count++;
-            } else
+                ESP_LOGI(TAG, "Disconnected from WiFi until the next upload");
+                break;
+            }
+            if (!esp_timer_is_active(wifi_retry_timer))
             {
-                ESP_LOGE(
-                    TAG,
-                    "Could not connect to WiFi after several attempts"
-                );
-                /*Additional actions if all attempts fail*/
+                /* Random wait growing up to CONFIG_FLEET_BACKOFF_CAP_MS, without blocking the default loop*/
+                uint32_t delay = fleet_backoff_next(&backoff);
+                ESP_LOGI(TAG, "Disconnected from WiFi, retrying in %" PRIu32 " ms...", delay);
+                esp_timer_start_once(wifi_retry_timer, ((uint64_t)delay) * 1000);
             }
             break;
         default:
@@ -109,8 +169,8 @@ static void wifi_event_handler(
 }
 
 /**
- * @brief This function handles new measurements from the SGP30 sensor, creates a log entry with the measurement and the time, converts the measurement to a JSON representation, and publishes it via MQTT. 
- *  Additionally, the code contains comments for enqueueing the measurement and storing the log entry.
+ * @brief This function handles new measurements from the SGP30 sensor, creates a log entry with the measurement and the time
+ *  and adds it to the telemetry batch, which publishes it via MQTT together with the next windows.
  *
  * @param void *handler_args. Additional arguments passed to the function.
  * @param esp_event_base_t base. Event base.
@@ -138,14 +198,285 @@ static void sgp30_on_new_measurement(
     );
     
     /* sgp30_measurement_enqueue(&new_log_entry, &sgp30_log);*/
-    char* measurement_JSON_repr = prepare_meassure_send(new_log_entry.time, new_log_entry.measurement);
-    mqtt_publish(measurement_JSON_repr, strlen(measurement_JSON_repr));
-    /*Send or store log_entry*/
+#if CONFIG_MEASUREMENT_HISTORY_ENABLE
+    if (measurement_history_append(&new_log_entry, NULL) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not keep the measurement in the history");
+    }
+#endif
+#if CONFIG_GATEWAY_ROLE_LEAF
+    gateway_leaf_add(&new_log_entry);
+#else
+    telemetry_batch_add(&new_log_entry);
+#endif
+}
+
+/**
+ * @brief This function applies the connection policy, keeping Wi-Fi and MQTT up or bringing them up only to upload.
+ *
+ * @param bool on_demand. true to connect on demand, validated by the runtime config registry.
+ * @return esp_err_t ESP_OK.
+ * @return esp_err_t ERROR.
+ *
+ */
+static esp_err_t apply_link_on_demand(bool on_demand)
+{
+    return link_manager_set_policy(on_demand ? LINK_MANAGER_ON_DEMAND : LINK_MANAGER_ALWAYS_ON);
+}
+
+/* Settings the server changes through shared attributes, see runtime_settings.h*/
+static const runtime_settings_hooks_t runtime_settings_hooks = {
+    .send_time = sgp30_restart_measuring,
+    .link_on_demand = apply_link_on_demand,
+    .active_range = power_manager_set_active_range,
+};
+
+/**
+ * @brief This function handles new shared attributes, applying every changed setting in one pass.
+ *
+ * @param void *handler_args. Additional arguments passed to the function.
+ * @param esp_event_base_t base. Event base.
+ * @param int32_t event_id. Event identifier.
+ * @param void *event_data. Event data.
+ * @return
+ *
+ */
+static void mqtt_on_runtime_config_update(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    const runtime_config_update_t *update = event_data;
+
+    mqtt_runtime_config_applied(update, runtime_config_apply(update));
+}
+
+/**
+ * @brief This function handles updates of the shared attributes, storing them so the next start applies them
+ *  before connecting.
+ *
+ * @param void *handler_args. Additional arguments passed to the function.
+ * @param esp_event_base_t base. Event base.
+ * @param int32_t event_id. Event identifier.
+ * @param void *event_data. Event data.
+ * @return
+ *
+ */
+static void mqtt_on_shared_attributes_changed(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    if (storage_set((const thingsboard_shared_attributes_t*) event_data) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Shared attributes not cached");
+    }
+}
+
+/**
+ * @brief This function logs the time from boot to the first session with the broker and to the first telemetry
+ *  acknowledged, telling cold boots from timer wakes so both can be compared.
+ *
+ * @param void *handler_args. Additional arguments passed to the function.
+ * @param esp_event_base_t base. Event base.
+ * @param int32_t event_id. Event identifier.
+ * @param void *event_data. Event data.
+ * @return
+ *
+ */
+static void mqtt_on_boot_milestone(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    static int64_t connected_at;
+    static bool delivered;
+
+    if (event_id == MQTT_BROKER_CONNECTED)
+    {
+        if (connected_at == 0)
+        {
+            connected_at = esp_timer_get_time();
+        }
+        return;
+    }
+    if (delivered)
+    {
+        return;
+    }
+    delivered = true;
+    ESP_LOGI(
+        TAG,
+        "First telemetry after a %s: broker at %" PRId64 " ms, acknowledged at %" PRId64 " ms",
+        esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER ? "timer wake" : "cold boot",
+        connected_at / 1000,
+        esp_timer_get_time() / 1000
+    );
+}
+
+#if CONFIG_STORAGE_STATS_PUBLISH_PERIOD > 0
+/**
+ * @brief This function adds one NVS counter to the statistics payload, as nvs_<namespace>_<name> or nvs_<name>.
+ *
+ * @param size_t *n. Values added so far.
+ * @param const char *ns. Namespace, NULL for the totals.
+ * @param const char *name. Counter name.
+ * @param uint32_t value. Counter value.
+ * @return
+ *
+ */
+static void storage_stats_add(size_t *n, const char *ns, const char *name, uint32_t value)
+{
+    snprintf(
+        storage_stats_keys[*n],
+        STATS_KEY_LEN,
+        "nvs_%s%s%s",
+        ns != NULL ? ns : "",
+        ns != NULL ? "_" : "",
+        name
+    );
+    storage_stats_values[*n] = (telemetry_codec_attribute_t){
+        .key = storage_stats_keys[*n],
+        .type = TELEMETRY_CODEC_ATTRIBUTE_INT,
+        .int_value = value,
+    };
+    (*n)++;
 }
 
 /**
- * @brief This function handles events that change the data transmission interval, logging the change, 
- *  assigning the new interval, and restarting the SGP30 sensor measurement with the new interval.
+ * @brief This function publishes the NVS operation counters and usage once every CONFIG_STORAGE_STATS_PUBLISH_PERIOD,
+ *  as flat keys the fleet can aggregate to project the flash writes.
+ *
+ * @return
+ *
+ */
+static void storage_stats_publish(void)
+{
+    storage_stats_t stats;
+    size_t n = 0;
+    size_t len;
+    time_t now;
+
+    time(&now);
+    if (now - storage_stats_published_at < CONFIG_STORAGE_STATS_PUBLISH_PERIOD)
+    {
+        return;
+    }
+    storage_get_stats(&stats);
+    storage_stats_add(&n, NULL, "used", stats.used_entries);
+    storage_stats_add(&n, NULL, "free", stats.free_entries);
+    storage_stats_add(&n, NULL, "namespaces", stats.namespace_count);
+    storage_stats_add(&n, NULL, "opens", stats.opens);
+    for (size_t i = 0; i < STORAGE_STATS_NAMESPACES; i++)
+    {
+        const storage_namespace_stats_t *ns = &stats.namespaces[i];
+        storage_stats_add(&n, ns->name, "reads", ns->reads);
+        storage_stats_add(&n, ns->name, "writes", ns->writes);
+        storage_stats_add(&n, ns->name, "skipped", ns->skipped);
+        storage_stats_add(&n, ns->name, "commits", ns->commits);
+        storage_stats_add(&n, ns->name, "written_bytes", ns->written_bytes);
+        storage_stats_add(&n, ns->name, "us", ns->read_us + ns->write_us + ns->commit_us);
+        storage_stats_add(&n, ns->name, "max_us", ns->max_us);
+    }
+    if (telemetry_codec_encode_attributes(
+            TELEMETRY_CODEC_FORMAT,
+            storage_stats_values,
+            n,
+            stats_payload,
+            sizeof(stats_payload),
+            &len) != ESP_OK
+        || mqtt_publish_topic(STATS_TOPIC, (const char *)stats_payload, len, NULL) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "NVS statistics not published");
+        return;
+    }
+    storage_stats_published_at = now;
+}
+#endif
+
+#if CONFIG_POWER_MANAGER_ENERGY_PUBLISH_PERIOD > 0
+/**
+ * @brief This function adds one value of the energy ledger to the payload, as energy_<state>_<unit> or energy_<unit>.
+ *
+ * @param size_t *n. Values added so far.
+ * @param const char *state. State name, NULL for the totals.
+ * @param const char *unit. Unit or counter name.
+ * @param uint32_t value. Value.
+ * @return
+ *
+ */
+static void energy_add(size_t *n, const char *state, const char *unit, uint32_t value)
+{
+    snprintf(
+        energy_keys[*n],
+        STATS_KEY_LEN,
+        "energy_%s%s%s",
+        state != NULL ? state : "",
+        state != NULL ? "_" : "",
+        unit
+    );
+    energy_values[*n] = (telemetry_codec_attribute_t){
+        .key = energy_keys[*n],
+        .type = TELEMETRY_CODEC_ATTRIBUTE_INT,
+        .int_value = value,
+    };
+    (*n)++;
+}
+
+/**
+ * @brief This function publishes the energy ledger once every CONFIG_POWER_MANAGER_ENERGY_PUBLISH_PERIOD,
+ *  the seconds and estimated charge of each power state since power on, with the power settings they were
+ *  measured with so the fleet can compare firmware configurations.
+ *
+ * @return
+ *
+ */
+static void energy_publish(void)
+{
+    power_energy_t energy;
+    size_t n = 0;
+    size_t len;
+    time_t now;
+
+    time(&now);
+    if (now - energy_published_at < CONFIG_POWER_MANAGER_ENERGY_PUBLISH_PERIOD)
+    {
+        return;
+    }
+    power_manager_energy_get(&energy);
+    for (power_state_t state = 0; state < POWER_STATE_MAX; state++)
+    {
+        energy_add(&n, power_manager_energy_state_name(state), "s", (uint32_t)(energy.time_us[state] / 1000000));
+        energy_add(&n, power_manager_energy_state_name(state), "uah", energy.charge_uah[state]);
+    }
+    energy_add(&n, NULL, "uah", energy.charge_total_uah);
+    energy_add(&n, NULL, "wakeups", energy.wakeups);
+    energy_add(&n, NULL, "light_sleep", energy.light_sleep_counted);
+    energy_add(&n, NULL, "wifi_ps", energy.wifi_ps);
+    if (telemetry_codec_encode_attributes(
+            TELEMETRY_CODEC_FORMAT,
+            energy_values,
+            n,
+            stats_payload,
+            sizeof(stats_payload),
+            &len) != ESP_OK
+        || mqtt_publish_topic(STATS_TOPIC, (const char *)stats_payload, len, NULL) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Energy ledger not published");
+        return;
+    }
+    energy_published_at = now;
+}
+#endif
+
+/**
+ * @brief This function handles published batches, bringing the link up to upload them if it is down.
  *
  * @param void *handler_args. Additional arguments passed to the function.
  * @param esp_event_base_t base. Event base.
@@ -154,16 +485,30 @@ static void sgp30_on_new_measurement(
  * @return
  *
  */
-static void mqtt_on_new_interval(
+static void telemetry_batch_on_flushed(
     void *handler_args,
     esp_event_base_t base,
     int32_t event_id,
     void *event_data
 )
 {
-    send_time = *((int *)event_data);
-    ESP_LOGI(TAG, "Changing transmission interval %d seconds", send_time);
-    sgp30_restart_measuring( send_time);
+#if CONFIG_GATEWAY_ROLE_GATEWAY
+    /* The windows of the leaves go out with the same upload*/
+    if (gateway_flush() != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not publish the leaf windows, they wait for the next batch");
+    }
+#endif
+#if CONFIG_STORAGE_STATS_PUBLISH_PERIOD > 0
+    storage_stats_publish();
+#endif
+#if CONFIG_POWER_MANAGER_ENERGY_PUBLISH_PERIOD > 0
+    energy_publish();
+#endif
+    if (link_manager_request() != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not bring the link up, the batch waits for the next one");
+    }
 }
 
 /**
@@ -242,6 +587,16 @@ static const sgp30_event_handler_register_t sgp30_registered_events[] = {
 
 static const size_t sgp30_registered_events_len =
     sizeof(sgp30_registered_events) / sizeof(sgp30_registered_events[0]);
+
+static const mqtt_thingsboard_event_handler_register_t mqtt_thingsboard_registered_events[] = {
+    { MQTT_RUNTIME_CONFIG_UPDATE,     mqtt_on_runtime_config_update },
+    { MQTT_SHARED_ATTRIBUTES_CHANGED, mqtt_on_shared_attributes_changed },
+    { MQTT_BROKER_CONNECTED,          mqtt_on_boot_milestone },
+    { MQTT_OUTBOX_DELIVERED,          mqtt_on_boot_milestone }
+};
+
+static const size_t mqtt_thingsboard_registered_events_len =
+    sizeof(mqtt_thingsboard_registered_events) / sizeof(mqtt_thingsboard_registered_events[0]);
 #endif
 
 static esp_err_t init_i2c(i2c_master_bus_handle_t *bus_handle)
@@ -264,28 +619,73 @@ static esp_err_t init_i2c(i2c_master_bus_handle_t *bus_handle)
     return ESP_OK;
 }
 
+#if CONFIG_GATEWAY_ROLE_LEAF
 /**
- * @brief This function takes a measurement from the SGP30 sensor and its timestamp, 
- * creates a JSON representation of the data, and returns this JSON representation as a string.
+ * @brief This function starts the radio of a leaf on the channel of its gateway, without joining any access point.
+ *
+ * @return esp_err_t ESP_OK.
+ * @return esp_err_t ERROR.
  *
- * @param long ts. Timestamp of the measurement.
- * @param sgp30_measurement_t measurement. Structure containing the eCO2 and TVOC measurements.
- * @return char*, data_to_send by JSON.
  */
-char *prepare_meassure_send(long ts, sgp30_measurement_t measurement)
+static esp_err_t init_leaf_radio(void)
 {
-    cJSON *json_data = cJSON_CreateObject();
-    cJSON *measurement_json = cJSON_CreateObject();
-    char *data_to_send;
-    cJSON_AddNumberToObject(json_data, "ts", ts);
-    cJSON_AddNumberToObject(measurement_json, "eCO2", measurement.eCO2);
-    cJSON_AddNumberToObject(measurement_json, "TVOC", measurement.TVOC);
-    cJSON_AddItemToObjectCS(json_data, "values", measurement_json);
-    data_to_send = cJSON_PrintUnformatted(json_data);
-
-    cJSON_Delete(json_data);
-    return data_to_send;
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+
+    ESP_RETURN_ON_ERROR(esp_wifi_init(&cfg), TAG, "Could not initialize Wi-Fi");
+    ESP_RETURN_ON_ERROR(esp_wifi_set_storage(WIFI_STORAGE_RAM), TAG, "Could not set Wi-Fi storage");
+    ESP_RETURN_ON_ERROR(esp_wifi_set_mode(WIFI_MODE_STA), TAG, "Could not set station mode");
+    ESP_RETURN_ON_ERROR(esp_wifi_start(), TAG, "Could not start Wi-Fi");
+    ESP_RETURN_ON_ERROR(
+        esp_wifi_set_channel(CONFIG_GATEWAY_ESPNOW_CHANNEL, WIFI_SECOND_CHAN_NONE),
+        TAG,
+        "Could not set the gateway channel"
+    );
+    return ESP_OK;
 }
+#endif
+
+#if CONFIG_CERT_STORE_ENABLE && !CONFIG_GATEWAY_ROLE_LEAF
+/**
+ * @brief This function makes the provisioned certificates available to the connections. A timer wake
+ * takes the configuration from RTC memory without them, the PEM is only read from NVS when the store
+ * does not hold them or the HTTP bulk upload or DTLS need it. Once the store holds them the PEM is
+ * dropped from RAM. Without the store the MQTT client falls back to the PEM certificates.
+ *
+ */
+static void init_certificates(void)
+{
+    uint32_t certificates_crc;
+
+    if (thingsboard_cfg.verification.certificate == NULL)
+    {
+        if (storage_get_certificates_crc(&certificates_crc) == ESP_OK
+            && cert_store_open(certificates_crc) == ESP_OK
+            && !CERTIFICATES_PEM_NEEDED)
+        {
+            return;
+        }
+        if (storage_load_certificates(&thingsboard_cfg) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Could not read the certificates");
+            return;
+        }
+    }
+    /* Converted on the first boot after provisioning, only checked after it*/
+    if (!cert_store_ready()
+        && cert_store_init(
+            thingsboard_cfg.verification.certificate,
+            thingsboard_cfg.credentials.authentication.certificate,
+            thingsboard_cfg.credentials.authentication.key) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Certificate store unavailable, using the PEM certificates");
+        return;
+    }
+    if (!CERTIFICATES_PEM_NEEDED && storage_release_certificates(&thingsboard_cfg) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not release the PEM certificates");
+    }
+}
+#endif
 
 void app_main(void)
 {
@@ -304,7 +704,7 @@ void app_main(void)
 
     esp_event_loop_args_t imc_event_loop_args = {
         /* An event loop for sensoring related events*/
-        .queue_size = 5,
+        .queue_size = 16,
         .task_name =
             "sgp30_event_loop_task", /* since it is a task it can be stopped */
         .task_stack_size = 4096,
@@ -315,7 +715,15 @@ void app_main(void)
 
     /* Initialize the event loop */
     ESP_ERROR_CHECK(esp_event_loop_create_default());
+    esp_timer_create_args_t wifi_retry_timer_args = {
+        .callback = wifi_retry_timer_callback,
+        .name = "wifi_retry"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&wifi_retry_timer_args, &wifi_retry_timer));
+#if !CONFIG_GATEWAY_ROLE_LEAF
+    /* Leaves never join the access point*/
     esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler, NULL);
+#endif
     //esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, event_handler_got_ip, NULL);
 
     ESP_ERROR_CHECK(storage_init());
@@ -339,24 +747,37 @@ void app_main(void)
         );
     }
 
-    /* Set up event listeenr for MQTT module*/
+    /* Set up event listeners for MQTT module*/
+    for (int i = 0; i < mqtt_thingsboard_registered_events_len; i++)
+    {
+        ESP_ERROR_CHECK(
+            esp_event_handler_register_with(
+                imc_event_loop_handle,
+                MQTT_THINGSBOARD_EVENT,
+                mqtt_thingsboard_registered_events[i].event_id,
+                mqtt_thingsboard_registered_events[i].event_handler,
+                NULL
+            )
+        );
+    }
+
+        /* Set up event listeenr for MQTT module*/
     ESP_ERROR_CHECK(
         esp_event_handler_register_with(
             imc_event_loop_handle,
-            MQTT_THINGSBOARD_EVENT,
-            MQTT_NEW_SEND_TIME,
-            mqtt_on_new_interval,
+            SNTP_SYNC_EVENT,
+            SNTP_SUCCESSFULL_SYNC,
+            sntp_on_sync_time,
             NULL
         )
     );
 
-        /* Set up event listeenr for MQTT module*/
     ESP_ERROR_CHECK(
         esp_event_handler_register_with(
             imc_event_loop_handle,
-            SNTP_SYNC_EVENT,
-            SNTP_SUCCESSFULL_SYNC,
-            sntp_on_sync_time,
+            TELEMETRY_BATCH_EVENT,
+            TELEMETRY_BATCH_EVENT_FLUSHED,
+            telemetry_batch_on_flushed,
             NULL
         )
     );
@@ -364,6 +785,10 @@ void app_main(void)
     power_manager_init();
     wifi_power_save_init();
 
+#if CONFIG_GATEWAY_ROLE_LEAF
+    /* A leaf only needs its radio, windows are stamped by the gateway*/
+    ESP_ERROR_CHECK(init_leaf_radio());
+#else
     esp_err_t got_thingboard_cfg = storage_get(&thingsboard_cfg);
     esp_err_t got_wifi_credentials = storage_get(&wifi_credentials);
     if( got_thingboard_cfg != got_wifi_credentials)
@@ -380,8 +805,19 @@ void app_main(void)
         ESP_ERROR_CHECK(softAP_provision_init(NULL, NULL));
         thingsboard_cfg = get_thingsboard_cfg();
         wifi_credentials = get_wifi_credentials();
-        storage_set((const thingsboard_cfg_t*) &thingsboard_cfg);
-        storage_set((const wifi_credentials_t*) &wifi_credentials);
+        /* Both parts are stored together, with a single commit*/
+        storage_txn_t txn;
+        ESP_ERROR_CHECK(storage_txn_begin(&txn));
+        storage_txn_set(&txn, (const thingsboard_cfg_t*) &thingsboard_cfg);
+        if (storage_txn_set(&txn, (const wifi_credentials_t*) &wifi_credentials) != ESP_OK)
+        {
+            storage_txn_abort(&txn);
+            ESP_LOGE(TAG, "Provisioning not stored");
+        }
+        else if (storage_txn_commit(&txn) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Provisioning not stored");
+        }
         ESP_LOGI(TAG, "%s", thingsboard_cfg.address.uri);
         ESP_LOGI(TAG, "%s", thingsboard_cfg.verification.certificate);
         #else
@@ -393,8 +829,12 @@ void app_main(void)
         ESP_LOGI(TAG, "Device provisioned");
         ESP_ERROR_CHECK(softAP_provision_init(&thingsboard_cfg, &wifi_credentials));
     }
+#if CONFIG_CERT_STORE_ENABLE
+    init_certificates();
+#endif
 
     init_sntp(imc_event_loop_handle);
+#endif
 
     /* At this point a valid time is required*/
     /* We start the sensor*/
@@ -415,8 +855,57 @@ void app_main(void)
     /* SGP30_EVENT_NEW_INTERVAL*/
     
     //Tras haber sincronizado la hora con sntp ajustamos la hora de entrada en deep sleep
-    mqtt_init(imc_event_loop_handle, &thingsboard_cfg);
-    wifi_set_power_mode(WIFI_POWER_MODE_MAX_MODEM);
+#if CONFIG_MEASUREMENT_HISTORY_ENABLE
+    ESP_ERROR_CHECK(measurement_history_init());
+#endif
+#if CONFIG_GATEWAY_ROLE_LEAF
+    ESP_ERROR_CHECK(gateway_leaf_init(imc_event_loop_handle, &gateway_link_espnow));
     sgp30_start_measuring(send_time);
+#else
+#if CONFIG_TELEMETRY_BATCH_STORE_AND_FORWARD
+    ESP_ERROR_CHECK(telemetry_queue_init(imc_event_loop_handle));
+#endif
+#if CONFIG_TELEMETRY_BULK_ENABLE
+    ESP_ERROR_CHECK(telemetry_bulk_init(imc_event_loop_handle, &thingsboard_cfg));
+#endif
+    ESP_ERROR_CHECK(telemetry_batch_init(imc_event_loop_handle));
+#if CONFIG_FLEET_UPLOAD_SLOTTING
+    ESP_ERROR_CHECK(telemetry_batch_set_slot(send_time * 1000, fleet_slot_offset(send_time * 1000)));
+#endif
+    /* Measuring starts before the cached shared attributes are applied, a
+     cached send_time restarts it with its interval*/
+    sgp30_start_measuring(send_time);
+    thingsboard_shared_attributes_t shared_attributes;
+    int32_t active_start, active_end;
+    power_manager_get_active_range(&active_start, &active_end);
+    ESP_ERROR_CHECK(runtime_settings_init(&(runtime_settings_t) {
+        .send_time = send_time,
+        .batch_size = CONFIG_TELEMETRY_BATCH_DEFAULT_SIZE,
+        .batch_deadline = CONFIG_TELEMETRY_BATCH_DEFAULT_DEADLINE,
+        .active_start = active_start,
+        .active_end = active_end,
+#if CONFIG_LINK_MANAGER_ON_DEMAND
+        .link_on_demand = true,
+#endif
+    }, &runtime_settings_hooks));
+    ESP_ERROR_CHECK(diagnostics_init());
+#if CONFIG_TELEMETRY_BATCH_STORE_AND_FORWARD
+    ESP_ERROR_CHECK(link_manager_init(imc_event_loop_handle, telemetry_queue_pending));
+#else
+    ESP_ERROR_CHECK(link_manager_init(imc_event_loop_handle, NULL));
+#endif
+    ESP_ERROR_CHECK(mqtt_init(
+        imc_event_loop_handle,
+        &thingsboard_cfg,
+        storage_get(&shared_attributes) == ESP_OK ? &shared_attributes : NULL
+    ));
+#if CONFIG_GATEWAY_ROLE_GATEWAY
+    ESP_ERROR_CHECK(gateway_init(imc_event_loop_handle, &gateway_link_espnow));
+    /* Modem sleep would miss the frames of the leaves*/
+    wifi_set_power_mode(WIFI_POWER_MODE_NONE);
+#else
+    wifi_set_power_mode(WIFI_POWER_MODE_MAX_MODEM);
+#endif
+#endif
     #endif
 }
@@ -0,0 +1,133 @@
+#include <inttypes.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "fleet.h"
+#include "runtime_config.h"
+#include "runtime_settings.h"
+#include "telemetry_batch.h"
+
+static const char *TAG = "runtime_settings";
+
+static const runtime_settings_hooks_t *settings_hooks;
+static uint32_t settings_send_time;
+static int32_t settings_active_start;
+static int32_t settings_active_end;
+
+static esp_err_t apply_send_time(int32_t value)
+{
+    ESP_LOGI(TAG, "Changing transmission interval %" PRIi32 " seconds", value);
+#if CONFIG_FLEET_UPLOAD_SLOTTING
+    ESP_RETURN_ON_ERROR(
+        telemetry_batch_set_slot(value * 1000, fleet_slot_offset(value * 1000)),
+        TAG,
+        "Could not set the upload slot"
+    );
+#endif
+    esp_err_t err = settings_hooks->send_time(value);
+    if (err != ESP_OK)
+    {
+#if CONFIG_FLEET_UPLOAD_SLOTTING
+        /* The slot goes back to the interval still sampled*/
+        telemetry_batch_set_slot(settings_send_time * 1000, fleet_slot_offset(settings_send_time * 1000));
+#endif
+        ESP_LOGE(TAG, "Could not change the interval");
+        return err;
+    }
+    settings_send_time = value;
+    return ESP_OK;
+}
+
+static esp_err_t apply_batch_size(int32_t value)
+{
+    return telemetry_batch_set_size(value);
+}
+
+static esp_err_t apply_batch_deadline(int32_t value)
+{
+    return telemetry_batch_set_deadline(value);
+}
+
+static esp_err_t apply_active_start(int32_t value)
+{
+    ESP_RETURN_ON_ERROR(settings_hooks->active_range(value, settings_active_end), TAG, "Could not change the active range");
+    settings_active_start = value;
+    return ESP_OK;
+}
+
+static esp_err_t apply_active_end(int32_t value)
+{
+    ESP_RETURN_ON_ERROR(settings_hooks->active_range(settings_active_start, value), TAG, "Could not change the active range");
+    settings_active_end = value;
+    return ESP_OK;
+}
+
+static esp_err_t apply_link_on_demand(int32_t value)
+{
+    return settings_hooks->link_on_demand(value);
+}
+
+/* The settings whose hook is NULL are left out of the registry*/
+static const runtime_config_entry_t settings_entries[] = {
+    { "send_time",      RUNTIME_CONFIG_INT, 1, RUNTIME_SETTINGS_MAX_SECONDS, apply_send_time },
+    { "batch_size",     RUNTIME_CONFIG_INT, 1, CONFIG_TELEMETRY_BATCH_CAPACITY, apply_batch_size },
+    { "batch_deadline", RUNTIME_CONFIG_INT, 0, RUNTIME_SETTINGS_MAX_SECONDS, apply_batch_deadline },
+    { "active_start",   RUNTIME_CONFIG_INT, 0, RUNTIME_SETTINGS_MINUTES_PER_DAY - 1, apply_active_start },
+    { "active_end",     RUNTIME_CONFIG_INT, 0, RUNTIME_SETTINGS_MINUTES_PER_DAY - 1, apply_active_end },
+    { "link_on_demand", RUNTIME_CONFIG_BOOL, 0, 1, apply_link_on_demand },
+};
+
+#define SETTINGS_ENTRIES (sizeof(settings_entries) / sizeof(settings_entries[0]))
+
+static runtime_config_entry_t settings_registry[SETTINGS_ENTRIES];
+
+static bool settings_entry_hooked(const runtime_config_entry_t *entry)
+{
+    if (entry->apply == apply_active_start || entry->apply == apply_active_end)
+    {
+        return settings_hooks->active_range != NULL;
+    }
+    return entry->apply != apply_link_on_demand || settings_hooks->link_on_demand != NULL;
+}
+
+esp_err_t runtime_settings_init(const runtime_settings_t *current, const runtime_settings_hooks_t *hooks)
+{
+    /* Indexed like settings_entries*/
+    const int32_t values[SETTINGS_ENTRIES] = {
+        current->send_time,
+        current->batch_size,
+        current->batch_deadline,
+        current->active_start,
+        current->active_end,
+        current->link_on_demand,
+    };
+    runtime_config_update_t in_use = { 0 };
+    size_t len = 0;
+
+    ESP_RETURN_ON_FALSE(
+        current->send_time >= 1 && current->send_time <= RUNTIME_SETTINGS_MAX_SECONDS,
+        ESP_ERR_INVALID_ARG,
+        TAG,
+        "send_time out of range"
+    );
+    settings_hooks = hooks;
+    settings_send_time = current->send_time;
+    settings_active_start = current->active_start;
+    settings_active_end = current->active_end;
+    for (size_t i = 0; i < SETTINGS_ENTRIES; i++)
+    {
+        if (settings_entry_hooked(&settings_entries[i]))
+        {
+            settings_registry[len] = settings_entries[i];
+            in_use.values[len] = values[i];
+            in_use.set |= 1u << len;
+            len++;
+        }
+    }
+    ESP_RETURN_ON_ERROR(runtime_config_init(settings_registry, len), TAG, "Could not set the registry");
+    return runtime_config_set_current(&in_use);
+}
+
+uint32_t runtime_settings_send_time(void)
+{
+    return settings_send_time;
+}
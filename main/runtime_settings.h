@@ -0,0 +1,77 @@
+/**
+ * @file runtime_settings.h
+ * @brief Settings the server changes through shared attributes.
+ *
+ * The registry of runtime_config and the callbacks applying the telemetry
+ * settings, used by app_main and by the devices of the fleet host, which
+ * only differ in how the sampling interval and the link policy are put in
+ * use.
+ */
+#ifndef RUNTIME_SETTINGS_H
+#define RUNTIME_SETTINGS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief Longest send_time and batch_deadline, in seconds.
+ */
+#define RUNTIME_SETTINGS_MAX_SECONDS 86400
+
+/**
+ * @brief Minutes of a day, active_start and active_end are below it.
+ */
+#define RUNTIME_SETTINGS_MINUTES_PER_DAY 1440
+
+/**
+ * @brief Values in use at start.
+ */
+typedef struct {
+    uint32_t send_time;      /*!< Seconds between measurement windows */
+    int32_t batch_size;      /*!< Windows published together */
+    int32_t batch_deadline;  /*!< Seconds a window waits at most */
+    int32_t active_start;    /*!< Start of the active power range, minute of the day, with active_range only */
+    int32_t active_end;      /*!< End of the active power range, minute of the day, with active_range only */
+    bool link_on_demand;     /*!< Link policy, with link_on_demand only */
+} runtime_settings_t;
+
+/**
+ * @brief How the caller puts a setting in use.
+ */
+typedef struct {
+    /**
+     * @brief Sample with a new interval, called after the upload slot is
+     * moved, which is moved back if it fails.
+     */
+    esp_err_t (*send_time)(uint32_t send_time);
+    /**
+     * @brief Change the link policy, NULL leaves the setting out of the
+     * registry.
+     */
+    esp_err_t (*link_on_demand)(bool on_demand);
+    /**
+     * @brief Change the active power range, in minutes of the day. Called
+     * with the other bound in use when only one changes, NULL leaves both
+     * out of the registry.
+     */
+    esp_err_t (*active_range)(int32_t start_minute, int32_t end_minute);
+} runtime_settings_hooks_t;
+
+/**
+ * @brief Set the registry and record the values in use.
+ *
+ * @param current Values in use at start.
+ * @param hooks Callbacks, referenced so they have to outlive the registry.
+ * @return
+ * - ESP_OK: Success
+ * - some other error code: the registry could not be set
+ */
+esp_err_t runtime_settings_init(const runtime_settings_t *current, const runtime_settings_hooks_t *hooks);
+
+/**
+ * @brief Get the sampling interval in use.
+ *
+ * @return Seconds between measurement windows.
+ */
+uint32_t runtime_settings_send_time(void);
+#endif // !RUNTIME_SETTINGS_H
@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+"""Answer the CoAP requests of the uplink_coap transport without ThingsBoard.
+
+Plain CoAP over UDP, DTLS is not terminated. Listens like the ThingsBoard
+CoAP transport on api/v1/<token>/telemetry, api/v1/<token>/attributes and
+the same paths without a token:
+
+- POST is answered 2.04 Changed.
+- GET attributes?sharedKeys=a,b is answered 2.05 Content with
+  {"shared":{"a":...,"b":...}}, the values taken from --shared.
+- An empty confirmable message (CoAP ping) is answered with a reset.
+
+Every exchange is logged with the datagram sizes, and a summary of bytes per
+upload is printed on Ctrl-C. --drop loses a share of the requests to exercise
+the retransmissions, --separate acknowledges first and responds later as a
+proxy would.
+
+    python tools/coap_standin.py
+    python tools/coap_standin.py --port 5683 --drop 0.2 --separate
+    python tools/coap_standin.py --shared '{"sendTime":60,"logLevel":3}'
+"""
+import argparse
+import json
+import random
+import socket
+import struct
+import time
+
+TYPE_CON, TYPE_NON, TYPE_ACK, TYPE_RST = range(4)
+CODE_EMPTY = 0x00
+CODE_GET = 0x01
+CODE_POST = 0x02
+CODE_CHANGED = 0x44
+CODE_CONTENT = 0x45
+CODE_BAD_REQUEST = 0x80
+CODE_NOT_FOUND = 0x84
+OPTION_URI_PATH = 11
+OPTION_CONTENT_FORMAT = 12
+OPTION_URI_QUERY = 15
+CONTENT_FORMAT_JSON = 50
+IP_UDP_HEADER_LEN = 28
+
+
+def read_extended(data, pos, nibble):
+    if nibble < 13:
+        return nibble, pos
+    if nibble == 13:
+        return data[pos] + 13, pos + 1
+    if nibble == 14:
+        return struct.unpack_from(">H", data, pos)[0] + 269, pos + 2
+    raise ValueError("reserved option nibble")
+
+
+def parse(data):
+    """Header fields, options as (number, value) and payload."""
+    if len(data) < 4 or data[0] >> 6 != 1:
+        raise ValueError("not CoAP version 1")
+    msg_type = (data[0] >> 4) & 0x03
+    token_len = data[0] & 0x0F
+    code = data[1]
+    message_id = struct.unpack_from(">H", data, 2)[0]
+    token = data[4:4 + token_len]
+    pos = 4 + token_len
+    number = 0
+    options = []
+    while pos < len(data) and data[pos] != 0xFF:
+        header = data[pos]
+        delta, pos = read_extended(data, pos + 1, header >> 4)
+        length, pos = read_extended(data, pos, header & 0x0F)
+        number += delta
+        options.append((number, data[pos:pos + length]))
+        pos += length
+    payload = data[pos + 1:] if pos < len(data) else b""
+    return msg_type, code, message_id, token, options, payload
+
+
+def option_nibble(value):
+    if value < 13:
+        return value, b""
+    if value < 269:
+        return 13, bytes([value - 13])
+    return 14, struct.pack(">H", value - 269)
+
+
+def build(msg_type, code, message_id, token=b"", options=(), payload=b""):
+    out = bytearray([0x40 | (msg_type << 4) | len(token), code])
+    out += struct.pack(">H", message_id) + token
+    last = 0
+    for number, value in options:
+        delta, delta_ext = option_nibble(number - last)
+        length, length_ext = option_nibble(len(value))
+        out.append((delta << 4) | length)
+        out += delta_ext + length_ext + value
+        last = number
+    if payload:
+        out += b"\xff" + payload
+    return bytes(out)
+
+
+def respond(code, options, payload, shared):
+    """Response code and payload of a request."""
+    path = [value.decode() for number, value in options if number == OPTION_URI_PATH]
+    query = [value.decode() for number, value in options if number == OPTION_URI_QUERY]
+    if len(path) < 3 or path[:2] != ["api", "v1"]:
+        return CODE_NOT_FOUND, b""
+    resource = path[-1]
+    if code == CODE_POST and resource in ("telemetry", "attributes"):
+        try:
+            json.loads(payload)
+        except ValueError:
+            # Binary codecs are accepted as they are
+            pass
+        return CODE_CHANGED, b""
+    if code == CODE_GET and resource == "attributes":
+        keys = []
+        for item in query:
+            name, _, value = item.partition("=")
+            if name == "sharedKeys":
+                keys += [key for key in value.split(",") if key]
+        values = {key: shared[key] for key in keys if key in shared}
+        return CODE_CONTENT, json.dumps({"shared": values}, separators=(",", ":")).encode()
+    return CODE_BAD_REQUEST, b""
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=5683)
+    parser.add_argument("--drop", type=float, default=0.0, help="share of requests lost")
+    parser.add_argument("--separate", action="store_true", help="empty ACK first, response later")
+    parser.add_argument("--delay", type=float, default=0.2, help="seconds before a separate response")
+    parser.add_argument("--shared", default="{}", help="shared attributes as JSON")
+    args = parser.parse_args()
+    shared = json.loads(args.shared)
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.host, args.port))
+    print(f"CoAP stand-in on {args.host}:{args.port}")
+    uploads = 0
+    rx_bytes = 0
+    tx_bytes = 0
+    # Responses of the latest exchanges, so retransmissions get the same one
+    answered = {}
+
+    def send(data, peer):
+        nonlocal tx_bytes
+        sock.sendto(data, peer)
+        tx_bytes += len(data) + IP_UDP_HEADER_LEN
+
+    try:
+        while True:
+            data, peer = sock.recvfrom(2048)
+            rx_bytes += len(data) + IP_UDP_HEADER_LEN
+            try:
+                msg_type, code, message_id, token, options, payload = parse(data)
+            except (ValueError, IndexError, struct.error) as err:
+                print(f"{peer[0]} malformed {len(data)} B: {err}")
+                continue
+            if msg_type in (TYPE_ACK, TYPE_RST):
+                continue
+            if random.random() < args.drop:
+                print(f"{peer[0]} mid {message_id} dropped")
+                continue
+            if code == CODE_EMPTY:
+                send(build(TYPE_RST, CODE_EMPTY, message_id), peer)
+                print(f"{peer[0]} ping {len(data)} B")
+                continue
+            key = (peer, message_id)
+            retransmission = key in answered
+            if not retransmission:
+                answered[key] = respond(code, options, payload, shared)
+                if len(answered) > 64:
+                    answered.pop(next(iter(answered)))
+                if answered[key][0] == CODE_CHANGED:
+                    uploads += 1
+            response_code, response_payload = answered[key]
+            content = [(OPTION_CONTENT_FORMAT, bytes([CONTENT_FORMAT_JSON]))] if response_payload else []
+            reply_type = TYPE_ACK if msg_type == TYPE_CON else TYPE_NON
+            if args.separate and msg_type == TYPE_CON:
+                send(build(TYPE_ACK, CODE_EMPTY, message_id), peer)
+                time.sleep(args.delay)
+                response = build(TYPE_CON, response_code, random.getrandbits(16), token, content, response_payload)
+            else:
+                response = build(reply_type, response_code, message_id, token, content, response_payload)
+            send(response, peer)
+            path = "/".join(value.decode() for number, value in options if number == OPTION_URI_PATH)
+            print(
+                f"{peer[0]} {'retx ' if retransmission else ''}{path} {len(data)} B "
+                f"({len(payload)} payload) -> {response_code >> 5}.{response_code & 0x1F:02d} {len(response)} B"
+            )
+    except KeyboardInterrupt:
+        pass
+    if uploads:
+        print(f"{uploads} uploads, {rx_bytes / uploads:.0f} B up and {tx_bytes / uploads:.0f} B down per upload")
+
+
+if __name__ == "__main__":
+    main()
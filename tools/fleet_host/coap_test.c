@@ -0,0 +1,373 @@
+/*
+ * Test of the CoAP messages and of the CoAP uplink.
+ *
+ * The writer is checked against messages assembled by hand, with extended
+ * option deltas and lengths, and the parser against them and against
+ * truncated and malformed datagrams. Then uplink_coap, built without DTLS,
+ * talks to a server thread on the loopback interface: the ping, the shared
+ * attributes with a separate response, a publish, a lost request sent again
+ * and a refused one. The bytes it reports have to be the CoAP messages the
+ * server saw, without the IP and UDP headers counted in the radio time. It
+ * exits with 1 on the first failed check.
+ *
+ *     coap_test
+ */
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "coap_message.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_controller.h"
+#include "mqtt_router.h"
+#include "power_manager.h"
+#include "uplink.h"
+
+#define CHECK(cond)                                                        \
+    do                                                                     \
+    {                                                                      \
+        if (!(cond))                                                       \
+        {                                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                      \
+        }                                                                  \
+    } while (0)
+
+#define TEST_TIMEOUT_MS 5000
+#define TEST_REQUEST_ID 7
+#define TEST_ACCESS_TOKEN "coap-test-token"
+#define TEST_ATTRIBUTES "{\"shared\":{\"sendTime\":30}}"
+#define IP_UDP_HEADER_LEN 28
+
+ESP_EVENT_DEFINE_BASE(MQTT_THINGSBOARD_EVENT);
+
+extern const uplink_transport_t uplink_coap;
+
+static volatile int test_events[MQTT_OUTBOX_AVAILABLE + 1];
+static volatile int test_delivered_id;
+static volatile int test_attributes_id;
+static char test_attributes[128];
+static volatile uint64_t energy_bytes;
+
+/* Server on the loopback interface, answers like coap_standin.py*/
+static int server_fd;
+static volatile int server_drop;
+static volatile bool server_refuse;
+static volatile uint64_t server_rx_bytes;
+static volatile uint64_t server_tx_bytes;
+static volatile uint32_t server_rx_datagrams;
+static volatile bool server_paths_ok = true;
+static char server_payload[256];
+
+void power_manager_energy_count_tx(size_t bytes)
+{
+    energy_bytes += bytes;
+}
+
+static void server_reply(
+    const struct sockaddr_in *peer,
+    coap_type_t type,
+    uint8_t code,
+    uint16_t message_id,
+    const coap_message_t *request,
+    const char *payload
+)
+{
+    uint8_t buf[256];
+    coap_writer_t w;
+    size_t len;
+
+    coap_message_start(&w, buf, sizeof(buf), type, code, message_id, request->token, request->token_len);
+    if (coap_message_finish(&w, payload, payload == NULL ? 0 : strlen(payload), &len) == ESP_OK)
+    {
+        server_tx_bytes += len;
+        sendto(server_fd, buf, len, 0, (const struct sockaddr *)peer, sizeof(*peer));
+    }
+}
+
+static void *server_main(void *arg)
+{
+    uint8_t buf[2048];
+    uint16_t message_id = 0x8000;
+
+    for (;;)
+    {
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        coap_message_t m;
+        ssize_t n = recvfrom(server_fd, buf, sizeof(buf), 0, (struct sockaddr *)&peer, &peer_len);
+        if (n <= 0)
+        {
+            return NULL;
+        }
+        server_rx_bytes += n;
+        server_rx_datagrams++;
+        if (coap_message_parse(buf, n, &m) != ESP_OK || m.type != COAP_TYPE_CON)
+        {
+            continue;
+        }
+        if (m.code == COAP_CODE_EMPTY)
+        {
+            server_reply(&peer, COAP_TYPE_RST, COAP_CODE_EMPTY, m.message_id, &m, NULL);
+            continue;
+        }
+        if (memmem(buf, n, TEST_ACCESS_TOKEN, strlen(TEST_ACCESS_TOKEN)) == NULL)
+        {
+            server_paths_ok = false;
+        }
+        if (m.code == COAP_CODE_GET)
+        {
+            if (memmem(buf, n, "attributes", 10) == NULL || memmem(buf, n, "sharedKeys=sendTime", 19) == NULL)
+            {
+                server_paths_ok = false;
+            }
+            /* Separate response, the empty ACK comes first*/
+            server_reply(&peer, COAP_TYPE_ACK, COAP_CODE_EMPTY, m.message_id, &(coap_message_t) { 0 }, NULL);
+            server_reply(&peer, COAP_TYPE_CON, COAP_CODE(2, 5), message_id++, &m, TEST_ATTRIBUTES);
+            continue;
+        }
+        if (server_drop > 0)
+        {
+            server_drop--;
+            continue;
+        }
+        if (memmem(buf, n, "telemetry", 9) == NULL)
+        {
+            server_paths_ok = false;
+        }
+        snprintf(server_payload, sizeof(server_payload), "%.*s", (int)m.payload_len, (const char *)m.payload);
+        server_reply(&peer, COAP_TYPE_ACK, server_refuse ? COAP_CODE(4, 1) : COAP_CODE(2, 4), m.message_id, &m, NULL);
+    }
+}
+
+static void test_on_event(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    if (event_id == MQTT_OUTBOX_DELIVERED)
+    {
+        test_delivered_id = *(int *)event_data;
+    }
+    test_events[event_id]++;
+}
+
+static void test_on_attributes(uint32_t id, const char *data, size_t data_len)
+{
+    snprintf(test_attributes, sizeof(test_attributes), "%.*s", (int)data_len, data);
+    test_attributes_id = id;
+}
+
+static void test_on_connected(void)
+{
+    uplink_coap.request_attributes(TEST_REQUEST_ID, "sendTime");
+}
+
+static bool wait_for(volatile int *value, int expected)
+{
+    for (int waited = 0; *value < expected && waited < TEST_TIMEOUT_MS; waited += 10)
+    {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return *value >= expected;
+}
+
+static int test_writer(void)
+{
+    static const uint8_t expected[] = {
+        0x42, 0x01, 0x12, 0x34, 0xAB, 0xCD,
+        0xB3, 'a', 'p', 'i',
+        0x02, 'v', '1',
+        0x09, 't', 'e', 'l', 'e', 'm', 'e', 't', 'r', 'y',
+        0x11, 50,
+        0x33, 'a', '=', '1',
+        0xFF, '{', '}',
+    };
+    const uint8_t token[] = { 0xAB, 0xCD };
+    uint8_t buf[512];
+    uint8_t value[300];
+    coap_writer_t w;
+    coap_message_t m;
+    size_t len;
+
+    coap_message_start(&w, buf, sizeof(buf), COAP_TYPE_CON, COAP_CODE_GET, 0x1234, token, sizeof(token));
+    coap_message_add_path(&w, "api/v1/telemetry");
+    coap_message_add_uint_option(&w, COAP_OPTION_CONTENT_FORMAT, COAP_CONTENT_FORMAT_JSON);
+    coap_message_add_option(&w, COAP_OPTION_URI_QUERY, "a=1", 3);
+    CHECK(coap_message_finish(&w, "{}", 2, &len) == ESP_OK);
+    CHECK(len == sizeof(expected));
+    CHECK(memcmp(buf, expected, len) == 0);
+
+    CHECK(coap_message_parse(buf, len, &m) == ESP_OK);
+    CHECK(m.type == COAP_TYPE_CON);
+    CHECK(m.code == COAP_CODE_GET);
+    CHECK(m.message_id == 0x1234);
+    CHECK(m.token_len == 2 && memcmp(m.token, token, 2) == 0);
+    CHECK(m.payload_len == 2 && memcmp(m.payload, "{}", 2) == 0);
+
+    /* Delta 60 and length 13 take one more byte each, delta 340 and
+     length 300 two more*/
+    memset(value, 'x', sizeof(value));
+    coap_message_start(&w, buf, sizeof(buf), COAP_TYPE_NON, COAP_CODE_POST, 1, NULL, 0);
+    coap_message_add_option(&w, 60, value, 13);
+    coap_message_add_option(&w, 400, value, 300);
+    CHECK(coap_message_finish(&w, "p", 1, &len) == ESP_OK);
+    CHECK(len == 4 + 3 + 13 + 5 + 300 + 2);
+    CHECK(buf[4] == 0xDD && buf[5] == 60 - 13 && buf[6] == 0);
+    CHECK(buf[20] == 0xEE);
+    CHECK(buf[21] == 0 && buf[22] == 340 - 269);
+    CHECK(buf[23] == 0 && buf[24] == 300 - 269);
+    CHECK(coap_message_parse(buf, len, &m) == ESP_OK);
+    CHECK(m.type == COAP_TYPE_NON && m.token_len == 0);
+    CHECK(m.payload_len == 1 && m.payload[0] == 'p');
+
+    /* Unsigned options drop their leading zeros, 0 is empty*/
+    coap_message_start(&w, buf, sizeof(buf), COAP_TYPE_CON, COAP_CODE_POST, 1, NULL, 0);
+    coap_message_add_uint_option(&w, 12, 0);
+    coap_message_add_uint_option(&w, 12, 0x1234);
+    CHECK(coap_message_finish(&w, NULL, 0, &len) == ESP_OK);
+    CHECK(len == 4 + 1 + 3);
+    CHECK(buf[4] == 0xC0 && buf[5] == 0x02 && buf[6] == 0x12 && buf[7] == 0x34);
+
+    /* The length needed is reported when the message does not fit*/
+    coap_message_start(&w, buf, 8, COAP_TYPE_CON, COAP_CODE_POST, 1, token, sizeof(token));
+    CHECK(coap_message_finish(&w, "payload", 7, &len) == ESP_ERR_INVALID_SIZE);
+    CHECK(len == 4 + 2 + 1 + 7);
+    return 0;
+}
+
+static int test_parser(void)
+{
+    const uint8_t ack[] = { 0x60, 0x00, 0x00, 0x01 };
+    const uint8_t short_header[] = { 0x40, 0x01, 0x00 };
+    const uint8_t version_2[] = { 0x80, 0x01, 0x00, 0x01 };
+    const uint8_t long_token[] = { 0x49, 0x01, 0x00, 0x01, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    const uint8_t short_token[] = { 0x44, 0x01, 0x00, 0x01, 1, 2 };
+    const uint8_t short_extended[] = { 0x40, 0x01, 0x00, 0x01, 0xE0, 0x00 };
+    const uint8_t short_option[] = { 0x40, 0x01, 0x00, 0x01, 0xB5, 'a', 'p' };
+    const uint8_t reserved_nibble[] = { 0x40, 0x01, 0x00, 0x01, 0xF0 };
+    const uint8_t marker_only[] = { 0x40, 0x01, 0x00, 0x01, 0xFF };
+    coap_message_t m;
+
+    CHECK(coap_message_parse(ack, sizeof(ack), &m) == ESP_OK);
+    CHECK(m.type == COAP_TYPE_ACK && m.code == COAP_CODE_EMPTY && m.message_id == 1);
+    CHECK(m.payload == NULL && m.payload_len == 0);
+    CHECK(coap_message_parse(short_header, sizeof(short_header), &m) == ESP_ERR_INVALID_SIZE);
+    CHECK(coap_message_parse(version_2, sizeof(version_2), &m) == ESP_ERR_INVALID_VERSION);
+    CHECK(coap_message_parse(long_token, sizeof(long_token), &m) == ESP_ERR_INVALID_SIZE);
+    CHECK(coap_message_parse(short_token, sizeof(short_token), &m) == ESP_ERR_INVALID_SIZE);
+    CHECK(coap_message_parse(short_extended, sizeof(short_extended), &m) == ESP_ERR_INVALID_SIZE);
+    CHECK(coap_message_parse(short_option, sizeof(short_option), &m) == ESP_ERR_INVALID_SIZE);
+    CHECK(coap_message_parse(reserved_nibble, sizeof(reserved_nibble), &m) == ESP_ERR_INVALID_SIZE);
+    CHECK(coap_message_parse(marker_only, sizeof(marker_only), &m) == ESP_ERR_INVALID_SIZE);
+    return 0;
+}
+
+static int test_uplink(void)
+{
+    esp_event_loop_args_t loop_args = {
+        .queue_size = 16,
+        .task_name = "coap_test",
+        .task_stack_size = 4096,
+        .task_priority = 5,
+        .task_core_id = tskNO_AFFINITY,
+    };
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_UPLINK_COAP_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    static const mqtt_route_t attributes_route = {
+        .topic = "v1/devices/me/attributes/response/",
+        .match = MQTT_ROUTE_ID,
+        .handler = test_on_attributes,
+    };
+    static char server_uri[] = "127.0.0.1";
+    static char access_token[] = TEST_ACCESS_TOKEN;
+    static thingsboard_cfg_t cfg = {
+        .address = { .uri = server_uri },
+    };
+    static uplink_config_t config = {
+        .cfg = &cfg,
+        .on_connected = test_on_connected,
+    };
+    static char oversized[CONFIG_MQTT_OUTBOX_SLOT_BYTES + 1];
+    const char *telemetry = "{\"eCO2\":400,\"TVOC\":10}";
+    uplink_stats_t stats;
+    pthread_t server;
+    int id;
+
+    server_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(server_fd >= 0);
+    CHECK(bind(server_fd, (struct sockaddr *)&address, sizeof(address)) == 0);
+    CHECK(pthread_create(&server, NULL, server_main, NULL) == 0);
+    CHECK(esp_event_loop_create(&loop_args, &config.loop) == ESP_OK);
+    CHECK(esp_event_handler_register_with(config.loop, MQTT_THINGSBOARD_EVENT, ESP_EVENT_ANY_ID, test_on_event, NULL) == ESP_OK);
+    CHECK(mqtt_router_register(&attributes_route) == ESP_OK);
+
+    /* Plain CoAP needs the access token of the device*/
+    CHECK(uplink_coap.init(&config) == ESP_ERR_INVALID_ARG);
+    cfg.credentials.access_token = access_token;
+
+    /* Pinged, then the shared attributes come in a separate response*/
+    CHECK(uplink_coap.init(&config) == ESP_OK);
+    CHECK(wait_for(&test_events[MQTT_BROKER_CONNECTED], 1));
+    CHECK(wait_for(&test_attributes_id, TEST_REQUEST_ID));
+    CHECK(strcmp(test_attributes, TEST_ATTRIBUTES) == 0);
+
+    CHECK(uplink_coap.publish(MQTT_TELEMETRY_TOPIC, telemetry, strlen(telemetry), &id) == ESP_OK);
+    CHECK(wait_for(&test_events[MQTT_OUTBOX_DELIVERED], 1));
+    CHECK(test_delivered_id == id);
+    CHECK(strcmp(server_payload, telemetry) == 0);
+
+    /* A lost request is sent again*/
+    server_drop = 1;
+    CHECK(uplink_coap.publish(MQTT_TELEMETRY_TOPIC, telemetry, strlen(telemetry), &id) == ESP_OK);
+    CHECK(wait_for(&test_events[MQTT_OUTBOX_DELIVERED], 2));
+    CHECK(test_delivered_id == id);
+    uplink_coap.get_stats(&stats);
+    CHECK(stats.retransmits == 1);
+
+    /* A refused publish is dropped, not delivered*/
+    server_refuse = true;
+    CHECK(uplink_coap.publish(MQTT_TELEMETRY_TOPIC, telemetry, strlen(telemetry), &id) == ESP_OK);
+    for (int waited = 0; uplink_coap.pending() > 0 && waited < TEST_TIMEOUT_MS; waited += 10)
+    {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    CHECK(uplink_coap.pending() == 0);
+    CHECK(test_events[MQTT_OUTBOX_DELIVERED] == 2);
+
+    CHECK(uplink_coap.publish("v1/devices/me/rpc/request/1", "{}", 2, NULL) == ESP_ERR_NOT_SUPPORTED);
+    CHECK(uplink_coap.publish(MQTT_TELEMETRY_TOPIC, oversized, sizeof(oversized), NULL) == ESP_ERR_INVALID_SIZE);
+
+    uplink_coap.get_stats(&stats);
+    CHECK(server_paths_ok);
+    CHECK(stats.uploads == 2);
+    CHECK(stats.failures == 1);
+    CHECK(stats.max_latency_us > 0 && stats.latency_us >= stats.max_latency_us);
+    /* The messages on both sides, the headers only in the radio time*/
+    CHECK(stats.tx_bytes == server_rx_bytes);
+    CHECK(stats.rx_bytes == server_tx_bytes);
+    CHECK(energy_bytes == stats.tx_bytes + (uint64_t)server_rx_datagrams * IP_UDP_HEADER_LEN);
+
+    CHECK(uplink_coap.stop() == ESP_OK);
+    CHECK(wait_for(&test_events[MQTT_BROKER_DISCONNECTED], 1));
+
+    printf(
+        "coap_test: %" PRIu32 " uploads, %" PRIu32 " retransmits, %" PRIu64 " B sent, %" PRIu64 " B received, ok\n",
+        stats.uploads,
+        stats.retransmits,
+        stats.tx_bytes,
+        stats.rx_bytes
+    );
+    return 0;
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+    return test_writer() || test_parser() || test_uplink();
+}
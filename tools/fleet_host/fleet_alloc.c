@@ -0,0 +1,58 @@
+#include <stddef.h>
+#include "fleet_alloc.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static uint64_t alloc_calls;
+static uint64_t free_calls;
+static uint64_t alloc_bytes;
+
+static void count_alloc(size_t size)
+{
+    __atomic_add_fetch(&alloc_calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+}
+
+void *__wrap_malloc(size_t size)
+{
+    count_alloc(size);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    count_alloc(n * size);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    count_alloc(size);
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+    if (ptr != NULL)
+    {
+        __atomic_add_fetch(&free_calls, 1, __ATOMIC_RELAXED);
+    }
+    __real_free(ptr);
+}
+
+void fleet_alloc_reset(void)
+{
+    __atomic_store_n(&alloc_calls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&free_calls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&alloc_bytes, 0, __ATOMIC_RELAXED);
+}
+
+void fleet_alloc_get_stats(fleet_alloc_stats_t *stats)
+{
+    stats->allocs = __atomic_load_n(&alloc_calls, __ATOMIC_RELAXED);
+    stats->frees = __atomic_load_n(&free_calls, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,28 @@
+/**
+ * @file fleet_alloc.h
+ * @brief Heap calls of a simulated device.
+ *
+ * malloc, calloc, realloc and free are wrapped at link time, so only the
+ * calls from the firmware components and the port are counted, not the ones
+ * made inside libc.
+ */
+#ifndef FLEET_ALLOC_H
+#define FLEET_ALLOC_H
+#include <stdint.h>
+
+/**
+ * @brief Heap calls since the last fleet_alloc_reset.
+ */
+typedef struct {
+    uint64_t allocs; /*!< malloc, calloc and realloc calls */
+    uint64_t frees;  /*!< free calls with a pointer */
+    uint64_t bytes;  /*!< Bytes requested */
+} fleet_alloc_stats_t;
+
+/**
+ * @brief Start counting from zero, e.g. once the device finished booting.
+ */
+void fleet_alloc_reset(void);
+
+void fleet_alloc_get_stats(fleet_alloc_stats_t *stats);
+#endif // !FLEET_ALLOC_H
@@ -0,0 +1,360 @@
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_check.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "fleet.h"
+#include "fleet_device.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mqtt_controller.h"
+#include "runtime_config.h"
+#include "runtime_settings.h"
+#include "sgp30_types.h"
+#include "telemetry_batch.h"
+#include "telemetry_queue.h"
+
+#define FLEET_DEVICE_SENSOR_SAMPLE 0
+#define FLEET_DEVICE_REPORT 1
+#define FLEET_DEVICE_LOOP_QUEUE 16
+#define FLEET_DEVICE_TOKEN_LEN 48
+
+static const char *TAG = "fleet_device";
+
+ESP_EVENT_DEFINE_BASE(FLEET_DEVICE_EVENT);
+
+static const fleet_device_cfg_t *device_cfg;
+static esp_event_loop_handle_t device_loop;
+static thingsboard_cfg_t device_thingsboard_cfg;
+static char device_host[256];
+static uint32_t device_send_time;
+static uint32_t device_windows;
+static int64_t device_started_us;
+static int64_t device_outage_end_us;
+static pthread_mutex_t device_histograms_lock = PTHREAD_MUTEX_INITIALIZER;
+static fleet_device_report_t device_report;
+static SemaphoreHandle_t device_report_ready;
+
+/* Same handler as main.c, stamping the window on the application loop*/
+static void fleet_device_on_measurement(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    sgp30_timed_measurement_t new_log_entry;
+
+    time(&new_log_entry.time);
+    new_log_entry.measurement = *((sgp30_measurement_t *)event_data);
+    telemetry_batch_add(&new_log_entry);
+}
+
+/* The outbox and the queue belong to the application loop*/
+static void fleet_device_on_report(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    mqtt_outbox_get_stats(&device_report.outbox);
+    device_report.queue_pending = telemetry_queue_pending();
+    xSemaphoreGive(device_report_ready);
+}
+
+static void fleet_device_on_runtime_config_update(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    const runtime_config_update_t *update = event_data;
+
+    mqtt_runtime_config_applied(update, runtime_config_apply(update));
+}
+
+static void fleet_device_on_connected(
+    void *handler_args,
+    esp_event_base_t base,
+    int32_t event_id,
+    void *event_data
+)
+{
+    int64_t outage_end_us = __atomic_exchange_n(&device_outage_end_us, 0, __ATOMIC_RELAXED);
+
+    if (outage_end_us == 0)
+    {
+        return;
+    }
+    int64_t waited_us = esp_timer_get_time() - outage_end_us;
+    pthread_mutex_lock(&device_histograms_lock);
+    fleet_histogram_record(&device_report.reconnect, waited_us > 0 ? (uint32_t)waited_us : 0);
+    pthread_mutex_unlock(&device_histograms_lock);
+}
+
+/* Runs on the MQTT client thread*/
+static void fleet_device_on_puback(uint32_t latency_us)
+{
+    pthread_mutex_lock(&device_histograms_lock);
+    fleet_histogram_record(&device_report.ack_latency, latency_us);
+    pthread_mutex_unlock(&device_histograms_lock);
+}
+
+/* The sensor thread samples with the new interval from its next window*/
+static esp_err_t fleet_device_set_send_time(uint32_t send_time)
+{
+    __atomic_store_n(&device_send_time, send_time, __ATOMIC_RELAXED);
+    return ESP_OK;
+}
+
+/* The settings of main.c, without the link policy the host does not have*/
+static const runtime_settings_hooks_t fleet_device_settings_hooks = {
+    .send_time = fleet_device_set_send_time,
+};
+
+static sgp30_measurement_t fleet_device_sample(double elapsed_s, unsigned int *seed)
+{
+    double eco2;
+    double noise = (rand_r(seed) % 21) - 10;
+
+    switch (device_cfg->curve)
+    {
+    case FLEET_CURVE_SINE:
+        eco2 = 700 + 300 * sin(2 * M_PI * elapsed_s / 600 + device_cfg->index);
+        break;
+    case FLEET_CURVE_RAMP:
+        eco2 = 400 + 1600 * elapsed_s / (device_cfg->duration_s > 0 ? device_cfg->duration_s : 1);
+        break;
+    case FLEET_CURVE_STEP:
+        eco2 = ((int)(elapsed_s / 60) % 2) ? 1200 : 500;
+        break;
+    default:
+        eco2 = 450;
+        break;
+    }
+    eco2 += noise;
+    sgp30_measurement_t measurement = {
+        .eCO2 = eco2 < 400 ? 400 : (uint16_t)eco2,
+        .TVOC = eco2 < 400 ? 0 : (uint16_t)((eco2 - 400) / 4),
+    };
+    return measurement;
+}
+
+/* Windows are posted on whole seconds of the wall clock, so their time()
+ stamp is when they were sampled and the monitor can measure from it*/
+static void *fleet_device_sensor_thread(void *arg)
+{
+    unsigned int seed = device_cfg->index + 1;
+    struct timespec next;
+
+    clock_gettime(CLOCK_REALTIME, &next);
+    next.tv_sec += 1 + esp_random() % __atomic_load_n(&device_send_time, __ATOMIC_RELAXED);
+    next.tv_nsec = 0;
+    while (true)
+    {
+        while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &next, NULL) == EINTR)
+        {
+        }
+        double elapsed_s = (esp_timer_get_time() - device_started_us) / 1e6;
+        sgp30_measurement_t measurement = fleet_device_sample(elapsed_s, &seed);
+        esp_event_post_to(
+            device_loop,
+            FLEET_DEVICE_EVENT,
+            FLEET_DEVICE_SENSOR_SAMPLE,
+            &measurement,
+            sizeof(measurement),
+            portMAX_DELAY
+        );
+        __atomic_add_fetch(&device_windows, 1, __ATOMIC_RELAXED);
+        next.tv_sec += __atomic_load_n(&device_send_time, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static esp_err_t fleet_device_boot(void)
+{
+    char token[FLEET_DEVICE_TOKEN_LEN];
+    uint8_t mac[6] = { 0x02, 0xF1, 0xEE, 0x70 };
+    esp_event_loop_args_t loop_args = {
+        .queue_size = FLEET_DEVICE_LOOP_QUEUE,
+        .task_name = "sgp30_event_loop_task",
+        .task_stack_size = 4096,
+        .task_priority = uxTaskPriorityGet(NULL),
+        .task_core_id = tskNO_AFFINITY,
+    };
+
+    mac[4] = device_cfg->index >> 8;
+    mac[5] = device_cfg->index & 0xFF;
+    esp_mac_host_set(mac);
+    snprintf(token, sizeof(token), "%s%04" PRIu32, device_cfg->token_prefix, device_cfg->index);
+    esp_mqtt_client_host_set_credentials(token, token);
+    esp_mqtt_client_host_set_ack_cb(fleet_device_on_puback);
+    device_report_ready = xSemaphoreCreateBinary();
+    ESP_RETURN_ON_FALSE(device_report_ready != NULL, ESP_ERR_NO_MEM, TAG, "Could not create semaphore");
+
+    ESP_RETURN_ON_ERROR(esp_event_loop_create(&loop_args, &device_loop), TAG, "Could not create loop");
+    ESP_RETURN_ON_ERROR(
+        esp_event_handler_register_with(
+            device_loop,
+            FLEET_DEVICE_EVENT,
+            FLEET_DEVICE_SENSOR_SAMPLE,
+            fleet_device_on_measurement,
+            NULL
+        ),
+        TAG,
+        "Could not register sensor handler"
+    );
+    ESP_RETURN_ON_ERROR(
+        esp_event_handler_register_with(device_loop, FLEET_DEVICE_EVENT, FLEET_DEVICE_REPORT, fleet_device_on_report, NULL),
+        TAG,
+        "Could not register report handler"
+    );
+    ESP_RETURN_ON_ERROR(
+        esp_event_handler_register_with(
+            device_loop,
+            MQTT_THINGSBOARD_EVENT,
+            MQTT_RUNTIME_CONFIG_UPDATE,
+            fleet_device_on_runtime_config_update,
+            NULL
+        ),
+        TAG,
+        "Could not register runtime config handler"
+    );
+    ESP_RETURN_ON_ERROR(
+        esp_event_handler_register_with(
+            device_loop,
+            MQTT_THINGSBOARD_EVENT,
+            MQTT_BROKER_CONNECTED,
+            fleet_device_on_connected,
+            NULL
+        ),
+        TAG,
+        "Could not register connected handler"
+    );
+
+    /* Same order as app_main*/
+#if CONFIG_TELEMETRY_BATCH_STORE_AND_FORWARD
+    ESP_RETURN_ON_ERROR(telemetry_queue_init(device_loop), TAG, "Could not init the telemetry queue");
+#endif
+    ESP_RETURN_ON_ERROR(telemetry_batch_init(device_loop), TAG, "Could not init the telemetry batch");
+    ESP_RETURN_ON_ERROR(telemetry_batch_set_size(device_cfg->batch_size), TAG, "Invalid batch size");
+    ESP_RETURN_ON_ERROR(telemetry_batch_set_deadline(device_cfg->batch_deadline), TAG, "Invalid batch deadline");
+#if CONFIG_FLEET_UPLOAD_SLOTTING
+    ESP_RETURN_ON_ERROR(
+        telemetry_batch_set_slot(device_cfg->send_time * 1000, fleet_slot_offset(device_cfg->send_time * 1000)),
+        TAG,
+        "Could not set the upload slot"
+    );
+#endif
+    device_send_time = device_cfg->send_time;
+    ESP_RETURN_ON_ERROR(
+        runtime_settings_init(&(runtime_settings_t) {
+            .send_time = device_cfg->send_time,
+            .batch_size = device_cfg->batch_size,
+            .batch_deadline = device_cfg->batch_deadline,
+        }, &fleet_device_settings_hooks),
+        TAG,
+        "Could not init the runtime settings"
+    );
+    snprintf(device_host, sizeof(device_host), "%s", device_cfg->broker_host);
+    device_thingsboard_cfg.address.uri = device_host;
+    device_thingsboard_cfg.address.port = device_cfg->broker_port;
+    ESP_RETURN_ON_ERROR(mqtt_init(device_loop, &device_thingsboard_cfg, NULL), TAG, "Could not start MQTT");
+    return ESP_OK;
+}
+
+static uint64_t fleet_device_cpu_us(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+        + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+void fleet_device_run(const fleet_device_cfg_t *cfg, int report_fd)
+{
+    pthread_t sensor_thread;
+    sigset_t signals;
+    struct timespec now;
+    struct timespec end;
+
+    device_cfg = cfg;
+    device_report.index = cfg->index;
+    esp_log_level_set("*", cfg->log_level);
+    device_started_us = esp_timer_get_time();
+    device_report.init_result = fleet_device_boot();
+    if (device_report.init_result != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Device %" PRIu32 " did not boot: %s", cfg->index, esp_err_to_name(device_report.init_result));
+        if (write(report_fd, &device_report, sizeof(device_report)) != sizeof(device_report))
+        {
+            ESP_LOGE(TAG, "Could not write the report");
+        }
+        return;
+    }
+    /* Only the steady state is measured*/
+    fleet_alloc_reset();
+    uint64_t booted_cpu_us = fleet_device_cpu_us();
+    int64_t booted_loop_cpu_us = esp_event_loop_host_cpu_us(device_loop);
+    pthread_create(&sensor_thread, NULL, fleet_device_sensor_thread, NULL);
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += cfg->duration_s;
+    while (true)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t left_ns = (end.tv_sec - now.tv_sec) * 1000000000LL + (end.tv_nsec - now.tv_nsec);
+        if (left_ns <= 0)
+        {
+            break;
+        }
+        struct timespec timeout = { .tv_sec = left_ns / 1000000000, .tv_nsec = left_ns % 1000000000 };
+        int signal = sigtimedwait(&signals, NULL, &timeout);
+        if (signal == SIGUSR2)
+        {
+            break;
+        }
+        if (signal == SIGUSR1)
+        {
+            ESP_LOGI(TAG, "Outage of %" PRIu32 " ms", cfg->outage_ms);
+            __atomic_store_n(&device_outage_end_us, esp_timer_get_time() + (int64_t)cfg->outage_ms * 1000, __ATOMIC_RELAXED);
+            esp_mqtt_client_host_outage(cfg->outage_ms);
+            device_report.storms++;
+        }
+    }
+
+    if (esp_event_post_to(device_loop, FLEET_DEVICE_EVENT, FLEET_DEVICE_REPORT, NULL, 0, portMAX_DELAY) != ESP_OK
+        || xSemaphoreTake(device_report_ready, pdMS_TO_TICKS(5000)) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Event loop stuck, outbox figures missing");
+    }
+    device_report.windows = __atomic_load_n(&device_windows, __ATOMIC_RELAXED);
+    esp_mqtt_client_host_get_stats(&device_report.mqtt);
+    device_report.cpu_us = fleet_device_cpu_us() - booted_cpu_us;
+    device_report.loop_cpu_us = esp_event_loop_host_cpu_us(device_loop) - booted_loop_cpu_us;
+    fleet_alloc_get_stats(&device_report.alloc);
+    pthread_mutex_lock(&device_histograms_lock);
+    ssize_t written = write(report_fd, &device_report, sizeof(device_report));
+    pthread_mutex_unlock(&device_histograms_lock);
+    if (written != sizeof(device_report))
+    {
+        ESP_LOGE(TAG, "Could not write the report");
+    }
+}
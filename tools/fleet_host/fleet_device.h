@@ -0,0 +1,76 @@
+/**
+ * @file fleet_device.h
+ * @brief One simulated classroom node.
+ *
+ * The device runs the firmware path from the SGP30 event to the broker:
+ * telemetry_batch, telemetry_queue, mqtt_controller with its outbox, router
+ * and RPC, runtime_config and fleet, on the host port of esp_event,
+ * esp_timer, esp_partition and esp-mqtt. Every device is a process of its
+ * own since the components keep their state in globals.
+ */
+#ifndef FLEET_DEVICE_H
+#define FLEET_DEVICE_H
+#include <stdint.h>
+#include "esp_log.h"
+#include "fleet_alloc.h"
+#include "fleet_histogram.h"
+#include "mqtt_client.h"
+#include "mqtt_outbox.h"
+
+/**
+ * @brief Shape of the simulated eCO2 and TVOC.
+ */
+typedef enum {
+    FLEET_CURVE_FLAT,  /*!< Constant with sensor noise */
+    FLEET_CURVE_SINE,  /*!< Occupancy over a 10 minute cycle */
+    FLEET_CURVE_RAMP,  /*!< Rising during the whole run, a class without ventilation */
+    FLEET_CURVE_STEP,  /*!< Jumping between two levels every minute */
+} fleet_curve_t;
+
+/**
+ * @brief Settings of a device.
+ */
+typedef struct {
+    uint32_t index;             /*!< Position in the fleet, gives the MAC and the token */
+    const char *broker_host;    /*!< Broker without TLS */
+    uint16_t broker_port;
+    const char *token_prefix;   /*!< Access token is the prefix and the index */
+    uint32_t duration_s;        /*!< Time to run before reporting */
+    uint32_t send_time;         /*!< Seconds between windows */
+    uint16_t batch_size;        /*!< Windows per publish */
+    uint32_t batch_deadline;    /*!< Seconds a window waits at most */
+    fleet_curve_t curve;
+    uint32_t outage_ms;         /*!< Length of the outage of a reconnect storm */
+    esp_log_level_t log_level;
+} fleet_device_cfg_t;
+
+/**
+ * @brief What a device measured, written to the orchestrator at the end.
+ */
+typedef struct {
+    uint32_t index;
+    esp_err_t init_result;           /*!< ESP_OK if the firmware started */
+    uint32_t windows;                /*!< Windows sampled */
+    uint32_t storms;                 /*!< Outages injected */
+    uint32_t queue_pending;          /*!< Payloads left in store and forward */
+    mqtt_outbox_stats_t outbox;
+    esp_mqtt_client_host_stats_t mqtt;
+    uint64_t cpu_us;                 /*!< CPU time of the device after booting */
+    uint64_t loop_cpu_us;            /*!< Part of cpu_us spent on the event loop */
+    fleet_alloc_stats_t alloc;       /*!< Heap calls after booting */
+    fleet_histogram_t ack_latency;   /*!< From the first write to the PUBACK */
+    fleet_histogram_t reconnect;     /*!< From the end of an outage to the session */
+} fleet_device_report_t;
+
+/**
+ * @brief Run a device in the calling process and write its report.
+ *
+ * It returns after cfg->duration_s, or earlier on SIGUSR2. Every SIGUSR1
+ * starts an outage of cfg->outage_ms. Both signals have to be blocked in
+ * the calling thread before.
+ *
+ * @param cfg Settings of the device.
+ * @param report_fd Where the fleet_device_report_t is written.
+ */
+void fleet_device_run(const fleet_device_cfg_t *cfg, int report_fd);
+#endif // !FLEET_DEVICE_H
@@ -0,0 +1,75 @@
+#include "fleet_histogram.h"
+
+static uint32_t bucket_of(uint32_t value_us)
+{
+    if (value_us < FLEET_HISTOGRAM_SUB_BUCKETS)
+    {
+        return value_us;
+    }
+    uint32_t exponent = 31 - __builtin_clz(value_us);
+    uint32_t sub = (value_us >> (exponent - 4)) & (FLEET_HISTOGRAM_SUB_BUCKETS - 1);
+    return FLEET_HISTOGRAM_SUB_BUCKETS * (exponent - 3) + sub;
+}
+
+/* Middle of the values a bucket holds*/
+static uint32_t bucket_value(uint32_t bucket)
+{
+    if (bucket < FLEET_HISTOGRAM_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    uint32_t exponent = bucket / FLEET_HISTOGRAM_SUB_BUCKETS + 3;
+    uint32_t sub = bucket % FLEET_HISTOGRAM_SUB_BUCKETS;
+    uint64_t low = ((uint64_t)(FLEET_HISTOGRAM_SUB_BUCKETS + sub)) << (exponent - 4);
+    return (uint32_t)(low + (1ull << (exponent - 4)) / 2);
+}
+
+void fleet_histogram_record(fleet_histogram_t *histogram, uint32_t value_us)
+{
+    histogram->counts[bucket_of(value_us)]++;
+    histogram->count++;
+    histogram->sum_us += value_us;
+    if (value_us > histogram->max_us)
+    {
+        histogram->max_us = value_us;
+    }
+}
+
+void fleet_histogram_merge(fleet_histogram_t *histogram, const fleet_histogram_t *other)
+{
+    for (uint32_t i = 0; i < FLEET_HISTOGRAM_BUCKETS; i++)
+    {
+        histogram->counts[i] += other->counts[i];
+    }
+    histogram->count += other->count;
+    histogram->sum_us += other->sum_us;
+    if (other->max_us > histogram->max_us)
+    {
+        histogram->max_us = other->max_us;
+    }
+}
+
+uint32_t fleet_histogram_percentile(const fleet_histogram_t *histogram, double fraction)
+{
+    uint64_t seen = 0;
+    uint64_t rank = (uint64_t)(fraction * histogram->count + 0.5);
+
+    if (histogram->count == 0)
+    {
+        return 0;
+    }
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    for (uint32_t i = 0; i < FLEET_HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->counts[i];
+        if (seen >= rank)
+        {
+            uint32_t value = bucket_value(i);
+            return value < histogram->max_us ? value : histogram->max_us;
+        }
+    }
+    return histogram->max_us;
+}
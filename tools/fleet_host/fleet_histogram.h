@@ -0,0 +1,43 @@
+/**
+ * @file fleet_histogram.h
+ * @brief Latency histogram with a relative error under 4%.
+ *
+ * Values below 16 us have their own bucket, every power of two above is
+ * split in 16 buckets. It is a plain struct so the devices can send it to
+ * the orchestrator through a pipe.
+ */
+#ifndef FLEET_HISTOGRAM_H
+#define FLEET_HISTOGRAM_H
+#include <stdint.h>
+
+#define FLEET_HISTOGRAM_SUB_BUCKETS 16
+#define FLEET_HISTOGRAM_BUCKETS (FLEET_HISTOGRAM_SUB_BUCKETS * 29)
+
+/**
+ * @brief Histogram of values in microseconds.
+ */
+typedef struct {
+    uint32_t counts[FLEET_HISTOGRAM_BUCKETS];
+    uint64_t count;   /*!< Values recorded */
+    uint64_t sum_us;  /*!< Sum of the values */
+    uint32_t max_us;  /*!< Largest value */
+} fleet_histogram_t;
+
+/**
+ * @brief Record a value, it is not thread safe.
+ */
+void fleet_histogram_record(fleet_histogram_t *histogram, uint32_t value_us);
+
+/**
+ * @brief Add the values of other into histogram.
+ */
+void fleet_histogram_merge(fleet_histogram_t *histogram, const fleet_histogram_t *other);
+
+/**
+ * @brief Value under which a fraction of the recorded values fall.
+ *
+ * @param fraction From 0 to 1, e.g. 0.99 for the 99th percentile.
+ * @return The value in microseconds, 0 if nothing was recorded.
+ */
+uint32_t fleet_histogram_percentile(const fleet_histogram_t *histogram, double fraction);
+#endif // !FLEET_HISTOGRAM_H
@@ -0,0 +1,463 @@
+/*
+ * Load generator for the broker built from the firmware components.
+ *
+ * Every simulated node is a child process running the telemetry path of
+ * the firmware (see fleet_device.h) against a broker without TLS. The
+ * parent injects the reconnect storms, subscribes to the telemetry topic to
+ * time the deliveries (see fleet_monitor.h) and prints the figures of the
+ * whole fleet at the end.
+ *
+ *     fleet_host --devices 50 --duration 120 --send-time 5 --batch-size 2
+ *     fleet_host --devices 200 --storm-at 60,120 --outage 5000
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "fleet_device.h"
+#include "fleet_monitor.h"
+#include "mqtt_controller.h"
+#include "runtime_settings.h"
+
+#define FLEET_MAX_STORMS 16
+#define FLEET_MAX_DEVICES 4096
+
+typedef struct {
+    pid_t pid;
+    int report_fd;
+} fleet_child_t;
+
+static volatile sig_atomic_t fleet_interrupted;
+
+static void on_interrupt(int signal)
+{
+    fleet_interrupted = 1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(
+        stderr,
+        "usage: %s [options]\n"
+        "  --broker HOST[:PORT]     broker without TLS, default 127.0.0.1:1883\n"
+        "  --devices N              simulated nodes, default 10\n"
+        "  --duration S             seconds to run, default 60\n"
+        "  --send-time S            seconds between windows, default 10\n"
+        "  --batch-size N           windows per publish, default %d\n"
+        "  --batch-deadline S       seconds a window waits at most, default %d\n"
+        "  --storm-at S[,S...]      seconds when every node loses the network\n"
+        "  --outage MS              length of every outage, default 5000\n"
+        "  --curve flat|sine|ramp|step  shape of the measurements, default sine\n"
+        "  --token-prefix PREFIX    access tokens are PREFIX0000, PREFIX0001...\n"
+        "  --log-level 0-5          firmware log level, default 1 (errors)\n"
+        "  --no-monitor             do not subscribe to the telemetry, e.g. for ThingsBoard\n",
+        name,
+        CONFIG_TELEMETRY_BATCH_DEFAULT_SIZE,
+        CONFIG_TELEMETRY_BATCH_DEFAULT_DEADLINE
+    );
+}
+
+static int parse_curve(const char *name, fleet_curve_t *curve)
+{
+    static const char *const names[] = { "flat", "sine", "ramp", "step" };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *curve = (fleet_curve_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static bool read_report(int fd, fleet_device_report_t *report)
+{
+    uint8_t *p = (uint8_t *)report;
+    size_t left = sizeof(*report);
+
+    while (left > 0)
+    {
+        ssize_t got = read(fd, p, left);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return false;
+        }
+        p += got;
+        left -= got;
+    }
+    return true;
+}
+
+static void print_latency(const char *name, const fleet_histogram_t *histogram)
+{
+    if (histogram->count == 0)
+    {
+        printf("%-18s no samples\n", name);
+        return;
+    }
+    printf(
+        "%-18s p50 %.1f ms  p90 %.1f ms  p99 %.1f ms  max %.1f ms  (%" PRIu64 " samples)\n",
+        name,
+        fleet_histogram_percentile(histogram, 0.50) / 1000.0,
+        fleet_histogram_percentile(histogram, 0.90) / 1000.0,
+        fleet_histogram_percentile(histogram, 0.99) / 1000.0,
+        histogram->max_us / 1000.0,
+        histogram->count
+    );
+}
+
+static void sleep_until(const struct timespec *started, uint32_t at_s)
+{
+    struct timespec at = { .tv_sec = started->tv_sec + at_s, .tv_nsec = started->tv_nsec };
+
+    while (!fleet_interrupted && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) == EINTR)
+    {
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "broker", required_argument, NULL, 'b' },
+        { "devices", required_argument, NULL, 'n' },
+        { "duration", required_argument, NULL, 'd' },
+        { "send-time", required_argument, NULL, 't' },
+        { "batch-size", required_argument, NULL, 's' },
+        { "batch-deadline", required_argument, NULL, 'D' },
+        { "storm-at", required_argument, NULL, 'S' },
+        { "outage", required_argument, NULL, 'o' },
+        { "curve", required_argument, NULL, 'c' },
+        { "token-prefix", required_argument, NULL, 'p' },
+        { "log-level", required_argument, NULL, 'l' },
+        { "no-monitor", no_argument, NULL, 'M' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    static char host[256] = "127.0.0.1";
+    fleet_device_cfg_t cfg = {
+        .broker_host = host,
+        .broker_port = 1883,
+        .token_prefix = "fleet-",
+        .duration_s = 60,
+        .send_time = 10,
+        .batch_size = CONFIG_TELEMETRY_BATCH_DEFAULT_SIZE,
+        .batch_deadline = CONFIG_TELEMETRY_BATCH_DEFAULT_DEADLINE,
+        .curve = FLEET_CURVE_SINE,
+        .outage_ms = 5000,
+        .log_level = ESP_LOG_ERROR,
+    };
+    uint32_t devices = 10;
+    uint32_t storms[FLEET_MAX_STORMS];
+    size_t storms_len = 0;
+    bool monitor = true;
+    int option;
+
+    while ((option = getopt_long(argc, argv, "h", options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'b': {
+            snprintf(host, sizeof(host), "%s", optarg);
+            char *colon = strrchr(host, ':');
+            if (colon != NULL)
+            {
+                *colon = '\0';
+                cfg.broker_port = atoi(colon + 1);
+            }
+            break;
+        }
+        case 'n':
+            devices = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            cfg.duration_s = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            cfg.send_time = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            cfg.batch_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'D':
+            cfg.batch_deadline = strtoul(optarg, NULL, 10);
+            break;
+        case 'S':
+            for (char *at = strtok(optarg, ","); at != NULL && storms_len < FLEET_MAX_STORMS; at = strtok(NULL, ","))
+            {
+                storms[storms_len++] = strtoul(at, NULL, 10);
+            }
+            break;
+        case 'o':
+            cfg.outage_ms = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            if (parse_curve(optarg, &cfg.curve) != 0)
+            {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'p':
+            cfg.token_prefix = optarg;
+            break;
+        case 'l':
+            cfg.log_level = (esp_log_level_t)atoi(optarg);
+            break;
+        case 'M':
+            monitor = false;
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+    if (devices == 0 || devices > FLEET_MAX_DEVICES || cfg.send_time == 0
+        || cfg.send_time > RUNTIME_SETTINGS_MAX_SECONDS || cfg.batch_size == 0
+        || cfg.batch_size > CONFIG_TELEMETRY_BATCH_CAPACITY
+        || cfg.batch_deadline > RUNTIME_SETTINGS_MAX_SECONDS || cfg.broker_port == 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    for (size_t i = 1; i < storms_len; i++)
+    {
+        if (storms[i] < storms[i - 1])
+        {
+            fprintf(stderr, "--storm-at has to be increasing\n");
+            return 2;
+        }
+    }
+
+    if (monitor && fleet_monitor_start(host, cfg.broker_port, cfg.duration_s) != 0)
+    {
+        fprintf(stderr, "Could not subscribe to %s on %s:%u\n", MQTT_TELEMETRY_TOPIC, host, cfg.broker_port);
+        return 1;
+    }
+
+    /* The devices take the storms with sigtimedwait, and Ctrl-C only from the parent*/
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    fleet_child_t *children = calloc(devices, sizeof(fleet_child_t));
+    if (children == NULL)
+    {
+        return 1;
+    }
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    for (uint32_t i = 0; i < devices; i++)
+    {
+        int fds[2];
+        if (pipe(fds) != 0)
+        {
+            perror("pipe");
+            devices = i;
+            break;
+        }
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            signal(SIGINT, SIG_IGN);
+            close(fds[0]);
+            for (uint32_t j = 0; j < i; j++)
+            {
+                close(children[j].report_fd);
+            }
+            cfg.index = i;
+            fleet_device_run(&cfg, fds[1]);
+            _exit(0);
+        }
+        close(fds[1]);
+        if (pid < 0)
+        {
+            perror("fork");
+            close(fds[0]);
+            devices = i;
+            break;
+        }
+        children[i] = (fleet_child_t) { .pid = pid, .report_fd = fds[0] };
+    }
+    struct sigaction interrupt = { .sa_handler = on_interrupt };
+    sigaction(SIGINT, &interrupt, NULL);
+    fprintf(stderr, "%" PRIu32 " devices started against %s:%u\n", devices, host, cfg.broker_port);
+
+    for (size_t s = 0; s < storms_len && !fleet_interrupted; s++)
+    {
+        if (storms[s] >= cfg.duration_s)
+        {
+            break;
+        }
+        sleep_until(&started, storms[s]);
+        if (fleet_interrupted)
+        {
+            break;
+        }
+        fprintf(stderr, "Reconnect storm at %" PRIu32 " s\n", storms[s]);
+        for (uint32_t i = 0; i < devices; i++)
+        {
+            kill(children[i].pid, SIGUSR1);
+        }
+    }
+    sleep_until(&started, cfg.duration_s);
+    if (fleet_interrupted)
+    {
+        for (uint32_t i = 0; i < devices; i++)
+        {
+            kill(children[i].pid, SIGUSR2);
+        }
+    }
+
+    fleet_device_report_t *report = malloc(sizeof(*report));
+    fleet_device_report_t total = { 0 };
+    uint32_t reported = 0;
+    uint32_t failed = 0;
+    uint32_t max_slots = 0;
+    for (uint32_t i = 0; i < devices && report != NULL; i++)
+    {
+        if (!read_report(children[i].report_fd, report))
+        {
+            failed++;
+        }
+        else if (report->init_result != ESP_OK)
+        {
+            failed++;
+        }
+        else
+        {
+            reported++;
+            total.windows += report->windows;
+            total.storms += report->storms;
+            total.queue_pending += report->queue_pending;
+            total.outbox.admitted += report->outbox.admitted;
+            total.outbox.rejected += report->outbox.rejected;
+            total.outbox.dropped += report->outbox.dropped;
+            total.outbox.delivered += report->outbox.delivered;
+            max_slots = report->outbox.slots_peak > max_slots ? report->outbox.slots_peak : max_slots;
+            total.mqtt.connects += report->mqtt.connects;
+            total.mqtt.connect_failures += report->mqtt.connect_failures;
+            total.mqtt.publishes += report->mqtt.publishes;
+            total.mqtt.resends += report->mqtt.resends;
+            total.mqtt.pubacks += report->mqtt.pubacks;
+            total.mqtt.expired += report->mqtt.expired;
+            total.mqtt.tx_bytes += report->mqtt.tx_bytes;
+            total.mqtt.rx_bytes += report->mqtt.rx_bytes;
+            total.cpu_us += report->cpu_us;
+            total.loop_cpu_us += report->loop_cpu_us;
+            total.alloc.allocs += report->alloc.allocs;
+            total.alloc.frees += report->alloc.frees;
+            total.alloc.bytes += report->alloc.bytes;
+            fleet_histogram_merge(&total.ack_latency, &report->ack_latency);
+            fleet_histogram_merge(&total.reconnect, &report->reconnect);
+        }
+        close(children[i].report_fd);
+        waitpid(children[i].pid, NULL, 0);
+    }
+    free(report);
+    free(children);
+    struct timespec ended;
+    clock_gettime(CLOCK_MONOTONIC, &ended);
+    double elapsed_s = (ended.tv_sec - started.tv_sec) + (ended.tv_nsec - started.tv_nsec) / 1e9;
+
+    fleet_monitor_stats_t monitor_stats = { 0 };
+    if (monitor)
+    {
+        /* Let the last publishes arrive*/
+        sleep(1);
+        fleet_monitor_stop(&monitor_stats);
+    }
+
+    uint64_t uploads = total.mqtt.pubacks > 0 ? total.mqtt.pubacks : 1;
+    uint64_t per_device = reported > 0 ? reported : 1;
+    printf(
+        "\n%" PRIu32 " devices (%" PRIu32 " failed) for %.0f s, window every %" PRIu32 " s, %u windows or %" PRIu32
+        " s per publish\n",
+        reported,
+        failed,
+        elapsed_s,
+        cfg.send_time,
+        cfg.batch_size,
+        cfg.batch_deadline
+    );
+    printf(
+        "%-18s %" PRIu32 " acknowledged, %.1f/s, %" PRIu32 " written, %" PRIu32 " resent, %" PRIu32 " expired\n",
+        "Publishes",
+        total.mqtt.pubacks,
+        total.mqtt.pubacks / elapsed_s,
+        total.mqtt.publishes,
+        total.mqtt.resends,
+        total.mqtt.expired
+    );
+    if (monitor_stats.connected)
+    {
+        printf(
+            "%-18s %" PRIu64 " received, peak %" PRIu32 "/s, %" PRIu64 " windows of %" PRIu32 " sampled\n",
+            "Broker delivered",
+            monitor_stats.publishes,
+            monitor_stats.peak_rate,
+            monitor_stats.windows,
+            total.windows
+        );
+    }
+    print_latency("PUBACK latency", &total.ack_latency);
+    if (monitor_stats.connected)
+    {
+        print_latency("Sample to monitor", &monitor_stats.latency);
+    }
+    printf(
+        "%-18s %" PRIu32 " sessions, %" PRIu32 " failed attempts, %" PRIu32 " outages\n",
+        "Connections",
+        total.mqtt.connects,
+        total.mqtt.connect_failures,
+        total.storms
+    );
+    if (total.reconnect.count > 0)
+    {
+        print_latency("Back after outage", &total.reconnect);
+    }
+    printf(
+        "%-18s %.1f ms per device, %.0f us per upload, %.0f%% on the event loop\n",
+        "Device CPU",
+        total.cpu_us / 1000.0 / per_device,
+        (double)total.cpu_us / uploads,
+        total.cpu_us > 0 ? 100.0 * total.loop_cpu_us / total.cpu_us : 0.0
+    );
+    printf(
+        "%-18s %.1f allocations and %.0f bytes per upload, %" PRIu64 " not freed\n",
+        "Heap",
+        (double)total.alloc.allocs / uploads,
+        (double)total.alloc.bytes / uploads,
+        total.alloc.allocs > total.alloc.frees ? total.alloc.allocs - total.alloc.frees : 0
+    );
+    printf(
+        "%-18s %.0f B sent and %.0f B received per upload\n",
+        "MQTT traffic",
+        (double)total.mqtt.tx_bytes / uploads,
+        (double)total.mqtt.rx_bytes / uploads
+    );
+    printf(
+        "%-18s %" PRIu32 " payloads in store and forward, outbox peak %" PRIu32 " of %d slots, %" PRIu32
+        " rejected, %" PRIu32 " dropped\n",
+        "Backlog",
+        total.queue_pending,
+        max_slots,
+        CONFIG_MQTT_OUTBOX_SLOTS,
+        total.outbox.rejected,
+        total.outbox.dropped
+    );
+    return failed > 0 ? 1 : 0;
+}
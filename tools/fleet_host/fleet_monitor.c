@@ -0,0 +1,173 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "fleet_monitor.h"
+#include "mqtt_controller.h"
+#include "mqtt_wire.h"
+
+#define MONITOR_TIMEOUT_MS 5000
+#define MONITOR_KEEPALIVE 60
+#define MONITOR_MAX_PACKET 65536
+#define MONITOR_POLL_MS 500
+
+static int monitor_sock = -1;
+static pthread_t monitor_thread;
+static bool monitor_stopping;
+static fleet_monitor_stats_t monitor_stats;
+static uint32_t *monitor_rates;
+static uint32_t monitor_rates_len;
+static int64_t monitor_started_s;
+static uint8_t monitor_packet[MONITOR_MAX_PACKET];
+
+static int64_t wall_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Telemetry is a JSON object or array of {"ts":...,"values":{...}}*/
+static void monitor_on_telemetry(const char *payload, size_t len, int64_t received_ms)
+{
+    int64_t newest_ts = 0;
+    uint32_t windows = 0;
+
+    for (const char *p = payload; (p = memmem(p, payload + len - p, "\"ts\":", 5)) != NULL; p += 5)
+    {
+        int64_t ts = strtoll(p + 5, NULL, 10);
+        newest_ts = ts > newest_ts ? ts : newest_ts;
+        windows++;
+    }
+    monitor_stats.publishes++;
+    monitor_stats.windows += windows;
+    monitor_stats.bytes += len;
+    if (newest_ts > 0)
+    {
+        int64_t latency_ms = received_ms - newest_ts;
+        fleet_histogram_record(&monitor_stats.latency, latency_ms > 0 ? (uint32_t)(latency_ms * 1000) : 0);
+    }
+    int64_t second = received_ms / 1000 - monitor_started_s;
+    if (second >= 0 && second < monitor_rates_len)
+    {
+        monitor_rates[second]++;
+    }
+}
+
+static void *monitor_receive(void *arg)
+{
+    uint8_t header;
+    size_t remaining;
+    int64_t last_ping_ms = wall_ms();
+
+    while (!__atomic_load_n(&monitor_stopping, __ATOMIC_RELAXED))
+    {
+        struct pollfd pfd = { .fd = monitor_sock, .events = POLLIN };
+        if (wall_ms() - last_ping_ms > MONITOR_KEEPALIVE * 1000 / 2)
+        {
+            uint8_t ping[2];
+            mqtt_wire_send(monitor_sock, ping, mqtt_wire_empty(ping, MQTT_WIRE_PINGREQ));
+            last_ping_ms = wall_ms();
+        }
+        if (poll(&pfd, 1, MONITOR_POLL_MS) <= 0)
+        {
+            continue;
+        }
+        if (!mqtt_wire_recv_header(monitor_sock, &header, &remaining, MONITOR_TIMEOUT_MS))
+        {
+            break;
+        }
+        if ((header & 0xF0) != MQTT_WIRE_PUBLISH || remaining > sizeof(monitor_packet))
+        {
+            if (!mqtt_wire_skip(monitor_sock, remaining, MONITOR_TIMEOUT_MS))
+            {
+                break;
+            }
+            continue;
+        }
+        if (!mqtt_wire_recv(monitor_sock, monitor_packet, remaining, MONITOR_TIMEOUT_MS))
+        {
+            break;
+        }
+        int64_t received_ms = wall_ms();
+        size_t topic_len = monitor_packet[0] << 8 | monitor_packet[1];
+        size_t data_at = 2 + topic_len + (((header >> 1) & 3) > 0 ? 2 : 0);
+        if (data_at <= remaining)
+        {
+            monitor_on_telemetry((const char *)&monitor_packet[data_at], remaining - data_at, received_ms);
+        }
+    }
+    return NULL;
+}
+
+int fleet_monitor_start(const char *host, uint16_t port, uint32_t duration_s)
+{
+    uint8_t packet[128];
+    uint8_t header;
+    uint8_t ack[8];
+    size_t remaining;
+    mqtt_wire_connect_t connect = {
+        .client_id = "fleet_monitor",
+        .keepalive = MONITOR_KEEPALIVE,
+        .clean_session = true,
+    };
+
+    monitor_sock = mqtt_wire_dial(host, port, MONITOR_TIMEOUT_MS);
+    if (monitor_sock < 0)
+    {
+        return -1;
+    }
+    size_t len = mqtt_wire_connect(packet, sizeof(packet), &connect);
+    if (!mqtt_wire_send(monitor_sock, packet, len)
+        || !mqtt_wire_recv_header(monitor_sock, &header, &remaining, MONITOR_TIMEOUT_MS)
+        || header != MQTT_WIRE_CONNACK || remaining != 2
+        || !mqtt_wire_recv(monitor_sock, ack, 2, MONITOR_TIMEOUT_MS) || ack[1] != 0)
+    {
+        close(monitor_sock);
+        return -1;
+    }
+    len = mqtt_wire_subscribe(packet, sizeof(packet), 1, MQTT_TELEMETRY_TOPIC, 0);
+    if (!mqtt_wire_send(monitor_sock, packet, len)
+        || !mqtt_wire_recv_header(monitor_sock, &header, &remaining, MONITOR_TIMEOUT_MS)
+        || header != MQTT_WIRE_SUBACK || remaining != 3
+        || !mqtt_wire_recv(monitor_sock, ack, 3, MONITOR_TIMEOUT_MS) || ack[2] == 0x80)
+    {
+        close(monitor_sock);
+        return -1;
+    }
+    /* Room for the publishes arriving after the devices stop*/
+    monitor_rates_len = duration_s + 60;
+    monitor_rates = calloc(monitor_rates_len, sizeof(uint32_t));
+    monitor_started_s = wall_ms() / 1000;
+    monitor_stats.connected = true;
+    pthread_create(&monitor_thread, NULL, monitor_receive, NULL);
+    return 0;
+}
+
+void fleet_monitor_stop(fleet_monitor_stats_t *stats)
+{
+    if (monitor_sock >= 0 && monitor_stats.connected)
+    {
+        uint8_t disconnect[2];
+        __atomic_store_n(&monitor_stopping, true, __ATOMIC_RELAXED);
+        pthread_join(monitor_thread, NULL);
+        mqtt_wire_send(monitor_sock, disconnect, mqtt_wire_empty(disconnect, MQTT_WIRE_DISCONNECT));
+        close(monitor_sock);
+        monitor_sock = -1;
+        for (uint32_t i = 0; i < monitor_rates_len; i++)
+        {
+            if (monitor_rates[i] > monitor_stats.peak_rate)
+            {
+                monitor_stats.peak_rate = monitor_rates[i];
+            }
+        }
+        free(monitor_rates);
+    }
+    *stats = monitor_stats;
+}
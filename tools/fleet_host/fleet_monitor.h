@@ -0,0 +1,40 @@
+/**
+ * @file fleet_monitor.h
+ * @brief Subscriber measuring what the broker delivers.
+ *
+ * It subscribes to the device telemetry topic and, for every payload,
+ * measures the time from the newest window it carries (its "ts") to its
+ * arrival, and counts the publishes of every second. It needs a broker
+ * that forwards the devices' topic to other clients, like mosquitto.
+ * ThingsBoard does not, and no figures are gathered against it.
+ */
+#ifndef FLEET_MONITOR_H
+#define FLEET_MONITOR_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "fleet_histogram.h"
+
+/**
+ * @brief Figures of the monitor.
+ */
+typedef struct {
+    bool connected;              /*!< The subscription was accepted */
+    uint64_t publishes;          /*!< Telemetry payloads received */
+    uint64_t windows;            /*!< Windows in them */
+    uint64_t bytes;              /*!< Payload bytes */
+    uint32_t peak_rate;          /*!< Most publishes received within one second */
+    fleet_histogram_t latency;   /*!< From the sampling of the newest window to the arrival */
+} fleet_monitor_stats_t;
+
+/**
+ * @brief Connect and start receiving in a thread.
+ *
+ * @return 0 on success, -1 if the broker could not be reached.
+ */
+int fleet_monitor_start(const char *host, uint16_t port, uint32_t duration_s);
+
+/**
+ * @brief Stop receiving and get the figures.
+ */
+void fleet_monitor_stop(fleet_monitor_stats_t *stats);
+#endif // !FLEET_MONITOR_H
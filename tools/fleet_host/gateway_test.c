@@ -0,0 +1,197 @@
+/*
+ * Test of the gateway role over gateway_link_loopback.
+ *
+ * A leaf and a gateway run on one event loop like they would on two nodes,
+ * the leaf frames reaching the gateway through the loopback link. The
+ * payload the gateway publishes is captured in place of the telemetry
+ * queue and checked against the windows the leaf was given, then a
+ * malformed frame and a second batch are checked. It exits with 1 on the
+ * first failed check.
+ *
+ *     gateway_test
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "gateway.h"
+#include "gateway_frame.h"
+#include "mqtt_controller.h"
+#include "telemetry_queue.h"
+
+#define CHECK(cond)                                                        \
+    do                                                                     \
+    {                                                                      \
+        if (!(cond))                                                       \
+        {                                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                      \
+        }                                                                  \
+    } while (0)
+
+ESP_EVENT_DEFINE_BASE(GATEWAY_TEST_EVENT);
+
+static const uint8_t test_mac[6] = { 0x02, 0x47, 0x57, 0x00, 0x00, 0x01 };
+
+static esp_event_loop_handle_t test_loop;
+static SemaphoreHandle_t test_done;
+static char published_topic[64];
+static char published[CONFIG_GATEWAY_MAX_BYTES + 1];
+static size_t published_count;
+
+/* The gateway publishes through the queue, the payload is kept here*/
+esp_err_t telemetry_queue_append(const char *topic, const uint8_t *payload, size_t len)
+{
+    snprintf(published_topic, sizeof(published_topic), "%s", topic);
+    memcpy(published, payload, len);
+    published[len] = '\0';
+    published_count++;
+    return ESP_OK;
+}
+
+typedef void (*test_step_t)(void);
+
+static void test_on_step(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    test_step_t step = *(test_step_t *)event_data;
+
+    if (step != NULL)
+    {
+        step();
+    }
+    xSemaphoreGive(test_done);
+}
+
+/* Runs a step on the loop like the role functions require, then lets the
+ events it posted be handled*/
+static void test_run(test_step_t step)
+{
+    test_step_t none = NULL;
+
+    esp_event_post_to(test_loop, GATEWAY_TEST_EVENT, 0, &step, sizeof(step), portMAX_DELAY);
+    xSemaphoreTake(test_done, portMAX_DELAY);
+    esp_event_post_to(test_loop, GATEWAY_TEST_EVENT, 0, &none, sizeof(none), portMAX_DELAY);
+    xSemaphoreTake(test_done, portMAX_DELAY);
+}
+
+static sgp30_timed_measurement_t test_window(int i)
+{
+    sgp30_timed_measurement_t m = {
+        .measurement = { .eCO2 = 400 + i, .TVOC = 10 + i },
+        .time = time(NULL) - 60 * (CONFIG_GATEWAY_LEAF_BATCH - i),
+    };
+    return m;
+}
+
+static int test_windows_added;
+
+static void add_batch(void)
+{
+    for (int i = 0; i < CONFIG_GATEWAY_LEAF_BATCH; i++)
+    {
+        sgp30_timed_measurement_t m = test_window(test_windows_added++);
+        gateway_leaf_add(&m);
+    }
+}
+
+static void flush(void)
+{
+    gateway_flush();
+}
+
+static void send_malformed(void)
+{
+    uint8_t frame[GATEWAY_FRAME_HEADER_LEN + 3] = { GATEWAY_FRAME_VERSION + 1 };
+
+    gateway_link_loopback.send(frame, sizeof(frame));
+}
+
+int main(void)
+{
+    esp_event_loop_args_t loop_args = {
+        .queue_size = 32,
+        .task_name = "gateway_test",
+        .task_stack_size = 4096,
+        .task_priority = 5,
+        .task_core_id = tskNO_AFFINITY,
+    };
+    gateway_stats_t leaf;
+    gateway_stats_t gateway;
+    char device[64];
+    char value[32];
+
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    esp_mac_host_set(test_mac);
+    test_done = xSemaphoreCreateBinary();
+    CHECK(test_done != NULL);
+    CHECK(esp_event_loop_create(&loop_args, &test_loop) == ESP_OK);
+    CHECK(esp_event_handler_register_with(test_loop, GATEWAY_TEST_EVENT, 0, test_on_step, NULL) == ESP_OK);
+    CHECK(gateway_init(test_loop, &gateway_link_loopback) == ESP_OK);
+    CHECK(gateway_leaf_init(test_loop, &gateway_link_loopback) == ESP_OK);
+
+    /* One frame of a batch reaches the gateway and is acknowledged*/
+    test_run(add_batch);
+    gateway_leaf_get_stats(&leaf);
+    gateway_get_stats(&gateway);
+    CHECK(leaf.frames == 1);
+    CHECK(leaf.windows == CONFIG_GATEWAY_LEAF_BATCH);
+    CHECK(leaf.rejected == 0);
+    CHECK(gateway.frames == 1);
+    CHECK(gateway.windows == CONFIG_GATEWAY_LEAF_BATCH);
+    CHECK(published_count == 0);
+
+    /* The windows are published under the device of the leaf*/
+    test_run(flush);
+    gateway_get_stats(&gateway);
+    CHECK(gateway.payloads == 1);
+    CHECK(published_count == 1);
+    CHECK(strcmp(published_topic, MQTT_GATEWAY_TELEMETRY_TOPIC) == 0);
+    snprintf(
+        device,
+        sizeof(device),
+        "{\"%s%02x%02x%02x%02x%02x%02x\":[",
+        CONFIG_GATEWAY_DEVICE_PREFIX,
+        MAC2STR(test_mac)
+    );
+    CHECK(strncmp(published, device, strlen(device)) == 0);
+    for (int i = 0; i < CONFIG_GATEWAY_LEAF_BATCH; i++)
+    {
+        snprintf(value, sizeof(value), "\"eCO2\":%d", 400 + i);
+        CHECK(strstr(published, value) != NULL);
+    }
+    CHECK(strcmp(published + strlen(published) - 2, "]}") == 0);
+
+    /* Nothing left, a second flush publishes nothing*/
+    test_run(flush);
+    CHECK(published_count == 1);
+
+    /* A frame of another layout is counted and dropped*/
+    test_run(send_malformed);
+    gateway_get_stats(&gateway);
+    CHECK(gateway.rejected == 1);
+    CHECK(gateway.frames == 1);
+
+    /* A second batch makes a second frame*/
+    test_run(add_batch);
+    test_run(flush);
+    gateway_leaf_get_stats(&leaf);
+    gateway_get_stats(&gateway);
+    CHECK(leaf.frames == 2);
+    CHECK(gateway.windows == 2 * CONFIG_GATEWAY_LEAF_BATCH);
+    CHECK(published_count == 2);
+    snprintf(value, sizeof(value), "\"eCO2\":%d", 400 + 2 * CONFIG_GATEWAY_LEAF_BATCH - 1);
+    CHECK(strstr(published, value) != NULL);
+
+    printf(
+        "gateway_test: %" PRIu32 " frames, %" PRIu32 " windows, %" PRIu32 " payloads, ok\n",
+        gateway.frames,
+        gateway.windows,
+        gateway.payloads
+    );
+    return 0;
+}
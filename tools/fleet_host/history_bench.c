@@ -0,0 +1,244 @@
+/*
+ * Benchmark of the measurement history on the RAM flash of port/.
+ *
+ * Appends a series of measurements, wrapping the partition when there are
+ * more than it holds, then looks up random time windows, truncates the log
+ * in the middle of an iteration and recovers it as a reboot would. Every
+ * lookup is checked against the series. The flash takes no time here, the
+ * bytes read tell what a lookup costs on the chip.
+ *
+ *     history_bench --records 50000 --interval 60 --window 3600
+ */
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "esp_log.h"
+#include "measurement_history.h"
+
+#define BENCH_START_TIME 1700000000
+
+static int64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+    fprintf(
+        stderr,
+        "usage: %s [options]\n"
+        "  --records N    measurements appended, default 50000\n"
+        "  --interval S   seconds between measurements, default 60\n"
+        "  --window S     seconds of every lookup, default 3600\n"
+        "  --lookups N    lookups, default 1000\n",
+        name
+    );
+}
+
+static sgp30_timed_measurement_t bench_measurement(uint32_t i, uint32_t interval)
+{
+    sgp30_timed_measurement_t measurement = {
+        .measurement = { .eCO2 = 400 + i % 1200, .TVOC = i % 600 },
+        .time = BENCH_START_TIME + (time_t)i * interval,
+    };
+    return measurement;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "records", required_argument, NULL, 'r' },
+        { "interval", required_argument, NULL, 'i' },
+        { "window", required_argument, NULL, 'w' },
+        { "lookups", required_argument, NULL, 'l' },
+        { "help", no_argument, NULL, 'h' },
+        { 0 },
+    };
+    uint32_t records = 50000;
+    uint32_t interval = 60;
+    uint32_t window = 3600;
+    uint32_t lookups = 1000;
+    measurement_history_stats_t stats;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'r': records = strtoul(optarg, NULL, 10); break;
+        case 'i': interval = strtoul(optarg, NULL, 10); break;
+        case 'w': window = strtoul(optarg, NULL, 10); break;
+        case 'l': lookups = strtoul(optarg, NULL, 10); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (records == 0 || interval == 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    if (measurement_history_init() != ESP_OK)
+    {
+        return 1;
+    }
+
+    int64_t worst_ns = 0;
+    int64_t start = now_ns();
+    for (uint32_t i = 0; i < records; i++)
+    {
+        sgp30_timed_measurement_t measurement = bench_measurement(i, interval);
+        int64_t append_start = now_ns();
+        if (measurement_history_append(&measurement, NULL) != ESP_OK)
+        {
+            fprintf(stderr, "append %" PRIu32 " failed\n", i);
+            return 1;
+        }
+        int64_t append_ns = now_ns() - append_start;
+        if (append_ns > worst_ns)
+        {
+            worst_ns = append_ns;
+        }
+    }
+    int64_t elapsed = now_ns() - start;
+    measurement_history_get_stats(&stats);
+    printf(
+        "append: %" PRIu32 " records, %.0f per second, worst %.1f us, %" PRIu32 " erases, wear %" PRIu32 "-%" PRIu32 "\n",
+        records,
+        records * 1e9 / elapsed,
+        worst_ns / 1e3,
+        stats.erases,
+        stats.min_wear,
+        stats.max_wear
+    );
+
+    /* Windows start anywhere in the kept records, or a little before them*/
+    uint32_t first = stats.first_seq - 1;
+    uint32_t kept = stats.records;
+    uint64_t read_before = stats.read_bytes;
+    uint64_t found_total = 0;
+    worst_ns = 0;
+    srand(1);
+    start = now_ns();
+    for (uint32_t n = 0; n < lookups; n++)
+    {
+        time_t from = BENCH_START_TIME + ((time_t)first + rand() % (kept + 16)) * interval - 8 * (time_t)interval;
+        time_t to = from + window;
+        measurement_history_iter_t iter;
+        measurement_history_record_t record;
+        uint32_t found = 0;
+        int64_t lookup_start = now_ns();
+
+        measurement_history_iter_init(&iter, from, to);
+        while (measurement_history_iter_next(&iter, &record) == ESP_OK)
+        {
+            sgp30_timed_measurement_t expected = bench_measurement(record.seq - 1, interval);
+            if (record.measurement.time < from || record.measurement.time >= to
+                || record.measurement.time != expected.time
+                || record.measurement.measurement.eCO2 != expected.measurement.eCO2)
+            {
+                fprintf(stderr, "lookup returned a wrong record %" PRIu32 "\n", record.seq);
+                return 1;
+            }
+            found++;
+        }
+        int64_t lookup_ns = now_ns() - lookup_start;
+        if (lookup_ns > worst_ns)
+        {
+            worst_ns = lookup_ns;
+        }
+
+        /* Every record of the series in the window and kept*/
+        time_t kept_from = BENCH_START_TIME + (time_t)first * interval;
+        time_t kept_to = BENCH_START_TIME + (time_t)records * interval;
+        time_t low = from > kept_from ? from : kept_from;
+        time_t high = to < kept_to ? to : kept_to;
+        uint32_t expected = 0;
+        if (high > low)
+        {
+            expected = (uint32_t)((high - 1 - BENCH_START_TIME) / interval - (low + interval - 1 - BENCH_START_TIME) / interval + 1);
+        }
+        if (found != expected)
+        {
+            fprintf(stderr, "lookup of [%lld, %lld) found %" PRIu32 " records, expected %" PRIu32 "\n",
+                    (long long)from, (long long)to, found, expected);
+            return 1;
+        }
+        found_total += found;
+    }
+    elapsed = now_ns() - start;
+    measurement_history_get_stats(&stats);
+    printf(
+        "lookup: %" PRIu32 " windows of %" PRIu32 " s, %.1f records, %.1f us average, worst %.1f us, %.0f bytes read\n",
+        lookups,
+        window,
+        lookups ? (double)found_total / lookups : 0,
+        lookups ? elapsed / 1e3 / lookups : 0,
+        worst_ns / 1e3,
+        lookups ? (double)(stats.read_bytes - read_before) / lookups : 0
+    );
+
+    /* A truncation while iterating skips to the oldest record kept*/
+    uint32_t acked = stats.first_seq + kept / 2;
+    uint32_t cut = stats.first_seq + kept / 4;
+    measurement_history_iter_t iter;
+    measurement_history_record_t record;
+    uint32_t next_seq = stats.first_seq;
+
+    measurement_history_iter_init(&iter, 0, BENCH_START_TIME + (time_t)records * interval);
+    while (measurement_history_iter_next(&iter, &record) == ESP_OK)
+    {
+        sgp30_timed_measurement_t expected = bench_measurement(record.seq - 1, interval);
+        if (record.seq != next_seq || record.measurement.time != expected.time)
+        {
+            fprintf(stderr, "iteration returned %" PRIu32 ", expected %" PRIu32 "\n", record.seq, next_seq);
+            return 1;
+        }
+        next_seq++;
+        if (record.seq == stats.first_seq + 2)
+        {
+            if (measurement_history_truncate(cut) != ESP_OK)
+            {
+                return 1;
+            }
+            next_seq = cut + 1;
+        }
+    }
+    if (next_seq != records + 1)
+    {
+        fprintf(stderr, "iteration across a truncation ended at %" PRIu32 "\n", next_seq);
+        return 1;
+    }
+
+    /* A reboot keeps the records and the truncation*/
+    if (measurement_history_truncate(acked) != ESP_OK)
+    {
+        return 1;
+    }
+    start = now_ns();
+    if (measurement_history_init() != ESP_OK)
+    {
+        return 1;
+    }
+    elapsed = now_ns() - start;
+    measurement_history_get_stats(&stats);
+    printf(
+        "recover: %" PRIu32 " records from %" PRIu32 " in %.1f us, %" PRIu64 " bytes read\n",
+        stats.records,
+        stats.first_seq,
+        elapsed / 1e3,
+        stats.read_bytes
+    );
+    if (stats.first_seq != acked + 1 || stats.next_seq != records + 1)
+    {
+        fprintf(stderr, "recovered %" PRIu32 "-%" PRIu32 ", expected %" PRIu32 "-%" PRIu32 "\n",
+                stats.first_seq, stats.next_seq, acked + 1, records + 1);
+        return 1;
+    }
+    return 0;
+}
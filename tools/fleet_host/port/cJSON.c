@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cJSON.h"
+
+cJSON *cJSON_CreateObject(void)
+{
+    return calloc(1, sizeof(cJSON));
+}
+
+cJSON *cJSON_CreateStringReference(const char *string)
+{
+    cJSON *item = calloc(1, sizeof(cJSON));
+
+    if (item != NULL)
+    {
+        item->valuestring = string;
+    }
+    return item;
+}
+
+int cJSON_AddItemToObjectCS(cJSON *object, const char *string, cJSON *item)
+{
+    cJSON **last = &object->child;
+
+    if (item == NULL)
+    {
+        return 0;
+    }
+    while (*last != NULL)
+    {
+        last = &(*last)->next;
+    }
+    item->string = string;
+    *last = item;
+    return 1;
+}
+
+char *cJSON_PrintUnformatted(const cJSON *item)
+{
+    size_t len = 3;
+
+    for (const cJSON *child = item->child; child != NULL; child = child->next)
+    {
+        len += strlen(child->string) + strlen(child->valuestring) + 6;
+    }
+    char *out = malloc(len);
+    if (out == NULL)
+    {
+        return NULL;
+    }
+    char *p = out;
+    *p++ = '{';
+    for (const cJSON *child = item->child; child != NULL; child = child->next)
+    {
+        p += sprintf(p, "%s\"%s\":\"%s\"", child == item->child ? "" : ",", child->string, child->valuestring);
+    }
+    strcpy(p, "}");
+    return out;
+}
+
+void cJSON_Delete(cJSON *item)
+{
+    while (item != NULL)
+    {
+        cJSON *next = item->next;
+        cJSON_Delete(item->child);
+        free(item);
+        item = next;
+    }
+}
+
+void cJSON_free(void *object)
+{
+    free(object);
+}
@@ -0,0 +1,222 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_event.h"
+
+#define HOST_MAX_HANDLERS 64
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *arg;
+} host_handler_t;
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    size_t len;
+    uint8_t data[ESP_EVENT_HOST_MAX_DATA];
+} host_event_t;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t posted;
+    pthread_cond_t taken;
+    host_event_t *queue;
+    size_t queue_size;
+    size_t head;
+    size_t count;
+    bool stopping;
+    host_handler_t handlers[HOST_MAX_HANDLERS];
+    size_t handlers_len;
+} host_loop_t;
+
+static void *event_loop_thread(void *arg)
+{
+    host_loop_t *loop = arg;
+    host_event_t event;
+
+    pthread_mutex_lock(&loop->lock);
+    while (true)
+    {
+        while (loop->count == 0 && !loop->stopping)
+        {
+            pthread_cond_wait(&loop->posted, &loop->lock);
+        }
+        if (loop->stopping)
+        {
+            break;
+        }
+        event = loop->queue[loop->head];
+        loop->head = (loop->head + 1) % loop->queue_size;
+        loop->count--;
+        pthread_cond_signal(&loop->taken);
+        size_t handlers_len = loop->handlers_len;
+        pthread_mutex_unlock(&loop->lock);
+        /* Handlers are only added, the first handlers_len do not move*/
+        for (size_t i = 0; i < handlers_len; i++)
+        {
+            const host_handler_t *handler = &loop->handlers[i];
+            if ((handler->base == ESP_EVENT_ANY_BASE || handler->base == event.base)
+                && (handler->id == ESP_EVENT_ANY_ID || handler->id == event.id))
+            {
+                handler->handler(handler->arg, event.base, event.id, event.len > 0 ? event.data : NULL);
+            }
+        }
+        pthread_mutex_lock(&loop->lock);
+    }
+    pthread_mutex_unlock(&loop->lock);
+    return NULL;
+}
+
+esp_err_t esp_event_loop_create(const esp_event_loop_args_t *event_loop_args, esp_event_loop_handle_t *event_loop)
+{
+    if (event_loop_args == NULL || event_loop_args->queue_size <= 0 || event_loop == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    host_loop_t *loop = calloc(1, sizeof(*loop));
+    if (loop == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    loop->queue_size = event_loop_args->queue_size;
+    loop->queue = calloc(loop->queue_size, sizeof(host_event_t));
+    if (loop->queue == NULL)
+    {
+        free(loop);
+        return ESP_ERR_NO_MEM;
+    }
+    pthread_mutex_init(&loop->lock, NULL);
+    pthread_cond_init(&loop->posted, NULL);
+    pthread_cond_init(&loop->taken, NULL);
+    if (pthread_create(&loop->thread, NULL, event_loop_thread, loop) != 0)
+    {
+        free(loop->queue);
+        free(loop);
+        return ESP_FAIL;
+    }
+    *event_loop = loop;
+    return ESP_OK;
+}
+
+esp_err_t esp_event_loop_delete(esp_event_loop_handle_t event_loop)
+{
+    host_loop_t *loop = event_loop;
+
+    pthread_mutex_lock(&loop->lock);
+    loop->stopping = true;
+    pthread_cond_broadcast(&loop->posted);
+    pthread_cond_broadcast(&loop->taken);
+    pthread_mutex_unlock(&loop->lock);
+    pthread_join(loop->thread, NULL);
+    free(loop->queue);
+    free(loop);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register_with(
+    esp_event_loop_handle_t event_loop,
+    esp_event_base_t event_base,
+    int32_t event_id,
+    esp_event_handler_t event_handler,
+    void *event_handler_arg
+)
+{
+    host_loop_t *loop = event_loop;
+    esp_err_t err = ESP_OK;
+
+    if (loop == NULL || event_handler == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&loop->lock);
+    if (loop->handlers_len == HOST_MAX_HANDLERS)
+    {
+        err = ESP_ERR_NO_MEM;
+    }
+    else
+    {
+        loop->handlers[loop->handlers_len++] = (host_handler_t) {
+            .base = event_base,
+            .id = event_id,
+            .handler = event_handler,
+            .arg = event_handler_arg,
+        };
+    }
+    pthread_mutex_unlock(&loop->lock);
+    return err;
+}
+
+esp_err_t esp_event_post_to(
+    esp_event_loop_handle_t event_loop,
+    esp_event_base_t event_base,
+    int32_t event_id,
+    const void *event_data,
+    size_t event_data_size,
+    TickType_t ticks_to_wait
+)
+{
+    host_loop_t *loop = event_loop;
+    struct timespec deadline;
+    int err = 0;
+
+    if (loop == NULL || event_data_size > ESP_EVENT_HOST_MAX_DATA)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ticks_to_wait / 1000;
+    deadline.tv_nsec += (long)(ticks_to_wait % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&loop->lock);
+    while (loop->count == loop->queue_size && !loop->stopping && err == 0)
+    {
+        if (ticks_to_wait == portMAX_DELAY)
+        {
+            pthread_cond_wait(&loop->taken, &loop->lock);
+        }
+        else
+        {
+            err = pthread_cond_timedwait(&loop->taken, &loop->lock, &deadline);
+        }
+    }
+    if (loop->count == loop->queue_size || loop->stopping)
+    {
+        pthread_mutex_unlock(&loop->lock);
+        return ESP_ERR_TIMEOUT;
+    }
+    host_event_t *event = &loop->queue[(loop->head + loop->count) % loop->queue_size];
+    event->base = event_base;
+    event->id = event_id;
+    event->len = event_data == NULL ? 0 : event_data_size;
+    if (event->len > 0)
+    {
+        memcpy(event->data, event_data, event->len);
+    }
+    loop->count++;
+    pthread_cond_signal(&loop->posted);
+    pthread_mutex_unlock(&loop->lock);
+    return ESP_OK;
+}
+
+int64_t esp_event_loop_host_cpu_us(esp_event_loop_handle_t event_loop)
+{
+    host_loop_t *loop = event_loop;
+    clockid_t clock;
+    struct timespec used;
+
+    if (pthread_getcpuclockid(loop->thread, &clock) != 0 || clock_gettime(clock, &used) != 0)
+    {
+        return 0;
+    }
+    return (int64_t)used.tv_sec * 1000000 + used.tv_nsec / 1000;
+}
@@ -0,0 +1,108 @@
+#include <stdbool.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define HOST_FLASH_SECTOR 4096
+
+/* Same layout as the data partitions of partitions.csv*/
+static uint8_t telemetry_flash[0x40000];
+static uint8_t history_flash[0x40000];
+
+typedef struct {
+    esp_partition_t partition;
+    uint8_t *data;
+} host_flash_t;
+
+static host_flash_t host_partitions[] = {
+    {
+        .partition = {
+            .type = ESP_PARTITION_TYPE_DATA,
+            .subtype = 0x40,
+            .address = 0x150000,
+            .size = sizeof(telemetry_flash),
+            .erase_size = HOST_FLASH_SECTOR,
+            .label = "telemetry",
+        },
+        .data = telemetry_flash,
+    },
+    {
+        .partition = {
+            .type = ESP_PARTITION_TYPE_DATA,
+            .subtype = 0x42,
+            .address = 0x194000,
+            .size = sizeof(history_flash),
+            .erase_size = HOST_FLASH_SECTOR,
+            .label = "history",
+        },
+        .data = history_flash,
+    },
+};
+static bool host_flash_erased;
+
+static uint8_t *partition_data(const esp_partition_t *partition)
+{
+    return ((const host_flash_t *)partition)->data;
+}
+
+const esp_partition_t *esp_partition_find_first(
+    esp_partition_type_t type,
+    esp_partition_subtype_t subtype,
+    const char *label
+)
+{
+    /* A new device starts with blank flash*/
+    if (!host_flash_erased)
+    {
+        memset(telemetry_flash, 0xFF, sizeof(telemetry_flash));
+        memset(history_flash, 0xFF, sizeof(history_flash));
+        host_flash_erased = true;
+    }
+    for (size_t i = 0; i < sizeof(host_partitions) / sizeof(host_partitions[0]); i++)
+    {
+        const esp_partition_t *partition = &host_partitions[i].partition;
+        if (partition->type == type && partition->subtype == subtype
+            && (label == NULL || strcmp(label, partition->label) == 0))
+        {
+            return partition;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (src_offset > partition->size || size > partition->size - src_offset)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, &partition_data(partition)[src_offset], size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    const uint8_t *bytes = src;
+
+    if (dst_offset > partition->size || size > partition->size - dst_offset)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint8_t *flash = &partition_data(partition)[dst_offset];
+    for (size_t i = 0; i < size; i++)
+    {
+        flash[i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (offset % partition->erase_size != 0 || size % partition->erase_size != 0
+        || offset > partition->size || size > partition->size - offset)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(&partition_data(partition)[offset], 0xFF, size);
+    return ESP_OK;
+}
@@ -0,0 +1,198 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+#include "esp_timer.h"
+
+#define HOST_MAX_TIMERS 32
+
+struct esp_timer {
+    bool used;
+    bool active;
+    esp_timer_cb_t callback;
+    void *arg;
+    int64_t alarm_us;
+    uint64_t period_us;
+};
+
+static struct esp_timer timers[HOST_MAX_TIMERS];
+static pthread_mutex_t timers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timers_changed;
+static pthread_once_t timers_once = PTHREAD_ONCE_INIT;
+static int64_t started_at_us;
+
+static int64_t monotonic_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+__attribute__((constructor)) static void esp_timer_boot(void)
+{
+    started_at_us = monotonic_us();
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return monotonic_us() - started_at_us;
+}
+
+static void *esp_timer_thread(void *arg)
+{
+    pthread_mutex_lock(&timers_lock);
+    while (true)
+    {
+        int64_t now = esp_timer_get_time();
+        int64_t next = INT64_MAX;
+        struct esp_timer *due = NULL;
+
+        for (size_t i = 0; i < HOST_MAX_TIMERS; i++)
+        {
+            if (timers[i].used && timers[i].active && timers[i].alarm_us < next)
+            {
+                next = timers[i].alarm_us;
+                due = &timers[i];
+            }
+        }
+        if (due != NULL && next <= now)
+        {
+            esp_timer_cb_t callback = due->callback;
+            void *callback_arg = due->arg;
+            if (due->period_us > 0)
+            {
+                due->alarm_us += due->period_us;
+            }
+            else
+            {
+                due->active = false;
+            }
+            /* Callbacks may start or stop timers*/
+            pthread_mutex_unlock(&timers_lock);
+            callback(callback_arg);
+            pthread_mutex_lock(&timers_lock);
+            continue;
+        }
+        if (due == NULL)
+        {
+            pthread_cond_wait(&timers_changed, &timers_lock);
+        }
+        else
+        {
+            int64_t wake_us = monotonic_us() + (next - now);
+            struct timespec wake = {
+                .tv_sec = wake_us / 1000000,
+                .tv_nsec = (wake_us % 1000000) * 1000,
+            };
+            pthread_cond_timedwait(&timers_changed, &timers_lock, &wake);
+        }
+    }
+    return NULL;
+}
+
+static void esp_timer_start_thread(void)
+{
+    pthread_condattr_t attr;
+    pthread_t thread;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timers_changed, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_create(&thread, NULL, esp_timer_thread, NULL);
+    pthread_detach(thread);
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_once(&timers_once, esp_timer_start_thread);
+    pthread_mutex_lock(&timers_lock);
+    for (size_t i = 0; i < HOST_MAX_TIMERS; i++)
+    {
+        if (!timers[i].used)
+        {
+            timers[i] = (struct esp_timer) {
+                .used = true,
+                .callback = create_args->callback,
+                .arg = create_args->arg,
+            };
+            *out_handle = &timers[i];
+            err = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&timers_lock);
+    return err;
+}
+
+static esp_err_t esp_timer_arm(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us, bool restart)
+{
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&timers_lock);
+    if (timer->active != restart)
+    {
+        err = ESP_ERR_INVALID_STATE;
+    }
+    else
+    {
+        timer->active = true;
+        timer->alarm_us = esp_timer_get_time() + (int64_t)timeout_us;
+        timer->period_us = restart ? (timer->period_us > 0 ? timeout_us : 0) : period_us;
+        pthread_cond_signal(&timers_changed);
+    }
+    pthread_mutex_unlock(&timers_lock);
+    return err;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return esp_timer_arm(timer, timeout_us, 0, false);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return esp_timer_arm(timer, period, period, false);
+}
+
+esp_err_t esp_timer_restart(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return esp_timer_arm(timer, timeout_us, 0, true);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&timers_lock);
+    if (!timer->active)
+    {
+        err = ESP_ERR_INVALID_STATE;
+    }
+    timer->active = false;
+    pthread_mutex_unlock(&timers_lock);
+    return err;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&timers_lock);
+    timer->active = false;
+    timer->used = false;
+    pthread_mutex_unlock(&timers_lock);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&timers_lock);
+    bool active = timer->active;
+    pthread_mutex_unlock(&timers_lock);
+    return active;
+}
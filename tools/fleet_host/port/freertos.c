@@ -0,0 +1,193 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+struct host_semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t given;
+    bool available;
+};
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t code;
+    void *parameters;
+    pthread_mutex_t lock;
+    pthread_cond_t notified;
+    uint32_t notifications;
+};
+
+static __thread struct host_task *current_task;
+
+static void deadline_after(TickType_t ticks, struct timespec *deadline)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += ticks / 1000;
+    deadline->tv_nsec += (long)(ticks % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+static void *task_main(void *arg)
+{
+    current_task = arg;
+    current_task->code(current_task->parameters);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(
+    TaskFunction_t code,
+    const char *name,
+    uint32_t stack_depth,
+    void *parameters,
+    UBaseType_t priority,
+    TaskHandle_t *created
+)
+{
+    struct host_task *task = calloc(1, sizeof(*task));
+
+    if (task == NULL)
+    {
+        return pdFAIL;
+    }
+    task->code = code;
+    task->parameters = parameters;
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->notified, NULL);
+    if (created != NULL)
+    {
+        *created = task;
+    }
+    if (pthread_create(&task->thread, NULL, task_main, task) != 0)
+    {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec delay = {
+        .tv_sec = ticks / 1000,
+        .tv_nsec = (long)(ticks % 1000) * 1000000,
+    };
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR)
+    {
+    }
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    return 5;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    SemaphoreHandle_t semaphore = calloc(1, sizeof(*semaphore));
+
+    if (semaphore == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&semaphore->lock, NULL);
+    pthread_cond_init(&semaphore->given, NULL);
+    return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    struct timespec deadline;
+    int err = 0;
+
+    deadline_after(ticks_to_wait, &deadline);
+    pthread_mutex_lock(&semaphore->lock);
+    while (!semaphore->available && err == 0)
+    {
+        if (ticks_to_wait == portMAX_DELAY)
+        {
+            pthread_cond_wait(&semaphore->given, &semaphore->lock);
+        }
+        else
+        {
+            err = pthread_cond_timedwait(&semaphore->given, &semaphore->lock, &deadline);
+        }
+    }
+    bool taken = semaphore->available;
+    semaphore->available = false;
+    pthread_mutex_unlock(&semaphore->lock);
+    return taken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    pthread_mutex_lock(&semaphore->lock);
+    bool given = !semaphore->available;
+    semaphore->available = true;
+    pthread_cond_signal(&semaphore->given);
+    pthread_mutex_unlock(&semaphore->lock);
+    return given ? pdTRUE : pdFALSE;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t semaphore = xSemaphoreCreateBinary();
+
+    if (semaphore != NULL)
+    {
+        xSemaphoreGive(semaphore);
+    }
+    return semaphore;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    struct host_task *task = current_task;
+    struct timespec deadline;
+    int err = 0;
+
+    if (task == NULL)
+    {
+        /* Only the tasks of xTaskCreate can be notified*/
+        vTaskDelay(ticks_to_wait == portMAX_DELAY ? 0 : ticks_to_wait);
+        return 0;
+    }
+    deadline_after(ticks_to_wait, &deadline);
+    pthread_mutex_lock(&task->lock);
+    while (task->notifications == 0 && err == 0)
+    {
+        if (ticks_to_wait == portMAX_DELAY)
+        {
+            pthread_cond_wait(&task->notified, &task->lock);
+        }
+        else
+        {
+            err = pthread_cond_timedwait(&task->notified, &task->lock, &deadline);
+        }
+    }
+    uint32_t value = task->notifications;
+    if (value > 0)
+    {
+        task->notifications = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notifications++;
+    pthread_cond_signal(&task->notified);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
@@ -0,0 +1,22 @@
+/**
+ * @file cJSON.h
+ * @brief Host stand-in of the part of cJSON used by the provisioning
+ * request of mqtt_controller: an object of string references.
+ */
+#ifndef CJSON_H
+#define CJSON_H
+
+typedef struct cJSON {
+    struct cJSON *next;
+    struct cJSON *child;
+    const char *string;
+    const char *valuestring;
+} cJSON;
+
+cJSON *cJSON_CreateObject(void);
+cJSON *cJSON_CreateStringReference(const char *string);
+int cJSON_AddItemToObjectCS(cJSON *object, const char *string, cJSON *item);
+char *cJSON_PrintUnformatted(const cJSON *item);
+void cJSON_Delete(cJSON *item);
+void cJSON_free(void *object);
+#endif // !CJSON_H
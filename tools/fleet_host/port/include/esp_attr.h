@@ -0,0 +1,12 @@
+/**
+ * @file esp_attr.h
+ * @brief Host stand-in of the placement attributes. RTC memory is ordinary
+ * memory, kept over the simulated deep sleep because the process goes on.
+ */
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
+#endif // !ESP_ATTR_H
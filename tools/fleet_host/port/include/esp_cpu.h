@@ -0,0 +1,17 @@
+/**
+ * @file esp_cpu.h
+ * @brief Host stand-in of the cycle counter, one cycle per nanosecond.
+ */
+#ifndef ESP_CPU_H
+#define ESP_CPU_H
+#include <stdint.h>
+#include <time.h>
+
+static inline uint32_t esp_cpu_get_cycle_count(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000000u + now.tv_nsec);
+}
+#endif // !ESP_CPU_H
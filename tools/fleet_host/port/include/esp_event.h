@@ -0,0 +1,48 @@
+/**
+ * @file esp_event.h
+ * @brief Host stand-in of the ESP-IDF user event loops.
+ *
+ * A loop is a thread with a bounded queue. Posted data is copied, up to
+ * ESP_EVENT_HOST_MAX_DATA bytes. The default loop is not provided.
+ */
+#ifndef ESP_EVENT_H
+#define ESP_EVENT_H
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event_base.h"
+#include "freertos/FreeRTOS.h"
+
+#define ESP_EVENT_HOST_MAX_DATA 256
+
+typedef struct {
+    int32_t queue_size;
+    const char *task_name;
+    UBaseType_t task_priority;
+    uint32_t task_stack_size;
+    BaseType_t task_core_id;
+} esp_event_loop_args_t;
+
+esp_err_t esp_event_loop_create(const esp_event_loop_args_t *event_loop_args, esp_event_loop_handle_t *event_loop);
+esp_err_t esp_event_loop_delete(esp_event_loop_handle_t event_loop);
+esp_err_t esp_event_handler_register_with(
+    esp_event_loop_handle_t event_loop,
+    esp_event_base_t event_base,
+    int32_t event_id,
+    esp_event_handler_t event_handler,
+    void *event_handler_arg
+);
+esp_err_t esp_event_post_to(
+    esp_event_loop_handle_t event_loop,
+    esp_event_base_t event_base,
+    int32_t event_id,
+    const void *event_data,
+    size_t event_data_size,
+    TickType_t ticks_to_wait
+);
+
+/**
+ * @brief CPU time of the loop thread, host only.
+ */
+int64_t esp_event_loop_host_cpu_us(esp_event_loop_handle_t event_loop);
+#endif // !ESP_EVENT_H
@@ -0,0 +1,26 @@
+/**
+ * @file esp_mac.h
+ * @brief Host stand-in of the MAC address, set per simulated device.
+ */
+#ifndef ESP_MAC_H
+#define ESP_MAC_H
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+    ESP_MAC_WIFI_STA,
+    ESP_MAC_WIFI_SOFTAP,
+    ESP_MAC_BT,
+    ESP_MAC_ETH,
+} esp_mac_type_t;
+
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type);
+
+/**
+ * @brief Set the address returned by esp_read_mac, host only.
+ */
+void esp_mac_host_set(const uint8_t mac[6]);
+#endif // !ESP_MAC_H
@@ -0,0 +1,10 @@
+/**
+ * @file esp_rom_crc.h
+ * @brief Host stand-in of the ROM CRC functions.
+ */
+#ifndef ESP_ROM_CRC_H
+#define ESP_ROM_CRC_H
+#include <stdint.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len);
+#endif // !ESP_ROM_CRC_H
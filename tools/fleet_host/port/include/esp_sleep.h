@@ -0,0 +1,22 @@
+/**
+ * @file esp_sleep.h
+ * @brief Host stand-in of the wakeup cause, set by the host.
+ */
+#ifndef ESP_SLEEP_H
+#define ESP_SLEEP_H
+
+typedef enum {
+    ESP_SLEEP_WAKEUP_UNDEFINED,
+    ESP_SLEEP_WAKEUP_ALL,
+    ESP_SLEEP_WAKEUP_EXT0,
+    ESP_SLEEP_WAKEUP_EXT1,
+    ESP_SLEEP_WAKEUP_TIMER,
+} esp_sleep_wakeup_cause_t;
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void);
+
+/**
+ * @brief Set the cause returned by esp_sleep_get_wakeup_cause, host only.
+ */
+void esp_sleep_host_set_wakeup_cause(esp_sleep_wakeup_cause_t cause);
+#endif // !ESP_SLEEP_H
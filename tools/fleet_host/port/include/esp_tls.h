@@ -0,0 +1,23 @@
+/**
+ * @file esp_tls.h
+ * @brief Host stand-in of the esp-tls configuration, the host build has no TLS.
+ */
+#ifndef ESP_TLS_H
+#define ESP_TLS_H
+#include <stdbool.h>
+#include "esp_err.h"
+
+typedef struct esp_tls_client_session esp_tls_client_session_t;
+
+typedef struct {
+    const unsigned char *cacert_buf;
+    unsigned int cacert_bytes;
+    const unsigned char *clientcert_buf;
+    unsigned int clientcert_bytes;
+    const unsigned char *clientkey_buf;
+    unsigned int clientkey_bytes;
+    int timeout_ms;
+    bool skip_common_name;
+    esp_tls_client_session_t *client_session;
+} esp_tls_cfg_t;
+#endif // !ESP_TLS_H
@@ -0,0 +1,10 @@
+/**
+ * @file esp_transport.h
+ * @brief Host stand-in of the transport handle.
+ */
+#ifndef ESP_TRANSPORT_H
+#define ESP_TRANSPORT_H
+#include "esp_err.h"
+
+typedef struct esp_transport_item_t *esp_transport_handle_t;
+#endif // !ESP_TRANSPORT_H
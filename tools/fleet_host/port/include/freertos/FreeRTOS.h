@@ -0,0 +1,21 @@
+/**
+ * @file FreeRTOS.h
+ * @brief Host stand-in of the FreeRTOS types, one tick per millisecond.
+ */
+#ifndef FREERTOS_H
+#define FREERTOS_H
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY ((TickType_t)0xffffffffu)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7FFFFFFF
+#endif // !FREERTOS_H
@@ -0,0 +1,9 @@
+/**
+ * @file idf_additions.h
+ * @brief Host stand-in of the ESP-IDF FreeRTOS additions.
+ */
+#ifndef FREERTOS_IDF_ADDITIONS_H
+#define FREERTOS_IDF_ADDITIONS_H
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#endif // !FREERTOS_IDF_ADDITIONS_H
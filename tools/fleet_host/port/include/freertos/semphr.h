@@ -0,0 +1,16 @@
+/**
+ * @file semphr.h
+ * @brief Host stand-in of the FreeRTOS binary semaphores and mutexes.
+ */
+#ifndef FREERTOS_SEMPHR_H
+#define FREERTOS_SEMPHR_H
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_semaphore *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+/* A binary semaphore given once, without priority inheritance*/
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+#endif // !FREERTOS_SEMPHR_H
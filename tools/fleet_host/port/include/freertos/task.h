@@ -0,0 +1,26 @@
+/**
+ * @file task.h
+ * @brief Host stand-in of the FreeRTOS task API, on pthreads.
+ */
+#ifndef FREERTOS_TASK_H
+#define FREERTOS_TASK_H
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+/* Tasks are threads, the stack size and priority are ignored*/
+BaseType_t xTaskCreate(
+    TaskFunction_t code,
+    const char *name,
+    uint32_t stack_depth,
+    void *parameters,
+    UBaseType_t priority,
+    TaskHandle_t *created
+);
+void vTaskDelay(TickType_t ticks);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+/* Notifications used as a counting semaphore of the calling task*/
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+#endif // !FREERTOS_TASK_H
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+/* newlib has strlcpy and strlcat, glibc only from 2.38 on*/
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+#define HOST_LIBC_STRL 1
+size_t strlcpy(char *dst, const char *src, size_t size);
+size_t strlcat(char *dst, const char *src, size_t size);
+#endif
@@ -0,0 +1,7 @@
+/**
+ * @file x509_crt.h
+ * @brief Host stand-in, the host build connects without TLS.
+ */
+#ifndef MBEDTLS_X509_CRT_H
+#define MBEDTLS_X509_CRT_H
+#endif // !MBEDTLS_X509_CRT_H
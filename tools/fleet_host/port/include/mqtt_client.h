@@ -0,0 +1,184 @@
+/**
+ * @file mqtt_client.h
+ * @brief Host stand-in of the esp-mqtt client.
+ *
+ * MQTT 3.1.1 over plain TCP to the broker host and port of the
+ * configuration, the TLS transport and the certificates are ignored. The
+ * events are dispatched from the client thread like esp-mqtt does from its
+ * task, DATA in fragments of buffer.size. QoS 1 messages stay in a bounded
+ * outbox until their PUBACK and are sent again after a reconnection. The
+ * host only functions at the end give every simulated device its
+ * credentials and inject network outages.
+ */
+#ifndef MQTT_CLIENT_H
+#define MQTT_CLIENT_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_transport.h"
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+typedef enum {
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+    MQTT_EVENT_BEFORE_CONNECT,
+    MQTT_EVENT_DELETED,
+} esp_mqtt_event_id_t;
+
+typedef enum {
+    MQTT_TRANSPORT_UNKNOWN = 0x0,
+    MQTT_TRANSPORT_OVER_TCP,
+    MQTT_TRANSPORT_OVER_SSL,
+    MQTT_TRANSPORT_OVER_WS,
+    MQTT_TRANSPORT_OVER_WSS,
+} esp_mqtt_transport_t;
+
+typedef enum {
+    MQTT_ERROR_TYPE_NONE = 0,
+    MQTT_ERROR_TYPE_TCP_TRANSPORT,
+    MQTT_ERROR_TYPE_CONNECTION_REFUSED,
+} esp_mqtt_error_type_t;
+
+typedef struct {
+    esp_err_t esp_tls_last_esp_err;
+    int esp_tls_stack_err;
+    int esp_tls_cert_verify_flags;
+    esp_mqtt_error_type_t error_type;
+    int connect_return_code;
+    int esp_transport_sock_errno;
+} esp_mqtt_error_codes_t;
+
+typedef struct esp_mqtt_event_t {
+    esp_mqtt_event_id_t event_id;
+    esp_mqtt_client_handle_t client;
+    char *data;
+    int data_len;
+    int total_data_len;
+    int current_data_offset;
+    char *topic;
+    int topic_len;
+    int msg_id;
+    int session_present;
+    esp_mqtt_error_codes_t *error_handle;
+    bool retain;
+    int qos;
+    bool dup;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+
+typedef struct {
+    struct {
+        struct {
+            const char *uri;
+            const char *hostname;
+            esp_mqtt_transport_t transport;
+            const char *path;
+            uint32_t port;
+        } address;
+    } broker;
+    struct {
+        const char *username;
+        const char *client_id;
+        struct {
+            const char *password;
+        } authentication;
+    } credentials;
+    struct {
+        struct {
+            const char *topic;
+            const char *msg;
+            int msg_len;
+            int qos;
+            int retain;
+        } last_will;
+        bool disable_clean_session;
+        int keepalive;
+    } session;
+    struct {
+        int reconnect_timeout_ms;
+        int timeout_ms;
+        bool disable_auto_reconnect;
+        esp_transport_handle_t transport;
+    } network;
+    struct {
+        int size;
+    } buffer;
+    struct {
+        uint64_t limit;
+    } outbox;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_register_event(
+    esp_mqtt_client_handle_t client,
+    esp_mqtt_event_id_t event,
+    esp_event_handler_t event_handler,
+    void *event_handler_arg
+);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_reconnect(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_set_config(esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_publish(
+    esp_mqtt_client_handle_t client,
+    const char *topic,
+    const char *data,
+    int len,
+    int qos,
+    int retain
+);
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos);
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic);
+
+/**
+ * @brief Traffic of a client, host only.
+ */
+typedef struct {
+    uint32_t connects;          /*!< Sessions accepted by the broker */
+    uint32_t connect_failures;  /*!< Attempts refused or without a route */
+    uint32_t publishes;         /*!< PUBLISH packets written, resends included */
+    uint32_t resends;           /*!< QoS 1 messages sent again after reconnecting */
+    uint32_t pubacks;           /*!< PUBACK received */
+    uint32_t expired;           /*!< QoS 1 messages reported with MQTT_EVENT_DELETED */
+    uint64_t tx_bytes;          /*!< MQTT bytes written */
+    uint64_t rx_bytes;          /*!< MQTT bytes read */
+} esp_mqtt_client_host_stats_t;
+
+/**
+ * @brief Called on every PUBACK with the time since the first write of the message.
+ */
+typedef void (*esp_mqtt_client_host_ack_cb_t)(uint32_t latency_us);
+
+/**
+ * @brief Credentials of the clients created afterwards, since the firmware
+ * authenticates with its certificate. Host only.
+ */
+void esp_mqtt_client_host_set_credentials(const char *client_id, const char *username);
+
+/**
+ * @brief Report the PUBACK latency of every client. Host only.
+ */
+void esp_mqtt_client_host_set_ack_cb(esp_mqtt_client_host_ack_cb_t cb);
+
+/**
+ * @brief Drop the connections of every client and fail their attempts for
+ * outage_ms, as when the access point goes away. Host only, it can be
+ * called from any thread.
+ */
+void esp_mqtt_client_host_outage(uint32_t outage_ms);
+
+/**
+ * @brief Traffic of every client of the process. Host only.
+ */
+void esp_mqtt_client_host_get_stats(esp_mqtt_client_host_stats_t *stats);
+#endif // !MQTT_CLIENT_H
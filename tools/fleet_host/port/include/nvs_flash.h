@@ -0,0 +1,13 @@
+/**
+ * @file nvs_flash.h
+ * @brief Host stand-in of the NVS partition, see nvs.h.
+ */
+#ifndef NVS_FLASH_H
+#define NVS_FLASH_H
+#include "esp_err.h"
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+/* Drops every value, committed or not, and closes the handles*/
+esp_err_t nvs_flash_erase(void);
+#endif // !NVS_FLASH_H
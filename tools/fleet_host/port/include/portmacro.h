@@ -0,0 +1,8 @@
+/**
+ * @file portmacro.h
+ * @brief Host stand-in of the FreeRTOS port definitions.
+ */
+#ifndef PORTMACRO_H
+#define PORTMACRO_H
+#include "freertos/FreeRTOS.h"
+#endif // !PORTMACRO_H
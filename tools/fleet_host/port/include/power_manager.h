@@ -0,0 +1,10 @@
+/**
+ * @file power_manager.h
+ * @brief Host stand-in, only the energy ledger count of the transports.
+ */
+#ifndef POWER_MANAGER_H_
+#define POWER_MANAGER_H_
+#include <stddef.h>
+
+void power_manager_energy_count_tx(size_t bytes);
+#endif // !POWER_MANAGER_H_
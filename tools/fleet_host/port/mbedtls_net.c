@@ -0,0 +1,83 @@
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "mbedtls/net_sockets.h"
+
+void mbedtls_net_init(mbedtls_net_context *ctx)
+{
+    ctx->fd = -1;
+}
+
+int mbedtls_net_connect(mbedtls_net_context *ctx, const char *host, const char *port, int proto)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = proto == MBEDTLS_NET_PROTO_UDP ? SOCK_DGRAM : SOCK_STREAM,
+    };
+    struct addrinfo *list;
+    int ret = MBEDTLS_ERR_NET_CONNECT_FAILED;
+
+    if (getaddrinfo(host, port, &hints, &list) != 0)
+    {
+        return MBEDTLS_ERR_NET_UNKNOWN_HOST;
+    }
+    for (struct addrinfo *cur = list; cur != NULL && ret != 0; cur = cur->ai_next)
+    {
+        ctx->fd = socket(cur->ai_family, cur->ai_socktype, cur->ai_protocol);
+        if (ctx->fd < 0)
+        {
+            continue;
+        }
+        if (connect(ctx->fd, cur->ai_addr, cur->ai_addrlen) == 0)
+        {
+            ret = 0;
+        }
+        else
+        {
+            close(ctx->fd);
+            ctx->fd = -1;
+        }
+    }
+    freeaddrinfo(list);
+    return ret;
+}
+
+int mbedtls_net_send(void *ctx, const unsigned char *buf, size_t len)
+{
+    int fd = ((mbedtls_net_context *)ctx)->fd;
+    ssize_t ret = send(fd, buf, len, MSG_NOSIGNAL);
+
+    return ret < 0 ? MBEDTLS_ERR_NET_SEND_FAILED : (int)ret;
+}
+
+/* Like mbedTLS, MBEDTLS_ERR_SSL_TIMEOUT once timeout ms pass without data*/
+int mbedtls_net_recv_timeout(void *ctx, unsigned char *buf, size_t len, uint32_t timeout)
+{
+    struct pollfd fds = {
+        .fd = ((mbedtls_net_context *)ctx)->fd,
+        .events = POLLIN,
+    };
+    int ret = poll(&fds, 1, timeout == 0 ? -1 : (int)timeout);
+
+    if (ret == 0)
+    {
+        return MBEDTLS_ERR_SSL_TIMEOUT;
+    }
+    if (ret < 0)
+    {
+        return errno == EINTR ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+    }
+    ret = recv(fds.fd, buf, len, 0);
+    return ret < 0 ? MBEDTLS_ERR_NET_RECV_FAILED : ret;
+}
+
+void mbedtls_net_free(mbedtls_net_context *ctx)
+{
+    if (ctx->fd >= 0)
+    {
+        close(ctx->fd);
+        ctx->fd = -1;
+    }
+}
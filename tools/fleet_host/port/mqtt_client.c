@@ -0,0 +1,939 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mqtt_client.h"
+#include "mqtt_wire.h"
+
+#define HOST_OUTBOX_ENTRIES 16
+#define HOST_OUTBOX_EXPIRE_US (30 * 1000000LL)
+#define HOST_MAX_HANDLERS 12
+#define HOST_DEFAULT_PORT 1883
+#define HOST_DEFAULT_BUFFER_SIZE 1024
+#define HOST_DEFAULT_RECONNECT_MS 10000
+#define HOST_DEFAULT_TIMEOUT_MS 10000
+#define HOST_DEFAULT_KEEPALIVE 120
+#define HOST_MAX_TOPIC_LEN 256
+/* Room of the packet buffers besides the payload*/
+#define HOST_PACKET_OVERHEAD 512
+#define HOST_POLL_MS 1000
+
+static const char *TAG = "mqtt_client_host";
+static const char *const MQTT_EVENTS = "MQTT_EVENTS";
+
+typedef enum {
+    HOST_STATE_STOPPED,
+    HOST_STATE_WAIT_RECONNECT,
+    HOST_STATE_CONNECTING,
+    HOST_STATE_CONNECTED,
+} host_state_t;
+
+typedef struct {
+    esp_mqtt_event_id_t event_id;
+    esp_event_handler_t handler;
+    void *arg;
+} host_handler_t;
+
+/* QoS 1 message kept until its PUBACK, packet is the encoded PUBLISH*/
+typedef struct {
+    bool used;
+    bool written;
+    uint16_t msg_id;
+    int64_t queued_at_us;
+    int64_t first_sent_us;
+    uint8_t *packet;
+    size_t len;
+    size_t cap;
+} host_outbox_entry_t;
+
+struct esp_mqtt_client {
+    /* Guards everything below and the writes to sock*/
+    pthread_mutex_t lock;
+    pthread_t thread;
+    bool running;
+    bool stopping;
+    bool reconnect_requested;
+    host_state_t state;
+    int wake[2];
+    int sock;
+    int64_t reconnect_at_us;
+    int64_t outage_until_us;
+    int64_t last_tx_us;
+    uint16_t next_msg_id;
+
+    char *host;
+    uint16_t port;
+    char *client_id;
+    char *username;
+    char *password;
+    char *will_topic;
+    char *will_msg;
+    size_t will_msg_len;
+    int will_qos;
+    bool will_retain;
+    bool clean_session;
+    uint16_t keepalive;
+    int reconnect_ms;
+    int timeout_ms;
+    bool auto_reconnect;
+    size_t buffer_size;
+    uint64_t outbox_limit;
+
+    uint8_t *tx;
+    size_t tx_cap;
+    uint8_t *rx;
+    char topic[HOST_MAX_TOPIC_LEN + 1];
+    host_outbox_entry_t outbox[HOST_OUTBOX_ENTRIES];
+    size_t outbox_bytes;
+    host_handler_t handlers[HOST_MAX_HANDLERS];
+    size_t handlers_len;
+    esp_mqtt_error_codes_t error;
+    esp_mqtt_client_host_stats_t stats;
+    struct esp_mqtt_client *next;
+};
+
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct esp_mqtt_client *clients;
+static char host_client_id[64] = "esp32";
+static char host_username[64];
+static esp_mqtt_client_host_ack_cb_t host_ack_cb;
+
+static char *copy_string(const char *string)
+{
+    return string == NULL ? NULL : strdup(string);
+}
+
+static void wake_client(esp_mqtt_client_handle_t client)
+{
+    uint8_t byte = 0;
+
+    if (write(client->wake[1], &byte, 1) < 0)
+    {
+        ESP_LOGD(TAG, "Wake pipe full");
+    }
+}
+
+static void drain_wake(esp_mqtt_client_handle_t client)
+{
+    uint8_t bytes[16];
+
+    while (read(client->wake[0], bytes, sizeof(bytes)) > 0)
+    {
+    }
+}
+
+/* Called without the lock, like the esp-mqtt task does*/
+static void dispatch(esp_mqtt_client_handle_t client, esp_mqtt_event_t *event)
+{
+    event->client = client;
+    event->error_handle = &client->error;
+    for (size_t i = 0; i < client->handlers_len; i++)
+    {
+        const host_handler_t *handler = &client->handlers[i];
+        if (handler->event_id == MQTT_EVENT_ANY || handler->event_id == event->event_id)
+        {
+            handler->handler(handler->arg, MQTT_EVENTS, event->event_id, event);
+        }
+    }
+}
+
+static void dispatch_id(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event_id, int msg_id)
+{
+    esp_mqtt_event_t event = {
+        .event_id = event_id,
+        .msg_id = msg_id,
+    };
+    dispatch(client, &event);
+}
+
+/* Has to be called with the lock*/
+static bool send_locked(esp_mqtt_client_handle_t client, const uint8_t *packet, size_t len)
+{
+    if (client->sock < 0 || !mqtt_wire_send(client->sock, packet, len))
+    {
+        return false;
+    }
+    client->stats.tx_bytes += len;
+    client->last_tx_us = esp_timer_get_time();
+    return true;
+}
+
+static uint16_t next_msg_id_locked(esp_mqtt_client_handle_t client)
+{
+    if (++client->next_msg_id == 0)
+    {
+        client->next_msg_id = 1;
+    }
+    return client->next_msg_id;
+}
+
+static void free_entry_locked(esp_mqtt_client_handle_t client, host_outbox_entry_t *entry)
+{
+    entry->used = false;
+    client->outbox_bytes -= entry->len;
+}
+
+/* Has to be called with the lock, the QoS 1 messages go again with DUP*/
+static void resend_outbox_locked(esp_mqtt_client_handle_t client)
+{
+    int64_t now = esp_timer_get_time();
+
+    for (size_t i = 0; i < HOST_OUTBOX_ENTRIES; i++)
+    {
+        host_outbox_entry_t *entry = &client->outbox[i];
+        if (!entry->used)
+        {
+            continue;
+        }
+        if (entry->written)
+        {
+            entry->packet[0] |= MQTT_WIRE_PUBLISH_DUP;
+            client->stats.resends++;
+        }
+        else
+        {
+            entry->first_sent_us = now;
+        }
+        if (!send_locked(client, entry->packet, entry->len))
+        {
+            return;
+        }
+        entry->written = true;
+        client->stats.publishes++;
+    }
+}
+
+static void connection_failed(esp_mqtt_client_handle_t client, esp_mqtt_error_type_t type, int code)
+{
+    client->error = (esp_mqtt_error_codes_t) {
+        .error_type = type,
+        .connect_return_code = type == MQTT_ERROR_TYPE_CONNECTION_REFUSED ? code : 0,
+        .esp_transport_sock_errno = type == MQTT_ERROR_TYPE_TCP_TRANSPORT ? code : 0,
+    };
+    dispatch_id(client, MQTT_EVENT_ERROR, 0);
+    dispatch_id(client, MQTT_EVENT_DISCONNECTED, 0);
+}
+
+static void connection_lost(esp_mqtt_client_handle_t client, int err)
+{
+    pthread_mutex_lock(&client->lock);
+    if (client->sock >= 0)
+    {
+        close(client->sock);
+        client->sock = -1;
+    }
+    client->state = HOST_STATE_WAIT_RECONNECT;
+    client->reconnect_at_us = esp_timer_get_time() + (int64_t)client->reconnect_ms * 1000;
+    bool stopping = client->stopping;
+    pthread_mutex_unlock(&client->lock);
+    /* esp_mqtt_client_stop does not report the session it closes*/
+    if (!stopping)
+    {
+        connection_failed(client, MQTT_ERROR_TYPE_TCP_TRANSPORT, err);
+    }
+}
+
+static void client_connect(esp_mqtt_client_handle_t client)
+{
+    uint8_t connack[2] = { 0 };
+    uint8_t header;
+    size_t remaining;
+    size_t connect_len = 0;
+    int sock = -1;
+
+    dispatch_id(client, MQTT_EVENT_BEFORE_CONNECT, 0);
+    pthread_mutex_lock(&client->lock);
+    bool outage = esp_timer_get_time() < client->outage_until_us;
+    pthread_mutex_unlock(&client->lock);
+    if (!outage)
+    {
+        sock = mqtt_wire_dial(client->host, client->port, client->timeout_ms);
+    }
+    int err = outage ? ENETUNREACH : errno;
+    if (sock >= 0)
+    {
+        mqtt_wire_connect_t connect = {
+            .client_id = client->client_id,
+            .username = client->username,
+            .password = client->password,
+            .keepalive = client->keepalive,
+            .clean_session = client->clean_session,
+            .will_topic = client->will_topic,
+            .will_msg = client->will_msg,
+            .will_msg_len = client->will_msg_len,
+            .will_qos = client->will_qos,
+            .will_retain = client->will_retain,
+        };
+        connect_len = mqtt_wire_connect(client->tx, client->tx_cap, &connect);
+        err = ECONNRESET;
+        if (connect_len > 0 && mqtt_wire_send(sock, client->tx, connect_len)
+            && mqtt_wire_recv_header(sock, &header, &remaining, client->timeout_ms)
+            && header == MQTT_WIRE_CONNACK && remaining == sizeof(connack)
+            && mqtt_wire_recv(sock, connack, sizeof(connack), client->timeout_ms))
+        {
+            err = 0;
+        }
+    }
+    pthread_mutex_lock(&client->lock);
+    if (err != 0 || connack[1] != 0 || client->stopping)
+    {
+        if (sock >= 0)
+        {
+            close(sock);
+        }
+        client->stats.connect_failures++;
+        client->state = client->stopping ? HOST_STATE_STOPPED : HOST_STATE_WAIT_RECONNECT;
+        client->reconnect_at_us = esp_timer_get_time() + (int64_t)client->reconnect_ms * 1000;
+        pthread_mutex_unlock(&client->lock);
+        if (err != 0)
+        {
+            connection_failed(client, MQTT_ERROR_TYPE_TCP_TRANSPORT, err);
+        }
+        else
+        {
+            connection_failed(client, MQTT_ERROR_TYPE_CONNECTION_REFUSED, connack[1]);
+        }
+        return;
+    }
+    client->sock = sock;
+    client->state = HOST_STATE_CONNECTED;
+    client->stats.connects++;
+    client->stats.rx_bytes += 4;
+    client->stats.tx_bytes += connect_len;
+    client->last_tx_us = esp_timer_get_time();
+    pthread_mutex_unlock(&client->lock);
+
+    esp_mqtt_event_t event = {
+        .event_id = MQTT_EVENT_CONNECTED,
+        .session_present = connack[0] & 1,
+    };
+    dispatch(client, &event);
+    pthread_mutex_lock(&client->lock);
+    resend_outbox_locked(client);
+    pthread_mutex_unlock(&client->lock);
+}
+
+static bool read_publish(esp_mqtt_client_handle_t client, uint8_t header, size_t remaining)
+{
+    uint8_t field[2];
+    int qos = (header >> 1) & 3;
+    uint16_t msg_id = 0;
+
+    if (remaining < 2 || !mqtt_wire_recv(client->sock, field, 2, client->timeout_ms))
+    {
+        return false;
+    }
+    size_t topic_len = field[0] << 8 | field[1];
+    size_t id_len = qos > 0 ? 2 : 0;
+    if (topic_len + id_len > remaining - 2)
+    {
+        return false;
+    }
+    size_t data_len = remaining - 2 - topic_len - id_len;
+    if (topic_len > HOST_MAX_TOPIC_LEN)
+    {
+        return mqtt_wire_skip(client->sock, remaining - 2, client->timeout_ms);
+    }
+    if (!mqtt_wire_recv(client->sock, client->topic, topic_len, client->timeout_ms))
+    {
+        return false;
+    }
+    client->topic[topic_len] = '\0';
+    if (qos > 0)
+    {
+        if (!mqtt_wire_recv(client->sock, field, 2, client->timeout_ms))
+        {
+            return false;
+        }
+        msg_id = field[0] << 8 | field[1];
+    }
+    /* Delivered in fragments of the buffer size like esp-mqtt*/
+    size_t offset = 0;
+    do
+    {
+        size_t fragment = data_len - offset < client->buffer_size ? data_len - offset : client->buffer_size;
+        if (!mqtt_wire_recv(client->sock, client->rx, fragment, client->timeout_ms))
+        {
+            return false;
+        }
+        esp_mqtt_event_t event = {
+            .event_id = MQTT_EVENT_DATA,
+            .data = (char *)client->rx,
+            .data_len = fragment,
+            .total_data_len = data_len,
+            .current_data_offset = offset,
+            .topic = offset == 0 ? client->topic : NULL,
+            .topic_len = offset == 0 ? topic_len : 0,
+            .msg_id = msg_id,
+            .qos = qos,
+            .retain = header & MQTT_WIRE_PUBLISH_RETAIN,
+            .dup = header & MQTT_WIRE_PUBLISH_DUP,
+        };
+        dispatch(client, &event);
+        offset += fragment;
+    } while (offset < data_len);
+    if (qos == 1)
+    {
+        uint8_t puback[4];
+        size_t len = mqtt_wire_ack(puback, MQTT_WIRE_PUBACK, msg_id);
+        pthread_mutex_lock(&client->lock);
+        bool sent = send_locked(client, puback, len);
+        pthread_mutex_unlock(&client->lock);
+        return sent;
+    }
+    return true;
+}
+
+static void puback_received(esp_mqtt_client_handle_t client, uint16_t msg_id)
+{
+    uint32_t latency_us = 0;
+    bool found = false;
+
+    pthread_mutex_lock(&client->lock);
+    for (size_t i = 0; i < HOST_OUTBOX_ENTRIES; i++)
+    {
+        host_outbox_entry_t *entry = &client->outbox[i];
+        if (entry->used && entry->msg_id == msg_id)
+        {
+            latency_us = esp_timer_get_time() - entry->first_sent_us;
+            free_entry_locked(client, entry);
+            client->stats.pubacks++;
+            found = true;
+            break;
+        }
+    }
+    esp_mqtt_client_host_ack_cb_t ack_cb = host_ack_cb;
+    pthread_mutex_unlock(&client->lock);
+    if (!found)
+    {
+        return;
+    }
+    if (ack_cb != NULL)
+    {
+        ack_cb(latency_us);
+    }
+    dispatch_id(client, MQTT_EVENT_PUBLISHED, msg_id);
+}
+
+static bool read_packet(esp_mqtt_client_handle_t client)
+{
+    uint8_t header;
+    uint8_t field[2];
+    size_t remaining;
+
+    if (!mqtt_wire_recv_header(client->sock, &header, &remaining, client->timeout_ms))
+    {
+        return false;
+    }
+    pthread_mutex_lock(&client->lock);
+    client->stats.rx_bytes += 2 + remaining + (remaining > 127) + (remaining > 16383);
+    pthread_mutex_unlock(&client->lock);
+    switch (header & 0xF0)
+    {
+    case MQTT_WIRE_PUBLISH:
+        return read_publish(client, header, remaining);
+    case MQTT_WIRE_PUBACK:
+    case MQTT_WIRE_SUBACK & 0xF0:
+    case MQTT_WIRE_UNSUBACK & 0xF0:
+        if (remaining < 2 || !mqtt_wire_recv(client->sock, field, 2, client->timeout_ms)
+            || !mqtt_wire_skip(client->sock, remaining - 2, client->timeout_ms))
+        {
+            return false;
+        }
+        if ((header & 0xF0) == MQTT_WIRE_PUBACK)
+        {
+            puback_received(client, field[0] << 8 | field[1]);
+        }
+        else
+        {
+            dispatch_id(
+                client,
+                (header & 0xF0) == MQTT_WIRE_SUBACK ? MQTT_EVENT_SUBSCRIBED : MQTT_EVENT_UNSUBSCRIBED,
+                field[0] << 8 | field[1]
+            );
+        }
+        return true;
+    default:
+        return mqtt_wire_skip(client->sock, remaining, client->timeout_ms);
+    }
+}
+
+/* Messages without PUBACK for too long are reported and dropped like esp-mqtt does*/
+static void expire_outbox(esp_mqtt_client_handle_t client)
+{
+    int expired[HOST_OUTBOX_ENTRIES];
+    size_t expired_len = 0;
+    int64_t now = esp_timer_get_time();
+
+    pthread_mutex_lock(&client->lock);
+    for (size_t i = 0; i < HOST_OUTBOX_ENTRIES; i++)
+    {
+        host_outbox_entry_t *entry = &client->outbox[i];
+        if (entry->used && now - entry->queued_at_us > HOST_OUTBOX_EXPIRE_US)
+        {
+            expired[expired_len++] = entry->msg_id;
+            free_entry_locked(client, entry);
+            client->stats.expired++;
+        }
+    }
+    pthread_mutex_unlock(&client->lock);
+    for (size_t i = 0; i < expired_len; i++)
+    {
+        dispatch_id(client, MQTT_EVENT_DELETED, expired[i]);
+    }
+}
+
+static void *client_thread(void *arg)
+{
+    esp_mqtt_client_handle_t client = arg;
+
+    pthread_mutex_lock(&client->lock);
+    while (!client->stopping)
+    {
+        int64_t now = esp_timer_get_time();
+        if (client->state == HOST_STATE_WAIT_RECONNECT)
+        {
+            if (client->reconnect_requested || (client->auto_reconnect && now >= client->reconnect_at_us))
+            {
+                client->reconnect_requested = false;
+                client->state = HOST_STATE_CONNECTING;
+                pthread_mutex_unlock(&client->lock);
+                client_connect(client);
+                pthread_mutex_lock(&client->lock);
+                continue;
+            }
+            int wait_ms = client->auto_reconnect ? (int)((client->reconnect_at_us - now + 999) / 1000) : -1;
+            pthread_mutex_unlock(&client->lock);
+            struct pollfd pfd = { .fd = client->wake[0], .events = POLLIN };
+            poll(&pfd, 1, wait_ms);
+            drain_wake(client);
+            pthread_mutex_lock(&client->lock);
+            continue;
+        }
+        /* Connected*/
+        int64_t ping_at_us = client->last_tx_us + (int64_t)client->keepalive * 1000000 / 2;
+        if (now >= ping_at_us)
+        {
+            uint8_t ping[2];
+            send_locked(client, ping, mqtt_wire_empty(ping, MQTT_WIRE_PINGREQ));
+            ping_at_us = client->last_tx_us + (int64_t)client->keepalive * 1000000 / 2;
+        }
+        int sock = client->sock;
+        pthread_mutex_unlock(&client->lock);
+        expire_outbox(client);
+
+        int64_t wait_us = ping_at_us - esp_timer_get_time();
+        int wait_ms = wait_us < HOST_POLL_MS * 1000 ? (int)(wait_us / 1000) + 1 : HOST_POLL_MS;
+        struct pollfd pfds[2] = {
+            { .fd = client->wake[0], .events = POLLIN },
+            { .fd = sock, .events = POLLIN },
+        };
+        if (poll(pfds, 2, wait_ms) > 0)
+        {
+            if (pfds[0].revents)
+            {
+                drain_wake(client);
+            }
+            errno = 0;
+            if (pfds[1].revents && !read_packet(client))
+            {
+                /* A closed socket leaves no errno, an outage reads as a lost network*/
+                int err = errno != 0 && errno != EAGAIN ? errno : ECONNRESET;
+                if (esp_timer_get_time() < client->outage_until_us)
+                {
+                    err = ENETUNREACH;
+                }
+                connection_lost(client, err);
+            }
+        }
+        pthread_mutex_lock(&client->lock);
+    }
+    if (client->sock >= 0)
+    {
+        uint8_t disconnect[2];
+        send_locked(client, disconnect, mqtt_wire_empty(disconnect, MQTT_WIRE_DISCONNECT));
+        close(client->sock);
+        client->sock = -1;
+    }
+    client->state = HOST_STATE_STOPPED;
+    pthread_mutex_unlock(&client->lock);
+    return NULL;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    esp_mqtt_client_handle_t client = calloc(1, sizeof(*client));
+
+    if (client == NULL)
+    {
+        return NULL;
+    }
+    const char *host = config->broker.address.hostname != NULL
+        ? config->broker.address.hostname : config->broker.address.uri;
+    client->host = copy_string(host != NULL ? host : "127.0.0.1");
+    client->port = config->broker.address.port != 0 ? config->broker.address.port : HOST_DEFAULT_PORT;
+    client->client_id = copy_string(
+        config->credentials.client_id != NULL ? config->credentials.client_id : host_client_id
+    );
+    client->username = copy_string(
+        config->credentials.username != NULL ? config->credentials.username
+        : host_username[0] != '\0' ? host_username : NULL
+    );
+    client->password = copy_string(config->credentials.authentication.password);
+    if (config->session.last_will.topic != NULL)
+    {
+        client->will_topic = copy_string(config->session.last_will.topic);
+        client->will_msg_len = config->session.last_will.msg_len > 0
+            ? (size_t)config->session.last_will.msg_len : strlen(config->session.last_will.msg);
+        client->will_msg = malloc(client->will_msg_len + 1);
+        if (client->will_msg != NULL)
+        {
+            memcpy(client->will_msg, config->session.last_will.msg, client->will_msg_len);
+        }
+        client->will_qos = config->session.last_will.qos;
+        client->will_retain = config->session.last_will.retain;
+    }
+    client->clean_session = !config->session.disable_clean_session;
+    client->keepalive = config->session.keepalive > 0 ? config->session.keepalive : HOST_DEFAULT_KEEPALIVE;
+    client->reconnect_ms = config->network.reconnect_timeout_ms > 0
+        ? config->network.reconnect_timeout_ms : HOST_DEFAULT_RECONNECT_MS;
+    client->timeout_ms = config->network.timeout_ms > 0 ? config->network.timeout_ms : HOST_DEFAULT_TIMEOUT_MS;
+    client->auto_reconnect = !config->network.disable_auto_reconnect;
+    client->buffer_size = config->buffer.size > 0 ? config->buffer.size : HOST_DEFAULT_BUFFER_SIZE;
+    client->outbox_limit = config->outbox.limit;
+    client->tx_cap = client->buffer_size + HOST_PACKET_OVERHEAD;
+    client->tx = malloc(client->tx_cap);
+    client->rx = malloc(client->buffer_size);
+    client->sock = -1;
+    /* The outbox is allocated up front so the steady state allocates nothing*/
+    bool allocated = client->host != NULL && client->client_id != NULL && client->tx != NULL && client->rx != NULL
+        && (client->will_topic == NULL || client->will_msg != NULL);
+    for (size_t i = 0; i < HOST_OUTBOX_ENTRIES && allocated; i++)
+    {
+        client->outbox[i].cap = client->tx_cap;
+        client->outbox[i].packet = malloc(client->tx_cap);
+        allocated = client->outbox[i].packet != NULL;
+    }
+    if (!allocated || pipe(client->wake) != 0)
+    {
+        esp_mqtt_client_destroy(client);
+        return NULL;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        int flags = fcntl(client->wake[i], F_GETFL);
+        fcntl(client->wake[i], F_SETFL, flags | O_NONBLOCK);
+    }
+    pthread_mutex_init(&client->lock, NULL);
+    pthread_mutex_lock(&clients_lock);
+    client->next = clients;
+    clients = client;
+    pthread_mutex_unlock(&clients_lock);
+    return client;
+}
+
+esp_err_t esp_mqtt_client_register_event(
+    esp_mqtt_client_handle_t client,
+    esp_mqtt_event_id_t event,
+    esp_event_handler_t event_handler,
+    void *event_handler_arg
+)
+{
+    if (client == NULL || event_handler == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (client->running || client->handlers_len == HOST_MAX_HANDLERS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    client->handlers[client->handlers_len++] = (host_handler_t) {
+        .event_id = event,
+        .handler = event_handler,
+        .arg = event_handler_arg,
+    };
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    if (client == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (client->running)
+    {
+        return ESP_FAIL;
+    }
+    client->stopping = false;
+    client->state = HOST_STATE_WAIT_RECONNECT;
+    client->reconnect_requested = true;
+    if (pthread_create(&client->thread, NULL, client_thread, client) != 0)
+    {
+        client->state = HOST_STATE_STOPPED;
+        return ESP_FAIL;
+    }
+    client->running = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_reconnect(esp_mqtt_client_handle_t client)
+{
+    esp_err_t err = ESP_FAIL;
+
+    pthread_mutex_lock(&client->lock);
+    if (client->state == HOST_STATE_WAIT_RECONNECT)
+    {
+        client->reconnect_requested = true;
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&client->lock);
+    wake_client(client);
+    return err;
+}
+
+/* Only the reconnect wait changes, it applies from the next disconnection*/
+esp_err_t esp_mqtt_set_config(esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t *config)
+{
+    if (client == NULL || config == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&client->lock);
+    client->reconnect_ms = config->network.reconnect_timeout_ms > 0
+        ? config->network.reconnect_timeout_ms : HOST_DEFAULT_RECONNECT_MS;
+    pthread_mutex_unlock(&client->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    if (client == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!client->running)
+    {
+        return ESP_FAIL;
+    }
+    pthread_mutex_lock(&client->lock);
+    client->stopping = true;
+    if (client->sock >= 0)
+    {
+        shutdown(client->sock, SHUT_RD);
+    }
+    pthread_mutex_unlock(&client->lock);
+    wake_client(client);
+    pthread_join(client->thread, NULL);
+    client->running = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+    if (client == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (client->running)
+    {
+        esp_mqtt_client_stop(client);
+    }
+    pthread_mutex_lock(&clients_lock);
+    for (struct esp_mqtt_client **c = &clients; *c != NULL; c = &(*c)->next)
+    {
+        if (*c == client)
+        {
+            *c = client->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&clients_lock);
+    for (size_t i = 0; i < HOST_OUTBOX_ENTRIES; i++)
+    {
+        free(client->outbox[i].packet);
+    }
+    if (client->wake[0] > 0)
+    {
+        close(client->wake[0]);
+        close(client->wake[1]);
+    }
+    free(client->host);
+    free(client->client_id);
+    free(client->username);
+    free(client->password);
+    free(client->will_topic);
+    free(client->will_msg);
+    free(client->tx);
+    free(client->rx);
+    free(client);
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(
+    esp_mqtt_client_handle_t client,
+    const char *topic,
+    const char *data,
+    int len,
+    int qos,
+    int retain
+)
+{
+    host_outbox_entry_t *entry = NULL;
+    int msg_id = 0;
+
+    if (client == NULL || topic == NULL)
+    {
+        return -1;
+    }
+    if (len <= 0 && data != NULL)
+    {
+        len = strlen(data);
+    }
+    size_t needed = strlen(topic) + len + 9;
+    pthread_mutex_lock(&client->lock);
+    if (qos == 0)
+    {
+        size_t packet_len = mqtt_wire_publish(client->tx, client->tx_cap, topic, data, len, 0, retain, 0);
+        bool sent = client->state == HOST_STATE_CONNECTED && packet_len > 0 && send_locked(client, client->tx, packet_len);
+        if (sent)
+        {
+            client->stats.publishes++;
+        }
+        pthread_mutex_unlock(&client->lock);
+        return sent ? 0 : -1;
+    }
+    if (client->outbox_limit > 0 && client->outbox_bytes + needed > client->outbox_limit)
+    {
+        pthread_mutex_unlock(&client->lock);
+        return -2;
+    }
+    for (size_t i = 0; i < HOST_OUTBOX_ENTRIES && entry == NULL; i++)
+    {
+        if (!client->outbox[i].used)
+        {
+            entry = &client->outbox[i];
+        }
+    }
+    if (entry == NULL)
+    {
+        pthread_mutex_unlock(&client->lock);
+        return -2;
+    }
+    if (needed > entry->cap)
+    {
+        uint8_t *packet = realloc(entry->packet, needed);
+        if (packet == NULL)
+        {
+            pthread_mutex_unlock(&client->lock);
+            return -1;
+        }
+        entry->packet = packet;
+        entry->cap = needed;
+    }
+    msg_id = next_msg_id_locked(client);
+    entry->len = mqtt_wire_publish(entry->packet, entry->cap, topic, data, len, 1, retain, msg_id);
+    entry->msg_id = msg_id;
+    entry->used = true;
+    entry->written = false;
+    entry->queued_at_us = esp_timer_get_time();
+    client->outbox_bytes += entry->len;
+    if (client->state == HOST_STATE_CONNECTED)
+    {
+        entry->first_sent_us = entry->queued_at_us;
+        /* A failed write is noticed by the client thread, the message goes again on reconnect*/
+        if (send_locked(client, entry->packet, entry->len))
+        {
+            entry->written = true;
+            client->stats.publishes++;
+        }
+    }
+    pthread_mutex_unlock(&client->lock);
+    return msg_id;
+}
+
+static int send_subscription(esp_mqtt_client_handle_t client, const char *topic, int qos, bool subscribe)
+{
+    int msg_id = -1;
+
+    pthread_mutex_lock(&client->lock);
+    if (client->state == HOST_STATE_CONNECTED)
+    {
+        uint16_t id = next_msg_id_locked(client);
+        size_t len = subscribe
+            ? mqtt_wire_subscribe(client->tx, client->tx_cap, id, topic, qos)
+            : mqtt_wire_unsubscribe(client->tx, client->tx_cap, id, topic);
+        if (len > 0 && send_locked(client, client->tx, len))
+        {
+            msg_id = id;
+        }
+    }
+    pthread_mutex_unlock(&client->lock);
+    return msg_id;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    return send_subscription(client, topic, qos, true);
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic)
+{
+    return send_subscription(client, topic, 0, false);
+}
+
+void esp_mqtt_client_host_set_credentials(const char *client_id, const char *username)
+{
+    snprintf(host_client_id, sizeof(host_client_id), "%s", client_id);
+    snprintf(host_username, sizeof(host_username), "%s", username != NULL ? username : "");
+}
+
+void esp_mqtt_client_host_set_ack_cb(esp_mqtt_client_host_ack_cb_t cb)
+{
+    host_ack_cb = cb;
+}
+
+void esp_mqtt_client_host_outage(uint32_t outage_ms)
+{
+    pthread_mutex_lock(&clients_lock);
+    for (struct esp_mqtt_client *client = clients; client != NULL; client = client->next)
+    {
+        pthread_mutex_lock(&client->lock);
+        client->outage_until_us = esp_timer_get_time() + (int64_t)outage_ms * 1000;
+        /* The client thread sees the connection fail like a lost access point*/
+        if (client->sock >= 0)
+        {
+            shutdown(client->sock, SHUT_RDWR);
+        }
+        pthread_mutex_unlock(&client->lock);
+        wake_client(client);
+    }
+    pthread_mutex_unlock(&clients_lock);
+}
+
+void esp_mqtt_client_host_get_stats(esp_mqtt_client_host_stats_t *stats)
+{
+    *stats = (esp_mqtt_client_host_stats_t) { 0 };
+    pthread_mutex_lock(&clients_lock);
+    for (struct esp_mqtt_client *client = clients; client != NULL; client = client->next)
+    {
+        pthread_mutex_lock(&client->lock);
+        stats->connects += client->stats.connects;
+        stats->connect_failures += client->stats.connect_failures;
+        stats->publishes += client->stats.publishes;
+        stats->resends += client->stats.resends;
+        stats->pubacks += client->stats.pubacks;
+        stats->expired += client->stats.expired;
+        stats->tx_bytes += client->stats.tx_bytes;
+        stats->rx_bytes += client->stats.rx_bytes;
+        pthread_mutex_unlock(&client->lock);
+    }
+    pthread_mutex_unlock(&clients_lock);
+}
@@ -0,0 +1,320 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "mqtt_wire.h"
+
+#define MQTT_WIRE_PROTOCOL_LEVEL 4
+
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    bool overflow;
+} wire_writer_t;
+
+static void put_bytes(wire_writer_t *w, const void *data, size_t len)
+{
+    if (w->overflow || len > w->cap - w->len)
+    {
+        w->overflow = true;
+        return;
+    }
+    memcpy(&w->buf[w->len], data, len);
+    w->len += len;
+}
+
+static void put_u8(wire_writer_t *w, uint8_t value)
+{
+    put_bytes(w, &value, 1);
+}
+
+static void put_u16(wire_writer_t *w, uint16_t value)
+{
+    uint8_t bytes[2] = { value >> 8, value & 0xFF };
+    put_bytes(w, bytes, sizeof(bytes));
+}
+
+static void put_string(wire_writer_t *w, const char *string, size_t len)
+{
+    put_u16(w, len);
+    put_bytes(w, string, len);
+}
+
+/* The body is written 5 bytes in, room for the longest fixed header, and
+ moved back to right after the fixed header*/
+static size_t finish(wire_writer_t *w, uint8_t header, size_t body_at)
+{
+    uint8_t fixed[5];
+    size_t remaining = w->len - body_at;
+    size_t fixed_len = 1;
+
+    if (w->overflow || remaining > 268435455)
+    {
+        return 0;
+    }
+    fixed[0] = header;
+    do
+    {
+        uint8_t digit = remaining % 128;
+        remaining /= 128;
+        fixed[fixed_len++] = remaining > 0 ? digit | 0x80 : digit;
+    } while (remaining > 0);
+    memcpy(&w->buf[body_at - fixed_len], fixed, fixed_len);
+    memmove(w->buf, &w->buf[body_at - fixed_len], w->len - (body_at - fixed_len));
+    return w->len - (body_at - fixed_len);
+}
+
+static wire_writer_t writer(uint8_t *buf, size_t cap)
+{
+    wire_writer_t w = { .buf = buf, .cap = cap, .len = 5, .overflow = cap < 5 };
+    return w;
+}
+
+size_t mqtt_wire_connect(uint8_t *buf, size_t cap, const mqtt_wire_connect_t *connect)
+{
+    wire_writer_t w = writer(buf, cap);
+    uint8_t flags = connect->clean_session ? 0x02 : 0;
+
+    if (connect->will_topic != NULL)
+    {
+        flags |= 0x04 | (connect->will_qos & 3) << 3 | (connect->will_retain ? 0x20 : 0);
+    }
+    if (connect->password != NULL)
+    {
+        flags |= 0x40;
+    }
+    if (connect->username != NULL)
+    {
+        flags |= 0x80;
+    }
+    put_string(&w, "MQTT", 4);
+    put_u8(&w, MQTT_WIRE_PROTOCOL_LEVEL);
+    put_u8(&w, flags);
+    put_u16(&w, connect->keepalive);
+    put_string(&w, connect->client_id, strlen(connect->client_id));
+    if (connect->will_topic != NULL)
+    {
+        put_string(&w, connect->will_topic, strlen(connect->will_topic));
+        put_string(&w, connect->will_msg, connect->will_msg_len);
+    }
+    if (connect->username != NULL)
+    {
+        put_string(&w, connect->username, strlen(connect->username));
+    }
+    if (connect->password != NULL)
+    {
+        put_string(&w, connect->password, strlen(connect->password));
+    }
+    return finish(&w, MQTT_WIRE_CONNECT, 5);
+}
+
+size_t mqtt_wire_publish(
+    uint8_t *buf,
+    size_t cap,
+    const char *topic,
+    const void *data,
+    size_t len,
+    int qos,
+    bool retain,
+    uint16_t msg_id
+)
+{
+    wire_writer_t w = writer(buf, cap);
+
+    put_string(&w, topic, strlen(topic));
+    if (qos > 0)
+    {
+        put_u16(&w, msg_id);
+    }
+    put_bytes(&w, data, len);
+    return finish(&w, MQTT_WIRE_PUBLISH | (qos & 3) << 1 | (retain ? MQTT_WIRE_PUBLISH_RETAIN : 0), 5);
+}
+
+size_t mqtt_wire_subscribe(uint8_t *buf, size_t cap, uint16_t msg_id, const char *topic, int qos)
+{
+    wire_writer_t w = writer(buf, cap);
+
+    put_u16(&w, msg_id);
+    put_string(&w, topic, strlen(topic));
+    put_u8(&w, qos & 3);
+    return finish(&w, MQTT_WIRE_SUBSCRIBE, 5);
+}
+
+size_t mqtt_wire_unsubscribe(uint8_t *buf, size_t cap, uint16_t msg_id, const char *topic)
+{
+    wire_writer_t w = writer(buf, cap);
+
+    put_u16(&w, msg_id);
+    put_string(&w, topic, strlen(topic));
+    return finish(&w, MQTT_WIRE_UNSUBSCRIBE, 5);
+}
+
+size_t mqtt_wire_ack(uint8_t *buf, uint8_t type, uint16_t msg_id)
+{
+    buf[0] = type;
+    buf[1] = 2;
+    buf[2] = msg_id >> 8;
+    buf[3] = msg_id & 0xFF;
+    return 4;
+}
+
+size_t mqtt_wire_empty(uint8_t *buf, uint8_t type)
+{
+    buf[0] = type;
+    buf[1] = 0;
+    return 2;
+}
+
+bool mqtt_wire_send(int sock, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t sent = send(sock, p, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        p += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+bool mqtt_wire_recv(int sock, void *buf, size_t len, int timeout_ms)
+{
+    uint8_t *p = buf;
+
+    while (len > 0)
+    {
+        struct pollfd pfd = { .fd = sock, .events = POLLIN };
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ready <= 0)
+        {
+            return false;
+        }
+        ssize_t got = recv(sock, p, len, 0);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return false;
+        }
+        p += got;
+        len -= got;
+    }
+    return true;
+}
+
+bool mqtt_wire_recv_header(int sock, uint8_t *header, size_t *remaining, int timeout_ms)
+{
+    uint8_t digit;
+    size_t multiplier = 1;
+
+    if (!mqtt_wire_recv(sock, header, 1, timeout_ms))
+    {
+        return false;
+    }
+    *remaining = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (!mqtt_wire_recv(sock, &digit, 1, timeout_ms))
+        {
+            return false;
+        }
+        *remaining += (digit & 0x7F) * multiplier;
+        multiplier *= 128;
+        if (!(digit & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool mqtt_wire_skip(int sock, size_t len, int timeout_ms)
+{
+    uint8_t scratch[256];
+
+    while (len > 0)
+    {
+        size_t n = len < sizeof(scratch) ? len : sizeof(scratch);
+        if (!mqtt_wire_recv(sock, scratch, n, timeout_ms))
+        {
+            return false;
+        }
+        len -= n;
+    }
+    return true;
+}
+
+int mqtt_wire_dial(const char *host, uint16_t port, int timeout_ms)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *addresses;
+    char service[8];
+    int sock = -1;
+    int err = ECONNREFUSED;
+
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &addresses) != 0)
+    {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    for (struct addrinfo *a = addresses; a != NULL && sock < 0; a = a->ai_next)
+    {
+        sock = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if (sock < 0)
+        {
+            err = errno;
+            continue;
+        }
+        int flags = fcntl(sock, F_GETFL);
+        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+        if (connect(sock, a->ai_addr, a->ai_addrlen) != 0 && errno != EINPROGRESS)
+        {
+            err = errno;
+            close(sock);
+            sock = -1;
+            continue;
+        }
+        struct pollfd pfd = { .fd = sock, .events = POLLOUT };
+        socklen_t err_len = sizeof(err);
+        err = ETIMEDOUT;
+        if (poll(&pfd, 1, timeout_ms) != 1 || getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0 || err != 0)
+        {
+            close(sock);
+            sock = -1;
+            continue;
+        }
+        fcntl(sock, F_SETFL, flags);
+    }
+    freeaddrinfo(addresses);
+    if (sock < 0)
+    {
+        errno = err;
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
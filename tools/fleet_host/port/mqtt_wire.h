@@ -0,0 +1,91 @@
+/**
+ * @file mqtt_wire.h
+ * @brief MQTT 3.1.1 packets of the host client and of the fleet monitor.
+ *
+ * The encoders write a whole packet into buf and return its length, 0 when
+ * it does not fit. The readers block on a connected TCP socket, up to
+ * timeout_ms for every piece.
+ */
+#ifndef MQTT_WIRE_H
+#define MQTT_WIRE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MQTT_WIRE_CONNECT 0x10
+#define MQTT_WIRE_CONNACK 0x20
+#define MQTT_WIRE_PUBLISH 0x30
+#define MQTT_WIRE_PUBACK 0x40
+#define MQTT_WIRE_SUBSCRIBE 0x82
+#define MQTT_WIRE_SUBACK 0x90
+#define MQTT_WIRE_UNSUBSCRIBE 0xA2
+#define MQTT_WIRE_UNSUBACK 0xB0
+#define MQTT_WIRE_PINGREQ 0xC0
+#define MQTT_WIRE_PINGRESP 0xD0
+#define MQTT_WIRE_DISCONNECT 0xE0
+
+#define MQTT_WIRE_PUBLISH_DUP 0x08
+#define MQTT_WIRE_PUBLISH_RETAIN 0x01
+
+/**
+ * @brief Fields of a CONNECT, NULL strings are left out.
+ */
+typedef struct {
+    const char *client_id;
+    const char *username;
+    const char *password;
+    uint16_t keepalive;
+    bool clean_session;
+    const char *will_topic;
+    const char *will_msg;
+    size_t will_msg_len;
+    int will_qos;
+    bool will_retain;
+} mqtt_wire_connect_t;
+
+size_t mqtt_wire_connect(uint8_t *buf, size_t cap, const mqtt_wire_connect_t *connect);
+size_t mqtt_wire_publish(
+    uint8_t *buf,
+    size_t cap,
+    const char *topic,
+    const void *data,
+    size_t len,
+    int qos,
+    bool retain,
+    uint16_t msg_id
+);
+size_t mqtt_wire_subscribe(uint8_t *buf, size_t cap, uint16_t msg_id, const char *topic, int qos);
+size_t mqtt_wire_unsubscribe(uint8_t *buf, size_t cap, uint16_t msg_id, const char *topic);
+size_t mqtt_wire_ack(uint8_t *buf, uint8_t type, uint16_t msg_id);
+size_t mqtt_wire_empty(uint8_t *buf, uint8_t type);
+
+/**
+ * @brief Write all of buf, false if the connection failed.
+ */
+bool mqtt_wire_send(int sock, const void *buf, size_t len);
+
+/**
+ * @brief Read exactly len bytes, false on timeout or if the connection failed.
+ */
+bool mqtt_wire_recv(int sock, void *buf, size_t len, int timeout_ms);
+
+/**
+ * @brief Read the fixed header of the next packet.
+ *
+ * @param header Packet type and flags.
+ * @param remaining Length of the rest of the packet.
+ */
+bool mqtt_wire_recv_header(int sock, uint8_t *header, size_t *remaining, int timeout_ms);
+
+/**
+ * @brief Read and drop len bytes.
+ */
+bool mqtt_wire_skip(int sock, size_t len, int timeout_ms);
+
+/**
+ * @brief Open a TCP connection with Nagle disabled.
+ *
+ * @return The socket, -1 with errno set on failure.
+ */
+int mqtt_wire_dial(const char *host, uint16_t port, int timeout_ms);
+#endif // !MQTT_WIRE_H
@@ -0,0 +1,429 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_err.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#define HOST_NVS_VALUES      64
+#define HOST_NVS_HANDLES     8
+#define HOST_NVS_NAMESPACES  8
+/* 24 KB partition, 5 pages of 126 entries of 32 bytes in use*/
+#define HOST_NVS_ENTRIES     630
+#define HOST_NVS_ENTRY_BYTES 32
+
+typedef enum {
+    HOST_NVS_U16,
+    HOST_NVS_U32,
+    HOST_NVS_STR,
+    HOST_NVS_BLOB,
+} host_nvs_type_t;
+
+typedef struct {
+    bool used;
+    char name[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    host_nvs_type_t type;
+    uint8_t *data;
+    size_t len;
+} host_nvs_value_t;
+
+typedef struct {
+    bool open;
+    char name[NVS_KEY_NAME_MAX_SIZE];
+    nvs_open_mode_t mode;
+} host_nvs_handle_t;
+
+static pthread_mutex_t host_nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool host_nvs_initialized;
+static host_nvs_value_t host_nvs_values[HOST_NVS_VALUES];
+static host_nvs_handle_t host_nvs_handles[HOST_NVS_HANDLES];
+static char host_nvs_namespaces[HOST_NVS_NAMESPACES][NVS_KEY_NAME_MAX_SIZE];
+static nvs_host_stats_t host_nvs_stats;
+static char host_nvs_fail_key[NVS_KEY_NAME_MAX_SIZE];
+static esp_err_t host_nvs_fail_err;
+
+static void value_free(host_nvs_value_t *value)
+{
+    free(value->data);
+    memset(value, 0, sizeof(*value));
+}
+
+static host_nvs_handle_t *handle_get(nvs_handle_t handle)
+{
+    if (handle == 0 || handle > HOST_NVS_HANDLES || !host_nvs_handles[handle - 1].open)
+    {
+        return NULL;
+    }
+    return &host_nvs_handles[handle - 1];
+}
+
+static bool namespace_exists(const char *name)
+{
+    for (size_t i = 0; i < HOST_NVS_NAMESPACES; i++)
+    {
+        if (strcmp(host_nvs_namespaces[i], name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static esp_err_t namespace_create(const char *name)
+{
+    for (size_t i = 0; i < HOST_NVS_NAMESPACES; i++)
+    {
+        if (host_nvs_namespaces[i][0] == '\0')
+        {
+            strcpy(host_nvs_namespaces[i], name);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+}
+
+static host_nvs_value_t *value_find(const char *name, const char *key)
+{
+    for (size_t i = 0; i < HOST_NVS_VALUES; i++)
+    {
+        host_nvs_value_t *value = &host_nvs_values[i];
+        if (value->used && strcmp(value->name, name) == 0 && strcmp(value->key, key) == 0)
+        {
+            return value;
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t value_get(
+    nvs_handle_t handle,
+    const char *key,
+    host_nvs_type_t type,
+    void *out_value,
+    size_t *length
+)
+{
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&host_nvs_lock);
+    host_nvs_stats.reads++;
+    const host_nvs_handle_t *slot = handle_get(handle);
+    if (slot == NULL)
+    {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    else
+    {
+        const host_nvs_value_t *value = value_find(slot->name, key);
+        if (value == NULL || value->type != type)
+        {
+            err = ESP_ERR_NVS_NOT_FOUND;
+        }
+        else if (out_value != NULL && *length < value->len)
+        {
+            err = ESP_ERR_NVS_INVALID_LENGTH;
+        }
+        else
+        {
+            if (out_value != NULL)
+            {
+                memcpy(out_value, value->data, value->len);
+            }
+            *length = value->len;
+        }
+    }
+    pthread_mutex_unlock(&host_nvs_lock);
+    return err;
+}
+
+/* Store a value, or erase it with data NULL, at once as NVS does*/
+static esp_err_t value_set(
+    nvs_handle_t handle,
+    const char *key,
+    host_nvs_type_t type,
+    const void *data,
+    size_t len
+)
+{
+    host_nvs_handle_t *slot;
+    host_nvs_value_t *value;
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&host_nvs_lock);
+    host_nvs_stats.writes++;
+    slot = handle_get(handle);
+    if (slot == NULL)
+    {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    else if (slot->mode != NVS_READWRITE)
+    {
+        err = ESP_ERR_NVS_READ_ONLY;
+    }
+    else if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE)
+    {
+        err = ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    else if (data != NULL && strcmp(key, host_nvs_fail_key) == 0)
+    {
+        err = host_nvs_fail_err;
+    }
+    else if (data == NULL && value_find(slot->name, key) == NULL)
+    {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (err != ESP_OK)
+    {
+        pthread_mutex_unlock(&host_nvs_lock);
+        return err;
+    }
+    value = value_find(slot->name, key);
+    if (data == NULL)
+    {
+        value_free(value);
+        pthread_mutex_unlock(&host_nvs_lock);
+        return ESP_OK;
+    }
+    /* The old value stays if the new one does not fit*/
+    uint8_t *copy = len > 0 ? malloc(len) : NULL;
+    for (size_t i = 0; value == NULL && i < HOST_NVS_VALUES; i++)
+    {
+        value = !host_nvs_values[i].used ? &host_nvs_values[i] : NULL;
+    }
+    if (value == NULL || (len > 0 && copy == NULL))
+    {
+        free(copy);
+        pthread_mutex_unlock(&host_nvs_lock);
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    if (len > 0)
+    {
+        memcpy(copy, data, len);
+    }
+    free(value->data);
+    *value = (host_nvs_value_t){
+        .used = true,
+        .type = type,
+        .data = copy,
+        .len = len,
+    };
+    strcpy(value->name, slot->name);
+    strcpy(value->key, key);
+    pthread_mutex_unlock(&host_nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    pthread_mutex_lock(&host_nvs_lock);
+    host_nvs_initialized = true;
+    pthread_mutex_unlock(&host_nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    pthread_mutex_lock(&host_nvs_lock);
+    for (size_t i = 0; i < HOST_NVS_VALUES; i++)
+    {
+        value_free(&host_nvs_values[i]);
+    }
+    memset(host_nvs_handles, 0, sizeof(host_nvs_handles));
+    memset(host_nvs_namespaces, 0, sizeof(host_nvs_namespaces));
+    host_nvs_stats.open_handles = 0;
+    pthread_mutex_unlock(&host_nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&host_nvs_lock);
+    if (!host_nvs_initialized)
+    {
+        err = ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    else if (strlen(name) >= NVS_KEY_NAME_MAX_SIZE)
+    {
+        err = ESP_ERR_NVS_INVALID_NAME;
+    }
+    else if (!namespace_exists(name))
+    {
+        /* Only a read-write open creates the namespace*/
+        err = open_mode == NVS_READWRITE ? namespace_create(name) : ESP_ERR_NVS_NOT_FOUND;
+    }
+    for (size_t i = 0; err == ESP_OK && i < HOST_NVS_HANDLES; i++)
+    {
+        if (!host_nvs_handles[i].open)
+        {
+            host_nvs_handles[i].open = true;
+            host_nvs_handles[i].mode = open_mode;
+            strcpy(host_nvs_handles[i].name, name);
+            host_nvs_stats.opens++;
+            host_nvs_stats.open_handles++;
+            *out_handle = i + 1;
+            pthread_mutex_unlock(&host_nvs_lock);
+            return ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&host_nvs_lock);
+    return err != ESP_OK ? err : ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&host_nvs_lock);
+    host_nvs_handle_t *slot = handle_get(handle);
+    if (slot != NULL)
+    {
+        slot->open = false;
+        host_nvs_stats.open_handles--;
+    }
+    pthread_mutex_unlock(&host_nvs_lock);
+}
+
+/* The values are already stored, as in NVS, it is only counted*/
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&host_nvs_lock);
+    host_nvs_stats.commits++;
+    esp_err_t err = handle_get(handle) != NULL ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+    pthread_mutex_unlock(&host_nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *out_value)
+{
+    size_t length = sizeof(*out_value);
+
+    return value_get(handle, key, HOST_NVS_U16, out_value, &length);
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+    size_t length = sizeof(*out_value);
+
+    return value_get(handle, key, HOST_NVS_U32, out_value, &length);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    return value_get(handle, key, HOST_NVS_STR, out_value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    return value_get(handle, key, HOST_NVS_BLOB, out_value, length);
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value)
+{
+    return value_set(handle, key, HOST_NVS_U16, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return value_set(handle, key, HOST_NVS_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return value_set(handle, key, HOST_NVS_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    /* An empty blob is stored, unlike an erase*/
+    static const uint8_t empty;
+
+    return value_set(handle, key, HOST_NVS_BLOB, value != NULL ? value : &empty, length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    return value_set(handle, key, HOST_NVS_BLOB, NULL, 0);
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    char keys[HOST_NVS_VALUES][NVS_KEY_NAME_MAX_SIZE];
+    size_t count = 0;
+
+    pthread_mutex_lock(&host_nvs_lock);
+    const host_nvs_handle_t *slot = handle_get(handle);
+    for (size_t i = 0; slot != NULL && i < HOST_NVS_VALUES; i++)
+    {
+        if (host_nvs_values[i].used && strcmp(host_nvs_values[i].name, slot->name) == 0)
+        {
+            strcpy(keys[count++], host_nvs_values[i].key);
+        }
+    }
+    pthread_mutex_unlock(&host_nvs_lock);
+    if (slot == NULL)
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        esp_err_t err = nvs_erase_key(handle, keys[i]);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_stats(const char *part_name, nvs_stats_t *nvs_stats)
+{
+    size_t used = 0;
+    size_t namespaces = 0;
+
+    pthread_mutex_lock(&host_nvs_lock);
+    if (!host_nvs_initialized)
+    {
+        pthread_mutex_unlock(&host_nvs_lock);
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    for (size_t i = 0; i < HOST_NVS_NAMESPACES; i++)
+    {
+        namespaces += host_nvs_namespaces[i][0] != '\0';
+    }
+    for (size_t i = 0; i < HOST_NVS_VALUES; i++)
+    {
+        const host_nvs_value_t *value = &host_nvs_values[i];
+        if (value->used)
+        {
+            /* An entry for the key, then the data in entries of 32 bytes*/
+            used += 1 + (value->type == HOST_NVS_U16 || value->type == HOST_NVS_U32 ? 0 : (value->len + HOST_NVS_ENTRY_BYTES - 1) / HOST_NVS_ENTRY_BYTES);
+        }
+    }
+    used += namespaces;
+    pthread_mutex_unlock(&host_nvs_lock);
+    *nvs_stats = (nvs_stats_t){
+        .used_entries = used,
+        .free_entries = HOST_NVS_ENTRIES - used,
+        .available_entries = HOST_NVS_ENTRIES - used,
+        .total_entries = HOST_NVS_ENTRIES,
+        .namespace_count = namespaces,
+    };
+    return ESP_OK;
+}
+
+void nvs_host_get_stats(nvs_host_stats_t *stats)
+{
+    pthread_mutex_lock(&host_nvs_lock);
+    *stats = host_nvs_stats;
+    pthread_mutex_unlock(&host_nvs_lock);
+}
+
+void nvs_host_fail(const char *key, esp_err_t err)
+{
+    pthread_mutex_lock(&host_nvs_lock);
+    strlcpy(host_nvs_fail_key, key != NULL ? key : "", sizeof(host_nvs_fail_key));
+    host_nvs_fail_err = err;
+    pthread_mutex_unlock(&host_nvs_lock);
+}
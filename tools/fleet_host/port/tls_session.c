@@ -0,0 +1,32 @@
+#include <string.h>
+#include "mqtt_client.h"
+#include "tls_session.h"
+
+/* The host client connects over plain TCP, the transport is only a token*/
+struct esp_transport_item_t {
+    esp_tls_cfg_t cfg;
+};
+
+static struct esp_transport_item_t host_transport;
+
+esp_transport_handle_t tls_session_transport_init(const esp_tls_cfg_t *cfg)
+{
+    host_transport.cfg = *cfg;
+    return &host_transport;
+}
+
+void tls_session_forget(void)
+{
+}
+
+void tls_session_get_stats(tls_session_stats_t *stats)
+{
+    esp_mqtt_client_host_stats_t mqtt;
+
+    esp_mqtt_client_host_get_stats(&mqtt);
+    *stats = (tls_session_stats_t) {
+        .full_handshakes = mqtt.connects,
+        .tx_bytes = mqtt.tx_bytes,
+        .rx_bytes = mqtt.rx_bytes,
+    };
+}
@@ -0,0 +1,195 @@
+/*
+ * Test of the settings registry shared by app_main and the fleet host.
+ *
+ * The telemetry batch is replaced by stubs recording what it is given.
+ * Out of range values have to be refused at start and when staged, a
+ * send_time beyond 16 bits has to reach the sampling and the upload slot
+ * as it is, a failed update has to give the previous interval and upload
+ * slot back and the link policy and active range have to be registered
+ * only with their hooks. It exits with 1
+ * on the first failed check.
+ *
+ *     runtime_settings_test
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "runtime_config.h"
+#include "runtime_settings.h"
+#include "telemetry_batch.h"
+
+#define CHECK(cond)                                                        \
+    do                                                                     \
+    {                                                                      \
+        if (!(cond))                                                       \
+        {                                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                      \
+        }                                                                  \
+    } while (0)
+
+/* Refused by the telemetry batch stub and by the sampling*/
+#define TEST_REFUSED_BATCH_SIZE 9
+#define TEST_REFUSED_SEND_TIME  45
+
+static uint32_t slot_period_ms;
+static int batch_size = -1;
+static int batch_size_calls;
+static uint32_t sampled_send_time;
+static int link_on_demand = -1;
+static int32_t active_start = -1;
+static int32_t active_end = -1;
+
+esp_err_t telemetry_batch_set_size(uint16_t n)
+{
+    batch_size_calls++;
+    if (n == TEST_REFUSED_BATCH_SIZE)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    batch_size = n;
+    return ESP_OK;
+}
+
+esp_err_t telemetry_batch_set_deadline(uint32_t s)
+{
+    return ESP_OK;
+}
+
+esp_err_t telemetry_batch_set_slot(uint32_t period_ms, uint32_t offset_ms)
+{
+    slot_period_ms = period_ms;
+    return ESP_OK;
+}
+
+static esp_err_t test_send_time(uint32_t send_time)
+{
+    if (send_time == TEST_REFUSED_SEND_TIME)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sampled_send_time = send_time;
+    return ESP_OK;
+}
+
+static esp_err_t test_link_on_demand(bool on_demand)
+{
+    link_on_demand = on_demand;
+    return ESP_OK;
+}
+
+static esp_err_t test_active_range(int32_t start_minute, int32_t end_minute)
+{
+    active_start = start_minute;
+    active_end = end_minute;
+    return ESP_OK;
+}
+
+static int stage(runtime_config_update_t *update, const char *key, runtime_config_type_t type, int32_t value)
+{
+    int index = runtime_config_find(key, strlen(key));
+
+    return index < 0 ? ESP_ERR_NOT_FOUND : runtime_config_stage(update, index, type, value);
+}
+
+int main(void)
+{
+    static const runtime_settings_hooks_t hooks = {
+        .send_time = test_send_time,
+    };
+    static const runtime_settings_hooks_t link_hooks = {
+        .send_time = test_send_time,
+        .link_on_demand = test_link_on_demand,
+    };
+    static const runtime_settings_hooks_t range_hooks = {
+        .send_time = test_send_time,
+        .active_range = test_active_range,
+    };
+    runtime_settings_t current = {
+        .send_time = 30,
+        .batch_size = 4,
+        .batch_deadline = 120,
+        .active_start = 8 * 60,
+        .active_end = 22 * 60,
+    };
+    runtime_config_update_t update = { 0 };
+    int32_t value;
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    /* Out of range at start*/
+    current.send_time = 0;
+    CHECK(runtime_settings_init(&current, &hooks) == ESP_ERR_INVALID_ARG);
+    current.send_time = RUNTIME_SETTINGS_MAX_SECONDS + 1;
+    CHECK(runtime_settings_init(&current, &hooks) == ESP_ERR_INVALID_ARG);
+    current.send_time = 30;
+    CHECK(runtime_settings_init(&current, &hooks) == ESP_OK);
+    CHECK(runtime_settings_send_time() == 30);
+    CHECK(runtime_config_len() == 3);
+    CHECK(runtime_config_find("link_on_demand", strlen("link_on_demand")) < 0);
+    CHECK(runtime_config_find("active_start", strlen("active_start")) < 0);
+
+    /* Out of range from the server, the whole update is discarded*/
+    CHECK(stage(&update, "send_time", RUNTIME_CONFIG_INT, 0) == ESP_ERR_INVALID_ARG);
+    CHECK(stage(&update, "send_time", RUNTIME_CONFIG_INT, -30) == ESP_ERR_INVALID_ARG);
+    CHECK(stage(&update, "send_time", RUNTIME_CONFIG_INT, RUNTIME_SETTINGS_MAX_SECONDS + 1) == ESP_ERR_INVALID_ARG);
+    CHECK(stage(&update, "send_time", RUNTIME_CONFIG_BOOL, 1) == ESP_ERR_INVALID_ARG);
+    CHECK(update.set == 0);
+
+    /* Beyond 16 bits, not truncated on the way*/
+    CHECK(stage(&update, "send_time", RUNTIME_CONFIG_INT, 70000) == ESP_OK);
+    CHECK(stage(&update, "batch_size", RUNTIME_CONFIG_INT, 4) == ESP_OK);
+    CHECK(runtime_config_apply(&update) == ESP_OK);
+    CHECK(sampled_send_time == 70000);
+    CHECK(runtime_settings_send_time() == 70000);
+    CHECK(runtime_config_get("send_time", &value) == ESP_OK && value == 70000);
+#if CONFIG_FLEET_UPLOAD_SLOTTING
+    CHECK(slot_period_ms == 70000u * 1000);
+#endif
+    /* The batch size in use at start is not applied again*/
+    CHECK(batch_size_calls == 0);
+
+    /* A refused batch size gives the previous interval back*/
+    update = (runtime_config_update_t) { 0 };
+    CHECK(stage(&update, "send_time", RUNTIME_CONFIG_INT, 60) == ESP_OK);
+    CHECK(stage(&update, "batch_size", RUNTIME_CONFIG_INT, TEST_REFUSED_BATCH_SIZE) == ESP_OK);
+    CHECK(runtime_config_apply(&update) == ESP_FAIL);
+    CHECK(sampled_send_time == 70000);
+    CHECK(runtime_settings_send_time() == 70000);
+    CHECK(batch_size == -1);
+#if CONFIG_FLEET_UPLOAD_SLOTTING
+    CHECK(slot_period_ms == 70000u * 1000);
+#endif
+
+    /* A refused interval gives the previous upload slot back*/
+    update = (runtime_config_update_t) { 0 };
+    CHECK(stage(&update, "send_time", RUNTIME_CONFIG_INT, TEST_REFUSED_SEND_TIME) == ESP_OK);
+    CHECK(runtime_config_apply(&update) == ESP_FAIL);
+    CHECK(runtime_settings_send_time() == 70000);
+#if CONFIG_FLEET_UPLOAD_SLOTTING
+    CHECK(slot_period_ms == 70000u * 1000);
+#endif
+
+    /* The link policy with its hook*/
+    CHECK(runtime_settings_init(&current, &link_hooks) == ESP_OK);
+    CHECK(runtime_config_len() == 4);
+    update = (runtime_config_update_t) { 0 };
+    CHECK(stage(&update, "link_on_demand", RUNTIME_CONFIG_BOOL, 1) == ESP_OK);
+    CHECK(runtime_config_apply(&update) == ESP_OK);
+    CHECK(link_on_demand == 1);
+
+    /* The active range with its hook, swapped across midnight*/
+    CHECK(runtime_settings_init(&current, &range_hooks) == ESP_OK);
+    CHECK(runtime_config_len() == 5);
+    CHECK(runtime_config_get("active_end", &value) == ESP_OK && value == 22 * 60);
+    update = (runtime_config_update_t) { 0 };
+    CHECK(stage(&update, "active_start", RUNTIME_CONFIG_INT, RUNTIME_SETTINGS_MINUTES_PER_DAY) == ESP_ERR_INVALID_ARG);
+    CHECK(stage(&update, "active_start", RUNTIME_CONFIG_INT, 22 * 60) == ESP_OK);
+    CHECK(stage(&update, "active_end", RUNTIME_CONFIG_INT, 8 * 60) == ESP_OK);
+    CHECK(runtime_config_apply(&update) == ESP_OK);
+    CHECK(active_start == 22 * 60 && active_end == 8 * 60);
+
+    printf("runtime_settings_test: ok\n");
+    return 0;
+}
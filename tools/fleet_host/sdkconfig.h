@@ -0,0 +1,62 @@
+/*
+ * Configuration of the host build: the menuconfig defaults of the linked
+ * components, with store and forward and upload slotting enabled like the
+ * classroom nodes. Edit it to load the broker with other settings, e.g.
+ * TELEMETRY_BATCH_COMPRESS or another TELEMETRY_CODEC_FORMAT.
+ */
+#pragma once
+
+#define CONFIG_FLEET_BACKOFF_BASE_MS 1000
+#define CONFIG_FLEET_BACKOFF_CAP_MS 60000
+#define CONFIG_FLEET_UPLOAD_SLOTTING 1
+
+#define CONFIG_PROVISION_KEY "553r8d8nmzy2zdel0wxv"
+#define CONFIG_SECRET_KEY "sqmucj3ywvnbdyi0l4ts"
+#define CONFIG_UPLINK_TRANSPORT_MQTT 1
+#define CONFIG_MQTT_INBOUND_MAX_DATA_LEN 1024
+#define CONFIG_MQTT_OUTBOX_SLOTS 8
+#define CONFIG_MQTT_OUTBOX_SLOT_BYTES 1024
+#define CONFIG_MQTT_OUTBOX_MAX_INFLIGHT 2
+#define CONFIG_MQTT_OUTBOX_POLICY_DROP_NEWEST 1
+#define CONFIG_MQTT_ROUTER_TABLE_SIZE 16
+#define CONFIG_MQTT_RPC_MAX_METHODS 8
+#define CONFIG_MQTT_RPC_RESPONSE_LEN 768
+#define CONFIG_MQTT_RPC_BUDGET_MS 50
+#define CONFIG_MQTT_SHARED_ATTRIBUTES_MAX_AGE 3600
+/* CoAP of coap_test, plain UDP off the port of coap_standin.py and short
+ timeouts*/
+#define CONFIG_UPLINK_COAP_PORT 56830
+#define CONFIG_UPLINK_COAP_SLOTS 2
+#define CONFIG_UPLINK_COAP_ACK_TIMEOUT_MS 100
+#define CONFIG_UPLINK_COAP_MAX_RETRANSMIT 2
+
+/* The RTC snapshot without cert_store, whose CRC storage_test stands in for*/
+#define CONFIG_STORAGE_RTC_CONFIG_CACHE 1
+#define CONFIG_STORAGE_RTC_CONFIG_MAX_LEN 384
+#define CONFIG_STORAGE_STATS_SAMPLE_PERIOD 600
+#define CONFIG_STORAGE_STATS_PUBLISH_PERIOD 3600
+
+#define CONFIG_TELEMETRY_CODEC_FORMAT_JSON 1
+
+#define CONFIG_TELEMETRY_COMPRESS_WINDOW_BITS 8
+
+#define CONFIG_TELEMETRY_BATCH_CAPACITY 16
+#define CONFIG_TELEMETRY_BATCH_DEFAULT_SIZE 4
+#define CONFIG_TELEMETRY_BATCH_DEFAULT_DEADLINE 120
+#define CONFIG_TELEMETRY_BATCH_MAX_BYTES 1024
+#define CONFIG_TELEMETRY_BATCH_STORE_AND_FORWARD 1
+#define CONFIG_TELEMETRY_BATCH_COMPRESS_MIN_BYTES 256
+#define CONFIG_TELEMETRY_BATCH_COMPRESS_TOPIC "v1/devices/me/telemetry/lzss"
+
+#define CONFIG_TELEMETRY_QUEUE_PARTITION_LABEL "telemetry"
+#define CONFIG_TELEMETRY_QUEUE_MAX_INFLIGHT 2
+#define CONFIG_TELEMETRY_QUEUE_ACK_TIMEOUT 30
+#define CONFIG_TELEMETRY_QUEUE_REPLAY_INTERVAL_MS 500
+
+#define CONFIG_GATEWAY_LEAF_BATCH 10
+#define CONFIG_GATEWAY_CAPACITY 64
+#define CONFIG_GATEWAY_MAX_BYTES 1024
+#define CONFIG_GATEWAY_DEVICE_PREFIX "sgp30-"
+
+#define CONFIG_MEASUREMENT_HISTORY_ENABLE 1
+#define CONFIG_MEASUREMENT_HISTORY_PARTITION_LABEL "history"
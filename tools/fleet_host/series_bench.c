@@ -0,0 +1,298 @@
+/*
+ * Benchmark of the series codec on measurement traces.
+ *
+ * Traces are CSV files of "time,eCO2,TVOC" lines, times in seconds, as
+ * exported from ThingsBoard or logged by a node; lines that do not parse,
+ * like a header, are skipped. Without files it generates a classroom week
+ * (see trace_classroom), which is synthetic and only a stand-in for real
+ * recordings. For every block size it prints the size against the raw
+ * samples, the history records and JSON, the encode and decode throughput
+ * and the time to seek and decode the block of a random time. Every block
+ * is decoded back and compared.
+ *
+ *     series_bench
+ *     series_bench --block 64 aula1.csv aula2.csv
+ */
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "json_structures.h"
+#include "series_codec.h"
+
+#define BENCH_MIN_NS 200000000 /* Repeat the timed loops for at least this long*/
+#define BENCH_RAW_SAMPLE 8      /* Time, eCO2 and TVOC as they are*/
+#define BENCH_HISTORY_RECORD 12 /* See measurement_history*/
+
+typedef struct {
+    sgp30_timed_measurement_t *samples;
+    size_t len;
+    size_t size;
+} trace_t;
+
+static int64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+    fprintf(
+        stderr,
+        "usage: %s [options] [trace.csv...]\n"
+        "  --block N      samples per block, default 16, 64, 256 and 1024\n"
+        "  --interval S   seconds between samples of the synthetic week, default 60\n",
+        name
+    );
+}
+
+static void trace_add(trace_t *trace, time_t time, int eCO2, int TVOC)
+{
+    if (trace->len == trace->size)
+    {
+        trace->size = trace->size ? trace->size * 2 : 1024;
+        trace->samples = realloc(trace->samples, trace->size * sizeof(*trace->samples));
+        if (trace->samples == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    trace->samples[trace->len++] = (sgp30_timed_measurement_t){
+        .measurement = { .eCO2 = (uint16_t)eCO2, .TVOC = (uint16_t)TVOC },
+        .time = time,
+    };
+}
+
+static int trace_load(trace_t *trace, const char *path)
+{
+    char line[256];
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        long long time;
+        int eCO2, TVOC;
+        if (sscanf(line, "%lld,%d,%d", &time, &eCO2, &TVOC) == 3)
+        {
+            /* ThingsBoard exports milliseconds*/
+            trace_add(trace, (time_t)(time > 100000000000LL ? time / 1000 : time), eCO2, TVOC);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/* Five school days and a weekend at one sample per interval. Lessons of
+ 50 minutes from 8:00 to 14:00 fill the room and raise eCO2 towards 1500
+ ppm, breaks and nights air it towards 420. The sensor adds a little
+ noise and the clock a second of jitter now and then*/
+static void trace_classroom(trace_t *trace, uint32_t interval)
+{
+    double eCO2 = 420;
+    double TVOC = 20;
+    uint32_t seed = 1;
+    time_t start = 1700438400; /* A Monday at 0:00 UTC*/
+
+    for (time_t t = 0; t < 7 * 86400; t += interval)
+    {
+        int day = t / 86400;
+        int minute = (t % 86400) / 60;
+        bool lesson = day < 5 && minute >= 8 * 60 && minute < 14 * 60 && (minute - 8 * 60) % 60 < 50;
+        double target = lesson ? 1500 : 420;
+        double rate = lesson ? 0.03 : 0.08;
+
+        seed = seed * 1103515245 + 12345;
+        eCO2 += (target - eCO2) * rate * interval / 60 + (int)(seed >> 16) % 5 - 2;
+        TVOC += ((lesson ? 180 : 15) - TVOC) * 0.05 * interval / 60 + (int)(seed >> 8) % 3 - 1;
+        time_t jitter = (seed >> 24) % 20 == 0 ? 1 : 0;
+        trace_add(trace, start + t + jitter, (int)fmax(400, eCO2), (int)fmax(0, TVOC));
+    }
+}
+
+static size_t json_len(const trace_t *trace)
+{
+    size_t len = 2;
+    for (size_t i = 0; i < trace->len; i++)
+    {
+        len += json_structures_write_timed_measurement(NULL, 0, &trace->samples[i]) + 1;
+    }
+    return len;
+}
+
+static int bench(const trace_t *trace, size_t block_samples, uint8_t *buf, size_t size)
+{
+    sgp30_timed_measurement_t sample;
+    series_codec_decoder_t dec;
+    size_t len = 0;
+    size_t runs = 0;
+    size_t decoded = 0;
+
+    int64_t start = now_ns();
+    do
+    {
+        if (series_codec_encode(trace->samples, trace->len, block_samples, buf, size, &len) != ESP_OK)
+        {
+            fprintf(stderr, "encode failed\n");
+            return -1;
+        }
+        runs++;
+    } while (now_ns() - start < BENCH_MIN_NS);
+    double encode_rate = (double)trace->len * runs * 1e3 / (now_ns() - start);
+
+    /* Check first, then time*/
+    size_t blocks = 0;
+    for (size_t pos = 0; pos < len; pos += dec.len, blocks++)
+    {
+        if (series_codec_decoder_init(&dec, buf + pos, len - pos) != ESP_OK)
+        {
+            fprintf(stderr, "damaged block at %zu\n", pos);
+            return -1;
+        }
+        while (series_codec_decoder_next(&dec, &sample) == ESP_OK)
+        {
+            const sgp30_timed_measurement_t *expected = &trace->samples[decoded++];
+            if (decoded > trace->len || sample.time != expected->time
+                || sample.measurement.eCO2 != expected->measurement.eCO2
+                || sample.measurement.TVOC != expected->measurement.TVOC)
+            {
+                fprintf(stderr, "sample %zu decoded wrong\n", decoded - 1);
+                return -1;
+            }
+        }
+    }
+    if (decoded != trace->len)
+    {
+        fprintf(stderr, "decoded %zu of %zu samples\n", decoded, trace->len);
+        return -1;
+    }
+
+    runs = 0;
+    start = now_ns();
+    do
+    {
+        for (size_t pos = 0; pos < len; pos += dec.len)
+        {
+            series_codec_decoder_init(&dec, buf + pos, len - pos);
+            while (series_codec_decoder_next(&dec, &sample) == ESP_OK)
+            {
+            }
+        }
+        runs++;
+    } while (now_ns() - start < BENCH_MIN_NS);
+    double decode_rate = (double)trace->len * runs * 1e3 / (now_ns() - start);
+
+    /* Random access: the block of a time, decoded up to it*/
+    time_t first = trace->samples[0].time;
+    time_t span = trace->samples[trace->len - 1].time - first + 1;
+    runs = 0;
+    srand(1);
+    start = now_ns();
+    do
+    {
+        time_t target = first + rand() % span;
+        size_t offset;
+        series_codec_seek(buf, len, target, &offset);
+        series_codec_decoder_init(&dec, buf + offset, len - offset);
+        while (series_codec_decoder_next(&dec, &sample) == ESP_OK && sample.time < target)
+        {
+        }
+        runs++;
+    } while (now_ns() - start < BENCH_MIN_NS);
+    double seek_us = (now_ns() - start) / 1e3 / runs;
+
+    printf(
+        "%5zu %6zu %8zu %6.2f %7.1f %6.1f %6.1f %9.1f %9.1f %8.1f\n",
+        block_samples,
+        blocks,
+        len,
+        len * 8.0 / trace->len,
+        (double)trace->len * BENCH_RAW_SAMPLE / len,
+        (double)trace->len * BENCH_HISTORY_RECORD / len,
+        (double)json_len(trace) / len,
+        encode_rate,
+        decode_rate,
+        seek_us
+    );
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "block", required_argument, NULL, 'b' },
+        { "interval", required_argument, NULL, 'i' },
+        { "help", no_argument, NULL, 'h' },
+        { 0 },
+    };
+    static const size_t default_blocks[] = { 16, 64, 256, 1024 };
+    size_t block_samples = 0;
+    uint32_t interval = 60;
+    trace_t trace = { 0 };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'b': block_samples = strtoul(optarg, NULL, 10); break;
+        case 'i': interval = strtoul(optarg, NULL, 10); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+    for (int i = optind; i < argc; i++)
+    {
+        if (trace_load(&trace, argv[i]) != 0)
+        {
+            return 1;
+        }
+    }
+    if (interval == 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if (optind == argc)
+    {
+        trace_classroom(&trace, interval);
+        printf("Synthetic classroom week, a sample every %" PRIu32 " s\n", interval);
+    }
+    if (trace.len == 0)
+    {
+        fprintf(stderr, "no samples\n");
+        return 1;
+    }
+
+    size_t size = SERIES_CODEC_MAX_BLOCK_LEN(trace.len) + trace.len * SERIES_CODEC_HEADER_LEN;
+    uint8_t *buf = malloc(size);
+    if (buf == NULL)
+    {
+        return 1;
+    }
+    printf("%zu samples\n", trace.len);
+    printf("block blocks    bytes   bits vs raw vs rec vs json  enc M/s   dec M/s  seek us\n");
+    if (block_samples > 0)
+    {
+        return bench(&trace, block_samples, buf, size) == 0 ? 0 : 1;
+    }
+    for (size_t i = 0; i < sizeof(default_blocks) / sizeof(default_blocks[0]); i++)
+    {
+        if (bench(&trace, default_blocks[i], buf, size) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
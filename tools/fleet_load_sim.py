@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""Simulate the broker load of a classroom fleet.
+
+Models what the fleet component changes: every node loses the access point at
+the same moment, then reconnects and publishes its batches. Reconnection uses
+either the previous fixed exponential backoff (1 s, 2 s, 4 s... identical on
+every node) or decorrelated jitter as in fleet_backoff_next. Uploads are
+published either as soon as they are due, which is the same instant on nodes
+started together, or in the slot derived from the MAC as in fleet_slot_offset.
+
+    python tools/fleet_load_sim.py
+    python tools/fleet_load_sim.py --nodes 120 --send-time 30 --ap-down 20
+"""
+import argparse
+import random
+
+FNV_OFFSET_BASIS = 2166136261
+FNV_PRIME = 16777619
+
+
+def slot_offset_ms(mac, period_ms):
+    """Same hash as fleet_slot_offset."""
+    h = FNV_OFFSET_BASIS
+    for byte in mac:
+        h ^= byte
+        h = (h * FNV_PRIME) & 0xFFFFFFFF
+    return h % period_ms
+
+
+def exponential_waits(base_ms, cap_ms, rng):
+    """Backoff used before the fleet component, the same on every node."""
+    wait = base_ms
+    while True:
+        yield wait
+        wait = min(cap_ms, wait * 2)
+
+
+def decorrelated_waits(base_ms, cap_ms, rng):
+    """Same sequence as fleet_backoff_next."""
+    last = 0
+    while True:
+        high = min(cap_ms, (last or base_ms) * 3)
+        last = rng.randint(base_ms, high)
+        yield last
+
+
+def reconnect_times(nodes, ap_down_ms, waits, base_ms, cap_ms, rng):
+    """Time every node gets through once the access point is back."""
+    times = []
+    for _ in range(nodes):
+        t = 0
+        for wait in waits(base_ms, cap_ms, rng):
+            t += wait
+            if t >= ap_down_ms:
+                break
+        times.append(t)
+    return times
+
+
+def upload_times(macs, connected_at, send_time_ms, uploads, slotting):
+    """Publish instants of the batches of every node."""
+    times = []
+    for mac, start in zip(macs, connected_at):
+        offset = slot_offset_ms(mac, send_time_ms)
+        # Every node measures from the start of the active window, so a batch is due at
+        # the same instant everywhere, or later for the nodes still reconnecting
+        for k in range(1, uploads + 1):
+            due = max(start, k * send_time_ms)
+            if slotting:
+                due += (offset - due % send_time_ms) % send_time_ms
+            times.append(due)
+    return times
+
+
+def load(times, bin_ms):
+    """Peak and mean events per bin over the bins with any event."""
+    bins = {}
+    for t in times:
+        bins[t // bin_ms] = bins.get(t // bin_ms, 0) + 1
+    span = max(bins) - min(bins) + 1
+    return max(bins.values()), len(times) / span
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--nodes", type=int, default=60, help="nodes sharing the access point")
+    parser.add_argument("--send-time", type=int, default=30, help="send_time shared attribute (s)")
+    parser.add_argument("--uploads", type=int, default=20, help="uploads simulated per node")
+    parser.add_argument("--ap-down", type=float, default=20, help="time the access point is down (s)")
+    parser.add_argument("--base", type=int, default=1000, help="CONFIG_FLEET_BACKOFF_BASE_MS")
+    parser.add_argument("--cap", type=int, default=60000, help="CONFIG_FLEET_BACKOFF_CAP_MS")
+    parser.add_argument("--bin", type=int, default=1000, help="load histogram bin (ms)")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    macs = [bytes([0x24, 0x0A, 0xC4, 0x00, i >> 8, i & 0xFF]) for i in range(args.nodes)]
+    send_time_ms = args.send_time * 1000
+    ap_down_ms = int(args.ap_down * 1000)
+
+    print(f"{args.nodes} nodes, send_time {args.send_time} s, access point down {args.ap_down} s")
+    print(f"{'scenario':<40} {'peak/' + str(args.bin) + 'ms':>12} {'mean':>8}")
+    for name, waits in (("reconnect, exponential backoff", exponential_waits),
+                        ("reconnect, decorrelated jitter", decorrelated_waits)):
+        connected = reconnect_times(args.nodes, ap_down_ms, waits, args.base, args.cap, rng)
+        peak, mean = load(connected, args.bin)
+        print(f"{name:<40} {peak:>12} {mean:>8.2f}")
+
+    connected = reconnect_times(args.nodes, ap_down_ms, decorrelated_waits, args.base, args.cap, rng)
+    for name, slotting in (("uploads, published when due", False), ("uploads, MAC slot", True)):
+        uploads = upload_times(macs, connected, send_time_ms, args.uploads, slotting)
+        peak, mean = load(uploads, args.bin)
+        print(f"{name:<40} {peak:>12} {mean:>8.2f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""Answer the bulk uploads of telemetry_bulk without ThingsBoard.
+
+Plain HTTP/1.1, TLS is not terminated. Accepts POST /api/v1/<token>/telemetry
+with a Content-Length or chunked body, checks that it is a JSON array or
+object and answers 200. Connections are kept alive like ThingsBoard does.
+
+Every request is logged with its measurement count, body size, number of
+chunks and throughput from its headers to the end of its body, and the totals
+are printed on Ctrl-C. --fail-after cuts the connection in the middle of the
+body from that request on, or with --status answers it with another
+code, to exercise the resume of an interrupted backlog.
+
+    python tools/http_standin.py
+    python tools/http_standin.py --port 8080 --delay 0.5
+    python tools/http_standin.py --fail-after 3 --status 503
+"""
+import argparse
+import json
+import re
+import socketserver
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+PATH = re.compile(r"^/api/v1/[^/]+/telemetry$")
+
+
+class Totals:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.requests = 0
+        self.failures = 0
+        self.measurements = 0
+        self.bytes = 0
+        self.seconds = 0.0
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "HttpStandin/1.0"
+
+    def log_message(self, fmt, *args):
+        pass
+
+    def read_body(self, cut_at):
+        """Body and chunk count, None if the connection is cut."""
+        if self.headers.get("Transfer-Encoding", "").lower() == "chunked":
+            body = bytearray()
+            chunks = 0
+            while True:
+                line = self.rfile.readline(64)
+                if not line:
+                    return None, chunks
+                size = int(line.split(b";")[0].strip(), 16)
+                if size == 0:
+                    # Trailers end with an empty line
+                    while self.rfile.readline(1024) not in (b"\r\n", b"\n", b""):
+                        pass
+                    return bytes(body), chunks
+                chunks += 1
+                body += self.rfile.read(size)
+                self.rfile.read(2)
+                if cut_at is not None and len(body) >= cut_at:
+                    return None, chunks
+        length = int(self.headers.get("Content-Length", 0))
+        if cut_at is not None:
+            self.rfile.read(min(length, cut_at))
+            return None, 0
+        return self.rfile.read(length), 1
+
+    def reply(self, status, payload=b""):
+        self.send_response(status)
+        self.send_header("Content-Length", str(len(payload)))
+        self.end_headers()
+        self.wfile.write(payload)
+
+    def do_POST(self):
+        started_at = time.monotonic()
+        args = self.server.args
+        totals = self.server.totals
+        if not PATH.match(self.path):
+            self.read_body(None)
+            self.reply(404)
+            return
+        with totals.lock:
+            number = totals.requests + totals.failures + 1
+        failing = args.fail_after is not None and number > args.fail_after
+        cut_at = 1 if failing and args.status == 200 else None
+        body, chunks = self.read_body(cut_at)
+        if body is None:
+            with totals.lock:
+                totals.failures += 1
+            print(f"{self.client_address[0]} #{number} cut after {chunks} chunks")
+            self.close_connection = True
+            return
+        try:
+            data = json.loads(body)
+        except ValueError as err:
+            with totals.lock:
+                totals.failures += 1
+            print(f"{self.client_address[0]} #{number} invalid JSON ({len(body)} B): {err}")
+            self.reply(400)
+            return
+        if failing:
+            with totals.lock:
+                totals.failures += 1
+            print(f"{self.client_address[0]} #{number} answered {args.status}")
+            self.reply(args.status)
+            return
+        time.sleep(args.delay)
+        measurements = len(data) if isinstance(data, list) else 1
+        seconds = max(time.monotonic() - started_at, 1e-6)
+        with totals.lock:
+            totals.requests += 1
+            totals.measurements += measurements
+            totals.bytes += len(body)
+            totals.seconds += seconds
+        print(
+            f"{self.client_address[0]} #{number} {measurements} measurements, {len(body)} B in {chunks} chunks, "
+            f"{seconds * 1000:.0f} ms, {len(body) / seconds:.0f} B/s"
+        )
+        self.reply(200)
+
+
+class Server(socketserver.ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--delay", type=float, default=0.0, help="seconds before answering")
+    parser.add_argument("--fail-after", type=int, default=None, help="requests answered before failing")
+    parser.add_argument("--status", type=int, default=200, help="code of the failing requests, 200 cuts them")
+    args = parser.parse_args()
+
+    server = Server((args.host, args.port), Handler)
+    server.args = args
+    server.totals = Totals()
+    print(f"HTTP stand-in on {args.host}:{args.port}")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    totals = server.totals
+    if totals.requests:
+        print(
+            f"{totals.requests} requests, {totals.failures} failed, {totals.measurements} measurements, "
+            f"{totals.bytes} B, {totals.bytes / max(totals.seconds, 1e-6):.0f} B/s"
+        )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""Decode telemetry payloads in the series format of the series_codec component.
+
+Nodes built with CONFIG_TELEMETRY_CODEC_FORMAT_SERIES publish on
+CONFIG_TELEMETRY_CODEC_SERIES_TOPIC, which telemetry_bridge.py rewrites with
+this decoder into the ThingsBoard JSON array on v1/devices/me/telemetry. Run
+alone it prints that array, to check a captured payload.
+
+    python tools/series_decode.py payload.bin
+    mosquitto_sub -t v1/devices/me/telemetry/series -C 1 | python tools/series_decode.py -
+"""
+import argparse
+import json
+import struct
+import sys
+
+HEADER_LEN = 12
+DOD_WIDTHS = (0, 7, 9, 12, 32)
+VALUE_WIDTHS = (0, 4, 8, 17)
+
+
+class BitReader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def bits(self, n):
+        value = 0
+        for _ in range(n):
+            if self.pos >= len(self.data) * 8:
+                raise ValueError("block cut short")
+            byte = self.data[self.pos // 8]
+            value = value << 1 | (byte >> (7 - self.pos % 8)) & 1
+            self.pos += 1
+        return value
+
+    def prefix(self, most):
+        ones = 0
+        while ones < most and self.bits(1):
+            ones += 1
+        return ones
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def decode_block(block):
+    length, count, time, eco2, tvoc = struct.unpack_from("<HHIHH", block)
+    samples = [(time, eco2, tvoc)]
+    reader = BitReader(block[HEADER_LEN:length])
+    delta = 0
+    for _ in range(count - 1):
+        ones = reader.prefix(4)
+        width = DOD_WIDTHS[ones]
+        dod = reader.bits(width)
+        if width and dod >> (width - 1):
+            dod -= 1 << width
+        delta += dod
+        time = (time + delta) & 0xFFFFFFFF
+        values = []
+        for previous in (eco2, tvoc):
+            ones = reader.prefix(3)
+            values.append((previous + unzigzag(reader.bits(VALUE_WIDTHS[ones]))) & 0xFFFF)
+        eco2, tvoc = values
+        samples.append((time, eco2, tvoc))
+    return samples
+
+
+def decode(data):
+    samples = []
+    pos = 0
+    while pos < len(data):
+        if len(data) - pos < HEADER_LEN:
+            raise ValueError("%d trailing bytes" % (len(data) - pos))
+        length = struct.unpack_from("<H", data, pos)[0]
+        if length < HEADER_LEN or pos + length > len(data):
+            raise ValueError("damaged block at %d" % pos)
+        samples.extend(decode_block(data[pos:pos + length]))
+        pos += length
+    return samples
+
+
+def to_json(samples):
+    """ThingsBoard JSON array of the samples."""
+    return json.dumps(
+        [{"ts": time * 1000, "values": {"eCO2": eco2, "TVOC": tvoc}} for time, eco2, tvoc in samples],
+        separators=(",", ":"),
+    ).encode()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("payload", help="series payload file, - for stdin")
+    args = parser.parse_args()
+
+    if args.payload == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.payload, "rb") as f:
+            data = f.read()
+    samples = decode(data)
+    sys.stderr.write("%d B -> %d samples\n" % (len(data), len(samples)))
+    sys.stdout.write(to_json(samples).decode() + "\n")
+
+
+if __name__ == "__main__":
+    main()
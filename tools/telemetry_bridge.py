@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Decode the compressed or series telemetry batches on their way to ThingsBoard.
+
+ThingsBoard acknowledges a publish on CONFIG_TELEMETRY_BATCH_COMPRESS_TOPIC
+or CONFIG_TELEMETRY_CODEC_SERIES_TOPIC but does not store it, so with
+CONFIG_TELEMETRY_BATCH_COMPRESS or CONFIG_TELEMETRY_CODEC_FORMAT_SERIES the
+devices connect to this bridge instead of ThingsBoard. It relays every MQTT
+packet in both directions and rewrites the publishes on those topics into
+the decompressed payload, or the JSON of the series, on
+v1/devices/me/telemetry, keeping their packet identifier, so the PUBACK the
+device gets is the one of ThingsBoard and the batch is only freed once it
+has been stored.
+
+A payload that does not decode closes the connection of the device without
+forwarding it. TLS is terminated with --cert and --key, and
+--upstream-tls connects to the MQTTS port of ThingsBoard.
+
+    python tools/telemetry_bridge.py --upstream thingsboard.local:1883
+    python tools/telemetry_bridge.py --port 8883 --cert bridge.pem --key bridge.key \\
+        --upstream thingsboard.local:8883 --upstream-tls
+"""
+import argparse
+import socket
+import ssl
+import struct
+import sys
+import threading
+
+from series_decode import decode, to_json
+from telemetry_decompress import decompress
+
+TELEMETRY_TOPIC = "v1/devices/me/telemetry"
+PACKET_CONNECT = 1
+PACKET_PUBLISH = 3
+
+
+def read_exact(sock, n):
+    data = bytearray()
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise EOFError
+        data += chunk
+    return bytes(data)
+
+
+def encode_length(n):
+    out = bytearray()
+    while True:
+        byte = n & 0x7F
+        n >>= 7
+        out.append(byte | 0x80 if n else byte)
+        if not n:
+            return bytes(out)
+
+
+def decode_length(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if byte < 0x80:
+            return value, pos
+        shift += 7
+
+
+def read_packet(sock):
+    """First byte and body of the next packet."""
+    first = read_exact(sock, 1)[0]
+    length = 0
+    shift = 0
+    while True:
+        byte = read_exact(sock, 1)[0]
+        length |= (byte & 0x7F) << shift
+        if byte < 0x80:
+            break
+        shift += 7
+    return first, read_exact(sock, length)
+
+
+def write_packet(sock, first, body):
+    sock.sendall(bytes([first]) + encode_length(len(body)) + body)
+
+
+class Session:
+    def __init__(self, device, upstream, args):
+        self.device = device
+        self.upstream = upstream
+        self.args = args
+        self.mqtt5 = False
+        self.peer = "%s:%d" % device.getpeername()[:2]
+        self.decoders = {
+            args.topic: decompress,
+            args.series_topic: lambda data: to_json(decode(data)),
+        }
+
+    def rewrite_publish(self, first, body):
+        """Body of the publish to forward, the same one unless it is compressed or a series."""
+        topic_len = struct.unpack_from(">H", body)[0]
+        topic = body[2:2 + topic_len].decode("utf-8", "replace")
+        decoder = self.decoders.get(topic)
+        if decoder is None:
+            return body
+        pos = 2 + topic_len
+        if (first >> 1) & 0x03:
+            pos += 2
+        if self.mqtt5:
+            properties, end = decode_length(body, pos)
+            pos = end + properties
+        header = body[2 + topic_len:pos]
+        payload = decoder(body[pos:])
+        sys.stderr.write(
+            "%s: %d B -> %d B\n" % (self.peer, len(body) - pos, len(payload))
+        )
+        name = TELEMETRY_TOPIC.encode()
+        return struct.pack(">H", len(name)) + name + header + payload
+
+    def device_to_upstream(self):
+        try:
+            while True:
+                first, body = read_packet(self.device)
+                kind = first >> 4
+                if kind == PACKET_CONNECT:
+                    name_len = struct.unpack_from(">H", body)[0]
+                    self.mqtt5 = body[2 + name_len] == 5
+                elif kind == PACKET_PUBLISH:
+                    body = self.rewrite_publish(first, body)
+                write_packet(self.upstream, first, body)
+        except (EOFError, OSError):
+            pass
+        except (ValueError, IndexError) as e:
+            sys.stderr.write("%s: dropped, %s\n" % (self.peer, e))
+        self.close()
+
+    def upstream_to_device(self):
+        try:
+            while True:
+                data = self.upstream.recv(4096)
+                if not data:
+                    break
+                self.device.sendall(data)
+        except OSError:
+            pass
+        self.close()
+
+    def close(self):
+        for sock in (self.device, self.upstream):
+            try:
+                sock.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+            sock.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--upstream", required=True, help="ThingsBoard host:port")
+    parser.add_argument("--upstream-tls", action="store_true")
+    parser.add_argument("--cert", help="certificate served to the devices")
+    parser.add_argument("--key", help="key of --cert")
+    parser.add_argument("--topic", default=TELEMETRY_TOPIC + "/lzss",
+                        help="CONFIG_TELEMETRY_BATCH_COMPRESS_TOPIC")
+    parser.add_argument("--series-topic", default=TELEMETRY_TOPIC + "/series",
+                        help="CONFIG_TELEMETRY_CODEC_SERIES_TOPIC")
+    args = parser.parse_args()
+
+    host, port = args.upstream.rsplit(":", 1)
+    server_ctx = None
+    if args.cert:
+        server_ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        server_ctx.load_cert_chain(args.cert, args.key)
+    client_ctx = ssl.create_default_context() if args.upstream_tls else None
+
+    listener = socket.create_server((args.host, args.port), reuse_port=False)
+    sys.stderr.write("bridging %s:%d to %s\n" % (args.host, args.port, args.upstream))
+    try:
+        while True:
+            device, _ = listener.accept()
+            try:
+                if server_ctx:
+                    device = server_ctx.wrap_socket(device, server_side=True)
+                upstream = socket.create_connection((host, int(port)))
+                if client_ctx:
+                    upstream = client_ctx.wrap_socket(upstream, server_hostname=host)
+            except (OSError, ssl.SSLError) as e:
+                sys.stderr.write("connection refused, %s\n" % e)
+                device.close()
+                continue
+            session = Session(device, upstream, args)
+            threading.Thread(target=session.device_to_upstream, daemon=True).start()
+            threading.Thread(target=session.upstream_to_device, daemon=True).start()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
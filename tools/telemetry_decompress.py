@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Decompress telemetry payloads produced by the telemetry_compress component.
+
+Restores the original payload of the compressed topic
+(CONFIG_TELEMETRY_BATCH_COMPRESS_TOPIC) to check it, telemetry_bridge.py uses
+it to forward the batches to v1/devices/me/telemetry.
+
+    python tools/telemetry_decompress.py payload.bin
+    mosquitto_sub -t v1/devices/me/telemetry/lzss -C 1 | python tools/telemetry_decompress.py -
+"""
+import argparse
+import sys
+
+MAGIC = 0x4C
+MIN_MATCH = 3
+
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if byte < 0x80:
+            return value, pos
+        shift += 7
+
+
+def decompress(data):
+    if len(data) < 3 or data[0] != MAGIC:
+        raise ValueError("not a compressed telemetry payload")
+    window = 1 << data[1]
+    length, pos = read_varint(data, 2)
+    out = bytearray()
+    while len(out) < length:
+        flags = data[pos]
+        pos += 1
+        for bit in range(8):
+            if len(out) >= length:
+                break
+            if flags & (1 << bit):
+                back = data[pos] | ((data[pos + 1] >> 4) << 8)
+                count = (data[pos + 1] & 0x0F) + MIN_MATCH
+                pos += 2
+                distance = back + 1
+                if distance > len(out) or distance > window:
+                    raise ValueError("reference outside the window at %d" % pos)
+                for _ in range(count):
+                    out.append(out[-distance])
+            else:
+                out.append(data[pos])
+                pos += 1
+    if pos != len(data):
+        raise ValueError("%d trailing bytes" % (len(data) - pos))
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("payload", help="compressed payload file, - for stdin")
+    args = parser.parse_args()
+
+    if args.payload == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.payload, "rb") as f:
+            data = f.read()
+    payload = decompress(data)
+    sys.stderr.write("%d B -> %d B\n" % (len(data), len(payload)))
+    sys.stdout.buffer.write(payload)
+    sys.stdout.buffer.write(b"\n")
+
+
+if __name__ == "__main__":
+    main()